@@ -1,15 +1,19 @@
 #include "whisper.h"
 
 #include <cstdio>
+#include <cstring>
 #include <string>
 #include <thread>
 
 // command-line parameters
 struct whisper_params {
     int32_t n_threads = std::min(4, (int32_t) std::thread::hardware_concurrency());
-    int32_t what = 0; // what to benchmark: 0 - whisper ecoder, 1 - memcpy, 2 - ggml_mul_mat
+    int32_t what = 0; // what to benchmark: 0 - whisper ecoder, 1 - memcpy, 2 - ggml_mul_mat, 3 - tune the kernels
 
     std::string model = "models/ggml-base.en.bin";
+    std::string fname_profile;
+    std::string fname_trace;
+    std::string fname_tune; // default: <model>.tune
 };
 
 void whisper_print_usage(int argc, char ** argv, const whisper_params & params);
@@ -25,6 +29,9 @@ bool whisper_params_parse(int argc, char ** argv, whisper_params & params) {
         else if (arg == "-t" || arg == "--threads") { params.n_threads = std::stoi(argv[++i]); }
         else if (arg == "-m" || arg == "--model")   { params.model     = argv[++i]; }
         else if (arg == "-w" || arg == "--what")    { params.what     = atoi(argv[++i]); }
+        else if (arg == "-pf"|| arg == "--profile") { params.fname_profile = argv[++i]; }
+        else if (arg == "-tf"|| arg == "--trace")   { params.fname_trace   = argv[++i]; }
+        else if (arg == "-tn"|| arg == "--tune")    { params.fname_tune    = argv[++i]; }
         else {
             fprintf(stderr, "error: unknown argument: %s\n", arg.c_str());
             whisper_print_usage(argc, argv, params);
@@ -47,6 +54,10 @@ void whisper_print_usage(int /*argc*/, char ** argv, const whisper_params & para
     fprintf(stderr, "                           %-7s  0 - whisper encoder\n",                         "");
     fprintf(stderr, "                           %-7s  1 - memcpy\n",                                  "");
     fprintf(stderr, "                           %-7s  2 - ggml_mul_mat\n",                            "");
+    fprintf(stderr, "                           %-7s  3 - tune the kernels of the model and save them to the tuning file\n", "");
+    fprintf(stderr, "  -pf FNAME, --profile FNAME [%-7s] save the encoder time per op and layer to a .json or .csv file\n", params.fname_profile.c_str());
+    fprintf(stderr, "  -tf FNAME, --trace FNAME   [%-7s] save the timeline of the encoder threads to a Chrome trace JSON file\n", params.fname_trace.c_str());
+    fprintf(stderr, "  -tn FNAME, --tune FNAME    [%-7s] kernel tuning file (default: <model>.tune)\n", params.fname_tune.c_str());
     fprintf(stderr, "\n");
 }
 
@@ -65,6 +76,14 @@ int whisper_bench_encoder(const whisper_params & params) {
         return 2;
     }
 
+    if (!params.fname_tune.empty() && whisper_set_tune(ctx, params.fname_tune.c_str()) != 0) {
+        fprintf(stderr, "error: failed to load the tuning file '%s'\n", params.fname_tune.c_str());
+        return 5;
+    }
+
+    whisper_set_profile(ctx, !params.fname_profile.empty());
+    whisper_set_trace  (ctx, !params.fname_trace.empty());
+
     if (int ret = whisper_set_mel(ctx, nullptr, 0, WHISPER_N_MEL)) {
         fprintf(stderr, "error: failed to set mel: %d\n", ret);
         return 3;
@@ -75,6 +94,23 @@ int whisper_bench_encoder(const whisper_params & params) {
         return 4;
     }
 
+    if (!params.fname_profile.empty()) {
+        const char * ext = strrchr(params.fname_profile.c_str(), '.');
+        const char * str = whisper_print_profile(ctx, ext ? ext + 1 : "");
+
+        FILE * f = str ? fopen(params.fname_profile.c_str(), "w") : nullptr;
+        if (f == nullptr) {
+            fprintf(stderr, "error: failed to save the profile to '%s'\n", params.fname_profile.c_str());
+        } else {
+            fputs(str, f);
+            fclose(f);
+        }
+    }
+
+    if (!params.fname_trace.empty()) {
+        whisper_save_trace(ctx, params.fname_trace.c_str());
+    }
+
     whisper_print_timings(ctx);
     whisper_free(ctx);
 
@@ -93,6 +129,30 @@ int whisper_bench_encoder(const whisper_params & params) {
     return 0;
 }
 
+int whisper_bench_tune(const whisper_params & params) {
+    struct whisper_context * ctx = whisper_init_from_file(params.model.c_str());
+
+    if (ctx == nullptr) {
+        fprintf(stderr, "error: failed to initialize whisper context\n");
+        return 2;
+    }
+
+    const std::string fname = params.fname_tune.empty() ? params.model + ".tune" : params.fname_tune;
+
+    if (int ret = whisper_tune(ctx, params.n_threads, 5, fname.c_str())) {
+        fprintf(stderr, "error: failed to tune the kernels: %d\n", ret);
+        whisper_free(ctx);
+        return 3;
+    }
+
+    fprintf(stderr, "\n");
+    fprintf(stderr, "saved the kernels for %d threads to '%s'\n", params.n_threads, fname.c_str());
+
+    whisper_free(ctx);
+
+    return 0;
+}
+
 int main(int argc, char ** argv) {
     whisper_params params;
 
@@ -106,6 +166,7 @@ int main(int argc, char ** argv) {
         case 0: ret = whisper_bench_encoder(params);                break;
         case 1: ret = whisper_bench_memcpy(params.n_threads);       break;
         case 2: ret = whisper_bench_ggml_mul_mat(params.n_threads); break;
+        case 3: ret = whisper_bench_tune(params);                   break;
         default: fprintf(stderr, "error: unknown benchmark: %d\n", params.what); break;
     }
 
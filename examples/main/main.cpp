@@ -8,6 +8,7 @@
 #include <cmath>
 #include <fstream>
 #include <cstdio>
+#include <cstring>
 #include <string>
 #include <thread>
 #include <vector>
@@ -50,6 +51,37 @@ void replace_all(std::string & s, const std::string & search, const std::string
     }
 }
 
+// parse a CPU list like "0-3,8,10-11"
+bool parse_cpus(const std::string & str, std::vector<int> & cpus) {
+    cpus.clear();
+
+    size_t pos = 0;
+    while (pos < str.size()) {
+        size_t end = str.find(',', pos);
+        if (end == std::string::npos) {
+            end = str.size();
+        }
+
+        const std::string range = str.substr(pos, end - pos);
+        const size_t dash = range.find('-');
+
+        try {
+            const int c0 = std::stoi(range.substr(0, dash));
+            const int c1 = dash == std::string::npos ? c0 : std::stoi(range.substr(dash + 1));
+
+            for (int c = c0; c <= c1; ++c) {
+                cpus.push_back(c);
+            }
+        } catch (const std::exception &) {
+            return false;
+        }
+
+        pos = end + 1;
+    }
+
+    return !cpus.empty();
+}
+
 // command-line parameters
 struct whisper_params {
     int32_t n_threads    = std::min(4, (int32_t) std::thread::hardware_concurrency());
@@ -61,6 +93,7 @@ struct whisper_params {
     int32_t max_len      = 0;
     int32_t best_of      = 5;
     int32_t beam_size    = -1;
+    int32_t weight_cache = 0; // MB
 
     float word_thold    = 0.01f;
     float entropy_thold = 2.4f;
@@ -82,6 +115,11 @@ struct whisper_params {
     std::string language = "en";
     std::string prompt;
     std::string model    = "models/ggml-base.en.bin";
+    std::string fname_profile;
+    std::string fname_trace;
+    std::string numa;
+
+    std::vector<int> cpus;
 
     std::vector<std::string> fname_inp = {};
     std::vector<std::string> fname_outp = {};
@@ -127,6 +165,17 @@ bool whisper_params_parse(int argc, char ** argv, whisper_params & params) {
         else if (arg == "-pc"   || arg == "--print-colors")   { params.print_colors   = true; }
         else if (arg == "-pp"   || arg == "--print-progress") { params.print_progress = true; }
         else if (arg == "-nt"   || arg == "--no-timestamps")  { params.no_timestamps  = true; }
+        else if (arg == "-pf"   || arg == "--profile")        { params.fname_profile  = argv[++i]; }
+        else if (arg == "-tf"   || arg == "--trace")          { params.fname_trace    = argv[++i]; }
+        else if (                  arg == "--numa")           { params.numa           = argv[++i]; }
+        else if (arg == "-wc"   || arg == "--weight-cache")   { params.weight_cache   = std::stoi(argv[++i]); }
+        else if (arg == "-cpu"  || arg == "--cpus") {
+            if (!parse_cpus(argv[++i], params.cpus)) {
+                fprintf(stderr, "error: invalid CPU list: %s\n", argv[i]);
+                whisper_print_usage(argc, argv, params);
+                exit(0);
+            }
+        }
         else if (arg == "-l"    || arg == "--language")       { params.language       = argv[++i]; }
         else if (                  arg == "--prompt")         { params.prompt         = argv[++i]; }
         else if (arg == "-m"    || arg == "--model")          { params.model          = argv[++i]; }
@@ -172,6 +221,11 @@ void whisper_print_usage(int /*argc*/, char ** argv, const whisper_params & para
     fprintf(stderr, "  -pc,       --print-colors      [%-7s] print colors\n",                                   params.print_colors ? "true" : "false");
     fprintf(stderr, "  -pp,       --print-progress    [%-7s] print progress\n",                                 params.print_progress ? "true" : "false");
     fprintf(stderr, "  -nt,       --no-timestamps     [%-7s] do not print timestamps\n",                        params.no_timestamps ? "false" : "true");
+    fprintf(stderr, "  -pf FNAME, --profile FNAME     [%-7s] save the time per op and layer to a .json or .csv file\n", params.fname_profile.c_str());
+    fprintf(stderr, "  -tf FNAME, --trace FNAME       [%-7s] save the timeline of the threads to a Chrome trace JSON file\n", params.fname_trace.c_str());
+    fprintf(stderr, "             --numa MODE         [%-7s] NUMA placement of the threads and the model: 'interleave' or 'distribute'\n", params.numa.c_str());
+    fprintf(stderr, "  -wc N,     --weight-cache N    [%-7d] MB of F32 copies of the weights kept between the BLAS calls\n", params.weight_cache);
+    fprintf(stderr, "  -cpu LIST, --cpus LIST         [%-7s] pin the threads to these CPUs (e.g. 0-3,8), split between the processors\n", "");
     fprintf(stderr, "  -l LANG,   --language LANG     [%-7s] spoken language ('auto' for auto-detect)\n",       params.language.c_str());
     fprintf(stderr, "             --prompt PROMPT     [%-7s] initial prompt\n",                                 params.prompt.c_str());
     fprintf(stderr, "  -m FNAME,  --model FNAME       [%-7s] model path\n",                                     params.model.c_str());
@@ -359,6 +413,28 @@ bool output_csv(struct whisper_context * ctx, const char * fname) {
     return true;
 }
 
+// the format is given by the extension of the file: .json or .csv
+bool output_profile(struct whisper_context * ctx, const char * fname) {
+    const char * ext = strrchr(fname, '.');
+    const char * str = whisper_print_profile(ctx, ext ? ext + 1 : "");
+    if (str == nullptr) {
+        fprintf(stderr, "%s: unknown profile format of '%s' - use .json or .csv\n", __func__, fname);
+        return false;
+    }
+
+    std::ofstream fout(fname);
+    if (!fout.is_open()) {
+        fprintf(stderr, "%s: failed to open '%s' for writing\n", __func__, fname);
+        return false;
+    }
+
+    fprintf(stderr, "%s: saving profile to '%s'\n", __func__, fname);
+
+    fout << str;
+
+    return true;
+}
+
 // karaoke video generation
 // outputs a bash script that uses ffmpeg to generate a video with the subtitles
 // TODO: font parameter adjustments
@@ -499,6 +575,23 @@ int main(int argc, char ** argv) {
         return 3;
     }
 
+    whisper_set_profile(ctx, !params.fname_profile.empty());
+    whisper_set_trace  (ctx, !params.fname_trace.empty());
+
+    if (!params.numa.empty()) {
+        if (params.numa != "interleave" && params.numa != "distribute") {
+            fprintf(stderr, "error: unknown NUMA mode '%s'\n", params.numa.c_str());
+            whisper_free(ctx);
+            return 4;
+        }
+
+        whisper_set_numa(ctx, params.numa == "interleave" ? WHISPER_NUMA_INTERLEAVE : WHISPER_NUMA_DISTRIBUTE);
+    }
+
+    if (params.weight_cache > 0) {
+        whisper_set_weight_cache(ctx, (size_t) params.weight_cache*1024*1024);
+    }
+
     // initial prompt
     std::vector<whisper_token> prompt_tokens;
 
@@ -644,6 +737,8 @@ int main(int argc, char ** argv) {
             wparams.translate        = params.translate;
             wparams.language         = params.language.c_str();
             wparams.n_threads        = params.n_threads;
+            wparams.cpus             = params.cpus.data();
+            wparams.n_cpus           = params.cpus.size();
             wparams.n_max_text_ctx   = params.max_context >= 0 ? params.max_context : wparams.n_max_text_ctx;
             wparams.offset_ms        = params.offset_t_ms;
             wparams.duration_ms      = params.duration_ms;
@@ -726,6 +821,15 @@ int main(int argc, char ** argv) {
         }
     }
 
+    if (!params.fname_profile.empty()) {
+        output_profile(ctx, params.fname_profile.c_str());
+    }
+
+    if (!params.fname_trace.empty()) {
+        fprintf(stderr, "%s: saving trace to '%s'\n", __func__, params.fname_trace.c_str());
+        whisper_save_trace(ctx, params.fname_trace.c_str());
+    }
+
     whisper_print_timings(ctx);
     whisper_free(ctx);
 
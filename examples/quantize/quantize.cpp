@@ -0,0 +1,321 @@
+#include "ggml.h"
+
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <string>
+#include <vector>
+
+// the ftype values stored in the model file
+// keep in sync with whisper_ftype_to_ggml_type() in whisper.cpp
+enum e_ftype {
+    FTYPE_F32  = 0,
+    FTYPE_F16  = 1,
+    FTYPE_Q4_0 = 2,
+    FTYPE_Q8_0 = 3,
+};
+
+static ggml_type ftype_to_ggml_type(int32_t ftype) {
+    switch (ftype) {
+        case FTYPE_F32:  return GGML_TYPE_F32;
+        case FTYPE_F16:  return GGML_TYPE_F16;
+        case FTYPE_Q4_0: return GGML_TYPE_Q4_0;
+        case FTYPE_Q8_0: return GGML_TYPE_Q8_0;
+    }
+
+    return GGML_TYPE_COUNT;
+}
+
+// these tensors are always kept in their original format
+static const std::vector<std::string> k_skip = {
+    "encoder.conv1.bias",
+    "encoder.conv2.bias",
+    "encoder.positional_embedding",
+    "decoder.positional_embedding",
+};
+
+template<typename T>
+static bool read_safe(std::ifstream & fin, T & dest) {
+    fin.read((char *) &dest, sizeof(T));
+    return fin.good();
+}
+
+template<typename T>
+static void write_safe(std::ofstream & fout, const T & data) {
+    fout.write((const char *) &data, sizeof(T));
+}
+
+// copy n bytes from fin to fout
+static bool copy_bytes(std::ifstream & fin, std::ofstream & fout, size_t n) {
+    std::vector<char> buf(n);
+    if (n > 0 && !fin.read(buf.data(), n)) {
+        return false;
+    }
+    fout.write(buf.data(), n);
+    return true;
+}
+
+// quantize a whisper model file
+//
+// the 2D weight matrices are converted to the requested type and the F32 conv weights to F16, since a quantized
+// model expects them in F16 - all other tensors are copied as they are
+// see whisper_model_load() in whisper.cpp for the file format
+//
+static bool whisper_model_quantize(const std::string & fname_inp, const std::string & fname_out, e_ftype ftype) {
+    const ggml_type qtype = ftype == FTYPE_Q4_0 ? GGML_TYPE_Q4_0 : GGML_TYPE_Q8_0;
+
+    fprintf(stderr, "%s: loading model from '%s'\n", __func__, fname_inp.c_str());
+
+    std::ifstream fin(fname_inp, std::ios::binary);
+    if (!fin) {
+        fprintf(stderr, "%s: failed to open '%s' for reading\n", __func__, fname_inp.c_str());
+        return false;
+    }
+
+    std::ofstream fout(fname_out, std::ios::binary);
+    if (!fout) {
+        fprintf(stderr, "%s: failed to open '%s' for writing\n", __func__, fname_out.c_str());
+        return false;
+    }
+
+    // verify magic
+    {
+        uint32_t magic;
+        if (!read_safe(fin, magic) || magic != 0x67676d6c) {
+            fprintf(stderr, "%s: invalid model file '%s' (bad magic)\n", __func__, fname_inp.c_str());
+            return false;
+        }
+
+        write_safe(fout, magic);
+    }
+
+    // hparams
+    {
+        int32_t hparams[10];
+        int32_t ftype_inp;
+
+        for (auto & v : hparams) {
+            read_safe(fin, v);
+        }
+        read_safe(fin, ftype_inp);
+
+        if (ftype_inp != FTYPE_F32 && ftype_inp != FTYPE_F16) {
+            fprintf(stderr, "%s: invalid model file '%s' (only F32 and F16 models can be quantized, ftype = %d)\n",
+                    __func__, fname_inp.c_str(), ftype_inp);
+            return false;
+        }
+
+        fprintf(stderr, "%s: ftype (src) = %s\n", __func__, ggml_type_name(ftype_to_ggml_type(ftype_inp)));
+        fprintf(stderr, "%s: ftype (dst) = %s\n", __func__, ggml_type_name(ftype_to_ggml_type(ftype)));
+
+        for (const auto & v : hparams) {
+            write_safe(fout, v);
+        }
+        write_safe(fout, (int32_t) ftype);
+    }
+
+    // mel filters
+    {
+        int32_t n_mel;
+        int32_t n_fft;
+
+        read_safe(fin, n_mel);
+        read_safe(fin, n_fft);
+
+        write_safe(fout, n_mel);
+        write_safe(fout, n_fft);
+
+        if (!copy_bytes(fin, fout, n_mel*n_fft*sizeof(float))) {
+            fprintf(stderr, "%s: failed to read mel filters\n", __func__);
+            return false;
+        }
+    }
+
+    // vocab
+    {
+        int32_t n_vocab;
+        read_safe(fin, n_vocab);
+        write_safe(fout, n_vocab);
+
+        for (int i = 0; i < n_vocab; i++) {
+            uint32_t len;
+            read_safe(fin, len);
+            write_safe(fout, len);
+
+            if (!copy_bytes(fin, fout, len)) {
+                fprintf(stderr, "%s: failed to read vocab\n", __func__);
+                return false;
+            }
+        }
+    }
+
+    // weights
+    {
+        size_t total_size_org = 0;
+        size_t total_size_new = 0;
+
+        std::vector<float>       data_f32;
+        std::vector<ggml_fp16_t> data_f16;
+        std::vector<uint8_t>     data_q;
+
+        while (true) {
+            int32_t n_dims;
+            int32_t length;
+            int32_t ftype_cur;
+
+            read_safe(fin, n_dims);
+            read_safe(fin, length);
+            read_safe(fin, ftype_cur);
+
+            if (fin.eof()) {
+                break;
+            }
+
+            int32_t nelements = 1;
+            int32_t ne[3] = { 1, 1, 1 };
+            for (int i = 0; i < n_dims; ++i) {
+                read_safe(fin, ne[i]);
+                nelements *= ne[i];
+            }
+
+            std::string name(length, 0);
+            fin.read(&name[0], length);
+
+            if (ftype_cur != FTYPE_F32 && ftype_cur != FTYPE_F16) {
+                fprintf(stderr, "%s: tensor '%s' has unsupported ftype %d\n", __func__, name.c_str(), ftype_cur);
+                return false;
+            }
+
+            const size_t bpe = ftype_cur == FTYPE_F32 ? sizeof(float) : sizeof(ggml_fp16_t);
+
+            bool quantize = n_dims == 2 && ne[0] % ggml_blck_size(qtype) == 0;
+            for (const auto & s : k_skip) {
+                if (name == s) {
+                    quantize = false;
+                }
+            }
+
+            // the conv weights are loaded in F16 by a quantized model
+            const bool to_f16 = !quantize && n_dims == 3 && ftype_cur == FTYPE_F32;
+
+            fprintf(stderr, "%48s - [%5d, %5d, %5d], type = %6s ", name.c_str(), ne[0], ne[1], ne[2], ggml_type_name(ftype_to_ggml_type(ftype_cur)));
+
+            write_safe(fout, n_dims);
+            write_safe(fout, length);
+            write_safe(fout, (int32_t) (quantize ? ftype : to_f16 ? FTYPE_F16 : ftype_cur));
+            for (int i = 0; i < n_dims; ++i) {
+                write_safe(fout, ne[i]);
+            }
+            fout.write(name.data(), length);
+
+            total_size_org += nelements*bpe;
+
+            if (to_f16) {
+                data_f32.resize(nelements);
+                data_f16.resize(nelements);
+
+                if (!fin.read((char *) data_f32.data(), nelements*sizeof(float))) {
+                    fprintf(stderr, "\n%s: failed to read tensor '%s'\n", __func__, name.c_str());
+                    return false;
+                }
+
+                for (int i = 0; i < nelements; ++i) {
+                    data_f16[i] = ggml_fp32_to_fp16(data_f32[i]);
+                }
+
+                fout.write((const char *) data_f16.data(), nelements*sizeof(ggml_fp16_t));
+
+                total_size_new += nelements*sizeof(ggml_fp16_t);
+
+                fprintf(stderr, "size = %8.3f MB -> %8.3f MB\n", nelements*bpe/1024.0/1024.0, nelements*sizeof(ggml_fp16_t)/1024.0/1024.0);
+                continue;
+            }
+
+            if (!quantize) {
+                if (!copy_bytes(fin, fout, nelements*bpe)) {
+                    fprintf(stderr, "\n%s: failed to read tensor '%s'\n", __func__, name.c_str());
+                    return false;
+                }
+
+                total_size_new += nelements*bpe;
+
+                fprintf(stderr, "size = %8.3f MB\n", nelements*bpe/1024.0/1024.0);
+                continue;
+            }
+
+            data_f32.resize(nelements);
+
+            if (ftype_cur == FTYPE_F16) {
+                data_f16.resize(nelements);
+                fin.read((char *) data_f16.data(), nelements*sizeof(ggml_fp16_t));
+                for (int i = 0; i < nelements; ++i) {
+                    data_f32[i] = ggml_fp16_to_fp32(data_f16[i]);
+                }
+            } else {
+                fin.read((char *) data_f32.data(), nelements*sizeof(float));
+            }
+
+            if (!fin) {
+                fprintf(stderr, "\n%s: failed to read tensor '%s'\n", __func__, name.c_str());
+                return false;
+            }
+
+            data_q.resize((nelements/ggml_blck_size(qtype))*ggml_type_size(qtype));
+
+            const size_t cur_size = ggml_quantize(qtype, data_f32.data(), data_q.data(), nelements);
+
+            fout.write((const char *) data_q.data(), cur_size);
+
+            total_size_new += cur_size;
+
+            fprintf(stderr, "size = %8.3f MB -> %8.3f MB\n", nelements*bpe/1024.0/1024.0, cur_size/1024.0/1024.0);
+        }
+
+        fprintf(stderr, "%s: model size  = %8.2f MB\n", __func__, total_size_org/1024.0/1024.0);
+        fprintf(stderr, "%s: quant size  = %8.2f MB\n", __func__, total_size_new/1024.0/1024.0);
+    }
+
+    return fout.good();
+}
+
+int main(int argc, char ** argv) {
+    if (argc != 4) {
+        fprintf(stderr, "usage: %s model-f16.bin model-quant.bin type\n", argv[0]);
+        fprintf(stderr, "  type = q4_0 - 4-bit weights\n");
+        fprintf(stderr, "  type = q8_0 - 8-bit weights\n");
+        return 1;
+    }
+
+    // needed to initialize f16 tables
+    {
+        struct ggml_init_params params = { 0, NULL };
+        struct ggml_context * ctx = ggml_init(params);
+        ggml_free(ctx);
+    }
+
+    const std::string fname_inp = argv[1];
+    const std::string fname_out = argv[2];
+    const std::string type      = argv[3];
+
+    e_ftype ftype;
+
+    if (type == "q4_0") {
+        ftype = FTYPE_Q4_0;
+    } else if (type == "q8_0") {
+        ftype = FTYPE_Q8_0;
+    } else {
+        fprintf(stderr, "%s: unknown type '%s'\n", __func__, type.c_str());
+        return 1;
+    }
+
+    const int64_t t_start_us = ggml_time_us();
+
+    if (!whisper_model_quantize(fname_inp, fname_out, ftype)) {
+        fprintf(stderr, "%s: failed to quantize model from '%s'\n", __func__, fname_inp.c_str());
+        return 1;
+    }
+
+    fprintf(stderr, "%s: quantize time = %8.2f ms\n", __func__, (ggml_time_us() - t_start_us)/1000.0);
+
+    return 0;
+}
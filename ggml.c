@@ -1,3 +1,7 @@
+#if defined(__linux__) && !defined(_GNU_SOURCE)
+#define _GNU_SOURCE // for cpu_set_t and pthread_setaffinity_np()
+#endif
+
 #include "ggml.h"
 
 #if defined(_MSC_VER) || defined(__MINGW32__)
@@ -64,6 +68,41 @@ static int pthread_join(pthread_t thread, void* unused) {
     return (int) WaitForSingleObject(thread, INFINITE);
 }
 
+typedef CRITICAL_SECTION   pthread_mutex_t;
+typedef CONDITION_VARIABLE pthread_cond_t;
+
+static int pthread_mutex_init(pthread_mutex_t* mutex, void* unused) {
+    InitializeCriticalSection(mutex);
+    return 0;
+}
+static int pthread_mutex_destroy(pthread_mutex_t* mutex) {
+    DeleteCriticalSection(mutex);
+    return 0;
+}
+static int pthread_mutex_lock(pthread_mutex_t* mutex) {
+    EnterCriticalSection(mutex);
+    return 0;
+}
+static int pthread_mutex_unlock(pthread_mutex_t* mutex) {
+    LeaveCriticalSection(mutex);
+    return 0;
+}
+
+static int pthread_cond_init(pthread_cond_t* cond, void* unused) {
+    InitializeConditionVariable(cond);
+    return 0;
+}
+static int pthread_cond_destroy(pthread_cond_t* cond) {
+    return 0;
+}
+static int pthread_cond_wait(pthread_cond_t* cond, pthread_mutex_t* mutex) {
+    return SleepConditionVariableCS(cond, mutex, INFINITE) ? 0 : EINVAL;
+}
+static int pthread_cond_broadcast(pthread_cond_t* cond) {
+    WakeAllConditionVariable(cond);
+    return 0;
+}
+
 static int sched_yield (void) {
     Sleep (0);
     return 0;
@@ -72,6 +111,12 @@ static int sched_yield (void) {
 #include <pthread.h>
 #include <stdatomic.h>
 
+#if defined(__linux__)
+#include <sched.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+#endif
+
 typedef void* thread_ret_t;
 #endif
 
@@ -83,13 +128,37 @@ typedef void* thread_ret_t;
 #define GGML_DEBUG 0
 #define GGML_GELU_FP16
 
-#define GGML_SOFT_MAX_UNROLL 4
 #define GGML_VEC_DOT_UNROLL  2
+#define GGML_VEC_GEMV_UNROLL 4
 
-#ifdef GGML_USE_ACCELERATE
-// uncomment to use vDSP for soft max computation
-// note: not sure if it is actually faster
-//#define GGML_SOFT_MAX_ACCELERATE
+// how far ahead (in bytes) to prefetch the src0 rows in the mat x vec kernel
+#ifndef GGML_VEC_GEMV_PREFETCH
+#define GGML_VEC_GEMV_PREFETCH 4096
+#endif
+
+// default number of busy-wait iterations before a waiting thread goes to sleep
+// can be changed per thread pool with ggml_threadpool_set_n_spin()
+#ifndef GGML_N_SPIN
+#define GGML_N_SPIN 100000
+#endif
+
+// graph scheduling: max number of small independent nodes computed in a single step, and how many of the previous
+// nodes each node is checked against for conflicts (see ggml_graph_schedule) - GGML_MAX_CONCURRENT 1 disables it
+#ifndef GGML_MAX_CONCURRENT
+#define GGML_MAX_CONCURRENT 16
+#endif
+
+#ifndef GGML_SCHED_WINDOW
+#define GGML_SCHED_WINDOW 32
+#endif
+
+// flash attention: query rows per block and the bytes of the K and V tiles of a block (see ggml_flash_attn_bk)
+#ifndef GGML_FLASH_ATTN_BQ
+#define GGML_FLASH_ATTN_BQ 64
+#endif
+
+#ifndef GGML_FLASH_ATTN_KV_TILE
+#define GGML_FLASH_ATTN_KV_TILE (64*1024)
 #endif
 
 #if UINTPTR_MAX == 0xFFFFFFFF
@@ -245,9 +314,6 @@ static inline ggml_fp16_t ggml_compute_fp32_to_fp16(float f) {
 // precomputed gelu table for f16 (128 KB)
 static ggml_fp16_t table_gelu_f16[1 << 16];
 
-// precomputed exp table for f16 (128 KB)
-static ggml_fp16_t table_exp_f16[1 << 16];
-
 // precomputed f32 table for f16 (256 KB)
 static float table_f32_f16[1 << 16];
 
@@ -823,6 +889,61 @@ static inline void __sse_f16x4_store(ggml_fp16_t *x, __m128 y) {
 #define GGML_F16_ARR (GGML_F16_STEP/GGML_F16_EPR)
 #endif
 
+//
+// runtime CPU dispatch
+//
+// on x86 the hot vector kernels are also compiled for AVX2 + FMA + F16C and for AVX-512 (F + BW + VL, optionally VNNI)
+// with function target attributes. ggml_init checks the CPU with cpuid and routes the kernels through ggml_vec_fns to the
+// best variant the CPU supports, so that a binary built for the lowest common denominator still runs the AVX2 / AVX-512
+// code on the newer machines. the baseline build has no 512-bit code paths, so the AVX-512 variants are always compiled
+//
+// build with GGML_NO_CPU_DISPATCH to always use the kernels of the baseline build
+//
+
+#if (defined(__x86_64__) || defined(__i386__)) && (defined(__GNUC__) || defined(__clang__)) && !defined(GGML_NO_CPU_DISPATCH)
+#define GGML_CPU_DISPATCH
+#endif
+
+#if defined(GGML_CPU_DISPATCH)
+
+#include <cpuid.h>
+
+enum ggml_vec_isa {
+    GGML_VEC_ISA_BASE,   // the kernels of the baseline build
+    GGML_VEC_ISA_AVX2,   // AVX2 + FMA + F16C
+    GGML_VEC_ISA_AVX512, // AVX2 + FMA + F16C + AVX512F + AVX512BW + AVX512VL
+};
+
+// a NULL entry means the kernel of the baseline build is used
+struct ggml_vec_fns_t {
+    enum ggml_vec_isa isa;
+    bool vnni; // AVX512-VNNI
+
+    void (*dot_f32)    (const int n, float * restrict s, const float * restrict x, const float * restrict y);
+    void (*dot_f16)    (const int n, float * restrict s, ggml_fp16_t * restrict x, ggml_fp16_t * restrict y);
+    void (*mad_f32)    (const int n, float * restrict y, const float * restrict x, const float v);
+    void (*mad_f16)    (const int n, ggml_fp16_t * restrict y, ggml_fp16_t * restrict x, const float v);
+    void (*scale_f32)  (const int n, float * y, const float v);
+    void (*gemv_f16)   (const int n, const int xs, float * restrict s, void * restrict xv, ggml_fp16_t * restrict y);
+    void (*cvt_f16_f32)(const int n, float * restrict y, const ggml_fp16_t * restrict x);
+    void (*cvt_f32_f16)(const int n, ggml_fp16_t * restrict y, const float * restrict x);
+
+    ggml_float (*soft_max_f32)(const int n, float * y, const float * x, const float s, const float max);
+
+    void (*dot_q4_0_q8_0)(const int n, float * restrict s, const void * restrict vx, const void * restrict vy);
+    void (*dot_q8_0_q8_0)(const int n, float * restrict s, const void * restrict vx, const void * restrict vy);
+
+    // GEMM micro-kernel and the number of src0 rows it computes (see ggml_gemm_f16_f32)
+    void (*gemm_ukernel)(const int k, const float * restrict a, const float * restrict b, const int ldb, float * restrict c, const int ldc, const bool acc);
+    int gemm_mr;
+};
+
+static struct ggml_vec_fns_t ggml_vec_fns = { GGML_VEC_ISA_BASE, false, NULL, NULL, NULL, NULL, NULL, NULL, NULL, NULL, NULL, NULL, NULL, NULL, 0 };
+
+static void ggml_vec_fns_init(void);
+
+#endif
+
 //
 // fundamental operations
 //
@@ -846,6 +967,13 @@ inline static void ggml_vec_mul_f32 (const int n, float * z, const float * x, co
 inline static void ggml_vec_div_f32 (const int n, float * z, const float * x, const float * y) { for (int i = 0; i < n; ++i) z[i]  = x[i]/y[i];   }
 
 inline static void ggml_vec_dot_f32(const int n, float * restrict s, const float * restrict x, const float * restrict y) {
+#if defined(GGML_CPU_DISPATCH)
+    if (ggml_vec_fns.dot_f32) {
+        ggml_vec_fns.dot_f32(n, s, x, y);
+        return;
+    }
+#endif
+
     ggml_float sumf = 0.0;
 
 #ifdef GGML_SIMD
@@ -883,6 +1011,13 @@ inline static void ggml_vec_dot_f32(const int n, float * restrict s, const float
 }
 
 inline static void ggml_vec_dot_f16(const int n, float * restrict s, ggml_fp16_t * restrict x, ggml_fp16_t * restrict y) {
+#if defined(GGML_CPU_DISPATCH)
+    if (ggml_vec_fns.dot_f16) {
+        ggml_vec_fns.dot_f16(n, s, x, y);
+        return;
+    }
+#endif
+
     ggml_float sumf = 0.0;
 
 #if defined(GGML_SIMD)
@@ -973,7 +1108,83 @@ inline static void ggml_vec_dot_f16_unroll(const int n, const int xs, float * re
     }
 }
 
+// compute GGML_VEC_GEMV_UNROLL dot products of consecutive rows with the same vector
+// used for the mat x vec products during decoding - y is loaded once per GGML_VEC_GEMV_UNROLL rows and the rows are
+// prefetched ahead of the loads, since the kernel is bound by the memory bandwidth of streaming x
+// xs - x row stride in bytes
+inline static void ggml_vec_gemv_f16(const int n, const int xs, float * restrict s, void * restrict xv, ggml_fp16_t * restrict y) {
+#if defined(GGML_CPU_DISPATCH)
+    if (ggml_vec_fns.gemv_f16) {
+        ggml_vec_fns.gemv_f16(n, xs, s, xv, y);
+        return;
+    }
+#endif
+
+    ggml_float sumf[GGML_VEC_GEMV_UNROLL] = { 0.0 };
+
+    ggml_fp16_t * restrict x[GGML_VEC_GEMV_UNROLL];
+
+    for (int i = 0; i < GGML_VEC_GEMV_UNROLL; ++i) {
+        x[i] = (ggml_fp16_t *) ((char *) xv + i*xs);
+    }
+
+#if defined(GGML_SIMD)
+    const int np = (n & ~(GGML_F16_STEP - 1));
+
+    GGML_F16_VEC sum[GGML_VEC_GEMV_UNROLL][GGML_F16_ARR] = { { GGML_F16_VEC_ZERO } };
+
+    GGML_F16_VEC ax;
+    GGML_F16_VEC ay;
+
+    for (int i = 0; i < np; i += GGML_F16_STEP) {
+#if defined(__GNUC__) && GGML_VEC_GEMV_PREFETCH > 0
+        for (int k = 0; k < GGML_VEC_GEMV_UNROLL; ++k) {
+            __builtin_prefetch((const char *) (x[k] + i) + GGML_VEC_GEMV_PREFETCH, 0, 3);
+        }
+#endif
+
+        for (int j = 0; j < GGML_F16_ARR; j++) {
+            ay = GGML_F16_VEC_LOAD(y + i + j*GGML_F16_EPR, j);
+
+            for (int k = 0; k < GGML_VEC_GEMV_UNROLL; ++k) {
+                ax = GGML_F16_VEC_LOAD(x[k] + i + j*GGML_F16_EPR, j);
+
+                sum[k][j] = GGML_F16_VEC_FMA(sum[k][j], ax, ay);
+            }
+        }
+    }
+
+    for (int k = 0; k < GGML_VEC_GEMV_UNROLL; ++k) {
+        GGML_F16_VEC_REDUCE(sumf[k], sum[k]);
+    }
+
+    // leftovers
+    for (int i = np; i < n; ++i) {
+        for (int k = 0; k < GGML_VEC_GEMV_UNROLL; ++k) {
+            sumf[k] += GGML_FP16_TO_FP32(x[k][i])*GGML_FP16_TO_FP32(y[i]);
+        }
+    }
+#else
+    for (int i = 0; i < n; ++i) {
+        for (int k = 0; k < GGML_VEC_GEMV_UNROLL; ++k) {
+            sumf[k] += GGML_FP16_TO_FP32(x[k][i])*GGML_FP16_TO_FP32(y[i]);
+        }
+    }
+#endif
+
+    for (int k = 0; k < GGML_VEC_GEMV_UNROLL; ++k) {
+        s[k] = sumf[k];
+    }
+}
+
 inline static void ggml_vec_mad_f32(const int n, float * restrict y, const float * restrict x, const float v) {
+#if defined(GGML_CPU_DISPATCH)
+    if (ggml_vec_fns.mad_f32) {
+        ggml_vec_fns.mad_f32(n, y, x, v);
+        return;
+    }
+#endif
+
 #if defined(GGML_SIMD)
     const int np = (n & ~(GGML_F32_STEP - 1));
 
@@ -1005,6 +1216,13 @@ inline static void ggml_vec_mad_f32(const int n, float * restrict y, const float
 }
 
 inline static void ggml_vec_mad_f16(const int n, ggml_fp16_t * restrict y, ggml_fp16_t * restrict x, const float v) {
+#if defined(GGML_CPU_DISPATCH)
+    if (ggml_vec_fns.mad_f16) {
+        ggml_vec_fns.mad_f16(n, y, x, v);
+        return;
+    }
+#endif
+
 #if defined(GGML_SIMD)
     const int np = (n & ~(GGML_F16_STEP - 1));
 
@@ -1035,8 +1253,153 @@ inline static void ggml_vec_mad_f16(const int n, ggml_fp16_t * restrict y, ggml_
 #endif
 }
 
+inline static void ggml_vec_cvt_f16_f32(const int n, float * restrict y, const ggml_fp16_t * restrict x) {
+#if defined(GGML_CPU_DISPATCH)
+    if (ggml_vec_fns.cvt_f16_f32) {
+        ggml_vec_fns.cvt_f16_f32(n, y, x);
+        return;
+    }
+#endif
+
+    for (int i = 0; i < n; ++i) {
+        y[i] = GGML_FP16_TO_FP32(x[i]);
+    }
+}
+
+inline static void ggml_vec_cvt_f32_f16(const int n, ggml_fp16_t * restrict y, const float * restrict x) {
+#if defined(GGML_CPU_DISPATCH)
+    if (ggml_vec_fns.cvt_f32_f16) {
+        ggml_vec_fns.cvt_f32_f16(n, y, x);
+        return;
+    }
+#endif
+
+    for (int i = 0; i < n; ++i) {
+        y[i] = GGML_FP32_TO_FP16(x[i]);
+    }
+}
+
+//
+// blocked transpose used to copy the transposed / permuted views (e.g. V for the flash attention)
+//
+//   y[j*ldy + i] = x[i*ldx + j], i < m, j < n
+//
+// x and y are either F16 or F32 - the conversion is done during the copy. The copy is done in tiles of 8x8, so that
+// both sides are accessed in runs of 8 elements, and the tiles are swept over blocks of GGML_TRANSPOSE_BLOCK rows of
+// y, so that the partially written rows of y stay in L1
+//
+// without AVX the element-wise copy in ggml_compute_forward_dup is used instead - it is faster than a scalar tiling
+//
+
+#if defined(__AVX__) && defined(__F16C__)
+#define GGML_VEC_TRANSPOSE
+
+#define GGML_TRANSPOSE_BLOCK 64
+
+inline static __m256 ggml_transpose_load8(const void * x, const bool x_f16) {
+    return x_f16 ? _mm256_cvtph_ps(_mm_loadu_si128((const __m128i *) x)) : _mm256_loadu_ps((const float *) x);
+}
+
+inline static void ggml_transpose_store8(void * y, const bool y_f16, __m256 v) {
+    if (y_f16) {
+        _mm_storeu_si128((__m128i *) y, _mm256_cvtps_ph(v, 0));
+    } else {
+        _mm256_storeu_ps((float *) y, v);
+    }
+}
+
+// transpose an 8x8 tile in registers
+inline static void ggml_transpose_8x8(__m256 r[8]) {
+    const __m256 t0 = _mm256_unpacklo_ps(r[0], r[1]);
+    const __m256 t1 = _mm256_unpackhi_ps(r[0], r[1]);
+    const __m256 t2 = _mm256_unpacklo_ps(r[2], r[3]);
+    const __m256 t3 = _mm256_unpackhi_ps(r[2], r[3]);
+    const __m256 t4 = _mm256_unpacklo_ps(r[4], r[5]);
+    const __m256 t5 = _mm256_unpackhi_ps(r[4], r[5]);
+    const __m256 t6 = _mm256_unpacklo_ps(r[6], r[7]);
+    const __m256 t7 = _mm256_unpackhi_ps(r[6], r[7]);
+
+    const __m256 u0 = _mm256_shuffle_ps(t0, t2, _MM_SHUFFLE(1, 0, 1, 0));
+    const __m256 u1 = _mm256_shuffle_ps(t0, t2, _MM_SHUFFLE(3, 2, 3, 2));
+    const __m256 u2 = _mm256_shuffle_ps(t1, t3, _MM_SHUFFLE(1, 0, 1, 0));
+    const __m256 u3 = _mm256_shuffle_ps(t1, t3, _MM_SHUFFLE(3, 2, 3, 2));
+    const __m256 u4 = _mm256_shuffle_ps(t4, t6, _MM_SHUFFLE(1, 0, 1, 0));
+    const __m256 u5 = _mm256_shuffle_ps(t4, t6, _MM_SHUFFLE(3, 2, 3, 2));
+    const __m256 u6 = _mm256_shuffle_ps(t5, t7, _MM_SHUFFLE(1, 0, 1, 0));
+    const __m256 u7 = _mm256_shuffle_ps(t5, t7, _MM_SHUFFLE(3, 2, 3, 2));
+
+    r[0] = _mm256_permute2f128_ps(u0, u4, 0x20);
+    r[1] = _mm256_permute2f128_ps(u1, u5, 0x20);
+    r[2] = _mm256_permute2f128_ps(u2, u6, 0x20);
+    r[3] = _mm256_permute2f128_ps(u3, u7, 0x20);
+    r[4] = _mm256_permute2f128_ps(u0, u4, 0x31);
+    r[5] = _mm256_permute2f128_ps(u1, u5, 0x31);
+    r[6] = _mm256_permute2f128_ps(u2, u6, 0x31);
+    r[7] = _mm256_permute2f128_ps(u3, u7, 0x31);
+}
+
+inline static void ggml_vec_transpose(
+        const int m,
+        const int n,
+        void * restrict y, const int ldy, const bool y_f16,
+        const void * restrict x, const int ldx, const bool x_f16) {
+    const size_t xs = x_f16 ? sizeof(ggml_fp16_t) : sizeof(float);
+    const size_t ys = y_f16 ? sizeof(ggml_fp16_t) : sizeof(float);
+
+    for (int jb = 0; jb < n; jb += GGML_TRANSPOSE_BLOCK) {
+        const int jb1 = MIN(jb + GGML_TRANSPOSE_BLOCK, n);
+
+        for (int i0 = 0; i0 < m; i0 += 8) {
+            for (int j0 = jb; j0 < jb1; j0 += 8) {
+                if (i0 + 8 <= m && j0 + 8 <= jb1) {
+                    __m256 r[8];
+
+                    for (int k = 0; k < 8; ++k) {
+                        r[k] = ggml_transpose_load8((const char *) x + ((size_t) (i0 + k)*ldx + j0)*xs, x_f16);
+                    }
+
+                    ggml_transpose_8x8(r);
+
+                    for (int k = 0; k < 8; ++k) {
+                        ggml_transpose_store8((char *) y + ((size_t) (j0 + k)*ldy + i0)*ys, y_f16, r[k]);
+                    }
+
+                    continue;
+                }
+
+                // partial tile
+                const int mi = MIN(8, m - i0);
+                const int nj = MIN(8, jb1 - j0);
+
+                for (int j = j0; j < j0 + nj; ++j) {
+                    for (int i = i0; i < i0 + mi; ++i) {
+                        const size_t ix = (size_t) i*ldx + j;
+                        const size_t iy = (size_t) j*ldy + i;
+
+                        const float v = x_f16 ? GGML_FP16_TO_FP32(((const ggml_fp16_t *) x)[ix]) : ((const float *) x)[ix];
+
+                        if (y_f16) {
+                            ((ggml_fp16_t *) y)[iy] = GGML_FP32_TO_FP16(v);
+                        } else {
+                            ((float *) y)[iy] = v;
+                        }
+                    }
+                }
+            }
+        }
+    }
+}
+#endif // GGML_VEC_TRANSPOSE
+
 //inline static void ggml_vec_scale_f32(const int n, float * y, const float   v) { for (int i = 0; i < n; ++i) y[i] *= v;          }
 inline static void ggml_vec_scale_f32(const int n, float * y, const float   v) {
+#if defined(GGML_CPU_DISPATCH)
+    if (ggml_vec_fns.scale_f32) {
+        ggml_vec_fns.scale_f32(n, y, v);
+        return;
+    }
+#endif
+
 #if defined(GGML_SIMD)
     const int np = (n & ~(GGML_F32_STEP - 1));
 
@@ -1118,7 +1481,7 @@ inline static void ggml_vec_sum_f32(const int n, float * s, const float * x) {
 
 inline static void ggml_vec_max_f32(const int n, float * s, const float * x) {
 #ifndef GGML_USE_ACCELERATE
-    ggml_float max = -INFINITY;
+    float max = -INFINITY;
     for (int i = 0; i < n; ++i) {
         max = MAX(max, x[i]);
     }
@@ -1128,4273 +1491,3518 @@ inline static void ggml_vec_max_f32(const int n, float * s, const float * x) {
 #endif
 }
 
-inline static void ggml_vec_norm_inv_f32(const int n, float * s, const float * x) { ggml_vec_norm_f32(n, s, x); *s = 1./(*s); }
-
 //
-// logging
+// vectorized expf
+//
+// exp(x) = 2^n*exp(r) with n = round(x/ln(2)) and r = x - n*ln(2) in [-ln(2)/2, ln(2)/2]
+// exp(r) is evaluated with the degree 5 polynomial of Cephes expf (relative error below 2e-7)
+// inputs below GGML_EXPF_LO (incl. -INFINITY) give exactly 0, inputs above GGML_EXPF_HI saturate
 //
 
-#if (GGML_DEBUG >= 1)
-#define GGML_PRINT_DEBUG(...) printf(__VA_ARGS__)
-#else
-#define GGML_PRINT_DEBUG(...)
-#endif
+#define GGML_EXPF_LO    -87.33654f    // ln(FLT_MIN)
+#define GGML_EXPF_HI     88.37f       // largest x for which 2^n is a normal float
+#define GGML_EXPF_LOG2E  1.44269504088896341f
+#define GGML_EXPF_LN2_HI 0.693359375f // ln(2) split in two parts for an exact x - n*ln(2)
+#define GGML_EXPF_LN2_LO -2.12194440e-4f
 
-#if (GGML_DEBUG >= 5)
-#define GGML_PRINT_DEBUG_5(...) printf(__VA_ARGS__)
-#else
-#define GGML_PRINT_DEBUG_5(...)
-#endif
+#define GGML_EXPF_P0 1.9875691500e-4f
+#define GGML_EXPF_P1 1.3981999507e-3f
+#define GGML_EXPF_P2 8.3334519073e-3f
+#define GGML_EXPF_P3 4.1665795894e-2f
+#define GGML_EXPF_P4 1.6666665459e-1f
+#define GGML_EXPF_P5 5.0000001201e-1f
 
-#if (GGML_DEBUG >= 10)
-#define GGML_PRINT_DEBUG_10(...) printf(__VA_ARGS__)
-#else
-#define GGML_PRINT_DEBUG_10(...)
-#endif
+#if defined(__AVX2__) && defined(__FMA__)
 
-#define GGML_PRINT(...) printf(__VA_ARGS__)
+inline static __m256 ggml_v_expf(__m256 x) {
+    const __m256 zero = _mm256_cmp_ps(x, _mm256_set1_ps(GGML_EXPF_LO), _CMP_LT_OQ);
 
-//
-// data types
-//
+    x = _mm256_min_ps(_mm256_max_ps(x, _mm256_set1_ps(GGML_EXPF_LO)), _mm256_set1_ps(GGML_EXPF_HI));
 
-static const size_t GGML_TYPE_SIZE[GGML_TYPE_COUNT] = {
-    sizeof(int8_t ),
-    sizeof(int16_t),
-    sizeof(int32_t),
-    sizeof(ggml_fp16_t),
-    sizeof(float  ),
-};
+    const __m256 n = _mm256_round_ps(_mm256_mul_ps(x, _mm256_set1_ps(GGML_EXPF_LOG2E)), _MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC);
 
-static const char * GGML_OP_LABEL[GGML_OP_COUNT] = {
-    "NONE",
+    __m256 r = _mm256_fnmadd_ps(n, _mm256_set1_ps(GGML_EXPF_LN2_HI), x);
+    r = _mm256_fnmadd_ps(n, _mm256_set1_ps(GGML_EXPF_LN2_LO), r);
 
-    "DUP",
-    "ADD",
-    "SUB",
-    "MUL",
-    "DIV",
-    "SQR",
-    "SQRT",
-    "SUM",
-    "MEAN",
-    "REPEAT",
-    "ABS",
-    "SGN",
-    "NEG",
-    "STEP",
-    "RELU",
-    "GELU",
-    "NORM",
+    __m256 p = _mm256_set1_ps(GGML_EXPF_P0);
+    p = _mm256_fmadd_ps(p, r, _mm256_set1_ps(GGML_EXPF_P1));
+    p = _mm256_fmadd_ps(p, r, _mm256_set1_ps(GGML_EXPF_P2));
+    p = _mm256_fmadd_ps(p, r, _mm256_set1_ps(GGML_EXPF_P3));
+    p = _mm256_fmadd_ps(p, r, _mm256_set1_ps(GGML_EXPF_P4));
+    p = _mm256_fmadd_ps(p, r, _mm256_set1_ps(GGML_EXPF_P5));
+    p = _mm256_fmadd_ps(p, _mm256_mul_ps(r, r), _mm256_add_ps(r, _mm256_set1_ps(1.0f)));
 
-    "MUL_MAT",
+    // 2^n
+    const __m256i e = _mm256_slli_epi32(_mm256_add_epi32(_mm256_cvtps_epi32(n), _mm256_set1_epi32(127)), 23);
 
-    "SCALE",
-    "CPY",
-    "RESHAPE",
-    "VIEW",
-    "PERMUTE",
-    "TRANSPOSE",
-    "GET_ROWS",
-    "DIAG_MASK_INF",
-    "SOFT_MAX",
-    "ROPE",
-    "CONV_1D_1S",
-    "CONV_1D_2S",
+    return _mm256_andnot_ps(zero, _mm256_mul_ps(p, _mm256_castsi256_ps(e)));
+}
 
-    "FLASH_ATTN",
-    "FLASH_FF",
-};
+#elif defined(__ARM_NEON) && defined(__aarch64__)
 
-static const char * GGML_OP_SYMBOL[GGML_OP_COUNT] = {
-    "none",
+inline static float32x4_t ggml_v_expf(float32x4_t x) {
+    const uint32x4_t keep = vcgeq_f32(x, vdupq_n_f32(GGML_EXPF_LO));
 
-    "x",
-    "x+y",
-    "x-y",
-    "x*y",
-    "x/y",
-    "x^2",
-    "√x",
-    "Σx",
-    "Σx/n",
-    "repeat(x)",
-    "abs(x)",
-    "sgn(x)",
-    "-x",
-    "step(x)",
-    "relu(x)",
-    "gelu(x)",
-    "norm(x)",
+    x = vminq_f32(vmaxq_f32(x, vdupq_n_f32(GGML_EXPF_LO)), vdupq_n_f32(GGML_EXPF_HI));
 
-    "X*Y",
+    const float32x4_t n = vrndnq_f32(vmulq_f32(x, vdupq_n_f32(GGML_EXPF_LOG2E)));
 
-    "x*v",
-    "x-\\>y",
-    "reshape(x)",
-    "view(x)",
-    "permute(x)",
-    "transpose(x)",
-    "get_rows(x)",
-    "diag_mask_inf(x)",
-    "soft_max(x)",
-    "rope(x)",
-    "conv_1d_1s(x)",
-    "conv_1d_2s(x)",
+    float32x4_t r = vfmsq_f32(x, n, vdupq_n_f32(GGML_EXPF_LN2_HI));
+    r = vfmsq_f32(r, n, vdupq_n_f32(GGML_EXPF_LN2_LO));
 
-    "flash_attn(x)",
-    "flash_ff(x)",
-};
+    float32x4_t p = vdupq_n_f32(GGML_EXPF_P0);
+    p = vfmaq_f32(vdupq_n_f32(GGML_EXPF_P1), p, r);
+    p = vfmaq_f32(vdupq_n_f32(GGML_EXPF_P2), p, r);
+    p = vfmaq_f32(vdupq_n_f32(GGML_EXPF_P3), p, r);
+    p = vfmaq_f32(vdupq_n_f32(GGML_EXPF_P4), p, r);
+    p = vfmaq_f32(vdupq_n_f32(GGML_EXPF_P5), p, r);
+    p = vfmaq_f32(vaddq_f32(r, vdupq_n_f32(1.0f)), p, vmulq_f32(r, r));
 
-//
-// ggml object
-//
+    // 2^n
+    const int32x4_t e = vshlq_n_s32(vaddq_s32(vcvtq_s32_f32(n), vdupq_n_s32(127)), 23);
 
-struct ggml_object {
-    size_t offset;
-    size_t size;
+    return vreinterpretq_f32_u32(vandq_u32(keep, vreinterpretq_u32_f32(vmulq_f32(p, vreinterpretq_f32_s32(e)))));
+}
 
-    struct ggml_object * next;
+#endif
 
-    char padding[8];
-};
+// y = exp(s*x - max), returns sum(y)
+// y and x may alias (in-place soft_max)
+inline static ggml_float ggml_vec_soft_max_f32(const int n, float * y, const float * x, const float s, const float max) {
+#if defined(GGML_CPU_DISPATCH)
+    if (ggml_vec_fns.soft_max_f32) {
+        return ggml_vec_fns.soft_max_f32(n, y, x, s, max);
+    }
+#endif
 
-static const size_t GGML_OBJECT_SIZE = sizeof(struct ggml_object);
+    int i = 0;
+    ggml_float sum = 0.0;
 
-static_assert(sizeof(struct ggml_object)%GGML_MEM_ALIGN == 0, "ggml_object size must be a multiple of GGML_MEM_ALIGN");
-static_assert(sizeof(struct ggml_tensor)%GGML_MEM_ALIGN == 0, "ggml_tensor size must be a multiple of GGML_MEM_ALIGN");
+#if defined(__AVX2__) && defined(__FMA__)
+    const __m256 vs   = _mm256_set1_ps(s);
+    const __m256 vmax = _mm256_set1_ps(max);
 
-//
-// ggml context
-//
+    __m256 vsum = _mm256_setzero_ps();
 
-struct ggml_context {
-    size_t mem_size;
-    void * mem_buffer;
-    bool   mem_buffer_owned;
+    for (; i + 7 < n; i += 8) {
+        const __m256 v = ggml_v_expf(_mm256_fmsub_ps(_mm256_loadu_ps(x + i), vs, vmax));
+        _mm256_storeu_ps(y + i, v);
+        vsum = _mm256_add_ps(vsum, v);
+    }
 
-    int n_objects;
+    __m128 t = _mm_add_ps(_mm256_castps256_ps128(vsum), _mm256_extractf128_ps(vsum, 1));
+    t = _mm_add_ps(t, _mm_movehl_ps(t, t));
+    t = _mm_add_ss(t, _mm_movehdup_ps(t));
+    sum += _mm_cvtss_f32(t);
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+    const float32x4_t vs   = vdupq_n_f32(s);
+    const float32x4_t vmax = vdupq_n_f32(max);
 
-    struct ggml_object * objects_begin;
-    struct ggml_object * objects_end;
-};
+    float32x4_t vsum = vdupq_n_f32(0.0f);
 
-struct ggml_context_container {
-    bool used;
+    for (; i + 3 < n; i += 4) {
+        const float32x4_t v = ggml_v_expf(vsubq_f32(vmulq_f32(vld1q_f32(x + i), vs), vmax));
+        vst1q_f32(y + i, v);
+        vsum = vaddq_f32(vsum, v);
+    }
 
-    struct ggml_context context;
-};
+    sum += vaddvq_f32(vsum);
+#endif
 
-//
-// compute types
-//
+    // leftovers
+    for (; i < n; ++i) {
+        const float v = expf(s*x[i] - max);
+        y[i] = v;
+        sum += v;
+    }
 
-enum ggml_task_type {
-    GGML_TASK_INIT = 0,
-    GGML_TASK_COMPUTE,
-    GGML_TASK_FINALIZE,
-};
+    return sum;
+}
 
-struct ggml_compute_params {
-    enum ggml_task_type type;
+// y = (x - mean(x))/sqrt(var(x) + eps)*w + b
+// the mean and the variance are accumulated in a single pass over x, shifted by x[0] to avoid the cancellation in
+// E[x^2] - E[x]^2 when the mean is large compared to the spread
+inline static void ggml_vec_norm_affine_f32(const int n, float * y, const float * x, const float * w, const float * b, const float eps) {
+    const float k = x[0];
 
-    int ith, nth;
+    ggml_float sum  = 0.0;
+    ggml_float sum2 = 0.0;
 
-    // work buffer for all threads
-    size_t wsize;
-    void * wdata;
-};
+#ifdef GGML_SIMD
+    const int np = (n & ~(GGML_F32_STEP - 1));
 
-//
-// ggml state
-//
+    GGML_F32_VEC vk = GGML_F32_VEC_SET1(-k);
 
-struct ggml_state {
-    struct ggml_context_container contexts[GGML_MAX_CONTEXTS];
-};
+    GGML_F32_VEC s1[GGML_F32_ARR] = { GGML_F32_VEC_ZERO };
+    GGML_F32_VEC s2[GGML_F32_ARR] = { GGML_F32_VEC_ZERO };
 
-// global state
-static struct ggml_state g_state;
-static atomic_int g_state_barrier = 0;
+    GGML_F32_VEC ax[GGML_F32_ARR];
 
-// barrier via spin lock
-inline static void ggml_critical_section_start(void) {
-    int processing = atomic_fetch_add(&g_state_barrier, 1);
+    for (int i = 0; i < np; i += GGML_F32_STEP) {
+        for (int j = 0; j < GGML_F32_ARR; j++) {
+            ax[j] = GGML_F32_VEC_LOAD(x + i + j*GGML_F32_EPR);
+            ax[j] = GGML_F32_VEC_ADD(ax[j], vk);
 
-    while (processing > 0) {
-        // wait for other threads to finish
-        atomic_fetch_sub(&g_state_barrier, 1);
-        sched_yield(); // TODO: reconsider this
-        processing = atomic_fetch_add(&g_state_barrier, 1);
+            s1[j] = GGML_F32_VEC_ADD(s1[j], ax[j]);
+            s2[j] = GGML_F32_VEC_FMA(s2[j], ax[j], ax[j]);
+        }
     }
-}
 
-// TODO: make this somehow automatically executed
-//       some sort of "sentry" mechanism
-inline static void ggml_critical_section_end(void) {
-    atomic_fetch_sub(&g_state_barrier, 1);
-}
+    GGML_F32_VEC_REDUCE(sum,  s1);
+    GGML_F32_VEC_REDUCE(sum2, s2);
 
-////////////////////////////////////////////////////////////////////////////////
+    // leftovers
+    for (int i = np; i < n; ++i) {
+        const ggml_float v = x[i] - k;
+        sum  += v;
+        sum2 += v*v;
+    }
+#else
+    for (int i = 0; i < n; ++i) {
+        const ggml_float v = x[i] - k;
+        sum  += v;
+        sum2 += v*v;
+    }
+#endif
 
-void ggml_print_object(const struct ggml_object * obj) {
-    GGML_PRINT(" - ggml_object: offset = %zu, size = %zu, next = %p\n",
-            obj->offset, obj->size, (const void *) obj->next);
-}
+    const ggml_float mean_k = sum/n;
+    const ggml_float var    = MAX(sum2/n - mean_k*mean_k, 0.0);
 
-void ggml_print_objects(const struct ggml_context * ctx) {
-    struct ggml_object * obj = ctx->objects_begin;
+    const float mean  = k + mean_k;
+    const float scale = 1.0/sqrt(var + eps);
 
-    GGML_PRINT("%s: objects in context %p:\n", __func__, (const void *) ctx);
+#ifdef GGML_SIMD
+    GGML_F32_VEC vm = GGML_F32_VEC_SET1(-mean);
+    GGML_F32_VEC vs = GGML_F32_VEC_SET1(scale);
 
-    while (obj != NULL) {
-        ggml_print_object(obj);
-        obj = obj->next;
+    GGML_F32_VEC aw[GGML_F32_ARR];
+    GGML_F32_VEC ab[GGML_F32_ARR];
+
+    for (int i = 0; i < np; i += GGML_F32_STEP) {
+        for (int j = 0; j < GGML_F32_ARR; j++) {
+            ax[j] = GGML_F32_VEC_LOAD(x + i + j*GGML_F32_EPR);
+            aw[j] = GGML_F32_VEC_LOAD(w + i + j*GGML_F32_EPR);
+            ab[j] = GGML_F32_VEC_LOAD(b + i + j*GGML_F32_EPR);
+
+            ax[j] = GGML_F32_VEC_MUL(GGML_F32_VEC_ADD(ax[j], vm), vs);
+            ab[j] = GGML_F32_VEC_FMA(ab[j], ax[j], aw[j]);
+
+            GGML_F32_VEC_STORE(y + i + j*GGML_F32_EPR, ab[j]);
+        }
     }
 
-    GGML_PRINT("%s: --- end ---\n", __func__);
+    // leftovers
+    for (int i = np; i < n; ++i) {
+        y[i] = (x[i] - mean)*scale*w[i] + b[i];
+    }
+#else
+    for (int i = 0; i < n; ++i) {
+        y[i] = (x[i] - mean)*scale*w[i] + b[i];
+    }
+#endif
 }
 
-int ggml_nelements(const struct ggml_tensor * tensor) {
-    static_assert(GGML_MAX_DIMS == 4, "GGML_MAX_DIMS is not 4 - update this function");
+inline static void ggml_vec_norm_inv_f32(const int n, float * s, const float * x) { ggml_vec_norm_f32(n, s, x); *s = 1./(*s); }
 
-    return tensor->ne[0]*tensor->ne[1]*tensor->ne[2]*tensor->ne[3];
-}
+#if defined(GGML_CPU_DISPATCH)
 
-int ggml_nrows(const struct ggml_tensor * tensor) {
-    static_assert(GGML_MAX_DIMS == 4, "GGML_MAX_DIMS is not 4 - update this function");
+// the AVX2 variants are only needed when the baseline build does not have these features already
+#if !(defined(__AVX2__) && defined(__FMA__) && defined(__F16C__))
+#define GGML_CPU_DISPATCH_AVX2
+#endif
 
-    return tensor->ne[1]*tensor->ne[2]*tensor->ne[3];
-}
+#if defined(GGML_CPU_DISPATCH_AVX2)
 
-size_t ggml_nbytes(const struct ggml_tensor * tensor) {
-    static_assert(GGML_MAX_DIMS == 4, "GGML_MAX_DIMS is not 4 - update this function");
+//
+// AVX2 + FMA + F16C variants of the dispatched kernels
+//
 
-    return ggml_nelements(tensor)*GGML_TYPE_SIZE[tensor->type];
+#define GGML_TARGET_AVX2 __attribute__((target("avx2,fma,f16c")))
+
+GGML_TARGET_AVX2 static inline float ggml_hsum_avx2(const __m256 x) {
+    __m128 res = _mm256_extractf128_ps(x, 1);
+    res = _mm_add_ps(res, _mm256_castps256_ps128(x));
+    res = _mm_add_ps(res, _mm_movehl_ps(res, res));
+    res = _mm_add_ss(res, _mm_movehdup_ps(res));
+    return _mm_cvtss_f32(res);
 }
 
-size_t ggml_type_size(enum ggml_type type) {
-    return GGML_TYPE_SIZE[type];
+GGML_TARGET_AVX2 static inline __m256 ggml_load_f16_avx2(const ggml_fp16_t * x) {
+    return _mm256_cvtph_ps(_mm_loadu_si128((const __m128i *) x));
 }
 
-size_t ggml_element_size(const struct ggml_tensor * tensor) {
-    return GGML_TYPE_SIZE[tensor->type];
+GGML_TARGET_AVX2 static inline void ggml_store_f16_avx2(ggml_fp16_t * x, const __m256 y) {
+    _mm_storeu_si128((__m128i *) x, _mm256_cvtps_ph(y, 0));
 }
 
-static inline bool ggml_is_scalar(const struct ggml_tensor * tensor) {
-    static_assert(GGML_MAX_DIMS == 4, "GGML_MAX_DIMS is not 4 - update this function");
+GGML_TARGET_AVX2 static void ggml_vec_dot_f32_avx2(const int n, float * restrict s, const float * restrict x, const float * restrict y) {
+    const int np = (n & ~31);
 
-    return tensor->ne[0] == 1 && tensor->ne[1] == 1 && tensor->ne[2] == 1 && tensor->ne[3] == 1;
-}
+    __m256 sum0 = _mm256_setzero_ps();
+    __m256 sum1 = _mm256_setzero_ps();
+    __m256 sum2 = _mm256_setzero_ps();
+    __m256 sum3 = _mm256_setzero_ps();
 
-static inline bool ggml_is_vector(const struct ggml_tensor * tensor) {
-    static_assert(GGML_MAX_DIMS == 4, "GGML_MAX_DIMS is not 4 - update this function");
+    for (int i = 0; i < np; i += 32) {
+        sum0 = _mm256_fmadd_ps(_mm256_loadu_ps(x + i +  0), _mm256_loadu_ps(y + i +  0), sum0);
+        sum1 = _mm256_fmadd_ps(_mm256_loadu_ps(x + i +  8), _mm256_loadu_ps(y + i +  8), sum1);
+        sum2 = _mm256_fmadd_ps(_mm256_loadu_ps(x + i + 16), _mm256_loadu_ps(y + i + 16), sum2);
+        sum3 = _mm256_fmadd_ps(_mm256_loadu_ps(x + i + 24), _mm256_loadu_ps(y + i + 24), sum3);
+    }
 
-    return tensor->ne[1] == 1 && tensor->ne[2] == 1 && tensor->ne[3] == 1;
-}
+    ggml_float sumf = ggml_hsum_avx2(_mm256_add_ps(_mm256_add_ps(sum0, sum1), _mm256_add_ps(sum2, sum3)));
 
-static inline bool ggml_is_matrix(const struct ggml_tensor * tensor) {
-    static_assert(GGML_MAX_DIMS == 4, "GGML_MAX_DIMS is not 4 - update this function");
+    // leftovers
+    for (int i = np; i < n; ++i) {
+        sumf += x[i]*y[i];
+    }
 
-    return tensor->ne[2] == 1 && tensor->ne[3] == 1;
+    *s = sumf;
 }
 
-static inline bool ggml_can_mul_mat(const struct ggml_tensor * t0, const struct ggml_tensor * t1) {
-    static_assert(GGML_MAX_DIMS == 4, "GGML_MAX_DIMS is not 4 - update this function");
+GGML_TARGET_AVX2 static void ggml_vec_dot_f16_avx2(const int n, float * restrict s, ggml_fp16_t * restrict x, ggml_fp16_t * restrict y) {
+    const int np = (n & ~31);
 
-    return
-        (t0->ne[0]  == t1->ne[0])  &&
-        (t0->ne[2]  == t1->ne[2])  &&
-        (t0->ne[3]  == t1->ne[3]);
-}
+    __m256 sum0 = _mm256_setzero_ps();
+    __m256 sum1 = _mm256_setzero_ps();
+    __m256 sum2 = _mm256_setzero_ps();
+    __m256 sum3 = _mm256_setzero_ps();
 
-static inline bool ggml_is_contiguous(const struct ggml_tensor * tensor) {
-    static_assert(GGML_MAX_DIMS == 4, "GGML_MAX_DIMS is not 4 - update this function");
+    for (int i = 0; i < np; i += 32) {
+        sum0 = _mm256_fmadd_ps(ggml_load_f16_avx2(x + i +  0), ggml_load_f16_avx2(y + i +  0), sum0);
+        sum1 = _mm256_fmadd_ps(ggml_load_f16_avx2(x + i +  8), ggml_load_f16_avx2(y + i +  8), sum1);
+        sum2 = _mm256_fmadd_ps(ggml_load_f16_avx2(x + i + 16), ggml_load_f16_avx2(y + i + 16), sum2);
+        sum3 = _mm256_fmadd_ps(ggml_load_f16_avx2(x + i + 24), ggml_load_f16_avx2(y + i + 24), sum3);
+    }
 
-    return
-        tensor->nb[0] == GGML_TYPE_SIZE[tensor->type] &&
-        tensor->nb[1] == tensor->nb[0]*tensor->ne[0] &&
-        tensor->nb[2] == tensor->nb[1]*tensor->ne[1] &&
-        tensor->nb[3] == tensor->nb[2]*tensor->ne[2];
-}
+    ggml_float sumf = ggml_hsum_avx2(_mm256_add_ps(_mm256_add_ps(sum0, sum1), _mm256_add_ps(sum2, sum3)));
 
-static inline bool ggml_is_padded_1d(const struct ggml_tensor * tensor) {
-    static_assert(GGML_MAX_DIMS == 4, "GGML_MAX_DIMS is not 4 - update this function");
+    // leftovers
+    for (int i = np; i < n; ++i) {
+        sumf += _cvtsh_ss(x[i])*_cvtsh_ss(y[i]);
+    }
 
-    return
-        tensor->nb[0] == GGML_TYPE_SIZE[tensor->type] &&
-        tensor->nb[2] == tensor->nb[1]*tensor->ne[1] &&
-        tensor->nb[3] == tensor->nb[2]*tensor->ne[2];
+    *s = sumf;
 }
 
-static inline bool ggml_are_same_shape(const struct ggml_tensor * t0, const struct ggml_tensor * t1) {
-    static_assert(GGML_MAX_DIMS == 4, "GGML_MAX_DIMS is not 4 - update this function");
+GGML_TARGET_AVX2 static void ggml_vec_gemv_f16_avx2(const int n, const int xs, float * restrict s, void * restrict xv, ggml_fp16_t * restrict y) {
+    const int np = (n & ~15);
 
-    return
-        (t0->ne[0] == t1->ne[0] ) &&
-        (t0->ne[1] == t1->ne[1] ) &&
-        (t0->ne[2] == t1->ne[2] ) &&
-        (t0->ne[3] == t1->ne[3] );
-}
+    ggml_fp16_t * restrict x[GGML_VEC_GEMV_UNROLL];
 
-// check if t1 can be represented as a repeatition of t0
-static inline bool ggml_can_repeat(const struct ggml_tensor * t0, const struct ggml_tensor * t1) {
-    static_assert(GGML_MAX_DIMS == 4, "GGML_MAX_DIMS is not 4 - update this function");
+    for (int k = 0; k < GGML_VEC_GEMV_UNROLL; ++k) {
+        x[k] = (ggml_fp16_t *) ((char *) xv + k*xs);
+    }
 
-    return
-        (t1->ne[0]%t0->ne[0] == 0) &&
-        (t1->ne[1]%t0->ne[1] == 0) &&
-        (t1->ne[2]%t0->ne[2] == 0) &&
-        (t1->ne[3]%t0->ne[3] == 0);
-}
+    __m256 sum0[GGML_VEC_GEMV_UNROLL];
+    __m256 sum1[GGML_VEC_GEMV_UNROLL];
 
-static inline int ggml_up32(int n) {
-    return (n + 31) & ~31;
-}
+    for (int k = 0; k < GGML_VEC_GEMV_UNROLL; ++k) {
+        sum0[k] = _mm256_setzero_ps();
+        sum1[k] = _mm256_setzero_ps();
+    }
 
-static inline int ggml_up64(int n) {
-    return (n + 63) & ~63;
-}
+    for (int i = 0; i < np; i += 16) {
+        const __m256 y0 = ggml_load_f16_avx2(y + i + 0);
+        const __m256 y1 = ggml_load_f16_avx2(y + i + 8);
 
-static inline int ggml_up(int n, int m) {
-    // assert m is a power of 2
-    GGML_ASSERT((m & (m - 1)) == 0);
-    return (n + m - 1) & ~(m - 1);
-}
+        for (int k = 0; k < GGML_VEC_GEMV_UNROLL; ++k) {
+#if GGML_VEC_GEMV_PREFETCH > 0
+            _mm_prefetch((const char *) (x[k] + i) + GGML_VEC_GEMV_PREFETCH, _MM_HINT_T0);
+#endif
+            sum0[k] = _mm256_fmadd_ps(ggml_load_f16_avx2(x[k] + i + 0), y0, sum0[k]);
+            sum1[k] = _mm256_fmadd_ps(ggml_load_f16_avx2(x[k] + i + 8), y1, sum1[k]);
+        }
+    }
 
-// assert that pointer is aligned to GGML_MEM_ALIGN
-#define ggml_assert_aligned(ptr) \
-    assert(((uintptr_t) (ptr))%GGML_MEM_ALIGN == 0)
+    for (int k = 0; k < GGML_VEC_GEMV_UNROLL; ++k) {
+        ggml_float sumf = ggml_hsum_avx2(_mm256_add_ps(sum0[k], sum1[k]));
 
-////////////////////////////////////////////////////////////////////////////////
+        // leftovers
+        for (int i = np; i < n; ++i) {
+            sumf += _cvtsh_ss(x[k][i])*_cvtsh_ss(y[i]);
+        }
 
-struct ggml_context * ggml_init(struct ggml_init_params params) {
-    // make this function thread safe
-    ggml_critical_section_start();
+        s[k] = sumf;
+    }
+}
 
-    static bool is_first_call = true;
+GGML_TARGET_AVX2 static void ggml_vec_mad_f32_avx2(const int n, float * restrict y, const float * restrict x, const float v) {
+    const int np = (n & ~31);
 
-    if (is_first_call) {
-        // initialize GELU, EXP and F32 tables
-        {
-            const uint64_t t_start = ggml_time_us(); UNUSED(t_start);
+    const __m256 vx = _mm256_set1_ps(v);
 
-            ggml_fp16_t ii;
-            for (int i = 0; i < (1 << 16); ++i) {
-                uint16_t ui = i;
-                memcpy(&ii, &ui, sizeof(ii));
-                const float f = table_f32_f16[i] = GGML_COMPUTE_FP16_TO_FP32(ii);
-                table_gelu_f16[i] = GGML_FP32_TO_FP16(ggml_gelu_f32(f));
-                table_exp_f16[i]  = GGML_FP32_TO_FP16(exp(f));
-            }
+    for (int i = 0; i < np; i += 32) {
+        _mm256_storeu_ps(y + i +  0, _mm256_fmadd_ps(_mm256_loadu_ps(x + i +  0), vx, _mm256_loadu_ps(y + i +  0)));
+        _mm256_storeu_ps(y + i +  8, _mm256_fmadd_ps(_mm256_loadu_ps(x + i +  8), vx, _mm256_loadu_ps(y + i +  8)));
+        _mm256_storeu_ps(y + i + 16, _mm256_fmadd_ps(_mm256_loadu_ps(x + i + 16), vx, _mm256_loadu_ps(y + i + 16)));
+        _mm256_storeu_ps(y + i + 24, _mm256_fmadd_ps(_mm256_loadu_ps(x + i + 24), vx, _mm256_loadu_ps(y + i + 24)));
+    }
 
-            const uint64_t t_end = ggml_time_us(); UNUSED(t_end);
+    // leftovers
+    for (int i = np; i < n; ++i) {
+        y[i] += x[i]*v;
+    }
+}
 
-            GGML_PRINT_DEBUG("%s: GELU and EXP tables initialized in %f ms\n", __func__, (t_end - t_start)/1000.0f);
-        }
+GGML_TARGET_AVX2 static void ggml_vec_mad_f16_avx2(const int n, ggml_fp16_t * restrict y, ggml_fp16_t * restrict x, const float v) {
+    const int np = (n & ~15);
 
-        // initialize g_state
-        {
-            const uint64_t t_start = ggml_time_us(); UNUSED(t_start);
+    const __m256 vx = _mm256_set1_ps(v);
 
-            g_state = (struct ggml_state) {
-                /*.contexts =*/ { { 0 } },
-            };
+    for (int i = 0; i < np; i += 16) {
+        ggml_store_f16_avx2(y + i + 0, _mm256_fmadd_ps(ggml_load_f16_avx2(x + i + 0), vx, ggml_load_f16_avx2(y + i + 0)));
+        ggml_store_f16_avx2(y + i + 8, _mm256_fmadd_ps(ggml_load_f16_avx2(x + i + 8), vx, ggml_load_f16_avx2(y + i + 8)));
+    }
 
-            for (int i = 0; i < GGML_MAX_CONTEXTS; ++i) {
-                g_state.contexts[i].used = false;
-            }
+    // leftovers
+    for (int i = np; i < n; ++i) {
+        y[i] = _cvtss_sh(_cvtsh_ss(y[i]) + _cvtsh_ss(x[i])*v, 0);
+    }
+}
 
-            const uint64_t t_end = ggml_time_us(); UNUSED(t_end);
+GGML_TARGET_AVX2 static void ggml_vec_cvt_f16_f32_avx2(const int n, float * restrict y, const ggml_fp16_t * restrict x) {
+    const int np = (n & ~7);
 
-            GGML_PRINT_DEBUG("%s: g_state initialized in %f ms\n", __func__, (t_end - t_start)/1000.0f);
-        }
+    for (int i = 0; i < np; i += 8) {
+        _mm256_storeu_ps(y + i, ggml_load_f16_avx2(x + i));
+    }
 
-        is_first_call = false;
+    for (int i = np; i < n; ++i) {
+        y[i] = _cvtsh_ss(x[i]);
     }
+}
 
-    // find non-used context in g_state
-    struct ggml_context * ctx = NULL;
+GGML_TARGET_AVX2 static void ggml_vec_cvt_f32_f16_avx2(const int n, ggml_fp16_t * restrict y, const float * restrict x) {
+    const int np = (n & ~7);
 
-    for (int i = 0; i < GGML_MAX_CONTEXTS; i++) {
-        if (!g_state.contexts[i].used) {
-            g_state.contexts[i].used = true;
-            ctx = &g_state.contexts[i].context;
+    for (int i = 0; i < np; i += 8) {
+        ggml_store_f16_avx2(y + i, _mm256_loadu_ps(x + i));
+    }
 
-            GGML_PRINT_DEBUG("%s: found unused context %d\n", __func__, i);
-            break;
-        }
+    for (int i = np; i < n; ++i) {
+        y[i] = _cvtss_sh(x[i], 0);
     }
+}
 
-    if (ctx == NULL) {
-        GGML_PRINT_DEBUG("%s: no unused context found\n", __func__);
+#endif // GGML_CPU_DISPATCH_AVX2
 
-        ggml_critical_section_end();
+//
+// AVX-512 variants of the dispatched kernels
+//
 
-        return NULL;
-    }
+#define GGML_TARGET_AVX512 __attribute__((target("avx512f,avx512bw,avx512vl,avx2,fma,f16c")))
 
-    *ctx = (struct ggml_context) {
-        .mem_size         = params.mem_size,
-        .mem_buffer       = params.mem_buffer ? params.mem_buffer : malloc(params.mem_size),
-        .mem_buffer_owned = params.mem_buffer ? false : true,
-        .n_objects        = 0,
-        .objects_begin    = NULL,
-        .objects_end      = NULL,
-    };
+GGML_TARGET_AVX512 static inline __m512 ggml_load_f16_avx512(const ggml_fp16_t * x) {
+    return _mm512_cvtph_ps(_mm256_loadu_si256((const __m256i *) x));
+}
 
-    ggml_assert_aligned(ctx->mem_buffer);
+GGML_TARGET_AVX512 static inline void ggml_store_f16_avx512(ggml_fp16_t * x, const __m512 y) {
+    _mm256_storeu_si256((__m256i *) x, _mm512_cvtps_ph(y, 0));
+}
 
-    GGML_PRINT_DEBUG("%s: context initialized\n", __func__);
+GGML_TARGET_AVX512 static void ggml_vec_dot_f32_avx512(const int n, float * restrict s, const float * restrict x, const float * restrict y) {
+    const int np = (n & ~63);
 
-    ggml_critical_section_end();
+    __m512 sum0 = _mm512_setzero_ps();
+    __m512 sum1 = _mm512_setzero_ps();
+    __m512 sum2 = _mm512_setzero_ps();
+    __m512 sum3 = _mm512_setzero_ps();
 
-    return ctx;
-}
+    for (int i = 0; i < np; i += 64) {
+        sum0 = _mm512_fmadd_ps(_mm512_loadu_ps(x + i +  0), _mm512_loadu_ps(y + i +  0), sum0);
+        sum1 = _mm512_fmadd_ps(_mm512_loadu_ps(x + i + 16), _mm512_loadu_ps(y + i + 16), sum1);
+        sum2 = _mm512_fmadd_ps(_mm512_loadu_ps(x + i + 32), _mm512_loadu_ps(y + i + 32), sum2);
+        sum3 = _mm512_fmadd_ps(_mm512_loadu_ps(x + i + 48), _mm512_loadu_ps(y + i + 48), sum3);
+    }
 
-void ggml_free(struct ggml_context * ctx) {
-    // make this function thread safe
-    ggml_critical_section_start();
+    ggml_float sumf = _mm512_reduce_add_ps(_mm512_add_ps(_mm512_add_ps(sum0, sum1), _mm512_add_ps(sum2, sum3)));
 
-    bool found = false;
+    // leftovers
+    for (int i = np; i < n; ++i) {
+        sumf += x[i]*y[i];
+    }
 
-    for (int i = 0; i < GGML_MAX_CONTEXTS; i++) {
-        if (&g_state.contexts[i].context == ctx) {
-            g_state.contexts[i].used = false;
+    *s = sumf;
+}
 
-            GGML_PRINT_DEBUG("%s: context %d with %d objects has been freed. memory used = %zu\n",
-                    __func__, i, ctx->n_objects, ctx->objects_end->offset + ctx->objects_end->size);
+GGML_TARGET_AVX512 static void ggml_vec_dot_f16_avx512(const int n, float * restrict s, ggml_fp16_t * restrict x, ggml_fp16_t * restrict y) {
+    const int np = (n & ~63);
 
-            if (ctx->mem_buffer_owned) {
-                free(ctx->mem_buffer);
-            }
+    __m512 sum0 = _mm512_setzero_ps();
+    __m512 sum1 = _mm512_setzero_ps();
+    __m512 sum2 = _mm512_setzero_ps();
+    __m512 sum3 = _mm512_setzero_ps();
 
-            found = true;
-            break;
-        }
+    for (int i = 0; i < np; i += 64) {
+        sum0 = _mm512_fmadd_ps(ggml_load_f16_avx512(x + i +  0), ggml_load_f16_avx512(y + i +  0), sum0);
+        sum1 = _mm512_fmadd_ps(ggml_load_f16_avx512(x + i + 16), ggml_load_f16_avx512(y + i + 16), sum1);
+        sum2 = _mm512_fmadd_ps(ggml_load_f16_avx512(x + i + 32), ggml_load_f16_avx512(y + i + 32), sum2);
+        sum3 = _mm512_fmadd_ps(ggml_load_f16_avx512(x + i + 48), ggml_load_f16_avx512(y + i + 48), sum3);
     }
 
-    if (!found) {
-        GGML_PRINT_DEBUG("%s: context not found\n", __func__);
+    ggml_float sumf = _mm512_reduce_add_ps(_mm512_add_ps(_mm512_add_ps(sum0, sum1), _mm512_add_ps(sum2, sum3)));
+
+    // leftovers
+    for (int i = np; i < n; ++i) {
+        sumf += _cvtsh_ss(x[i])*_cvtsh_ss(y[i]);
     }
 
-    ggml_critical_section_end();
+    *s = sumf;
 }
 
-size_t ggml_used_mem(const struct ggml_context * ctx) {
-    return ctx->objects_end->offset + ctx->objects_end->size;
-}
+GGML_TARGET_AVX512 static void ggml_vec_gemv_f16_avx512(const int n, const int xs, float * restrict s, void * restrict xv, ggml_fp16_t * restrict y) {
+    const int np = (n & ~31);
 
-////////////////////////////////////////////////////////////////////////////////
+    ggml_fp16_t * restrict x[GGML_VEC_GEMV_UNROLL];
 
-struct ggml_tensor * ggml_new_tensor_impl(
-        struct ggml_context * ctx,
-        enum   ggml_type type,
-        int    n_dims,
-        const int* ne,
-        void*  data) {
-    // always insert objects at the end of the context's memory pool
-    struct ggml_object * obj_cur = ctx->objects_end;
+    for (int k = 0; k < GGML_VEC_GEMV_UNROLL; ++k) {
+        x[k] = (ggml_fp16_t *) ((char *) xv + k*xs);
+    }
 
-    const size_t cur_offset = obj_cur == NULL ? 0 : obj_cur->offset;
-    const size_t cur_size   = obj_cur == NULL ? 0 : obj_cur->size;
-    const size_t cur_end    = cur_offset + cur_size;
+    __m512 sum0[GGML_VEC_GEMV_UNROLL];
+    __m512 sum1[GGML_VEC_GEMV_UNROLL];
 
-    size_t size_needed = 0;
+    for (int k = 0; k < GGML_VEC_GEMV_UNROLL; ++k) {
+        sum0[k] = _mm512_setzero_ps();
+        sum1[k] = _mm512_setzero_ps();
+    }
 
-    if (data == NULL) {
-        size_needed += GGML_TYPE_SIZE[type];
-        for (int i = 0; i < n_dims; i++) {
-            size_needed *= ne[i];
-        }
-        // align to GGML_MEM_ALIGN
-        size_needed = ((size_needed + GGML_MEM_ALIGN - 1)/GGML_MEM_ALIGN)*GGML_MEM_ALIGN;
+    for (int i = 0; i < np; i += 32) {
+        const __m512 y0 = ggml_load_f16_avx512(y + i +  0);
+        const __m512 y1 = ggml_load_f16_avx512(y + i + 16);
 
+        for (int k = 0; k < GGML_VEC_GEMV_UNROLL; ++k) {
+#if GGML_VEC_GEMV_PREFETCH > 0
+            _mm_prefetch((const char *) (x[k] + i) + GGML_VEC_GEMV_PREFETCH, _MM_HINT_T0);
+#endif
+            sum0[k] = _mm512_fmadd_ps(ggml_load_f16_avx512(x[k] + i +  0), y0, sum0[k]);
+            sum1[k] = _mm512_fmadd_ps(ggml_load_f16_avx512(x[k] + i + 16), y1, sum1[k]);
+        }
     }
-    size_needed += sizeof(struct ggml_tensor);
 
-    if (cur_end + size_needed + GGML_OBJECT_SIZE > ctx->mem_size) {
-        GGML_PRINT("%s: not enough space in the context's memory pool\n", __func__);
-        assert(false);
-        return NULL;
+    for (int k = 0; k < GGML_VEC_GEMV_UNROLL; ++k) {
+        ggml_float sumf = _mm512_reduce_add_ps(_mm512_add_ps(sum0[k], sum1[k]));
+
+        // leftovers
+        for (int i = np; i < n; ++i) {
+            sumf += _cvtsh_ss(x[k][i])*_cvtsh_ss(y[i]);
+        }
+
+        s[k] = sumf;
     }
+}
 
-    char * const mem_buffer = ctx->mem_buffer;
+GGML_TARGET_AVX512 static void ggml_vec_mad_f32_avx512(const int n, float * restrict y, const float * restrict x, const float v) {
+    const int np = (n & ~31);
 
-    struct ggml_object * const obj_new = (struct ggml_object *)(mem_buffer + cur_end);
+    const __m512 vx = _mm512_set1_ps(v);
 
-    *obj_new = (struct ggml_object) {
-        .offset = cur_end + GGML_OBJECT_SIZE,
-        .size   = size_needed,
-        .next   = NULL,
-    };
+    for (int i = 0; i < np; i += 32) {
+        _mm512_storeu_ps(y + i +  0, _mm512_fmadd_ps(_mm512_loadu_ps(x + i +  0), vx, _mm512_loadu_ps(y + i +  0)));
+        _mm512_storeu_ps(y + i + 16, _mm512_fmadd_ps(_mm512_loadu_ps(x + i + 16), vx, _mm512_loadu_ps(y + i + 16)));
+    }
 
-    if (obj_cur != NULL) {
-        obj_cur->next = obj_new;
-    } else {
-        // this is the first object in this context
-        ctx->objects_begin = obj_new;
+    // leftovers
+    for (int i = np; i < n; ++i) {
+        y[i] += x[i]*v;
     }
+}
 
-    ctx->objects_end = obj_new;
+GGML_TARGET_AVX512 static void ggml_vec_mad_f16_avx512(const int n, ggml_fp16_t * restrict y, ggml_fp16_t * restrict x, const float v) {
+    const int np = (n & ~31);
 
-    //GGML_PRINT_DEBUG("%s: inserted new object at %zu\n", __func__, cur_end);
+    const __m512 vx = _mm512_set1_ps(v);
 
-    struct ggml_tensor * const result = (struct ggml_tensor *)(mem_buffer + obj_new->offset);
+    for (int i = 0; i < np; i += 32) {
+        ggml_store_f16_avx512(y + i +  0, _mm512_fmadd_ps(ggml_load_f16_avx512(x + i +  0), vx, ggml_load_f16_avx512(y + i +  0)));
+        ggml_store_f16_avx512(y + i + 16, _mm512_fmadd_ps(ggml_load_f16_avx512(x + i + 16), vx, ggml_load_f16_avx512(y + i + 16)));
+    }
 
-    ggml_assert_aligned(result);
+    // leftovers
+    for (int i = np; i < n; ++i) {
+        y[i] = _cvtss_sh(_cvtsh_ss(y[i]) + _cvtsh_ss(x[i])*v, 0);
+    }
+}
 
-    *result = (struct ggml_tensor) {
-        /*.type         =*/ type,
-        /*.n_dims       =*/ n_dims,
-        /*.ne           =*/ { 1, 1, 1, 1 },
-        /*.nb           =*/ { 0, 0, 0, 0 },
-        /*.op           =*/ GGML_OP_NONE,
-        /*.is_param     =*/ false,
-        /*.grad         =*/ NULL,
-        /*.src0         =*/ NULL,
-        /*.src1         =*/ NULL,
-        /*.opt          =*/ { NULL },
-        /*.n_tasks      =*/ 0,
-        /*.perf_runs    =*/ 0,
-        /*.perf_cycles  =*/ 0,
-        /*.perf_time_us =*/ 0,
-        /*.data         =*/ data == NULL ? (void *)(result + 1) : data,
-        /*.pad          =*/ { 0 },
-    };
+GGML_TARGET_AVX512 static void ggml_vec_scale_f32_avx512(const int n, float * y, const float v) {
+    const int np = (n & ~15);
 
-    ggml_assert_aligned(result->data);
+    const __m512 vx = _mm512_set1_ps(v);
 
-    for (int i = 0; i < n_dims; i++) {
-        result->ne[i] = ne[i];
+    for (int i = 0; i < np; i += 16) {
+        _mm512_storeu_ps(y + i, _mm512_mul_ps(_mm512_loadu_ps(y + i), vx));
     }
 
-    result->nb[0] = GGML_TYPE_SIZE[type];
-    for (int i = 1; i < GGML_MAX_DIMS; i++) {
-        result->nb[i] = result->nb[i - 1]*result->ne[i - 1];
+    // leftovers
+    for (int i = np; i < n; ++i) {
+        y[i] *= v;
     }
+}
 
-    ctx->n_objects++;
+GGML_TARGET_AVX512 static inline __m512 ggml_v_expf_avx512(__m512 x) {
+    const __mmask16 keep = _mm512_cmp_ps_mask(x, _mm512_set1_ps(GGML_EXPF_LO), _CMP_GE_OQ);
 
-    return result;
-}
+    x = _mm512_min_ps(_mm512_max_ps(x, _mm512_set1_ps(GGML_EXPF_LO)), _mm512_set1_ps(GGML_EXPF_HI));
 
-struct ggml_tensor * ggml_new_tensor(
-        struct ggml_context * ctx,
-        enum   ggml_type type,
-        int    n_dims,
-        const int* ne) {
-    return ggml_new_tensor_impl(ctx, type, n_dims, ne, NULL);
-}
+    const __m512 n = _mm512_roundscale_ps(_mm512_mul_ps(x, _mm512_set1_ps(GGML_EXPF_LOG2E)), _MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC);
 
-struct ggml_tensor * ggml_new_tensor_1d(
-        struct ggml_context * ctx,
-        enum   ggml_type type,
-        int    ne0) {
-    return ggml_new_tensor(ctx, type, 1, &ne0);
-}
+    __m512 r = _mm512_fnmadd_ps(n, _mm512_set1_ps(GGML_EXPF_LN2_HI), x);
+    r = _mm512_fnmadd_ps(n, _mm512_set1_ps(GGML_EXPF_LN2_LO), r);
 
-struct ggml_tensor * ggml_new_tensor_2d(
-        struct ggml_context * ctx,
-        enum   ggml_type type,
-        int    ne0,
-        int    ne1) {
-    const int ne[2] = { ne0, ne1 };
-    return ggml_new_tensor(ctx, type, 2, ne);
-}
+    __m512 p = _mm512_set1_ps(GGML_EXPF_P0);
+    p = _mm512_fmadd_ps(p, r, _mm512_set1_ps(GGML_EXPF_P1));
+    p = _mm512_fmadd_ps(p, r, _mm512_set1_ps(GGML_EXPF_P2));
+    p = _mm512_fmadd_ps(p, r, _mm512_set1_ps(GGML_EXPF_P3));
+    p = _mm512_fmadd_ps(p, r, _mm512_set1_ps(GGML_EXPF_P4));
+    p = _mm512_fmadd_ps(p, r, _mm512_set1_ps(GGML_EXPF_P5));
+    p = _mm512_fmadd_ps(p, _mm512_mul_ps(r, r), _mm512_add_ps(r, _mm512_set1_ps(1.0f)));
 
-struct ggml_tensor * ggml_new_tensor_3d(
-        struct ggml_context * ctx,
-        enum   ggml_type type,
-        int    ne0,
-        int    ne1,
-        int    ne2) {
-    const int ne[3] = { ne0, ne1, ne2 };
-    return ggml_new_tensor(ctx, type, 3, ne);
+    return _mm512_maskz_scalef_ps(keep, p, n);
 }
 
-struct ggml_tensor * ggml_new_tensor_4d(
-        struct ggml_context * ctx,
-        enum   ggml_type type,
-        int    ne0,
-        int    ne1,
-        int    ne2,
-        int    ne3) {
-    const int ne[4] = { ne0, ne1, ne2, ne3 };
-    return ggml_new_tensor(ctx, type, 4, ne);
+GGML_TARGET_AVX512 static ggml_float ggml_vec_soft_max_f32_avx512(const int n, float * y, const float * x, const float s, const float max) {
+    const int np = (n & ~15);
+
+    const __m512 vs   = _mm512_set1_ps(s);
+    const __m512 vmax = _mm512_set1_ps(max);
+
+    __m512 vsum = _mm512_setzero_ps();
+
+    for (int i = 0; i < np; i += 16) {
+        const __m512 v = ggml_v_expf_avx512(_mm512_fmsub_ps(_mm512_loadu_ps(x + i), vs, vmax));
+        _mm512_storeu_ps(y + i, v);
+        vsum = _mm512_add_ps(vsum, v);
+    }
+
+    // the leftovers go through a masked load so that they see the same expf as the rest of the row
+    if (np < n) {
+        const __mmask16 m = (__mmask16) ((1u << (n - np)) - 1);
+        const __m512 v = _mm512_maskz_mov_ps(m, ggml_v_expf_avx512(_mm512_fmsub_ps(_mm512_maskz_loadu_ps(m, x + np), vs, vmax)));
+        _mm512_mask_storeu_ps(y + np, m, v);
+        vsum = _mm512_add_ps(vsum, v);
+    }
+
+    return _mm512_reduce_add_ps(vsum);
 }
 
-struct ggml_tensor * ggml_new_i32(struct ggml_context * ctx, int32_t value) {
-    struct ggml_tensor * result = ggml_new_tensor_1d(ctx, GGML_TYPE_I32, 1);
+GGML_TARGET_AVX512 static void ggml_vec_cvt_f16_f32_avx512(const int n, float * restrict y, const ggml_fp16_t * restrict x) {
+    const int np = (n & ~15);
 
-    ggml_set_i32(result, value);
+    for (int i = 0; i < np; i += 16) {
+        _mm512_storeu_ps(y + i, ggml_load_f16_avx512(x + i));
+    }
 
-    return result;
+    for (int i = np; i < n; ++i) {
+        y[i] = _cvtsh_ss(x[i]);
+    }
 }
 
-struct ggml_tensor * ggml_new_f32(struct ggml_context * ctx, float value) {
-    struct ggml_tensor * result = ggml_new_tensor_1d(ctx, GGML_TYPE_F32, 1);
+GGML_TARGET_AVX512 static void ggml_vec_cvt_f32_f16_avx512(const int n, ggml_fp16_t * restrict y, const float * restrict x) {
+    const int np = (n & ~15);
 
-    ggml_set_f32(result, value);
+    for (int i = 0; i < np; i += 16) {
+        ggml_store_f16_avx512(y + i, _mm512_loadu_ps(x + i));
+    }
 
-    return result;
+    for (int i = np; i < n; ++i) {
+        y[i] = _cvtss_sh(x[i], 0);
+    }
 }
 
-struct ggml_tensor * ggml_dup_tensor(struct ggml_context * ctx, const struct ggml_tensor * src) {
-    return ggml_new_tensor_impl(ctx, src->type, src->n_dims, src->ne, NULL);
+#endif
+
+//
+// quantization
+//
+// the quantized types store the values of each row in blocks of QK consecutive elements
+// every block has its own scale factor d:
+//
+//   Q4_0: x[j] = d*(q[j] - 8), q[j] in [1, 15] - the low nibbles hold elements [0, QK/2), the high nibbles [QK/2, QK)
+//   Q8_0: x[j] = d*q[j],       q[j] in [-127, 127]
+//
+// for mul_mat, src1 is quantized to Q8_0 so that the dot products can be computed with integer arithmetic
+//
+
+#define QK 32
+
+typedef struct {
+    float   d;          // delta
+    uint8_t qs[QK / 2]; // nibbles / quants
+} block_q4_0;
+static_assert(sizeof(block_q4_0) == sizeof(float) + QK / 2, "wrong q4_0 block size/padding");
+
+typedef struct {
+    float  d;      // delta
+    int8_t qs[QK]; // quants
+} block_q8_0;
+static_assert(sizeof(block_q8_0) == sizeof(float) + QK, "wrong q8_0 block size/padding");
+
+#if defined(__AVX2__)
+// horizontally add 8 floats
+static inline float hsum_float_8(const __m256 x) {
+    __m128 res = _mm256_extractf128_ps(x, 1);
+    res = _mm_add_ps(res, _mm256_castps256_ps128(x));
+    res = _mm_add_ps(res, _mm_movehl_ps(res, res));
+    res = _mm_add_ss(res, _mm_movehdup_ps(res));
+    return _mm_cvtss_f32(res);
+}
+
+// unpack 32 4-bit values into 32 bytes - the low nibbles go to the lower half
+static inline __m256i bytes_from_nibbles_32(const uint8_t * rsi) {
+    const __m128i tmp   = _mm_loadu_si128((const __m128i *) rsi);
+    const __m256i bytes = _mm256_insertf128_si256(_mm256_castsi128_si256(tmp), _mm_srli_epi16(tmp, 4), 1);
+    return _mm256_and_si256(_mm256_set1_epi8(0x0F), bytes);
+}
+
+// multiply the signed bytes of x and y and sum the products in groups of 4 into 8 floats
+static inline __m256 mul_sum_i8_pairs_float(const __m256i x, const __m256i y) {
+    // maddubs needs an unsigned first operand - move the sign of x to y
+    const __m256i ax = _mm256_sign_epi8(x, x);
+    const __m256i sy = _mm256_sign_epi8(y, x);
+#if defined(__AVX512VNNI__) && defined(__AVX512VL__)
+    const __m256i summed = _mm256_dpbusd_epi32(_mm256_setzero_si256(), ax, sy);
+#else
+    const __m256i dot    = _mm256_maddubs_epi16(ax, sy);
+    const __m256i summed = _mm256_madd_epi16(_mm256_set1_epi16(1), dot);
+#endif
+    return _mm256_cvtepi32_ps(summed);
 }
 
-struct ggml_tensor * ggml_set_zero(struct ggml_tensor * tensor) {
-    memset(tensor->data, 0, ggml_nbytes(tensor));
-    return tensor;
+static inline __m256 madd_ps(const __m256 a, const __m256 b, const __m256 c) {
+#if defined(__FMA__)
+    return _mm256_fmadd_ps(a, b, c);
+#else
+    return _mm256_add_ps(_mm256_mul_ps(a, b), c);
+#endif
 }
+#endif
 
-struct ggml_tensor * ggml_set_i32 (struct ggml_tensor * tensor, int32_t value) {
-    const int n     = ggml_nrows(tensor);
-    const int nc    = tensor->ne[0];
-    const size_t n1 = tensor->nb[1];
+static void quantize_row_q4_0(const float * restrict x, void * restrict vy, int k) {
+    assert(k % QK == 0);
+    const int nb = k / QK;
 
-    char * const data = tensor->data;
+    block_q4_0 * restrict y = vy;
 
-    switch (tensor->type) {
-        case GGML_TYPE_I8:
-            {
-                assert(tensor->nb[0] == sizeof(int8_t));
-                for (int i = 0; i < n; i++) {
-                    ggml_vec_set_i8(nc, (int8_t *)(data + i*n1), value);
-                }
-            } break;
-        case GGML_TYPE_I16:
-            {
-                assert(tensor->nb[0] == sizeof(int16_t));
-                for (int i = 0; i < n; i++) {
-                    ggml_vec_set_i16(nc, (int16_t *)(data + i*n1), value);
-                }
-            } break;
-        case GGML_TYPE_I32:
-            {
-                assert(tensor->nb[0] == sizeof(int32_t));
-                for (int i = 0; i < n; i++) {
-                    ggml_vec_set_i32(nc, (int32_t *)(data + i*n1), value);
-                }
-            } break;
-        case GGML_TYPE_F16:
-            {
-                assert(tensor->nb[0] == sizeof(ggml_fp16_t));
-                for (int i = 0; i < n; i++) {
-                    ggml_vec_set_f16(nc, (ggml_fp16_t *)(data + i*n1), value);
-                }
-            } break;
-        case GGML_TYPE_F32:
-            {
-                assert(tensor->nb[0] == sizeof(float));
-                for (int i = 0; i < n; i++) {
-                    ggml_vec_set_f32(nc, (float *)(data + i*n1), value);
-                }
-            } break;
-        case GGML_TYPE_COUNT:
-            {
-                assert(false);
-            } break;
-    }
+    for (int i = 0; i < nb; i++) {
+        float amax = 0.0f; // absolute max
 
-    return tensor;
-}
+        for (int j = 0; j < QK; j++) {
+            amax = MAX(amax, fabsf(x[i*QK + j]));
+        }
 
-struct ggml_tensor * ggml_set_f32(struct ggml_tensor * tensor, float value) {
-    const int n     = ggml_nrows(tensor);
-    const int nc    = tensor->ne[0];
-    const size_t n1 = tensor->nb[1];
+        const float d  = amax / 7.0f;
+        const float id = d ? 1.0f/d : 0.0f;
 
-    char * const data = tensor->data;
+        y[i].d = d;
 
-    switch (tensor->type) {
-        case GGML_TYPE_I8:
-            {
-                assert(tensor->nb[0] == sizeof(int8_t));
-                for (int i = 0; i < n; i++) {
-                    ggml_vec_set_i8(nc, (int8_t *)(data + i*n1), value);
-                }
-            } break;
-        case GGML_TYPE_I16:
-            {
-                assert(tensor->nb[0] == sizeof(int16_t));
-                for (int i = 0; i < n; i++) {
-                    ggml_vec_set_i16(nc, (int16_t *)(data + i*n1), value);
-                }
-            } break;
-        case GGML_TYPE_I32:
-            {
-                assert(tensor->nb[0] == sizeof(int32_t));
-                for (int i = 0; i < n; i++) {
-                    ggml_vec_set_i32(nc, (int32_t *)(data + i*n1), value);
-                }
-            } break;
-        case GGML_TYPE_F16:
-            {
-                assert(tensor->nb[0] == sizeof(ggml_fp16_t));
-                for (int i = 0; i < n; i++) {
-                    ggml_vec_set_f16(nc, (ggml_fp16_t *)(data + i*n1), value);
-                }
-            } break;
-        case GGML_TYPE_F32:
-            {
-                assert(tensor->nb[0] == sizeof(float));
-                for (int i = 0; i < n; i++) {
-                    ggml_vec_set_f32(nc, (float *)(data + i*n1), value);
-                }
-            } break;
-        case GGML_TYPE_COUNT:
-            {
-                assert(false);
-            } break;
-    }
+        for (int j = 0; j < QK/2; ++j) {
+            const uint8_t v0 = (int8_t) roundf(x[i*QK + j       ]*id) + 8;
+            const uint8_t v1 = (int8_t) roundf(x[i*QK + j + QK/2]*id) + 8;
 
-    return tensor;
-}
+            assert(v0 < 16);
+            assert(v1 < 16);
 
-int32_t ggml_get_i32_1d(const struct ggml_tensor * tensor, int i) {
-    switch (tensor->type) {
-        case GGML_TYPE_I8:
-            {
-                GGML_ASSERT(tensor->nb[0] == sizeof(int8_t));
-                return ((int8_t *)(tensor->data))[i];
-            } break;
-        case GGML_TYPE_I16:
-            {
-                GGML_ASSERT(tensor->nb[0] == sizeof(int16_t));
-                return ((int16_t *)(tensor->data))[i];
-            } break;
-        case GGML_TYPE_I32:
-            {
-                GGML_ASSERT(tensor->nb[0] == sizeof(int32_t));
-                return ((int32_t *)(tensor->data))[i];
-            } break;
-        case GGML_TYPE_F16:
-            {
-                GGML_ASSERT(tensor->nb[0] == sizeof(ggml_fp16_t));
-                return GGML_FP16_TO_FP32(((ggml_fp16_t *)(tensor->data))[i]);
-            } break;
-        case GGML_TYPE_F32:
-            {
-                GGML_ASSERT(tensor->nb[0] == sizeof(float));
-                return ((float *)(tensor->data))[i];
-            } break;
-        case GGML_TYPE_COUNT:
-            {
-                GGML_ASSERT(false);
-            } break;
+            y[i].qs[j] = v0 | (v1 << 4);
+        }
     }
-
-    return 0.0f;
 }
 
-void ggml_set_i32_1d(const struct ggml_tensor * tensor, int i, int32_t value) {
-    switch (tensor->type) {
-        case GGML_TYPE_I8:
-            {
-                GGML_ASSERT(tensor->nb[0] == sizeof(int8_t));
-                ((int8_t *)(tensor->data))[i] = value;
-            } break;
-        case GGML_TYPE_I16:
-            {
-                GGML_ASSERT(tensor->nb[0] == sizeof(int16_t));
-                ((int16_t *)(tensor->data))[i] = value;
-            } break;
-        case GGML_TYPE_I32:
-            {
-                GGML_ASSERT(tensor->nb[0] == sizeof(int32_t));
-                ((int32_t *)(tensor->data))[i] = value;
-            } break;
-        case GGML_TYPE_F16:
-            {
-                GGML_ASSERT(tensor->nb[0] == sizeof(ggml_fp16_t));
-                ((ggml_fp16_t *)(tensor->data))[i] = GGML_FP32_TO_FP16(value);
-            } break;
-        case GGML_TYPE_F32:
-            {
-                GGML_ASSERT(tensor->nb[0] == sizeof(float));
-                ((float *)(tensor->data))[i] = value;
-            } break;
-        case GGML_TYPE_COUNT:
-            {
-                GGML_ASSERT(false);
-            } break;
-    }
-}
+static void dequantize_row_q4_0(const void * restrict vx, float * restrict y, int k) {
+    assert(k % QK == 0);
+    const int nb = k / QK;
 
-float ggml_get_f32_1d(const struct ggml_tensor * tensor, int i) {
-    switch (tensor->type) {
-        case GGML_TYPE_I8:
-            {
-                GGML_ASSERT(tensor->nb[0] == sizeof(int8_t));
-                return ((int8_t *)(tensor->data))[i];
-            } break;
-        case GGML_TYPE_I16:
-            {
-                GGML_ASSERT(tensor->nb[0] == sizeof(int16_t));
-                return ((int16_t *)(tensor->data))[i];
-            } break;
-        case GGML_TYPE_I32:
-            {
-                GGML_ASSERT(tensor->nb[0] == sizeof(int32_t));
-                return ((int32_t *)(tensor->data))[i];
-            } break;
-        case GGML_TYPE_F16:
-            {
-                GGML_ASSERT(tensor->nb[0] == sizeof(ggml_fp16_t));
-                return GGML_FP16_TO_FP32(((ggml_fp16_t *)(tensor->data))[i]);
-            } break;
-        case GGML_TYPE_F32:
-            {
-                GGML_ASSERT(tensor->nb[0] == sizeof(float));
-                return ((float *)(tensor->data))[i];
-            } break;
-        case GGML_TYPE_COUNT:
-            {
-                GGML_ASSERT(false);
-            } break;
-    }
+    const block_q4_0 * restrict x = vx;
 
-    return 0.0f;
-}
+    for (int i = 0; i < nb; i++) {
+        const float d = x[i].d;
 
-void ggml_set_f32_1d(const struct ggml_tensor * tensor, int i, float value) {
-    switch (tensor->type) {
-        case GGML_TYPE_I8:
-            {
-                GGML_ASSERT(tensor->nb[0] == sizeof(int8_t));
-                ((int8_t *)(tensor->data))[i] = value;
-            } break;
-        case GGML_TYPE_I16:
-            {
-                GGML_ASSERT(tensor->nb[0] == sizeof(int16_t));
-                ((int16_t *)(tensor->data))[i] = value;
-            } break;
-        case GGML_TYPE_I32:
-            {
-                GGML_ASSERT(tensor->nb[0] == sizeof(int32_t));
-                ((int32_t *)(tensor->data))[i] = value;
-            } break;
-        case GGML_TYPE_F16:
-            {
-                GGML_ASSERT(tensor->nb[0] == sizeof(ggml_fp16_t));
-                ((ggml_fp16_t *)(tensor->data))[i] = GGML_FP32_TO_FP16(value);
-            } break;
-        case GGML_TYPE_F32:
-            {
-                GGML_ASSERT(tensor->nb[0] == sizeof(float));
-                ((float *)(tensor->data))[i] = value;
-            } break;
-        case GGML_TYPE_COUNT:
-            {
-                GGML_ASSERT(false);
-            } break;
+        for (int j = 0; j < QK/2; ++j) {
+            y[i*QK + j       ] = ((x[i].qs[j] & 0x0F) - 8)*d;
+            y[i*QK + j + QK/2] = ((x[i].qs[j] >>   4) - 8)*d;
+        }
     }
 }
 
-void * ggml_get_data(const struct ggml_tensor * tensor) {
-    return tensor->data;
-}
+static void quantize_row_q8_0(const float * restrict x, void * restrict vy, int k) {
+    assert(k % QK == 0);
+    const int nb = k / QK;
 
-float * ggml_get_data_f32(const struct ggml_tensor * tensor) {
-    assert(tensor->type == GGML_TYPE_F32);
-    return (float *)(tensor->data);
-}
+    block_q8_0 * restrict y = vy;
 
-struct ggml_tensor * ggml_view_tensor(
-        struct ggml_context * ctx,
-        const struct ggml_tensor * src) {
-    return ggml_new_tensor_impl(ctx, src->type, src->n_dims, src->ne, src->data);
-}
+#if defined(__AVX2__)
+    const __m256 sign_bit = _mm256_set1_ps(-0.0f);
 
-////////////////////////////////////////////////////////////////////////////////
+    for (int i = 0; i < nb; i++) {
+        __m256 v0 = _mm256_loadu_ps(x + i*QK +  0);
+        __m256 v1 = _mm256_loadu_ps(x + i*QK +  8);
+        __m256 v2 = _mm256_loadu_ps(x + i*QK + 16);
+        __m256 v3 = _mm256_loadu_ps(x + i*QK + 24);
 
-// ggml_dup
+        // max(abs(x)) for the block
+        __m256 amax = _mm256_andnot_ps(sign_bit, v0);
+        amax = _mm256_max_ps(amax, _mm256_andnot_ps(sign_bit, v1));
+        amax = _mm256_max_ps(amax, _mm256_andnot_ps(sign_bit, v2));
+        amax = _mm256_max_ps(amax, _mm256_andnot_ps(sign_bit, v3));
 
-struct ggml_tensor * ggml_dup_impl(
-        struct ggml_context * ctx,
-        struct ggml_tensor * a,
-        bool inplace) {
-    bool is_node = false;
+        __m128 max4 = _mm_max_ps(_mm256_extractf128_ps(amax, 1), _mm256_castps256_ps128(amax));
+        max4 = _mm_max_ps(max4, _mm_movehl_ps(max4, max4));
+        max4 = _mm_max_ss(max4, _mm_movehdup_ps(max4));
 
-    if (!inplace && (a->grad)) {
-        is_node = true;
-    }
+        const float d  = _mm_cvtss_f32(max4) / 127.0f;
+        const float id = d ? 1.0f/d : 0.0f;
 
-    struct ggml_tensor * result = inplace ? ggml_view_tensor(ctx, a) : ggml_dup_tensor(ctx, a);
+        y[i].d = d;
 
-    result->op   = GGML_OP_DUP;
-    result->grad = is_node ? ggml_dup_tensor(ctx, result) : NULL;
-    result->src0 = a;
-    result->src1 = NULL;
+        const __m256 mul = _mm256_set1_ps(id);
 
-    return result;
-}
+        v0 = _mm256_round_ps(_mm256_mul_ps(v0, mul), _MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC);
+        v1 = _mm256_round_ps(_mm256_mul_ps(v1, mul), _MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC);
+        v2 = _mm256_round_ps(_mm256_mul_ps(v2, mul), _MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC);
+        v3 = _mm256_round_ps(_mm256_mul_ps(v3, mul), _MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC);
 
-struct ggml_tensor * ggml_dup(
-        struct ggml_context * ctx,
-        struct ggml_tensor * a) {
-    return ggml_dup_impl(ctx, a, false);
-}
+        // int32 -> int16 -> int8
+        __m256i i0 = _mm256_packs_epi32(_mm256_cvtps_epi32(v0), _mm256_cvtps_epi32(v1));
+        __m256i i2 = _mm256_packs_epi32(_mm256_cvtps_epi32(v2), _mm256_cvtps_epi32(v3));
 
-struct ggml_tensor * ggml_dup_inplace(
-        struct ggml_context * ctx,
-        struct ggml_tensor * a) {
-    return ggml_dup_impl(ctx, a, true);
-}
+        i0 = _mm256_packs_epi16(i0, i2);
 
-// ggml_add
+        // the packs instructions work on 128-bit lanes - restore the order of the values
+        i0 = _mm256_permutevar8x32_epi32(i0, _mm256_setr_epi32(0, 4, 1, 5, 2, 6, 3, 7));
 
-struct ggml_tensor * ggml_add_impl(
-        struct ggml_context * ctx,
-        struct ggml_tensor * a,
-        struct ggml_tensor * b,
-        bool inplace) {
-    assert(ggml_are_same_shape(a, b));
+        _mm256_storeu_si256((__m256i *) y[i].qs, i0);
+    }
+#else
+    for (int i = 0; i < nb; i++) {
+        float amax = 0.0f; // absolute max
 
-    bool is_node = false;
+        for (int j = 0; j < QK; j++) {
+            amax = MAX(amax, fabsf(x[i*QK + j]));
+        }
 
-    if (!inplace && (a->grad || b->grad)) {
-        is_node = true;
+        const float d  = amax / 127.0f;
+        const float id = d ? 1.0f/d : 0.0f;
+
+        y[i].d = d;
+
+        for (int j = 0; j < QK; ++j) {
+            y[i].qs[j] = roundf(x[i*QK + j]*id);
+        }
     }
+#endif
+}
 
-    struct ggml_tensor * result = inplace ? ggml_view_tensor(ctx, a) : ggml_dup_tensor(ctx, a);
+static void dequantize_row_q8_0(const void * restrict vx, float * restrict y, int k) {
+    assert(k % QK == 0);
+    const int nb = k / QK;
 
-    result->op   = GGML_OP_ADD;
-    result->grad = is_node ? ggml_dup_tensor(ctx, result) : NULL;
-    result->src0 = a;
-    result->src1 = b;
+    const block_q8_0 * restrict x = vx;
 
-    return result;
-}
+    for (int i = 0; i < nb; i++) {
+        const float d = x[i].d;
 
-struct ggml_tensor * ggml_add(
-        struct ggml_context * ctx,
-        struct ggml_tensor * a,
-        struct ggml_tensor * b) {
-    return ggml_add_impl(ctx, a, b, false);
+        for (int j = 0; j < QK; ++j) {
+            y[i*QK + j] = x[i].qs[j]*d;
+        }
+    }
 }
 
-struct ggml_tensor * ggml_add_inplace(
-        struct ggml_context * ctx,
-        struct ggml_tensor * a,
-        struct ggml_tensor * b) {
-    return ggml_add_impl(ctx, a, b, true);
-}
+static void ggml_vec_dot_q4_0_q8_0(const int n, float * restrict s, const void * restrict vx, const void * restrict vy) {
+#if defined(GGML_CPU_DISPATCH)
+    if (ggml_vec_fns.dot_q4_0_q8_0) {
+        ggml_vec_fns.dot_q4_0_q8_0(n, s, vx, vy);
+        return;
+    }
+#endif
 
-// ggml_sub
+    assert(n % QK == 0);
+    const int nb = n / QK;
 
-struct ggml_tensor * ggml_sub_impl(
-        struct ggml_context * ctx,
-        struct ggml_tensor * a,
-        struct ggml_tensor * b,
-        bool inplace) {
-    assert(ggml_are_same_shape(a, b));
+    const block_q4_0 * restrict x = vx;
+    const block_q8_0 * restrict y = vy;
 
-    bool is_node = false;
+#if defined(__AVX2__)
+    __m256 acc = _mm256_setzero_ps();
 
-    if (!inplace && (a->grad || b->grad)) {
-        is_node = true;
-    }
+    for (int i = 0; i < nb; ++i) {
+        const __m256 d = _mm256_set1_ps(x[i].d*y[i].d);
 
-    struct ggml_tensor * result = inplace ? ggml_view_tensor(ctx, a) : ggml_dup_tensor(ctx, a);
+        const __m256i bx = _mm256_sub_epi8(bytes_from_nibbles_32(x[i].qs), _mm256_set1_epi8(8));
+        const __m256i by = _mm256_loadu_si256((const __m256i *) y[i].qs);
 
-    result->op   = GGML_OP_SUB;
-    result->grad = is_node ? ggml_dup_tensor(ctx, result) : NULL;
-    result->src0 = a;
-    result->src1 = b;
+        acc = madd_ps(d, mul_sum_i8_pairs_float(bx, by), acc);
+    }
 
-    return result;
-}
+    *s = hsum_float_8(acc);
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+    const uint8x16_t m4b = vdupq_n_u8(0x0F);
+    const int8x16_t  s8b = vdupq_n_s8(0x8);
 
-struct ggml_tensor * ggml_sub(
-        struct ggml_context * ctx,
-        struct ggml_tensor * a,
-        struct ggml_tensor * b) {
-    return ggml_sub_impl(ctx, a, b, false);
-}
+    float32x4_t acc = vdupq_n_f32(0.0f);
 
-struct ggml_tensor * ggml_sub_inplace(
-        struct ggml_context * ctx,
-        struct ggml_tensor * a,
-        struct ggml_tensor * b) {
-    return ggml_sub_impl(ctx, a, b, true);
-}
+    for (int i = 0; i < nb; ++i) {
+        const uint8x16_t v0 = vld1q_u8(x[i].qs);
 
-// ggml_mul
+        const int8x16_t v0l = vsubq_s8(vreinterpretq_s8_u8(vandq_u8(v0, m4b)), s8b);
+        const int8x16_t v0h = vsubq_s8(vreinterpretq_s8_u8(vshrq_n_u8(v0, 4)), s8b);
 
-struct ggml_tensor * ggml_mul_impl(
-        struct ggml_context * ctx,
-        struct ggml_tensor * a,
-        struct ggml_tensor * b,
-        bool inplace) {
-    assert(ggml_are_same_shape(a, b));
+        const int8x16_t v1l = vld1q_s8(y[i].qs);
+        const int8x16_t v1h = vld1q_s8(y[i].qs + QK/2);
 
-    bool is_node = false;
+#if defined(__ARM_FEATURE_DOTPROD)
+        const int32x4_t p = vdotq_s32(vdotq_s32(vdupq_n_s32(0), v0l, v1l), v0h, v1h);
+#else
+        const int16x8_t pl0 = vmull_s8(vget_low_s8 (v0l), vget_low_s8 (v1l));
+        const int16x8_t pl1 = vmull_s8(vget_high_s8(v0l), vget_high_s8(v1l));
+        const int16x8_t ph0 = vmull_s8(vget_low_s8 (v0h), vget_low_s8 (v1h));
+        const int16x8_t ph1 = vmull_s8(vget_high_s8(v0h), vget_high_s8(v1h));
+
+        const int32x4_t p = vaddq_s32(
+                vaddq_s32(vpaddlq_s16(pl0), vpaddlq_s16(pl1)),
+                vaddq_s32(vpaddlq_s16(ph0), vpaddlq_s16(ph1)));
+#endif
 
-    if (!inplace && (a->grad || b->grad)) {
-        is_node = true;
+        acc = vmlaq_n_f32(acc, vcvtq_f32_s32(p), x[i].d*y[i].d);
     }
 
-    if (inplace) {
-        assert(is_node == false);
-    }
+    *s = vaddvq_f32(acc);
+#else
+    // scalar
+    float sumf = 0.0f;
 
-    struct ggml_tensor * result = inplace ? ggml_view_tensor(ctx, a) : ggml_dup_tensor(ctx, a);
+    for (int i = 0; i < nb; i++) {
+        int sumi = 0;
 
-    result->op   = GGML_OP_MUL;
-    result->grad = is_node ? ggml_dup_tensor(ctx, result) : NULL;
-    result->src0 = a;
-    result->src1 = b;
+        for (int j = 0; j < QK/2; ++j) {
+            const int v0 = (x[i].qs[j] & 0x0F) - 8;
+            const int v1 = (x[i].qs[j] >>   4) - 8;
 
-    return result;
-}
+            sumi += v0*y[i].qs[j] + v1*y[i].qs[j + QK/2];
+        }
 
-struct ggml_tensor * ggml_mul(
-        struct ggml_context * ctx,
-        struct ggml_tensor  * a,
-        struct ggml_tensor  * b) {
-    return ggml_mul_impl(ctx, a, b, false);
-}
+        sumf += sumi*x[i].d*y[i].d;
+    }
 
-struct ggml_tensor * ggml_mul_inplace(
-        struct ggml_context * ctx,
-        struct ggml_tensor  * a,
-        struct ggml_tensor  * b) {
-    return ggml_mul_impl(ctx, a, b, true);
+    *s = sumf;
+#endif
 }
 
-// ggml_div
-
-struct ggml_tensor * ggml_div_impl(
-        struct ggml_context * ctx,
-        struct ggml_tensor * a,
-        struct ggml_tensor * b,
-        bool inplace) {
-    assert(ggml_are_same_shape(a, b));
+static void ggml_vec_dot_q8_0_q8_0(const int n, float * restrict s, const void * restrict vx, const void * restrict vy) {
+#if defined(GGML_CPU_DISPATCH)
+    if (ggml_vec_fns.dot_q8_0_q8_0) {
+        ggml_vec_fns.dot_q8_0_q8_0(n, s, vx, vy);
+        return;
+    }
+#endif
 
-    bool is_node = false;
+    assert(n % QK == 0);
+    const int nb = n / QK;
 
-    if (!inplace && (a->grad || b->grad)) {
-        is_node = true;
-    }
+    const block_q8_0 * restrict x = vx;
+    const block_q8_0 * restrict y = vy;
 
-    if (inplace) {
-        assert(is_node == false);
-    }
+#if defined(__AVX2__)
+    __m256 acc = _mm256_setzero_ps();
 
-    struct ggml_tensor * result = inplace ? ggml_view_tensor(ctx, a) : ggml_dup_tensor(ctx, a);
+    for (int i = 0; i < nb; ++i) {
+        const __m256 d = _mm256_set1_ps(x[i].d*y[i].d);
 
-    result->op   = GGML_OP_DIV;
-    result->grad = is_node ? ggml_dup_tensor(ctx, result) : NULL;
-    result->src0 = a;
-    result->src1 = b;
+        const __m256i bx = _mm256_loadu_si256((const __m256i *) x[i].qs);
+        const __m256i by = _mm256_loadu_si256((const __m256i *) y[i].qs);
 
-    return result;
-}
+        acc = madd_ps(d, mul_sum_i8_pairs_float(bx, by), acc);
+    }
 
-struct ggml_tensor * ggml_div(
-        struct ggml_context * ctx,
-        struct ggml_tensor  * a,
-        struct ggml_tensor  * b) {
-    return ggml_div_impl(ctx, a, b, false);
-}
+    *s = hsum_float_8(acc);
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+    float32x4_t acc = vdupq_n_f32(0.0f);
 
-struct ggml_tensor * ggml_div_inplace(
-        struct ggml_context * ctx,
-        struct ggml_tensor  * a,
-        struct ggml_tensor  * b) {
-    return ggml_div_impl(ctx, a, b, true);
-}
+    for (int i = 0; i < nb; ++i) {
+        const int8x16_t v0l = vld1q_s8(x[i].qs);
+        const int8x16_t v0h = vld1q_s8(x[i].qs + QK/2);
 
-// ggml_sqr
+        const int8x16_t v1l = vld1q_s8(y[i].qs);
+        const int8x16_t v1h = vld1q_s8(y[i].qs + QK/2);
 
-struct ggml_tensor * ggml_sqr_impl(
-        struct ggml_context * ctx,
-        struct ggml_tensor * a,
-        bool inplace) {
-    bool is_node = false;
+#if defined(__ARM_FEATURE_DOTPROD)
+        const int32x4_t p = vdotq_s32(vdotq_s32(vdupq_n_s32(0), v0l, v1l), v0h, v1h);
+#else
+        const int16x8_t pl0 = vmull_s8(vget_low_s8 (v0l), vget_low_s8 (v1l));
+        const int16x8_t pl1 = vmull_s8(vget_high_s8(v0l), vget_high_s8(v1l));
+        const int16x8_t ph0 = vmull_s8(vget_low_s8 (v0h), vget_low_s8 (v1h));
+        const int16x8_t ph1 = vmull_s8(vget_high_s8(v0h), vget_high_s8(v1h));
+
+        const int32x4_t p = vaddq_s32(
+                vaddq_s32(vpaddlq_s16(pl0), vpaddlq_s16(pl1)),
+                vaddq_s32(vpaddlq_s16(ph0), vpaddlq_s16(ph1)));
+#endif
 
-    if (!inplace && (a->grad)) {
-        is_node = true;
+        acc = vmlaq_n_f32(acc, vcvtq_f32_s32(p), x[i].d*y[i].d);
     }
 
-    struct ggml_tensor * result = inplace ? ggml_view_tensor(ctx, a) : ggml_dup_tensor(ctx, a);
+    *s = vaddvq_f32(acc);
+#else
+    // scalar
+    float sumf = 0.0f;
 
-    result->op   = GGML_OP_SQR;
-    result->grad = is_node ? ggml_dup_tensor(ctx, result) : NULL;
-    result->src0 = a;
-    result->src1 = NULL;
+    for (int i = 0; i < nb; i++) {
+        int sumi = 0;
 
-    return result;
-}
+        for (int j = 0; j < QK; ++j) {
+            sumi += x[i].qs[j]*y[i].qs[j];
+        }
 
-struct ggml_tensor * ggml_sqr(
-        struct ggml_context * ctx,
-        struct ggml_tensor  * a) {
-    return ggml_sqr_impl(ctx, a, false);
-}
+        sumf += sumi*x[i].d*y[i].d;
+    }
 
-struct ggml_tensor * ggml_sqr_inplace(
-        struct ggml_context * ctx,
-        struct ggml_tensor  * a) {
-    return ggml_sqr_impl(ctx, a, true);
+    *s = sumf;
+#endif
 }
 
-// ggml_sqrt
-
-struct ggml_tensor * ggml_sqrt_impl(
-        struct ggml_context * ctx,
-        struct ggml_tensor * a,
-        bool inplace) {
-    bool is_node = false;
-
-    if (!inplace && (a->grad)) {
-        is_node = true;
-    }
+#if defined(GGML_CPU_DISPATCH)
 
-    struct ggml_tensor * result = inplace ? ggml_view_tensor(ctx, a) : ggml_dup_tensor(ctx, a);
+//
+// AVX512-VNNI variants of the quantized dot products
+//
+// VPDPBUSD replaces the VPMADDUBSW + VPMADDWD pair of the AVX2 code. the blocks are processed with 256-bit registers -
+// one block per register - since joining two 36-byte blocks into a 512-bit register costs more than it saves
+//
 
-    result->op   = GGML_OP_SQRT;
-    result->grad = is_node ? ggml_dup_tensor(ctx, result) : NULL;
-    result->src0 = a;
-    result->src1 = NULL;
+#define GGML_TARGET_AVX512_VNNI __attribute__((target("avx512f,avx512bw,avx512vl,avx512vnni,avx2,fma,f16c")))
 
-    return result;
+// unpack 32 4-bit values into 32 bytes - the low nibbles go to the lower half
+GGML_TARGET_AVX512_VNNI static inline __m256i ggml_bytes_from_nibbles_32_vnni(const uint8_t * rsi) {
+    const __m128i tmp   = _mm_loadu_si128((const __m128i *) rsi);
+    const __m256i bytes = _mm256_inserti128_si256(_mm256_castsi128_si256(tmp), _mm_srli_epi16(tmp, 4), 1);
+    return _mm256_and_si256(_mm256_set1_epi8(0x0F), bytes);
 }
 
-struct ggml_tensor * ggml_sqrt(
-        struct ggml_context * ctx,
-        struct ggml_tensor  * a) {
-    return ggml_sqrt_impl(ctx, a, false);
+// multiply the signed bytes of x and y and sum the products in groups of 4 into 8 floats
+GGML_TARGET_AVX512_VNNI static inline __m256 ggml_mul_sum_i8_pairs_vnni(const __m256i x, const __m256i y) {
+    // dpbusd needs an unsigned first operand - move the sign of x to y
+    const __m256i ax = _mm256_sign_epi8(x, x);
+    const __m256i sy = _mm256_sign_epi8(y, x);
+    return _mm256_cvtepi32_ps(_mm256_dpbusd_epi32(_mm256_setzero_si256(), ax, sy));
 }
 
-struct ggml_tensor * ggml_sqrt_inplace(
-        struct ggml_context * ctx,
-        struct ggml_tensor  * a) {
-    return ggml_sqrt_impl(ctx, a, true);
+GGML_TARGET_AVX512_VNNI static inline float ggml_hsum_vnni(const __m256 x) {
+    __m128 res = _mm256_extractf128_ps(x, 1);
+    res = _mm_add_ps(res, _mm256_castps256_ps128(x));
+    res = _mm_add_ps(res, _mm_movehl_ps(res, res));
+    res = _mm_add_ss(res, _mm_movehdup_ps(res));
+    return _mm_cvtss_f32(res);
 }
 
-// ggml_sum
+GGML_TARGET_AVX512_VNNI static void ggml_vec_dot_q4_0_q8_0_vnni(const int n, float * restrict s, const void * restrict vx, const void * restrict vy) {
+    assert(n % QK == 0);
+    const int nb = n / QK;
 
-struct ggml_tensor * ggml_sum(
-        struct ggml_context * ctx,
-        struct ggml_tensor * a) {
-    bool is_node = false;
+    const block_q4_0 * restrict x = vx;
+    const block_q8_0 * restrict y = vy;
 
-    if (a->grad) {
-        is_node = true;
-    }
+    __m256 acc = _mm256_setzero_ps();
 
-    struct ggml_tensor * result = ggml_new_tensor_1d(ctx, a->type, 1);
+    for (int i = 0; i < nb; ++i) {
+        const __m256 d = _mm256_set1_ps(x[i].d*y[i].d);
 
-    result->op   = GGML_OP_SUM;
-    result->grad = is_node ? ggml_dup_tensor(ctx, result) : NULL;
-    result->src0 = a;
-    result->src1 = NULL;
+        const __m256i bx = _mm256_sub_epi8(ggml_bytes_from_nibbles_32_vnni(x[i].qs), _mm256_set1_epi8(8));
+        const __m256i by = _mm256_loadu_si256((const __m256i *) y[i].qs);
 
-    return result;
+        acc = _mm256_fmadd_ps(d, ggml_mul_sum_i8_pairs_vnni(bx, by), acc);
+    }
+
+    *s = ggml_hsum_vnni(acc);
 }
 
-// ggml_mean
+GGML_TARGET_AVX512_VNNI static void ggml_vec_dot_q8_0_q8_0_vnni(const int n, float * restrict s, const void * restrict vx, const void * restrict vy) {
+    assert(n % QK == 0);
+    const int nb = n / QK;
 
-struct ggml_tensor * ggml_mean(
-        struct ggml_context * ctx,
-        struct ggml_tensor * a) {
-    bool is_node = false;
+    const block_q8_0 * restrict x = vx;
+    const block_q8_0 * restrict y = vy;
 
-    if (a->grad) {
-        assert(false); // TODO: implement
-        is_node = true;
-    }
+    __m256 acc = _mm256_setzero_ps();
 
-    int ne[GGML_MAX_DIMS] = { 1, a->ne[1], a->ne[2], a->ne[3] };
-    struct ggml_tensor * result = ggml_new_tensor(ctx, GGML_TYPE_F32, a->n_dims, ne);
+    for (int i = 0; i < nb; ++i) {
+        const __m256 d = _mm256_set1_ps(x[i].d*y[i].d);
 
-    result->op   = GGML_OP_MEAN;
-    result->grad = is_node ? ggml_dup_tensor(ctx, result) : NULL;
-    result->src0 = a;
-    result->src1 = NULL;
+        const __m256i bx = _mm256_loadu_si256((const __m256i *) x[i].qs);
+        const __m256i by = _mm256_loadu_si256((const __m256i *) y[i].qs);
 
-    return result;
-}
+        acc = _mm256_fmadd_ps(d, ggml_mul_sum_i8_pairs_vnni(bx, by), acc);
+    }
 
-// ggml_repeat
+    *s = ggml_hsum_vnni(acc);
+}
 
-struct ggml_tensor * ggml_repeat(
-        struct ggml_context * ctx,
-        struct ggml_tensor * a,
-        struct ggml_tensor * b) {
-    assert(ggml_can_repeat(a, b));
+#endif
 
-    bool is_node = false;
+typedef void (*dequantize_row_q_t)(const void  * restrict x, float * restrict y, int k);
+typedef void (*quantize_row_q_t)  (const float * restrict x, void  * restrict y, int k);
+typedef void (*vec_dot_q_t)       (const int n, float * restrict s, const void * restrict x, const void * restrict y);
+
+typedef struct {
+    dequantize_row_q_t dequantize_row_q;
+    quantize_row_q_t   quantize_row_q;
+    vec_dot_q_t        vec_dot_q; // the second argument is always Q8_0
+} quantize_fns_t;
+
+static const quantize_fns_t quantize_fns[GGML_TYPE_COUNT] = {
+    [GGML_TYPE_Q4_0] = {
+        .dequantize_row_q = dequantize_row_q4_0,
+        .quantize_row_q   = quantize_row_q4_0,
+        .vec_dot_q        = ggml_vec_dot_q4_0_q8_0,
+    },
+    [GGML_TYPE_Q8_0] = {
+        .dequantize_row_q = dequantize_row_q8_0,
+        .quantize_row_q   = quantize_row_q8_0,
+        .vec_dot_q        = ggml_vec_dot_q8_0_q8_0,
+    },
+};
 
-    if (a->grad) {
-        is_node = true;
-    }
+//
+// logging
+//
 
-    if (ggml_are_same_shape(a, b) && !is_node) {
-        return a;
-    }
+#if (GGML_DEBUG >= 1)
+#define GGML_PRINT_DEBUG(...) printf(__VA_ARGS__)
+#else
+#define GGML_PRINT_DEBUG(...)
+#endif
 
-    struct ggml_tensor * result = ggml_new_tensor(ctx, a->type, b->n_dims, b->ne);
+#if (GGML_DEBUG >= 5)
+#define GGML_PRINT_DEBUG_5(...) printf(__VA_ARGS__)
+#else
+#define GGML_PRINT_DEBUG_5(...)
+#endif
 
-    result->op   = GGML_OP_REPEAT;
-    result->grad = is_node ? ggml_dup_tensor(ctx, result) : NULL;
-    result->src0 = a;
-    result->src1 = NULL;
+#if (GGML_DEBUG >= 10)
+#define GGML_PRINT_DEBUG_10(...) printf(__VA_ARGS__)
+#else
+#define GGML_PRINT_DEBUG_10(...)
+#endif
 
-    return result;
-}
+#define GGML_PRINT(...) printf(__VA_ARGS__)
 
-// ggml_abs
+//
+// data types
+//
 
-struct ggml_tensor * ggml_abs_impl(
-        struct ggml_context * ctx,
-        struct ggml_tensor * a,
-        bool inplace) {
-    bool is_node = false;
+static const int GGML_BLCK_SIZE[GGML_TYPE_COUNT] = {
+    1,
+    1,
+    1,
+    1,
+    1,
+    QK,
+    QK,
+};
 
-    if (!inplace && (a->grad)) {
-        is_node = true;
-    }
+static const size_t GGML_TYPE_SIZE[GGML_TYPE_COUNT] = {
+    sizeof(int8_t ),
+    sizeof(int16_t),
+    sizeof(int32_t),
+    sizeof(ggml_fp16_t),
+    sizeof(float  ),
+    sizeof(block_q4_0),
+    sizeof(block_q8_0),
+};
 
-    struct ggml_tensor * result = inplace ? ggml_view_tensor(ctx, a) : ggml_dup_tensor(ctx, a);
+static const char * GGML_TYPE_NAME[GGML_TYPE_COUNT] = {
+    "i8",
+    "i16",
+    "i32",
+    "f16",
+    "f32",
+    "q4_0",
+    "q8_0",
+};
 
-    result->op   = GGML_OP_ABS;
-    result->grad = is_node ? ggml_dup_tensor(ctx, result) : NULL;
-    result->src0 = a;
-    result->src1 = NULL;
+static const char * GGML_OP_LABEL[GGML_OP_COUNT] = {
+    "NONE",
 
-    return result;
-}
+    "DUP",
+    "ADD",
+    "SUB",
+    "MUL",
+    "DIV",
+    "SQR",
+    "SQRT",
+    "SUM",
+    "MEAN",
+    "REPEAT",
+    "ABS",
+    "SGN",
+    "NEG",
+    "STEP",
+    "RELU",
+    "GELU",
+    "NORM",
+    "NORM_AFFINE",
 
-struct ggml_tensor * ggml_abs(
-        struct ggml_context * ctx,
-        struct ggml_tensor  * a) {
-    return ggml_abs_impl(ctx, a, false);
-}
+    "MUL_MAT",
 
-struct ggml_tensor * ggml_abs_inplace(
-        struct ggml_context * ctx,
-        struct ggml_tensor  * a) {
-    return ggml_abs_impl(ctx, a, true);
-}
+    "SCALE",
+    "CPY",
+    "RESHAPE",
+    "VIEW",
+    "PERMUTE",
+    "TRANSPOSE",
+    "GET_ROWS",
+    "DIAG_MASK_INF",
+    "SOFT_MAX",
+    "ROPE",
+    "CONV_1D_1S",
+    "CONV_1D_2S",
 
+    "FLASH_ATTN",
+    "FLASH_FF",
+};
 
-// ggml_sgn
+static const char * GGML_OP_SYMBOL[GGML_OP_COUNT] = {
+    "none",
 
-struct ggml_tensor * ggml_sgn_impl(
-        struct ggml_context * ctx,
-        struct ggml_tensor * a,
-        bool inplace) {
-    bool is_node = false;
+    "x",
+    "x+y",
+    "x-y",
+    "x*y",
+    "x/y",
+    "x^2",
+    "√x",
+    "Σx",
+    "Σx/n",
+    "repeat(x)",
+    "abs(x)",
+    "sgn(x)",
+    "-x",
+    "step(x)",
+    "relu(x)",
+    "gelu(x)",
+    "norm(x)",
+    "norm_affine(x)",
 
-    if (!inplace && (a->grad)) {
-        is_node = true;
-    }
+    "X*Y",
 
-    struct ggml_tensor * result = inplace ? ggml_view_tensor(ctx, a) : ggml_dup_tensor(ctx, a);
+    "x*v",
+    "x-\\>y",
+    "reshape(x)",
+    "view(x)",
+    "permute(x)",
+    "transpose(x)",
+    "get_rows(x)",
+    "diag_mask_inf(x)",
+    "soft_max(x)",
+    "rope(x)",
+    "conv_1d_1s(x)",
+    "conv_1d_2s(x)",
 
-    result->op   = GGML_OP_SGN;
-    result->grad = is_node ? ggml_dup_tensor(ctx, result) : NULL;
-    result->src0 = a;
-    result->src1 = NULL;
+    "flash_attn(x)",
+    "flash_ff(x)",
+};
 
-    return result;
-}
+//
+// ggml object
+//
 
-struct ggml_tensor * ggml_sgn(
-        struct ggml_context * ctx,
-        struct ggml_tensor  * a) {
-    return ggml_sgn_impl(ctx, a, false);
-}
+struct ggml_object {
+    size_t offset;
+    size_t size;
 
-struct ggml_tensor * ggml_sgn_inplace(
-        struct ggml_context * ctx,
-        struct ggml_tensor  * a) {
-    return ggml_sgn_impl(ctx, a, true);
-}
+    struct ggml_object * next;
 
-// ggml_neg
+    char padding[8];
+};
 
-struct ggml_tensor * ggml_neg_impl(
-        struct ggml_context * ctx,
-        struct ggml_tensor * a,
-        bool inplace) {
-    bool is_node = false;
+static const size_t GGML_OBJECT_SIZE = sizeof(struct ggml_object);
 
-    if (!inplace && (a->grad)) {
-        is_node = true;
-    }
+static_assert(sizeof(struct ggml_object)%GGML_MEM_ALIGN == 0, "ggml_object size must be a multiple of GGML_MEM_ALIGN");
+static_assert(sizeof(struct ggml_tensor)%GGML_MEM_ALIGN == 0, "ggml_tensor size must be a multiple of GGML_MEM_ALIGN");
 
-    struct ggml_tensor * result = inplace ? ggml_view_tensor(ctx, a) : ggml_dup_tensor(ctx, a);
+//
+// ggml context
+//
 
-    result->op   = GGML_OP_NEG;
-    result->grad = is_node ? ggml_dup_tensor(ctx, result) : NULL;
-    result->src0 = a;
-    result->src1 = NULL;
+struct ggml_context {
+    size_t mem_size;
+    void * mem_buffer;
+    bool   mem_buffer_owned;
 
-    return result;
-}
+    int n_objects;
 
-struct ggml_tensor * ggml_neg(
-        struct ggml_context * ctx,
-        struct ggml_tensor  * a) {
-    return ggml_neg_impl(ctx, a, false);
-}
+    struct ggml_object * objects_begin;
+    struct ggml_object * objects_end;
 
-struct ggml_tensor * ggml_neg_inplace(
-        struct ggml_context * ctx,
-        struct ggml_tensor  * a) {
-    return ggml_neg_impl(ctx, a, true);
-}
+    struct ggml_scratch scratch;
+    struct ggml_scratch scratch_save;
 
-// ggml_step
+    bool no_alloc;
+    bool no_alloc_save;
+};
 
-struct ggml_tensor * ggml_step_impl(
-        struct ggml_context * ctx,
-        struct ggml_tensor * a,
-        bool inplace) {
-    bool is_node = false;
+struct ggml_context_container {
+    bool used;
 
-    if (!inplace && (a->grad)) {
-        is_node = true;
-    }
+    struct ggml_context context;
+};
 
-    struct ggml_tensor * result = inplace ? ggml_view_tensor(ctx, a) : ggml_dup_tensor(ctx, a);
+//
+// compute types
+//
 
-    result->op   = GGML_OP_STEP;
-    result->grad = is_node ? ggml_dup_tensor(ctx, result) : NULL;
-    result->src0 = a;
-    result->src1 = NULL;
+enum ggml_task_type {
+    GGML_TASK_INIT = 0,
+    GGML_TASK_COMPUTE,
+    GGML_TASK_FINALIZE,
+};
 
-    return result;
-}
+// number of chunks claimed from a block of chunks, on its own cache line - see ggml_task_chunk_next()
+struct ggml_task_chunk {
+    atomic_int n;
+    char padding[CACHE_LINE_SIZE - sizeof(atomic_int)];
+};
 
-struct ggml_tensor * ggml_step(
-        struct ggml_context * ctx,
-        struct ggml_tensor  * a) {
-    return ggml_step_impl(ctx, a, false);
-}
+struct ggml_compute_params {
+    enum ggml_task_type type;
 
-struct ggml_tensor * ggml_step_inplace(
-        struct ggml_context * ctx,
-        struct ggml_tensor  * a) {
-    return ggml_step_impl(ctx, a, true);
-}
+    int ith, nth;
 
-// ggml_relu
+    // work buffer for all threads
+    size_t wsize;
+    void * wdata;
 
-struct ggml_tensor * ggml_relu_impl(
-        struct ggml_context * ctx,
-        struct ggml_tensor * a,
-        bool inplace) {
-    bool is_node = false;
+    // the threads are split into n_numa groups, one per NUMA node, and the chunks into n_numa blocks with a
+    // counter each - see ggml_task_chunk_next()
+    int n_numa;
+    struct ggml_task_chunk * chunk; // [n_numa]
 
-    if (!inplace && (a->grad)) {
-        is_node = true;
-    }
+    // F32 copies of the weights for the BLAS path of mul_mat - optional
+    struct ggml_wcache * wcache;
+};
 
-    struct ggml_tensor * result = inplace ? ggml_view_tensor(ctx, a) : ggml_dup_tensor(ctx, a);
+#if defined(GGML_USE_ACCELERATE) || defined(GGML_USE_OPENBLAS)
+static float * ggml_wcache_acquire(struct ggml_wcache * cache, const struct ggml_tensor * tensor, bool * fill);
+static void    ggml_wcache_release(struct ggml_wcache * cache, const struct ggml_tensor * tensor);
+#endif
 
-    result->op   = GGML_OP_RELU;
-    result->grad = is_node ? ggml_dup_tensor(ctx, result) : NULL;
-    result->src0 = a;
-    result->src1 = NULL;
+//
+// dynamic work distribution
+//
+// the heavy ops (mul_mat, conv_1d) split their rows into chunks that the threads claim one at a time from a shared
+// counter, so that a slow thread (SMT sibling, throttled core, another process) does not hold back the others at the
+// end of the task. each thread starts with chunk ith without touching the counter, so with one chunk per thread this
+// is the static ith/nth partition
+//
+// with a thread pool spread over several NUMA nodes (see ggml_threadpool_new_numa()), the threads of the pool and the
+// chunks are split into one contiguous group / block per node: the threads of a node claim the chunks of their block
+// first and only then help the other nodes. with the rows of src0 placed by ggml_numa_distribute(), the threads
+// mostly read the memory of their own node
+//
+//   for (int ik = ggml_task_chunk_first(params, nchunk); ik < nchunk; ik = ggml_task_chunk_next(params, nchunk)) { ... }
+//
 
-    return result;
-}
+#ifndef GGML_CHUNKS_PER_THREAD
+#define GGML_CHUNKS_PER_THREAD 4
+#endif
 
-struct ggml_tensor * ggml_relu(
-        struct ggml_context * ctx,
-        struct ggml_tensor  * a) {
-    return ggml_relu_impl(ctx, a, false);
-}
+// 0 - GGML_CHUNKS_PER_THREAD
+static int ggml_chunks_per_thread[GGML_OP_COUNT] = { 0 };
 
-struct ggml_tensor * ggml_relu_inplace(
-        struct ggml_context * ctx,
-        struct ggml_tensor  * a) {
-    return ggml_relu_impl(ctx, a, true);
+void ggml_set_chunks_per_thread(enum ggml_op op, int n_chunks) {
+    ggml_chunks_per_thread[op] = MAX(0, n_chunks);
 }
 
-// ggml_gelu
-
-struct ggml_tensor * ggml_gelu_impl(
-        struct ggml_context * ctx,
-        struct ggml_tensor * a,
-        bool inplace) {
-    bool is_node = false;
-
-    if (!inplace && (a->grad)) {
-        is_node = true;
-    }
-
-    struct ggml_tensor * result = inplace ? ggml_view_tensor(ctx, a) : ggml_dup_tensor(ctx, a);
+int ggml_get_chunks_per_thread(enum ggml_op op) {
+    return ggml_chunks_per_thread[op] > 0 ? ggml_chunks_per_thread[op] : GGML_CHUNKS_PER_THREAD;
+}
 
-    result->op   = GGML_OP_GELU;
-    result->grad = is_node ? ggml_dup_tensor(ctx, result) : NULL;
-    result->src0 = a;
-    result->src1 = NULL;
+// number of rows per chunk when splitting nr rows of the task of dst - a multiple of align
+static inline int ggml_task_chunk_size(const struct ggml_compute_params * params, const struct ggml_tensor * dst, int nr, int align) {
+    // a single thread has nobody to balance with
+    const int n_chunks = params->nth > 1 ? params->nth*(dst->n_chunks > 0 ? dst->n_chunks : ggml_get_chunks_per_thread(dst->op)) : 1;
 
-    return result;
+    return MAX(1, ((nr + n_chunks - 1)/n_chunks + align - 1)/align)*align;
 }
 
-struct ggml_tensor * ggml_gelu(
-        struct ggml_context * ctx,
-        struct ggml_tensor  * a) {
-    return ggml_gelu_impl(ctx, a, false);
+// the group of thread ith when nth threads are split into n contiguous groups: [g*nth/n, (g + 1)*nth/n)
+static inline int ggml_numa_group(int ith, int nth, int n) {
+    int g = 0;
+    while ((g + 1)*nth/n <= ith) {
+        g++;
+    }
+    return g;
 }
 
-struct ggml_tensor * ggml_gelu_inplace(
-        struct ggml_context * ctx,
-        struct ggml_tensor  * a) {
-    return ggml_gelu_impl(ctx, a, true);
-}
+// claim the next chunk - called after finishing a chunk
+// returns nchunk when all chunks have been claimed
+static inline int ggml_task_chunk_next(const struct ggml_compute_params * params, int nchunk) {
+    const int n   = params->n_numa;
+    const int nth = params->nth;
+    const int g   = ggml_numa_group(params->ith, nth, n);
 
-// ggml_norm
+    for (int i = 0; i < n; i++) {
+        const int h = (g + i) % n;
 
-struct ggml_tensor * ggml_norm_impl(
-        struct ggml_context * ctx,
-        struct ggml_tensor  * a,
-        bool inplace) {
-    bool is_node = false;
+        // the first chunk of each thread of the group is claimed without the counter
+        const int ik = h*nchunk/n + ((h + 1)*nth/n - h*nth/n) + atomic_fetch_add(&params->chunk[h].n, 1);
 
-    if (!inplace && (a->grad)) {
-        assert(false); // TODO: implement backward
-        is_node = true;
+        if (ik < (h + 1)*nchunk/n) {
+            return ik;
+        }
     }
 
-    struct ggml_tensor * result = inplace ? ggml_view_tensor(ctx, a) : ggml_dup_tensor(ctx, a);
+    return nchunk;
+}
 
-    result->op   = GGML_OP_NORM;
-    result->grad = is_node ? ggml_dup_tensor(ctx, result) : NULL;
-    result->src0 = a;
-    result->src1 = NULL; // TODO: maybe store epsilon here?
+// the first chunk of the thread - the chunk of its block with the index of the thread in its group
+static inline int ggml_task_chunk_first(const struct ggml_compute_params * params, int nchunk) {
+    const int n   = params->n_numa;
+    const int nth = params->nth;
+    const int g   = ggml_numa_group(params->ith, nth, n);
 
-    return result;
-}
+    const int ik = g*nchunk/n + (params->ith - g*nth/n);
 
-struct ggml_tensor * ggml_norm(
-        struct ggml_context * ctx,
-        struct ggml_tensor  * a) {
-    return ggml_norm_impl(ctx, a, false);
+    return ik < (g + 1)*nchunk/n ? ik : ggml_task_chunk_next(params, nchunk);
 }
 
-struct ggml_tensor * ggml_norm_inplace(
-        struct ggml_context * ctx,
-        struct ggml_tensor  * a) {
-    return ggml_norm_impl(ctx, a, true);
+static void ggml_task_chunk_reset(struct ggml_task_chunk * chunk, int n) {
+    for (int i = 0; i < n; i++) {
+        atomic_store(&chunk[i].n, 0);
+    }
 }
 
-// ggml_mul_mat
+//
+// ggml state
+//
 
-struct ggml_tensor * ggml_mul_mat(
-        struct ggml_context * ctx,
-        struct ggml_tensor  * a,
-        struct ggml_tensor  * b) {
-    assert(ggml_can_mul_mat(a, b));
+struct ggml_state {
+    struct ggml_context_container contexts[GGML_MAX_CONTEXTS];
+};
 
-    bool is_node = false;
+// global state
+static struct ggml_state g_state;
+static atomic_int g_state_barrier = 0;
 
-    if (a->grad || b->grad) {
-        is_node = true;
+// barrier via spin lock
+inline static void ggml_critical_section_start(void) {
+    int processing = atomic_fetch_add(&g_state_barrier, 1);
+
+    while (processing > 0) {
+        // wait for other threads to finish
+        atomic_fetch_sub(&g_state_barrier, 1);
+        sched_yield(); // TODO: reconsider this
+        processing = atomic_fetch_add(&g_state_barrier, 1);
     }
+}
 
-    const int ne[4] = { a->ne[1], b->ne[1], a->ne[2], b->ne[3] };
-    struct ggml_tensor * result = ggml_new_tensor(ctx, GGML_TYPE_F32, MIN(a->n_dims, b->n_dims), ne);
+// TODO: make this somehow automatically executed
+//       some sort of "sentry" mechanism
+inline static void ggml_critical_section_end(void) {
+    atomic_fetch_sub(&g_state_barrier, 1);
+}
 
-    result->op   = GGML_OP_MUL_MAT;
-    result->grad = is_node ? ggml_dup_tensor(ctx, result) : NULL;
-    result->src0 = a;
-    result->src1 = b;
+////////////////////////////////////////////////////////////////////////////////
 
-    return result;
+void ggml_print_object(const struct ggml_object * obj) {
+    GGML_PRINT(" - ggml_object: offset = %zu, size = %zu, next = %p\n",
+            obj->offset, obj->size, (const void *) obj->next);
 }
 
-// ggml_scale
-
-struct ggml_tensor * ggml_scale_impl(
-        struct ggml_context * ctx,
-        struct ggml_tensor  * a,
-        struct ggml_tensor  * b,
-        bool inplace) {
-    assert(ggml_is_scalar(b));
-    assert(ggml_is_padded_1d(a));
+void ggml_print_objects(const struct ggml_context * ctx) {
+    struct ggml_object * obj = ctx->objects_begin;
 
-    bool is_node = false;
+    GGML_PRINT("%s: objects in context %p:\n", __func__, (const void *) ctx);
 
-    if (!inplace && (a->grad || b->grad)) {
-        assert(false); // TODO: implement backward
-        is_node = true;
+    while (obj != NULL) {
+        ggml_print_object(obj);
+        obj = obj->next;
     }
 
-    // TODO: when implement backward, fix this:
-    //struct ggml_tensor * result = inplace ? ggml_view_tensor(ctx, a) : ggml_dup_tensor(ctx, a);
-    struct ggml_tensor * result = ggml_view_tensor(ctx, a);
-
-    result->op   = GGML_OP_SCALE;
-    result->grad = is_node ? ggml_dup_tensor(ctx, result) : NULL;
-    result->src0 = a;
-    result->src1 = b;
-
-    return result;
+    GGML_PRINT("%s: --- end ---\n", __func__);
 }
 
-struct ggml_tensor * ggml_scale(
-        struct ggml_context * ctx,
-        struct ggml_tensor * a,
-        struct ggml_tensor * b) {
-    return ggml_scale_impl(ctx, a, b, false);
-}
+int ggml_nelements(const struct ggml_tensor * tensor) {
+    static_assert(GGML_MAX_DIMS == 4, "GGML_MAX_DIMS is not 4 - update this function");
 
-struct ggml_tensor * ggml_scale_inplace(
-        struct ggml_context * ctx,
-        struct ggml_tensor * a,
-        struct ggml_tensor * b) {
-    return ggml_scale_impl(ctx, a, b, true);
+    return tensor->ne[0]*tensor->ne[1]*tensor->ne[2]*tensor->ne[3];
 }
 
-// ggml_cpy
-
-struct ggml_tensor * ggml_cpy_impl(
-        struct ggml_context * ctx,
-        struct ggml_tensor  * a,
-        struct ggml_tensor  * b,
-        bool inplace) {
-    assert(ggml_nelements(a) == ggml_nelements(b));
+int ggml_nrows(const struct ggml_tensor * tensor) {
+    static_assert(GGML_MAX_DIMS == 4, "GGML_MAX_DIMS is not 4 - update this function");
 
-    bool is_node = false;
+    return tensor->ne[1]*tensor->ne[2]*tensor->ne[3];
+}
 
-    if (!inplace && (a->grad || b->grad)) {
-        assert(false); // TODO: implement backward
-        is_node = true;
-    }
+size_t ggml_nbytes(const struct ggml_tensor * tensor) {
+    static_assert(GGML_MAX_DIMS == 4, "GGML_MAX_DIMS is not 4 - update this function");
 
-    // make a view of the destination
-    struct ggml_tensor * result = ggml_view_tensor(ctx, b);
+    return (ggml_nelements(tensor)*GGML_TYPE_SIZE[tensor->type])/GGML_BLCK_SIZE[tensor->type];
+}
 
-    result->op   = GGML_OP_CPY;
-    result->grad = is_node ? ggml_dup_tensor(ctx, result) : NULL;
-    result->src0 = a;
-    result->src1 = b;
+int ggml_blck_size(enum ggml_type type) {
+    return GGML_BLCK_SIZE[type];
+}
 
-    return result;
+size_t ggml_type_size(enum ggml_type type) {
+    return GGML_TYPE_SIZE[type];
 }
 
-struct ggml_tensor * ggml_cpy(
-        struct ggml_context * ctx,
-        struct ggml_tensor * a,
-        struct ggml_tensor * b) {
-    return ggml_cpy_impl(ctx, a, b, false);
+float ggml_type_sizef(enum ggml_type type) {
+    return ((float)(GGML_TYPE_SIZE[type]))/GGML_BLCK_SIZE[type];
 }
 
-struct ggml_tensor * ggml_cpy_inplace(
-        struct ggml_context * ctx,
-        struct ggml_tensor * a,
-        struct ggml_tensor * b) {
-    return ggml_cpy_impl(ctx, a, b, true);
+bool ggml_is_quantized(enum ggml_type type) {
+    return GGML_BLCK_SIZE[type] > 1;
 }
 
-// ggml_reshape
+const char * ggml_type_name(enum ggml_type type) {
+    return type < GGML_TYPE_COUNT ? GGML_TYPE_NAME[type] : "unknown";
+}
 
-struct ggml_tensor * ggml_reshape(
-        struct ggml_context * ctx,
-        struct ggml_tensor * a,
-        struct ggml_tensor * b) {
-    assert(ggml_is_contiguous(a));
-    assert(ggml_is_contiguous(b));
-    assert(ggml_nelements(a) == ggml_nelements(b));
+const char * ggml_op_name(enum ggml_op op) {
+    return GGML_OP_LABEL[op];
+}
 
-    bool is_node = false;
+size_t ggml_element_size(const struct ggml_tensor * tensor) {
+    return GGML_TYPE_SIZE[tensor->type];
+}
 
-    if (a->grad || b->grad) {
-        assert(false); // TODO: implement backward
-        is_node = true;
-    }
+static inline bool ggml_is_scalar(const struct ggml_tensor * tensor) {
+    static_assert(GGML_MAX_DIMS == 4, "GGML_MAX_DIMS is not 4 - update this function");
 
-    struct ggml_tensor * result = ggml_new_tensor_impl(ctx, a->type, b->n_dims, b->ne, a->data);
+    return tensor->ne[0] == 1 && tensor->ne[1] == 1 && tensor->ne[2] == 1 && tensor->ne[3] == 1;
+}
 
-    result->op   = GGML_OP_RESHAPE;
-    result->grad = is_node ? ggml_dup_tensor(ctx, result) : NULL;
-    result->src0 = a;
-    result->src1 = NULL;
+static inline bool ggml_is_vector(const struct ggml_tensor * tensor) {
+    static_assert(GGML_MAX_DIMS == 4, "GGML_MAX_DIMS is not 4 - update this function");
 
-    return result;
+    return tensor->ne[1] == 1 && tensor->ne[2] == 1 && tensor->ne[3] == 1;
 }
 
-struct ggml_tensor * ggml_reshape_2d(
-        struct ggml_context * ctx,
-        struct ggml_tensor  * a,
-        int                   ne0,
-        int                   ne1) {
-    assert(ggml_is_contiguous(a));
-    assert(ggml_nelements(a) == ne0*ne1);
-
-    bool is_node = false;
-
-    if (a->grad) {
-        assert(false); // TODO: implement backward
-        is_node = true;
-    }
+static inline bool ggml_is_matrix(const struct ggml_tensor * tensor) {
+    static_assert(GGML_MAX_DIMS == 4, "GGML_MAX_DIMS is not 4 - update this function");
 
-    const int ne[2] = { ne0, ne1 };
-    struct ggml_tensor * result = ggml_new_tensor_impl(ctx, a->type, 2, ne, a->data);
+    return tensor->ne[2] == 1 && tensor->ne[3] == 1;
+}
 
-    result->op   = GGML_OP_RESHAPE;
-    result->grad = is_node ? ggml_dup_tensor(ctx, result) : NULL;
-    result->src0 = a;
-    result->src1 = NULL;
+static inline bool ggml_can_mul_mat(const struct ggml_tensor * t0, const struct ggml_tensor * t1) {
+    static_assert(GGML_MAX_DIMS == 4, "GGML_MAX_DIMS is not 4 - update this function");
 
-    return result;
+    return
+        (t0->ne[0]  == t1->ne[0])  &&
+        (t0->ne[2]  == t1->ne[2])  &&
+        (t0->ne[3]  == t1->ne[3]);
 }
 
-struct ggml_tensor * ggml_reshape_3d(
-        struct ggml_context * ctx,
-        struct ggml_tensor  * a,
-        int                   ne0,
-        int                   ne1,
-        int                   ne2) {
-    assert(ggml_is_contiguous(a));
-    assert(ggml_nelements(a) == ne0*ne1*ne2);
+static inline bool ggml_is_contiguous(const struct ggml_tensor * tensor) {
+    static_assert(GGML_MAX_DIMS == 4, "GGML_MAX_DIMS is not 4 - update this function");
 
-    bool is_node = false;
+    return
+        tensor->nb[0] == GGML_TYPE_SIZE[tensor->type] &&
+        tensor->nb[1] == (tensor->nb[0]*tensor->ne[0])/GGML_BLCK_SIZE[tensor->type] &&
+        tensor->nb[2] == tensor->nb[1]*tensor->ne[1] &&
+        tensor->nb[3] == tensor->nb[2]*tensor->ne[2];
+}
 
-    if (a->grad) {
-        assert(false); // TODO: implement backward
-        is_node = true;
-    }
+static inline bool ggml_is_padded_1d(const struct ggml_tensor * tensor) {
+    static_assert(GGML_MAX_DIMS == 4, "GGML_MAX_DIMS is not 4 - update this function");
 
-    const int ne[3] = { ne0, ne1, ne2 };
-    struct ggml_tensor * result = ggml_new_tensor_impl(ctx, a->type, 3, ne, a->data);
+    return
+        tensor->nb[0] == GGML_TYPE_SIZE[tensor->type] &&
+        tensor->nb[2] == tensor->nb[1]*tensor->ne[1] &&
+        tensor->nb[3] == tensor->nb[2]*tensor->ne[2];
+}
 
-    result->op   = GGML_OP_RESHAPE;
-    result->grad = is_node ? ggml_dup_tensor(ctx, result) : NULL;
-    result->src0 = a;
-    result->src1 = NULL;
+static inline bool ggml_are_same_shape(const struct ggml_tensor * t0, const struct ggml_tensor * t1) {
+    static_assert(GGML_MAX_DIMS == 4, "GGML_MAX_DIMS is not 4 - update this function");
 
-    return result;
+    return
+        (t0->ne[0] == t1->ne[0] ) &&
+        (t0->ne[1] == t1->ne[1] ) &&
+        (t0->ne[2] == t1->ne[2] ) &&
+        (t0->ne[3] == t1->ne[3] );
 }
 
-// ggml_view_1d
+// check if t1 can be represented as a repeatition of t0
+static inline bool ggml_can_repeat(const struct ggml_tensor * t0, const struct ggml_tensor * t1) {
+    static_assert(GGML_MAX_DIMS == 4, "GGML_MAX_DIMS is not 4 - update this function");
 
-struct ggml_tensor * ggml_view_1d(
-        struct ggml_context * ctx,
-        struct ggml_tensor  * a,
-        int                   ne0,
-        size_t                offset) {
-    if (a->grad) {
-        assert(false); // gradient propagation is not supported
-    }
+    return
+        (t1->ne[0]%t0->ne[0] == 0) &&
+        (t1->ne[1]%t0->ne[1] == 0) &&
+        (t1->ne[2]%t0->ne[2] == 0) &&
+        (t1->ne[3]%t0->ne[3] == 0);
+}
 
-    struct ggml_tensor * result = ggml_new_tensor_impl(ctx, a->type, 1, &ne0, (char *) a->data + offset);
+static inline int ggml_up32(int n) {
+    return (n + 31) & ~31;
+}
 
-    result->op   = GGML_OP_VIEW;
-    result->grad = NULL;
-    result->src0 = a;
-    result->src1 = NULL; // TODO: maybe store the offset here?
+static inline int ggml_up64(int n) {
+    return (n + 63) & ~63;
+}
 
-    return result;
+static inline int ggml_up(int n, int m) {
+    // assert m is a power of 2
+    GGML_ASSERT((m & (m - 1)) == 0);
+    return (n + m - 1) & ~(m - 1);
 }
 
-// ggml_view_2d
+// assert that pointer is aligned to GGML_MEM_ALIGN
+#define ggml_assert_aligned(ptr) \
+    assert(((uintptr_t) (ptr))%GGML_MEM_ALIGN == 0)
 
-struct ggml_tensor * ggml_view_2d(
-        struct ggml_context * ctx,
-        struct ggml_tensor  * a,
-        int                   ne0,
-        int                   ne1,
-        size_t                nb1,
-        size_t                offset) {
-    if (a->grad) {
-        assert(false); // gradient propagation is not supported
-    }
+////////////////////////////////////////////////////////////////////////////////
 
-    const int ne[GGML_MAX_DIMS] = { ne0, ne1, 1, 1 };
+static void ggml_numa_init(void);
 
-    struct ggml_tensor * result = ggml_new_tensor_impl(ctx, a->type, 2, ne, (char *) a->data + offset);
+struct ggml_context * ggml_init(struct ggml_init_params params) {
+    // make this function thread safe
+    ggml_critical_section_start();
 
-    result->nb[1] = nb1;
-    result->nb[2] = result->nb[1]*ne1;
-    result->nb[3] = result->nb[2];
+    static bool is_first_call = true;
 
-    result->op   = GGML_OP_VIEW;
-    result->grad = NULL;
-    result->src0 = a;
-    result->src1 = NULL; // TODO: maybe store the offset here?
+    if (is_first_call) {
+#if defined(GGML_CPU_DISPATCH)
+        // select the vector kernels for this CPU
+        ggml_vec_fns_init();
+#endif
 
-    return result;
-}
+        // initialize GELU and F32 tables
+        {
+            const uint64_t t_start = ggml_time_us(); UNUSED(t_start);
 
-// ggml_permute
+            ggml_fp16_t ii;
+            for (int i = 0; i < (1 << 16); ++i) {
+                uint16_t ui = i;
+                memcpy(&ii, &ui, sizeof(ii));
+                const float f = table_f32_f16[i] = GGML_COMPUTE_FP16_TO_FP32(ii);
+                table_gelu_f16[i] = GGML_FP32_TO_FP16(ggml_gelu_f32(f));
+            }
 
-struct ggml_tensor * ggml_permute(
-        struct ggml_context * ctx,
-        struct ggml_tensor  * a,
-        int                   axis0,
-        int                   axis1,
-        int                   axis2,
-        int                   axis3) {
-    assert(axis0 >= 0 && axis0 < GGML_MAX_DIMS);
-    assert(axis1 >= 0 && axis1 < GGML_MAX_DIMS);
-    assert(axis2 >= 0 && axis2 < GGML_MAX_DIMS);
-    assert(axis3 >= 0 && axis3 < GGML_MAX_DIMS);
+            const uint64_t t_end = ggml_time_us(); UNUSED(t_end);
 
-    assert(axis0 != axis1);
-    assert(axis0 != axis2);
-    assert(axis0 != axis3);
-    assert(axis1 != axis2);
-    assert(axis1 != axis3);
-    assert(axis2 != axis3);
+            GGML_PRINT_DEBUG("%s: GELU and F32 tables initialized in %f ms\n", __func__, (t_end - t_start)/1000.0f);
+        }
 
-    bool is_node = false;
+        // initialize g_state
+        {
+            const uint64_t t_start = ggml_time_us(); UNUSED(t_start);
 
-    if (a->grad) {
-        assert(false); // TODO: implement backward
-        is_node = true;
-    }
+            g_state = (struct ggml_state) {
+                /*.contexts =*/ { { 0 } },
+            };
 
-    struct ggml_tensor * result = ggml_view_tensor(ctx, a);
+            for (int i = 0; i < GGML_MAX_CONTEXTS; ++i) {
+                g_state.contexts[i].used = false;
+            }
 
-    int ne[GGML_MAX_DIMS];
-    int nb[GGML_MAX_DIMS];
+            const uint64_t t_end = ggml_time_us(); UNUSED(t_end);
 
-    ne[axis0] = a->ne[0];
-    ne[axis1] = a->ne[1];
-    ne[axis2] = a->ne[2];
-    ne[axis3] = a->ne[3];
+            GGML_PRINT_DEBUG("%s: g_state initialized in %f ms\n", __func__, (t_end - t_start)/1000.0f);
+        }
 
-    nb[axis0] = a->nb[0];
-    nb[axis1] = a->nb[1];
-    nb[axis2] = a->nb[2];
-    nb[axis3] = a->nb[3];
+        ggml_numa_init();
 
-    result->ne[0] = ne[0];
-    result->ne[1] = ne[1];
-    result->ne[2] = ne[2];
-    result->ne[3] = ne[3];
+        is_first_call = false;
+    }
 
-    result->nb[0] = nb[0];
-    result->nb[1] = nb[1];
-    result->nb[2] = nb[2];
-    result->nb[3] = nb[3];
+    // find non-used context in g_state
+    struct ggml_context * ctx = NULL;
 
-    result->op   = GGML_OP_PERMUTE;
-    result->grad = is_node ? ggml_dup_tensor(ctx, result) : NULL;
-    result->src0 = a;
-    result->src1 = NULL; // TODO: maybe store the permutation here?
+    for (int i = 0; i < GGML_MAX_CONTEXTS; i++) {
+        if (!g_state.contexts[i].used) {
+            g_state.contexts[i].used = true;
+            ctx = &g_state.contexts[i].context;
 
-    return result;
-}
+            GGML_PRINT_DEBUG("%s: found unused context %d\n", __func__, i);
+            break;
+        }
+    }
 
-// ggml_transpose
+    if (ctx == NULL) {
+        GGML_PRINT_DEBUG("%s: no unused context found\n", __func__);
 
-struct ggml_tensor * ggml_transpose(
-        struct ggml_context * ctx,
-        struct ggml_tensor  * a) {
-    bool is_node = false;
+        ggml_critical_section_end();
 
-    if (a->grad) {
-        assert(false); // TODO: implement backward
-        is_node = true;
+        return NULL;
     }
 
-    struct ggml_tensor * result = ggml_view_tensor(ctx, a);
+    *ctx = (struct ggml_context) {
+        .mem_size         = params.mem_size,
+        .mem_buffer       = params.mem_buffer ? params.mem_buffer : malloc(params.mem_size),
+        .mem_buffer_owned = params.mem_buffer ? false : true,
+        .n_objects        = 0,
+        .objects_begin    = NULL,
+        .objects_end      = NULL,
+        .scratch          = { 0, 0, NULL, },
+        .scratch_save     = { 0, 0, NULL, },
+        .no_alloc         = false,
+        .no_alloc_save    = false,
+    };
 
-    result->ne[0] = a->ne[1];
-    result->ne[1] = a->ne[0];
+    ggml_assert_aligned(ctx->mem_buffer);
 
-    result->nb[0] = a->nb[1];
-    result->nb[1] = a->nb[0];
+    GGML_PRINT_DEBUG("%s: context initialized\n", __func__);
 
-    result->op   = GGML_OP_TRANSPOSE;
-    result->grad = is_node ? ggml_dup_tensor(ctx, result) : NULL;
-    result->src0 = a;
-    result->src1 = NULL;
+    ggml_critical_section_end();
 
-    return result;
+    return ctx;
 }
 
-// ggml_get_rows
+void ggml_free(struct ggml_context * ctx) {
+    // make this function thread safe
+    ggml_critical_section_start();
 
-struct ggml_tensor * ggml_get_rows(
-        struct ggml_context * ctx,
-        struct ggml_tensor  * a,
-        struct ggml_tensor  * b) {
-    assert(ggml_is_matrix(a) && ggml_is_vector(b) && b->type == GGML_TYPE_I32);
-
-    bool is_node = false;
-
-    if (a->grad || b->grad) {
-        assert(false); // TODO: implement backward
-        is_node = true;
-    }
-
-    // TODO: implement non F32 return
-    //struct ggml_tensor * result = ggml_new_tensor_2d(ctx, a->type, a->ne[0], b->ne[0]);
-    struct ggml_tensor * result = ggml_new_tensor_2d(ctx, GGML_TYPE_F32, a->ne[0], b->ne[0]);
+    bool found = false;
 
-    result->op   = GGML_OP_GET_ROWS;
-    result->grad = is_node ? ggml_dup_tensor(ctx, result) : NULL;
-    result->src0 = a;
-    result->src1 = b;
+    for (int i = 0; i < GGML_MAX_CONTEXTS; i++) {
+        if (&g_state.contexts[i].context == ctx) {
+            g_state.contexts[i].used = false;
 
-    return result;
-}
+            GGML_PRINT_DEBUG("%s: context %d with %d objects has been freed. memory used = %zu\n",
+                    __func__, i, ctx->n_objects, ctx->objects_end->offset + ctx->objects_end->size);
 
-// ggml_diag_mask_inf
+            if (ctx->mem_buffer_owned) {
+                free(ctx->mem_buffer);
+            }
 
-struct ggml_tensor * ggml_diag_mask_inf(
-        struct ggml_context * ctx,
-        struct ggml_tensor  * a,
-        int                   n_past) {
-    bool is_node = false;
+            found = true;
+            break;
+        }
+    }
 
-    if (a->grad) {
-        assert(false); // TODO: implement backward
-        is_node = true;
+    if (!found) {
+        GGML_PRINT_DEBUG("%s: context not found\n", __func__);
     }
 
-    // TODO: when implement backward, fix this:
-    //struct ggml_tensor * result = inplace ? ggml_view_tensor(ctx, a) : ggml_dup_tensor(ctx, a);
-    struct ggml_tensor * result = ggml_view_tensor(ctx, a);
+    ggml_critical_section_end();
+}
 
-    struct ggml_tensor * b = ggml_new_tensor_1d(ctx, GGML_TYPE_I32, 1);
-    ((int32_t *) b->data)[0] = n_past;
+size_t ggml_used_mem(const struct ggml_context * ctx) {
+    return ctx->objects_end->offset + ctx->objects_end->size;
+}
 
-    result->op   = GGML_OP_DIAG_MASK_INF;
-    result->grad = is_node ? ggml_dup_tensor(ctx, result) : NULL;
-    result->src0 = a;
-    result->src1 = b;
+size_t ggml_set_scratch(struct ggml_context * ctx, struct ggml_scratch scratch) {
+    const size_t result = ctx->scratch.data ? ctx->scratch.offs : 0;
+
+    ctx->scratch = scratch;
 
     return result;
 }
 
-// ggml_soft_max
-
-struct ggml_tensor * ggml_soft_max(
-        struct ggml_context * ctx,
-        struct ggml_tensor  * a) {
-    bool is_node = false;
+void ggml_set_no_alloc(struct ggml_context * ctx, bool no_alloc) {
+    ctx->no_alloc = no_alloc;
+}
 
-    if (a->grad) {
-        assert(false); // TODO: implement backward
-        is_node = true;
-    }
+size_t ggml_tensor_overhead(void) {
+    return GGML_OBJECT_SIZE + sizeof(struct ggml_tensor);
+}
 
-    // TODO: when implement backward, fix this:
-    //struct ggml_tensor * result = inplace ? ggml_view_tensor(ctx, a) : ggml_dup_tensor(ctx, a);
-    struct ggml_tensor * result = ggml_view_tensor(ctx, a);
+// tensors whose data is written while building the graph (parameters, constants) must not be placed in the
+// scratch buffer or by the planner, because their memory can be reused before the graph is computed
+static void ggml_scratch_save(struct ggml_context * ctx) {
+    ctx->scratch_save = ctx->scratch;
+    ctx->scratch.data = NULL;
 
-    result->op   = GGML_OP_SOFT_MAX;
-    result->grad = is_node ? ggml_dup_tensor(ctx, result) : NULL;
-    result->src0 = a;
-    result->src1 = NULL;
+    ctx->no_alloc_save = ctx->no_alloc;
+    ctx->no_alloc = false;
+}
 
-    return result;
+static void ggml_scratch_load(struct ggml_context * ctx) {
+    ctx->scratch = ctx->scratch_save;
+    ctx->no_alloc = ctx->no_alloc_save;
 }
 
-// ggml_rope
+////////////////////////////////////////////////////////////////////////////////
 
-struct ggml_tensor * ggml_rope(
+struct ggml_tensor * ggml_new_tensor_impl(
         struct ggml_context * ctx,
-        struct ggml_tensor  * a,
-        int                   n_past,
-        int                   n_dims,
-        int                   mode) {
-    assert(n_past >= 0);
-    bool is_node = false;
+        enum   ggml_type type,
+        int    n_dims,
+        const int* ne,
+        struct ggml_tensor * view_src,
+        size_t view_offs) {
+    // always insert objects at the end of the context's memory pool
+    struct ggml_object * obj_cur = ctx->objects_end;
 
-    if (a->grad) {
-        assert(false); // TODO: implement backward
-        is_node = true;
+    const size_t cur_offset = obj_cur == NULL ? 0 : obj_cur->offset;
+    const size_t cur_size   = obj_cur == NULL ? 0 : obj_cur->size;
+    const size_t cur_end    = cur_offset + cur_size;
+
+    // a view of a view points directly to the data of the original tensor
+    if (view_src != NULL && view_src->view_src != NULL) {
+        view_offs += view_src->view_offs;
+        view_src   = view_src->view_src;
     }
 
-    // TODO: when implement backward, fix this:
-    //struct ggml_tensor * result = inplace ? ggml_view_tensor(ctx, a) : ggml_dup_tensor(ctx, a);
-    struct ggml_tensor * result = ggml_view_tensor(ctx, a);
+    // the data of a view of a tensor that has not been placed yet is set by ggml_graph_plan()
+    void * data = view_src != NULL && view_src->data != NULL ? (char *) view_src->data + view_offs : NULL;
 
-    struct ggml_tensor * b = ggml_new_tensor_1d(ctx, GGML_TYPE_I32, 3);
-    ((int32_t *) b->data)[0] = n_past;
-    ((int32_t *) b->data)[1] = n_dims;
-    ((int32_t *) b->data)[2] = mode;
+    size_t size_needed = 0;
 
-    result->op   = GGML_OP_ROPE;
-    result->grad = is_node ? ggml_dup_tensor(ctx, result) : NULL;
-    result->src0 = a;
-    result->src1 = b;
+    if (view_src == NULL && !ctx->no_alloc) {
+        size_needed += GGML_TYPE_SIZE[type];
 
-    return result;
-}
+        GGML_ASSERT(ne[0] % GGML_BLCK_SIZE[type] == 0);
+        size_needed *= ne[0]/GGML_BLCK_SIZE[type];
 
-// ggml_conv_1d_1s
+        for (int i = 1; i < n_dims; i++) {
+            size_needed *= ne[i];
+        }
+        // align to GGML_MEM_ALIGN
+        size_needed = ((size_needed + GGML_MEM_ALIGN - 1)/GGML_MEM_ALIGN)*GGML_MEM_ALIGN;
 
-struct ggml_tensor * ggml_conv_1d_1s(
-        struct ggml_context * ctx,
-        struct ggml_tensor  * a,
-        struct ggml_tensor  * b) {
-    assert(ggml_is_matrix(b));
-    assert(a->ne[1] == b->ne[1]);
-    assert(a->ne[3] == 1);
-    bool is_node = false;
+        // the data goes to the scratch buffer - only the tensor object is allocated in the memory pool
+        if (ctx->scratch.data != NULL) {
+            if (ctx->scratch.offs + size_needed > ctx->scratch.size) {
+                GGML_PRINT("%s: not enough space in the scratch memory\n", __func__);
+                assert(false);
+                return NULL;
+            }
 
-    if (a->grad || b->grad) {
-        assert(false); // TODO: implement backward
-        is_node = true;
-    }
+            data = (char *) ctx->scratch.data + ctx->scratch.offs;
 
-    const int ne[4] = { b->ne[0], a->ne[2], 1, 1, };
-    struct ggml_tensor * result = ggml_new_tensor(ctx, GGML_TYPE_F32, 2, ne);
+            ctx->scratch.offs += size_needed;
 
-    result->op   = GGML_OP_CONV_1D_1S;
-    result->grad = is_node ? ggml_dup_tensor(ctx, result) : NULL;
-    result->src0 = a;
-    result->src1 = b;
+            size_needed = 0;
+        }
+    }
+    size_needed += sizeof(struct ggml_tensor);
 
-    return result;
-}
+    if (cur_end + size_needed + GGML_OBJECT_SIZE > ctx->mem_size) {
+        GGML_PRINT("%s: not enough space in the context's memory pool\n", __func__);
+        assert(false);
+        return NULL;
+    }
 
-// ggml_conv_1d_2s
+    char * const mem_buffer = ctx->mem_buffer;
 
-struct ggml_tensor * ggml_conv_1d_2s(
-        struct ggml_context * ctx,
-        struct ggml_tensor  * a,
-        struct ggml_tensor  * b) {
-    assert(ggml_is_matrix(b));
-    assert(a->ne[1] == b->ne[1]);
-    assert(a->ne[3] == 1);
-    bool is_node = false;
+    struct ggml_object * const obj_new = (struct ggml_object *)(mem_buffer + cur_end);
 
-    if (a->grad || b->grad) {
-        assert(false); // TODO: implement backward
-        is_node = true;
+    *obj_new = (struct ggml_object) {
+        .offset = cur_end + GGML_OBJECT_SIZE,
+        .size   = size_needed,
+        .next   = NULL,
+    };
+
+    if (obj_cur != NULL) {
+        obj_cur->next = obj_new;
+    } else {
+        // this is the first object in this context
+        ctx->objects_begin = obj_new;
     }
 
-    const int ne[4] = { b->ne[0]/2, a->ne[2], 1, 1, };
-    struct ggml_tensor * result = ggml_new_tensor(ctx, GGML_TYPE_F32, 2, ne);
+    ctx->objects_end = obj_new;
 
-    result->op   = GGML_OP_CONV_1D_2S;
-    result->grad = is_node ? ggml_dup_tensor(ctx, result) : NULL;
-    result->src0 = a;
-    result->src1 = b;
+    //GGML_PRINT_DEBUG("%s: inserted new object at %zu\n", __func__, cur_end);
 
-    return result;
-}
+    struct ggml_tensor * const result = (struct ggml_tensor *)(mem_buffer + obj_new->offset);
 
-// ggml_flash_attn
+    ggml_assert_aligned(result);
 
-struct ggml_tensor * ggml_flash_attn(
-        struct ggml_context * ctx,
-        struct ggml_tensor  * q,
-        struct ggml_tensor  * k,
-        struct ggml_tensor  * v,
-        bool                  masked) {
-    assert(ggml_can_mul_mat(k, q));
-    // TODO: check if vT can be multiplied by (k*qT)
+    *result = (struct ggml_tensor) {
+        /*.type         =*/ type,
+        /*.n_dims       =*/ n_dims,
+        /*.ne           =*/ { 1, 1, 1, 1 },
+        /*.nb           =*/ { 0, 0, 0, 0 },
+        /*.op           =*/ GGML_OP_NONE,
+        /*.is_param     =*/ false,
+        /*.grad         =*/ NULL,
+        /*.src0         =*/ NULL,
+        /*.src1         =*/ NULL,
+        /*.opt          =*/ { NULL },
+        /*.n_tasks      =*/ 0,
+        /*.n_chunks     =*/ 0,
+        /*.kernel       =*/ 0,
+        /*.perf_runs    =*/ 0,
+        /*.perf_cycles  =*/ 0,
+        /*.perf_time_us =*/ 0,
+        /*.view_src     =*/ view_src,
+        /*.view_offs    =*/ view_offs,
+        /*.data         =*/ data == NULL && view_src == NULL && !ctx->no_alloc ? (void *)(result + 1) : data,
+    };
 
-    bool is_node = false;
+    ggml_assert_aligned(result->data);
 
-    if (q->grad || k->grad || v->grad) {
-        GGML_ASSERT(false); // TODO: implement backward
-        is_node = true;
+    for (int i = 0; i < n_dims; i++) {
+        result->ne[i] = ne[i];
     }
 
-    //struct ggml_tensor * result = ggml_dup_tensor(ctx, q);
-    struct ggml_tensor * result = ggml_new_tensor(ctx, GGML_TYPE_F32, 4, q->ne);
+    result->nb[0] = GGML_TYPE_SIZE[type];
+    result->nb[1] = result->nb[0]*(result->ne[0]/GGML_BLCK_SIZE[type]);
+    for (int i = 2; i < GGML_MAX_DIMS; i++) {
+        result->nb[i] = result->nb[i - 1]*result->ne[i - 1];
+    }
 
-    result->op   = GGML_OP_FLASH_ATTN;
-    result->grad = is_node ? ggml_dup_tensor(ctx, result) : NULL;
-    result->src0 = q;
-    result->src1 = k;
-    result->opt[0] = v;
-    result->opt[1] = ggml_new_i32(ctx, masked ? 1 : 0);
+    ctx->n_objects++;
 
     return result;
 }
 
-// ggml_flash_ff
-
-struct ggml_tensor * ggml_flash_ff(
+struct ggml_tensor * ggml_new_tensor(
         struct ggml_context * ctx,
-        struct ggml_tensor  * a,
-        struct ggml_tensor  * b0,
-        struct ggml_tensor  * b1,
-        struct ggml_tensor  * c0,
-        struct ggml_tensor  * c1) {
-    assert(ggml_can_mul_mat(b0, a));
-    // TODO: more checks
+        enum   ggml_type type,
+        int    n_dims,
+        const int* ne) {
+    return ggml_new_tensor_impl(ctx, type, n_dims, ne, NULL, 0);
+}
 
-    bool is_node = false;
+struct ggml_tensor * ggml_new_tensor_1d(
+        struct ggml_context * ctx,
+        enum   ggml_type type,
+        int    ne0) {
+    return ggml_new_tensor(ctx, type, 1, &ne0);
+}
 
-    if (a->grad || b0->grad || b1->grad || c0->grad || c1->grad) {
-        GGML_ASSERT(false); // TODO: implement backward
-        is_node = true;
-    }
-
-    //struct ggml_tensor * result = ggml_dup_tensor(ctx, a);
-    struct ggml_tensor * result = ggml_new_tensor(ctx, GGML_TYPE_F32, 4, a->ne);
-
-    result->op   = GGML_OP_FLASH_FF;
-    result->grad = is_node ? ggml_dup_tensor(ctx, result) : NULL;
-    result->src0 = a;
-    result->src1 = b0;
-    result->opt[0] = b1;
-    result->opt[1] = c0;
-    result->opt[2] = c1;
-
-    return result;
+struct ggml_tensor * ggml_new_tensor_2d(
+        struct ggml_context * ctx,
+        enum   ggml_type type,
+        int    ne0,
+        int    ne1) {
+    const int ne[2] = { ne0, ne1 };
+    return ggml_new_tensor(ctx, type, 2, ne);
 }
 
-////////////////////////////////////////////////////////////////////////////////
-
-void ggml_set_param(
+struct ggml_tensor * ggml_new_tensor_3d(
         struct ggml_context * ctx,
-        struct ggml_tensor * tensor) {
-    tensor->is_param = true;
-
-    assert(tensor->grad == NULL);
-    tensor->grad = ggml_dup_tensor(ctx, tensor);
+        enum   ggml_type type,
+        int    ne0,
+        int    ne1,
+        int    ne2) {
+    const int ne[3] = { ne0, ne1, ne2 };
+    return ggml_new_tensor(ctx, type, 3, ne);
 }
 
-// ggml_compute_forward_dup
-
-static void ggml_compute_forward_dup_f16(
-        const struct ggml_compute_params * params,
-        const struct ggml_tensor * src0,
-        struct ggml_tensor * dst) {
-    assert(params->ith == 0);
-    assert(ggml_is_contiguous(dst));
-    assert(ggml_nelements(dst) == ggml_nelements(src0));
-
-    if (params->type == GGML_TASK_INIT || params->type == GGML_TASK_FINALIZE) {
-        return;
-    }
-
-    const int ne00 = src0->ne[0];
-    const int ne01 = src0->ne[1];
-    const int ne02 = src0->ne[2];
-    const int ne03 = src0->ne[3];
-
-    const size_t nb00 = src0->nb[0];
-    const size_t nb01 = src0->nb[1];
-    const size_t nb02 = src0->nb[2];
-    const size_t nb03 = src0->nb[3];
-
-    if (ggml_is_contiguous(src0) && src0->type == dst->type) {
-        memcpy(dst->data, src0->data, ggml_nelements(dst) * GGML_TYPE_SIZE[src0->type]);
-        return;
-    }
-
-    if (src0->nb[0] == sizeof(ggml_fp16_t)) {
-        if (dst->type == GGML_TYPE_F16) {
-            int id = 0;
-            const size_t rs = ne00*nb00;
-
-            for (int i03 = 0; i03 < ne03; i03++) {
-                for (int i02 = 0; i02 < ne02; i02++) {
-                    for (int i01 = 0; i01 < ne01; i01++) {
-                        const char * src0_ptr = (char *) src0->data + i01*nb01 + i02*nb02 + i03*nb03;
-                        char * dst_ptr = (char *) dst->data + id*rs;
-
-                        memcpy(dst_ptr, src0_ptr, rs);
-
-                        id++;
-                    }
-                }
-            }
-        } else if (dst->type == GGML_TYPE_F32) {
-            int id = 0;
-            float * dst_ptr = (float *) dst->data;
-
-            for (int i03 = 0; i03 < ne03; i03++) {
-                for (int i02 = 0; i02 < ne02; i02++) {
-                    for (int i01 = 0; i01 < ne01; i01++) {
-                        for (int i00 = 0; i00 < ne00; i00++) {
-                            const ggml_fp16_t * src0_ptr = (ggml_fp16_t *) ((char *) src0->data + i00*nb00 + i01*nb01 + i02*nb02 + i03*nb03);
-
-                            dst_ptr[id] = GGML_FP16_TO_FP32(*src0_ptr);
-                            id++;
-                        }
-                    }
-                }
-            }
-        } else {
-            GGML_ASSERT(false); // TODO: implement
-        }
-    } else {
-        //printf("%s: this is not optimal - fix me\n", __func__);
+struct ggml_tensor * ggml_new_tensor_4d(
+        struct ggml_context * ctx,
+        enum   ggml_type type,
+        int    ne0,
+        int    ne1,
+        int    ne2,
+        int    ne3) {
+    const int ne[4] = { ne0, ne1, ne2, ne3 };
+    return ggml_new_tensor(ctx, type, 4, ne);
+}
 
-        if (dst->type == GGML_TYPE_F32) {
-            int id = 0;
-            float * dst_ptr = (float *) dst->data;
+struct ggml_tensor * ggml_new_i32(struct ggml_context * ctx, int32_t value) {
+    ggml_scratch_save(ctx);
 
-            for (int i03 = 0; i03 < ne03; i03++) {
-                for (int i02 = 0; i02 < ne02; i02++) {
-                    for (int i01 = 0; i01 < ne01; i01++) {
-                        for (int i00 = 0; i00 < ne00; i00++) {
-                            const ggml_fp16_t * src0_ptr = (ggml_fp16_t *) ((char *) src0->data + i00*nb00 + i01*nb01 + i02*nb02 + i03*nb03);
+    struct ggml_tensor * result = ggml_new_tensor_1d(ctx, GGML_TYPE_I32, 1);
 
-                            dst_ptr[id] = GGML_FP16_TO_FP32(*src0_ptr);
-                            id++;
-                        }
-                    }
-                }
-            }
-        } else if (dst->type == GGML_TYPE_F16) {
-            int id = 0;
-            ggml_fp16_t * dst_ptr = (ggml_fp16_t *) dst->data;
+    ggml_scratch_load(ctx);
 
-            for (int i03 = 0; i03 < ne03; i03++) {
-                for (int i02 = 0; i02 < ne02; i02++) {
-                    for (int i01 = 0; i01 < ne01; i01++) {
-                        for (int i00 = 0; i00 < ne00; i00++) {
-                            const ggml_fp16_t * src0_ptr = (ggml_fp16_t *) ((char *) src0->data + i00*nb00 + i01*nb01 + i02*nb02 + i03*nb03);
+    ggml_set_i32(result, value);
 
-                            dst_ptr[id] = *src0_ptr;
-                            id++;
-                        }
-                    }
-                }
-            }
-        } else {
-            GGML_ASSERT(false); // TODO: implement
-        }
-    }
+    return result;
 }
 
-static void ggml_compute_forward_dup_f32(
-        const struct ggml_compute_params * params,
-        const struct ggml_tensor * src0,
-        struct ggml_tensor * dst) {
-    GGML_ASSERT(params->ith == 0);
-    GGML_ASSERT(ggml_is_contiguous(dst));
-    GGML_ASSERT(ggml_nelements(dst) == ggml_nelements(src0));
-
-    if (params->type == GGML_TASK_INIT || params->type == GGML_TASK_FINALIZE) {
-        return;
-    }
+struct ggml_tensor * ggml_new_f32(struct ggml_context * ctx, float value) {
+    ggml_scratch_save(ctx);
 
-    const int ne00 = src0->ne[0];
-    const int ne01 = src0->ne[1];
-    const int ne02 = src0->ne[2];
-    const int ne03 = src0->ne[3];
+    struct ggml_tensor * result = ggml_new_tensor_1d(ctx, GGML_TYPE_F32, 1);
 
-    const size_t nb00 = src0->nb[0];
-    const size_t nb01 = src0->nb[1];
-    const size_t nb02 = src0->nb[2];
-    const size_t nb03 = src0->nb[3];
+    ggml_scratch_load(ctx);
 
-    if (ggml_is_contiguous(src0) && src0->type == dst->type) {
-        memcpy(dst->data, src0->data, ggml_nelements(dst) * GGML_TYPE_SIZE[src0->type]);
-        return;
-    }
+    ggml_set_f32(result, value);
 
-    if (src0->nb[0] == sizeof(float)) {
-        if (dst->type == GGML_TYPE_F32) {
-            int id = 0;
-            const size_t rs = ne00*nb00;
+    return result;
+}
 
-            for (int i03 = 0; i03 < ne03; i03++) {
-                for (int i02 = 0; i02 < ne02; i02++) {
-                    for (int i01 = 0; i01 < ne01; i01++) {
-                        const char * src0_ptr = (char *) src0->data + i01*nb01 + i02*nb02 + i03*nb03;
-                        char * dst_ptr = (char *) dst->data + id*rs;
+struct ggml_tensor * ggml_dup_tensor(struct ggml_context * ctx, const struct ggml_tensor * src) {
+    return ggml_new_tensor_impl(ctx, src->type, src->n_dims, src->ne, NULL, 0);
+}
 
-                        memcpy(dst_ptr, src0_ptr, rs);
+struct ggml_tensor * ggml_set_zero(struct ggml_tensor * tensor) {
+    memset(tensor->data, 0, ggml_nbytes(tensor));
+    return tensor;
+}
 
-                        id++;
-                    }
-                }
-            }
-        } else if (dst->type == GGML_TYPE_F16) {
-            int id = 0;
-            ggml_fp16_t * dst_ptr = (ggml_fp16_t *) dst->data;
+struct ggml_tensor * ggml_set_i32 (struct ggml_tensor * tensor, int32_t value) {
+    const int n     = ggml_nrows(tensor);
+    const int nc    = tensor->ne[0];
+    const size_t n1 = tensor->nb[1];
 
-            for (int i03 = 0; i03 < ne03; i03++) {
-                for (int i02 = 0; i02 < ne02; i02++) {
-                    for (int i01 = 0; i01 < ne01; i01++) {
-                        for (int i00 = 0; i00 < ne00; i00++) {
-                            const float * src0_ptr = (float *) ((char *) src0->data + i00*nb00 + i01*nb01 + i02*nb02 + i03*nb03);
+    char * const data = tensor->data;
 
-                            dst_ptr[id] = GGML_FP32_TO_FP16(*src0_ptr);
-                            id++;
-                        }
-                    }
+    switch (tensor->type) {
+        case GGML_TYPE_I8:
+            {
+                assert(tensor->nb[0] == sizeof(int8_t));
+                for (int i = 0; i < n; i++) {
+                    ggml_vec_set_i8(nc, (int8_t *)(data + i*n1), value);
                 }
-            }
-        } else {
-            GGML_ASSERT(false); // TODO: implement
-        }
-    } else {
-        //printf("%s: this is not optimal - fix me\n", __func__);
-
-        if (dst->type == GGML_TYPE_F32) {
-            int id = 0;
-            float * dst_ptr = (float *) dst->data;
-
-            for (int i03 = 0; i03 < ne03; i03++) {
-                for (int i02 = 0; i02 < ne02; i02++) {
-                    for (int i01 = 0; i01 < ne01; i01++) {
-                        for (int i00 = 0; i00 < ne00; i00++) {
-                            const float * src0_ptr = (float *) ((char *) src0->data + i00*nb00 + i01*nb01 + i02*nb02 + i03*nb03);
-
-                            dst_ptr[id] = *src0_ptr;
-                            id++;
-                        }
-                    }
+            } break;
+        case GGML_TYPE_I16:
+            {
+                assert(tensor->nb[0] == sizeof(int16_t));
+                for (int i = 0; i < n; i++) {
+                    ggml_vec_set_i16(nc, (int16_t *)(data + i*n1), value);
                 }
-            }
-        } else if (dst->type == GGML_TYPE_F16) {
-            int id = 0;
-            ggml_fp16_t * dst_ptr = (ggml_fp16_t *) dst->data;
-
-            for (int i03 = 0; i03 < ne03; i03++) {
-                for (int i02 = 0; i02 < ne02; i02++) {
-                    for (int i01 = 0; i01 < ne01; i01++) {
-                        for (int i00 = 0; i00 < ne00; i00++) {
-                            const float * src0_ptr = (float *) ((char *) src0->data + i00*nb00 + i01*nb01 + i02*nb02 + i03*nb03);
-
-                            dst_ptr[id] = GGML_FP32_TO_FP16(*src0_ptr);
-                            id++;
-                        }
-                    }
+            } break;
+        case GGML_TYPE_I32:
+            {
+                assert(tensor->nb[0] == sizeof(int32_t));
+                for (int i = 0; i < n; i++) {
+                    ggml_vec_set_i32(nc, (int32_t *)(data + i*n1), value);
                 }
-            }
-        } else {
-            GGML_ASSERT(false); // TODO: implement
-        }
-    }
-}
-
-static void ggml_compute_forward_dup(
-        const struct ggml_compute_params * params,
-        const struct ggml_tensor * src0,
-        struct ggml_tensor * dst) {
-    switch (src0->type) {
+            } break;
         case GGML_TYPE_F16:
             {
-                ggml_compute_forward_dup_f16(params, src0, dst);
+                assert(tensor->nb[0] == sizeof(ggml_fp16_t));
+                for (int i = 0; i < n; i++) {
+                    ggml_vec_set_f16(nc, (ggml_fp16_t *)(data + i*n1), value);
+                }
             } break;
         case GGML_TYPE_F32:
             {
-                ggml_compute_forward_dup_f32(params, src0, dst);
+                assert(tensor->nb[0] == sizeof(float));
+                for (int i = 0; i < n; i++) {
+                    ggml_vec_set_f32(nc, (float *)(data + i*n1), value);
+                }
             } break;
-        case GGML_TYPE_I8:
-        case GGML_TYPE_I16:
-        case GGML_TYPE_I32:
+        case GGML_TYPE_Q4_0:
+        case GGML_TYPE_Q8_0:
         case GGML_TYPE_COUNT:
             {
-                GGML_ASSERT(false);
+                assert(false);
             } break;
     }
+
+    return tensor;
 }
 
-// ggml_compute_forward_add
+struct ggml_tensor * ggml_set_f32(struct ggml_tensor * tensor, float value) {
+    const int n     = ggml_nrows(tensor);
+    const int nc    = tensor->ne[0];
+    const size_t n1 = tensor->nb[1];
 
-static void ggml_compute_forward_add_f32(
-        const struct ggml_compute_params * params,
-        const struct ggml_tensor * src0,
-        const struct ggml_tensor * src1,
-        struct ggml_tensor * dst) {
-    GGML_ASSERT(ggml_are_same_shape(src0, src1) && ggml_are_same_shape(src0, dst));
+    char * const data = tensor->data;
 
-    if (params->type == GGML_TASK_INIT || params->type == GGML_TASK_FINALIZE) {
-        return;
-    }
-
-    const int ith = params->ith;
-    const int nth = params->nth;
-
-    const int n  = ggml_nrows(src0);
-    const int nc = src0->ne[0];
-
-    const size_t nb00 = src0->nb[0];
-    const size_t nb01 = src0->nb[1];
-
-    const size_t nb10 = src1->nb[0];
-    const size_t nb11 = src1->nb[1];
-
-    const size_t nb0 = dst->nb[0];
-    const size_t nb1 = dst->nb[1];
-
-    GGML_ASSERT( nb0 == sizeof(float));
-    GGML_ASSERT(nb00 == sizeof(float));
-
-    if (nb10 == sizeof(float)) {
-        const int j0 = (n/nth)*ith;
-        const int j1 = ith == nth - 1 ? n : (n/nth)*(ith + 1);
-
-        for (int j = j0; j < j1; j++) {
-            ggml_vec_add_f32(nc,
-                    (float *) ((char *) dst->data  + j*nb1),
-                    (float *) ((char *) src0->data + j*nb01),
-                    (float *) ((char *) src1->data + j*nb11));
-        }
-    } else {
-        // src1 is not contiguous
-        for (int j = ith; j < n; j += nth) {
-            float * dst_ptr  = (float *) ((char *) dst->data  + j*nb1);
-            float * src0_ptr = (float *) ((char *) src0->data + j*nb01);
-            for (int i = 0; i < nc; i++) {
-                float * src1_ptr = (float *) ((char *) src1->data + j*nb11 + i*nb10);
-
-                dst_ptr[i] = src0_ptr[i] + *src1_ptr;
-            }
-        }
-    }
-}
-
-static void ggml_compute_forward_add(
-        const struct ggml_compute_params * params,
-        const struct ggml_tensor * src0,
-        const struct ggml_tensor * src1,
-        struct ggml_tensor * dst) {
-    switch (src0->type) {
-        case GGML_TYPE_F32:
+    switch (tensor->type) {
+        case GGML_TYPE_I8:
             {
-                ggml_compute_forward_add_f32(params, src0, src1, dst);
+                assert(tensor->nb[0] == sizeof(int8_t));
+                for (int i = 0; i < n; i++) {
+                    ggml_vec_set_i8(nc, (int8_t *)(data + i*n1), value);
+                }
             } break;
-        case GGML_TYPE_I8:
         case GGML_TYPE_I16:
+            {
+                assert(tensor->nb[0] == sizeof(int16_t));
+                for (int i = 0; i < n; i++) {
+                    ggml_vec_set_i16(nc, (int16_t *)(data + i*n1), value);
+                }
+            } break;
         case GGML_TYPE_I32:
+            {
+                assert(tensor->nb[0] == sizeof(int32_t));
+                for (int i = 0; i < n; i++) {
+                    ggml_vec_set_i32(nc, (int32_t *)(data + i*n1), value);
+                }
+            } break;
         case GGML_TYPE_F16:
-        case GGML_TYPE_COUNT:
             {
-                assert(false);
+                assert(tensor->nb[0] == sizeof(ggml_fp16_t));
+                for (int i = 0; i < n; i++) {
+                    ggml_vec_set_f16(nc, (ggml_fp16_t *)(data + i*n1), value);
+                }
             } break;
-    }
-}
-
-// ggml_compute_forward_sub
-
-static void ggml_compute_forward_sub_f32(
-        const struct ggml_compute_params * params,
-        const struct ggml_tensor * src0,
-        const struct ggml_tensor * src1,
-        struct ggml_tensor * dst) {
-    assert(params->ith == 0);
-    assert(ggml_are_same_shape(src0, src1) && ggml_are_same_shape(src0, dst));
-
-    if (params->type == GGML_TASK_INIT || params->type == GGML_TASK_FINALIZE) {
-        return;
-    }
-
-    const int n  = ggml_nrows(src0);
-    const int nc = src0->ne[0];
-
-    assert( dst->nb[0] == sizeof(float));
-    assert(src0->nb[0] == sizeof(float));
-    assert(src1->nb[0] == sizeof(float));
-
-    for (int i = 0; i < n; i++) {
-        ggml_vec_sub_f32(nc,
-                (float *) ((char *) dst->data  + i*( dst->nb[1])),
-                (float *) ((char *) src0->data + i*(src0->nb[1])),
-                (float *) ((char *) src1->data + i*(src1->nb[1])));
-    }
-}
-
-static void ggml_compute_forward_sub(
-        const struct ggml_compute_params * params,
-        const struct ggml_tensor * src0,
-        const struct ggml_tensor * src1,
-        struct ggml_tensor * dst) {
-    switch (src0->type) {
         case GGML_TYPE_F32:
             {
-                ggml_compute_forward_sub_f32(params, src0, src1, dst);
+                assert(tensor->nb[0] == sizeof(float));
+                for (int i = 0; i < n; i++) {
+                    ggml_vec_set_f32(nc, (float *)(data + i*n1), value);
+                }
             } break;
-        case GGML_TYPE_I8:
-        case GGML_TYPE_I16:
-        case GGML_TYPE_I32:
-        case GGML_TYPE_F16:
+        case GGML_TYPE_Q4_0:
+        case GGML_TYPE_Q8_0:
         case GGML_TYPE_COUNT:
             {
                 assert(false);
             } break;
     }
-}
-
-// ggml_compute_forward_mul
-
-static void ggml_compute_forward_mul_f32(
-        const struct ggml_compute_params * params,
-        const struct ggml_tensor * src0,
-        const struct ggml_tensor * src1,
-        struct ggml_tensor * dst) {
-    assert(params->ith == 0);
-    assert(ggml_are_same_shape(src0, src1) && ggml_are_same_shape(src0, dst));
-
-    if (params->type == GGML_TASK_INIT || params->type == GGML_TASK_FINALIZE) {
-        return;
-    }
-
-    const int n  = ggml_nrows(src0);
-    const int nc = src0->ne[0];
-
-    assert( dst->nb[0] == sizeof(float));
-    assert(src0->nb[0] == sizeof(float));
-    assert(src1->nb[0] == sizeof(float));
 
-    for (int i = 0; i < n; i++) {
-        ggml_vec_mul_f32(nc,
-                (float *) ((char *) dst->data  + i*( dst->nb[1])),
-                (float *) ((char *) src0->data + i*(src0->nb[1])),
-                (float *) ((char *) src1->data + i*(src1->nb[1])));
-    }
+    return tensor;
 }
 
-static void ggml_compute_forward_mul(
-        const struct ggml_compute_params * params,
-        const struct ggml_tensor * src0,
-        const struct ggml_tensor * src1,
-        struct ggml_tensor * dst) {
-    switch (src0->type) {
-        case GGML_TYPE_F32:
+int32_t ggml_get_i32_1d(const struct ggml_tensor * tensor, int i) {
+    switch (tensor->type) {
+        case GGML_TYPE_I8:
             {
-                ggml_compute_forward_mul_f32(params, src0, src1, dst);
+                GGML_ASSERT(tensor->nb[0] == sizeof(int8_t));
+                return ((int8_t *)(tensor->data))[i];
             } break;
-        case GGML_TYPE_I8:
         case GGML_TYPE_I16:
+            {
+                GGML_ASSERT(tensor->nb[0] == sizeof(int16_t));
+                return ((int16_t *)(tensor->data))[i];
+            } break;
         case GGML_TYPE_I32:
+            {
+                GGML_ASSERT(tensor->nb[0] == sizeof(int32_t));
+                return ((int32_t *)(tensor->data))[i];
+            } break;
         case GGML_TYPE_F16:
+            {
+                GGML_ASSERT(tensor->nb[0] == sizeof(ggml_fp16_t));
+                return GGML_FP16_TO_FP32(((ggml_fp16_t *)(tensor->data))[i]);
+            } break;
+        case GGML_TYPE_F32:
+            {
+                GGML_ASSERT(tensor->nb[0] == sizeof(float));
+                return ((float *)(tensor->data))[i];
+            } break;
+        case GGML_TYPE_Q4_0:
+        case GGML_TYPE_Q8_0:
         case GGML_TYPE_COUNT:
             {
-                assert(false);
+                GGML_ASSERT(false);
             } break;
     }
-}
-
-// ggml_compute_forward_div
-
-static void ggml_compute_forward_div_f32(
-        const struct ggml_compute_params * params,
-        const struct ggml_tensor * src0,
-        const struct ggml_tensor * src1,
-        struct ggml_tensor * dst) {
-    assert(params->ith == 0);
-    assert(ggml_are_same_shape(src0, src1) && ggml_are_same_shape(src0, dst));
-
-    if (params->type == GGML_TASK_INIT || params->type == GGML_TASK_FINALIZE) {
-        return;
-    }
-
-    const int n  = ggml_nrows(src0);
-    const int nc = src0->ne[0];
-
-    assert( dst->nb[0] == sizeof(float));
-    assert(src0->nb[0] == sizeof(float));
-    assert(src1->nb[0] == sizeof(float));
 
-    for (int i = 0; i < n; i++) {
-        ggml_vec_div_f32(nc,
-                (float *) ((char *) dst->data  + i*( dst->nb[1])),
-                (float *) ((char *) src0->data + i*(src0->nb[1])),
-                (float *) ((char *) src1->data + i*(src1->nb[1])));
-    }
+    return 0.0f;
 }
 
-static void ggml_compute_forward_div(
-        const struct ggml_compute_params * params,
-        const struct ggml_tensor * src0,
-        const struct ggml_tensor * src1,
-        struct ggml_tensor * dst) {
-    switch (src0->type) {
-        case GGML_TYPE_F32:
+void ggml_set_i32_1d(const struct ggml_tensor * tensor, int i, int32_t value) {
+    switch (tensor->type) {
+        case GGML_TYPE_I8:
             {
-                ggml_compute_forward_div_f32(params, src0, src1, dst);
+                GGML_ASSERT(tensor->nb[0] == sizeof(int8_t));
+                ((int8_t *)(tensor->data))[i] = value;
             } break;
-        case GGML_TYPE_I8:
         case GGML_TYPE_I16:
+            {
+                GGML_ASSERT(tensor->nb[0] == sizeof(int16_t));
+                ((int16_t *)(tensor->data))[i] = value;
+            } break;
         case GGML_TYPE_I32:
+            {
+                GGML_ASSERT(tensor->nb[0] == sizeof(int32_t));
+                ((int32_t *)(tensor->data))[i] = value;
+            } break;
         case GGML_TYPE_F16:
+            {
+                GGML_ASSERT(tensor->nb[0] == sizeof(ggml_fp16_t));
+                ((ggml_fp16_t *)(tensor->data))[i] = GGML_FP32_TO_FP16(value);
+            } break;
+        case GGML_TYPE_F32:
+            {
+                GGML_ASSERT(tensor->nb[0] == sizeof(float));
+                ((float *)(tensor->data))[i] = value;
+            } break;
+        case GGML_TYPE_Q4_0:
+        case GGML_TYPE_Q8_0:
         case GGML_TYPE_COUNT:
             {
-                assert(false);
+                GGML_ASSERT(false);
             } break;
     }
 }
 
-// ggml_compute_forward_sqr
-
-static void ggml_compute_forward_sqr_f32(
-        const struct ggml_compute_params * params,
-        const struct ggml_tensor * src0,
-        struct ggml_tensor * dst) {
-    assert(params->ith == 0);
-    assert(ggml_are_same_shape(src0, dst));
-
-    if (params->type == GGML_TASK_INIT || params->type == GGML_TASK_FINALIZE) {
-        return;
-    }
-
-    const int n     = ggml_nrows(src0);
-    const int nc    = src0->ne[0];
-
-    assert( dst->nb[0] == sizeof(float));
-    assert(src0->nb[0] == sizeof(float));
-
-    for (int i = 0; i < n; i++) {
-        ggml_vec_sqr_f32(nc,
-                (float *) ((char *) dst->data  + i*( dst->nb[1])),
-                (float *) ((char *) src0->data + i*(src0->nb[1])));
-    }
-}
-
-static void ggml_compute_forward_sqr(
-        const struct ggml_compute_params * params,
-        const struct ggml_tensor * src0,
-        struct ggml_tensor * dst) {
-    switch (src0->type) {
-        case GGML_TYPE_F32:
+float ggml_get_f32_1d(const struct ggml_tensor * tensor, int i) {
+    switch (tensor->type) {
+        case GGML_TYPE_I8:
             {
-                ggml_compute_forward_sqr_f32(params, src0, dst);
+                GGML_ASSERT(tensor->nb[0] == sizeof(int8_t));
+                return ((int8_t *)(tensor->data))[i];
             } break;
-        case GGML_TYPE_I8:
         case GGML_TYPE_I16:
+            {
+                GGML_ASSERT(tensor->nb[0] == sizeof(int16_t));
+                return ((int16_t *)(tensor->data))[i];
+            } break;
         case GGML_TYPE_I32:
+            {
+                GGML_ASSERT(tensor->nb[0] == sizeof(int32_t));
+                return ((int32_t *)(tensor->data))[i];
+            } break;
         case GGML_TYPE_F16:
+            {
+                GGML_ASSERT(tensor->nb[0] == sizeof(ggml_fp16_t));
+                return GGML_FP16_TO_FP32(((ggml_fp16_t *)(tensor->data))[i]);
+            } break;
+        case GGML_TYPE_F32:
+            {
+                GGML_ASSERT(tensor->nb[0] == sizeof(float));
+                return ((float *)(tensor->data))[i];
+            } break;
+        case GGML_TYPE_Q4_0:
+        case GGML_TYPE_Q8_0:
         case GGML_TYPE_COUNT:
             {
-                assert(false);
+                GGML_ASSERT(false);
             } break;
     }
-}
-
-// ggml_compute_forward_sqrt
-
-static void ggml_compute_forward_sqrt_f32(
-        const struct ggml_compute_params * params,
-        const struct ggml_tensor * src0,
-        struct ggml_tensor * dst) {
-    assert(params->ith == 0);
-    assert(ggml_are_same_shape(src0, dst));
-
-    if (params->type == GGML_TASK_INIT || params->type == GGML_TASK_FINALIZE) {
-        return;
-    }
 
-    const int n  = ggml_nrows(src0);
-    const int nc = src0->ne[0];
-
-    assert( dst->nb[0] == sizeof(float));
-    assert(src0->nb[0] == sizeof(float));
-
-    for (int i = 0; i < n; i++) {
-        ggml_vec_sqrt_f32(nc,
-                (float *) ((char *) dst->data  + i*( dst->nb[1])),
-                (float *) ((char *) src0->data + i*(src0->nb[1])));
-    }
+    return 0.0f;
 }
 
-static void ggml_compute_forward_sqrt(
-        const struct ggml_compute_params * params,
-        const struct ggml_tensor * src0,
-        struct ggml_tensor * dst) {
-    switch (src0->type) {
-        case GGML_TYPE_F32:
+void ggml_set_f32_1d(const struct ggml_tensor * tensor, int i, float value) {
+    switch (tensor->type) {
+        case GGML_TYPE_I8:
             {
-                ggml_compute_forward_sqrt_f32(params, src0, dst);
+                GGML_ASSERT(tensor->nb[0] == sizeof(int8_t));
+                ((int8_t *)(tensor->data))[i] = value;
             } break;
-        case GGML_TYPE_I8:
         case GGML_TYPE_I16:
+            {
+                GGML_ASSERT(tensor->nb[0] == sizeof(int16_t));
+                ((int16_t *)(tensor->data))[i] = value;
+            } break;
         case GGML_TYPE_I32:
+            {
+                GGML_ASSERT(tensor->nb[0] == sizeof(int32_t));
+                ((int32_t *)(tensor->data))[i] = value;
+            } break;
         case GGML_TYPE_F16:
+            {
+                GGML_ASSERT(tensor->nb[0] == sizeof(ggml_fp16_t));
+                ((ggml_fp16_t *)(tensor->data))[i] = GGML_FP32_TO_FP16(value);
+            } break;
+        case GGML_TYPE_F32:
+            {
+                GGML_ASSERT(tensor->nb[0] == sizeof(float));
+                ((float *)(tensor->data))[i] = value;
+            } break;
+        case GGML_TYPE_Q4_0:
+        case GGML_TYPE_Q8_0:
         case GGML_TYPE_COUNT:
             {
-                assert(false);
+                GGML_ASSERT(false);
             } break;
     }
 }
 
-// ggml_compute_forward_sum
+void * ggml_get_data(const struct ggml_tensor * tensor) {
+    return tensor->data;
+}
 
-static void ggml_compute_forward_sum_f32(
-        const struct ggml_compute_params * params,
-        const struct ggml_tensor * src0,
-        struct ggml_tensor * dst) {
-    assert(params->ith == 0);
-    assert(ggml_is_scalar(dst));
+float * ggml_get_data_f32(const struct ggml_tensor * tensor) {
+    assert(tensor->type == GGML_TYPE_F32);
+    return (float *)(tensor->data);
+}
 
-    if (params->type == GGML_TASK_INIT || params->type == GGML_TASK_FINALIZE) {
-        return;
-    }
+struct ggml_tensor * ggml_view_tensor(
+        struct ggml_context * ctx,
+        struct ggml_tensor  * src) {
+    return ggml_new_tensor_impl(ctx, src->type, src->n_dims, src->ne, src, 0);
+}
 
-    assert(ggml_is_scalar(dst));
-    assert(src0->nb[0] == sizeof(float));
+////////////////////////////////////////////////////////////////////////////////
 
-    const int ne00 = src0->ne[0];
-    const int ne01 = src0->ne[1];
-    const int ne02 = src0->ne[2];
-    const int ne03 = src0->ne[3];
+// ggml_dup
 
-    const size_t nb01 = src0->nb[1];
-    const size_t nb02 = src0->nb[2];
-    const size_t nb03 = src0->nb[3];
+struct ggml_tensor * ggml_dup_impl(
+        struct ggml_context * ctx,
+        struct ggml_tensor * a,
+        bool inplace) {
+    bool is_node = false;
 
-    for (int i03 = 0; i03 < ne03; i03++) {
-        for (int i02 = 0; i02 < ne02; i02++) {
-            for (int i01 = 0; i01 < ne01; i01++) {
-                ggml_vec_sum_f32(ne00,
-                        (float *) (dst->data),
-                        (float *) ((char *) src0->data + i01*nb01 + i02*nb02 + i03*nb03));
-            }
-        }
+    if (!inplace && (a->grad)) {
+        is_node = true;
     }
-}
 
-static void ggml_compute_forward_sum(
-        const struct ggml_compute_params * params,
-        const struct ggml_tensor * src0,
-        struct ggml_tensor * dst) {
-    switch (src0->type) {
-        case GGML_TYPE_F32:
-            {
-                ggml_compute_forward_sum_f32(params, src0, dst);
-            } break;
-        case GGML_TYPE_I8:
-        case GGML_TYPE_I16:
-        case GGML_TYPE_I32:
-        case GGML_TYPE_F16:
-        case GGML_TYPE_COUNT:
-            {
-                assert(false);
-            } break;
-    }
-}
+    struct ggml_tensor * result = inplace ? ggml_view_tensor(ctx, a) : ggml_dup_tensor(ctx, a);
 
-// ggml_compute_forward_mean
+    result->op   = GGML_OP_DUP;
+    result->grad = is_node ? ggml_dup_tensor(ctx, result) : NULL;
+    result->src0 = a;
+    result->src1 = NULL;
 
-static void ggml_compute_forward_mean_f32(
-        const struct ggml_compute_params * params,
-        const struct ggml_tensor * src0,
-        struct ggml_tensor * dst) {
-    assert(params->ith == 0);
+    return result;
+}
 
-    if (params->type == GGML_TASK_INIT || params->type == GGML_TASK_FINALIZE) {
-        return;
-    }
+struct ggml_tensor * ggml_dup(
+        struct ggml_context * ctx,
+        struct ggml_tensor * a) {
+    return ggml_dup_impl(ctx, a, false);
+}
 
-    assert(src0->nb[0] == sizeof(float));
+struct ggml_tensor * ggml_dup_inplace(
+        struct ggml_context * ctx,
+        struct ggml_tensor * a) {
+    return ggml_dup_impl(ctx, a, true);
+}
 
-    const int ne00 = src0->ne[0];
-    const int ne01 = src0->ne[1];
-    const int ne02 = src0->ne[2];
-    const int ne03 = src0->ne[3];
+// ggml_add
 
-    const size_t nb01 = src0->nb[1];
-    const size_t nb02 = src0->nb[2];
-    const size_t nb03 = src0->nb[3];
+struct ggml_tensor * ggml_add_impl(
+        struct ggml_context * ctx,
+        struct ggml_tensor * a,
+        struct ggml_tensor * b,
+        bool inplace) {
+    assert(ggml_are_same_shape(a, b));
 
-    const int ne0 = dst->ne[0];
-    const int ne1 = dst->ne[1];
-    const int ne2 = dst->ne[2];
-    const int ne3 = dst->ne[3];
+    bool is_node = false;
 
-    assert(ne0 == 1);
-    assert(ne1 == ne01);
-    assert(ne2 == ne02);
-    assert(ne3 == ne03);
+    if (!inplace && (a->grad || b->grad)) {
+        is_node = true;
+    }
 
-    UNUSED(ne0);
-    UNUSED(ne1);
-    UNUSED(ne2);
-    UNUSED(ne3);
+    struct ggml_tensor * result = inplace ? ggml_view_tensor(ctx, a) : ggml_dup_tensor(ctx, a);
 
-    const size_t nb1 = dst->nb[1];
-    const size_t nb2 = dst->nb[2];
-    const size_t nb3 = dst->nb[3];
+    result->op   = GGML_OP_ADD;
+    result->grad = is_node ? ggml_dup_tensor(ctx, result) : NULL;
+    result->src0 = a;
+    result->src1 = b;
 
-    for (int i03 = 0; i03 < ne03; i03++) {
-        for (int i02 = 0; i02 < ne02; i02++) {
-            for (int i01 = 0; i01 < ne01; i01++) {
-                ggml_vec_sum_f32(ne00,
-                        (float *) ((char *)  dst->data + i01*nb1  + i02*nb2  + i03*nb3),
-                        (float *) ((char *) src0->data + i01*nb01 + i02*nb02 + i03*nb03));
+    return result;
+}
 
-                *(float *) ((char *) dst->data + i01*nb1 + i02*nb2 + i03*nb3) /= (float) ne00;
-            }
-        }
-    }
+struct ggml_tensor * ggml_add(
+        struct ggml_context * ctx,
+        struct ggml_tensor * a,
+        struct ggml_tensor * b) {
+    return ggml_add_impl(ctx, a, b, false);
 }
 
-static void ggml_compute_forward_mean(
-        const struct ggml_compute_params * params,
-        const struct ggml_tensor * src0,
-        struct ggml_tensor * dst) {
-    switch (src0->type) {
-        case GGML_TYPE_F32:
-            {
-                ggml_compute_forward_mean_f32(params, src0, dst);
-            } break;
-        case GGML_TYPE_I8:
-        case GGML_TYPE_I16:
-        case GGML_TYPE_I32:
-        case GGML_TYPE_F16:
-        case GGML_TYPE_COUNT:
-            {
-                assert(false);
-            } break;
-    }
+struct ggml_tensor * ggml_add_inplace(
+        struct ggml_context * ctx,
+        struct ggml_tensor * a,
+        struct ggml_tensor * b) {
+    return ggml_add_impl(ctx, a, b, true);
 }
 
-// ggml_compute_forward_repeat
+// ggml_sub
 
-static void ggml_compute_forward_repeat_f32(
-        const struct ggml_compute_params * params,
-        const struct ggml_tensor * src0,
-        struct ggml_tensor * dst) {
-    assert(params->ith == 0);
-    assert(ggml_can_repeat(src0, dst));
+struct ggml_tensor * ggml_sub_impl(
+        struct ggml_context * ctx,
+        struct ggml_tensor * a,
+        struct ggml_tensor * b,
+        bool inplace) {
+    assert(ggml_are_same_shape(a, b));
 
-    if (params->type == GGML_TASK_INIT || params->type == GGML_TASK_FINALIZE) {
-        return;
+    bool is_node = false;
+
+    if (!inplace && (a->grad || b->grad)) {
+        is_node = true;
     }
 
-    // TODO: implement support for rank > 2 tensors
-    assert(src0->ne[2] == 1);
-    assert(src0->ne[3] == 1);
-    assert( dst->ne[2] == 1);
-    assert( dst->ne[3] == 1);
+    struct ggml_tensor * result = inplace ? ggml_view_tensor(ctx, a) : ggml_dup_tensor(ctx, a);
 
-    const int nc  = dst->ne[0];
-    const int nr  = dst->ne[1];
-    const int nc0 = src0->ne[0];
-    const int nr0 = src0->ne[1];
-    const int ncr = nc/nc0; // guaranteed to be an integer due to the check in ggml_can_repeat
-    const int nrr = nr/nr0; // guaranteed to be an integer due to the check in ggml_can_repeat
+    result->op   = GGML_OP_SUB;
+    result->grad = is_node ? ggml_dup_tensor(ctx, result) : NULL;
+    result->src0 = a;
+    result->src1 = b;
 
-    // TODO: support for transposed / permuted tensors
-    assert( dst->nb[0] == sizeof(float));
-    assert(src0->nb[0] == sizeof(float));
+    return result;
+}
 
-    // TODO: maybe this is not optimal?
-    for (int i = 0; i < nrr; i++) {
-        for (int j = 0; j < ncr; j++) {
-            for (int k = 0; k < nr0; k++) {
-                ggml_vec_cpy_f32(nc0,
-                        (float *) ((char *)  dst->data + (i*nr0 + k)*( dst->nb[1]) + j*nc0*( dst->nb[0])),
-                        (float *) ((char *) src0->data + (        k)*(src0->nb[1])));
-            }
-        }
-    }
+struct ggml_tensor * ggml_sub(
+        struct ggml_context * ctx,
+        struct ggml_tensor * a,
+        struct ggml_tensor * b) {
+    return ggml_sub_impl(ctx, a, b, false);
 }
 
-static void ggml_compute_forward_repeat(
-        const struct ggml_compute_params * params,
-        const struct ggml_tensor * src0,
-        struct ggml_tensor * dst) {
-    switch (src0->type) {
-        case GGML_TYPE_F32:
-            {
-                ggml_compute_forward_repeat_f32(params, src0, dst);
-            } break;
-        case GGML_TYPE_I8:
-        case GGML_TYPE_I16:
-        case GGML_TYPE_I32:
-        case GGML_TYPE_F16:
-        case GGML_TYPE_COUNT:
-            {
-                assert(false);
-            } break;
-    }
+struct ggml_tensor * ggml_sub_inplace(
+        struct ggml_context * ctx,
+        struct ggml_tensor * a,
+        struct ggml_tensor * b) {
+    return ggml_sub_impl(ctx, a, b, true);
 }
 
-// ggml_compute_forward_abs
+// ggml_mul
 
-static void ggml_compute_forward_abs_f32(
-        const struct ggml_compute_params * params,
-        const struct ggml_tensor * src0,
-        struct ggml_tensor * dst) {
-    assert(params->ith == 0);
-    assert(ggml_are_same_shape(src0, dst));
+struct ggml_tensor * ggml_mul_impl(
+        struct ggml_context * ctx,
+        struct ggml_tensor * a,
+        struct ggml_tensor * b,
+        bool inplace) {
+    assert(ggml_are_same_shape(a, b));
 
-    if (params->type == GGML_TASK_INIT || params->type == GGML_TASK_FINALIZE) {
-        return;
+    bool is_node = false;
+
+    if (!inplace && (a->grad || b->grad)) {
+        is_node = true;
     }
 
-    const int n  = ggml_nrows(src0);
-    const int nc = src0->ne[0];
+    if (inplace) {
+        assert(is_node == false);
+    }
 
-    assert(dst->nb[0]  == sizeof(float));
-    assert(src0->nb[0] == sizeof(float));
+    struct ggml_tensor * result = inplace ? ggml_view_tensor(ctx, a) : ggml_dup_tensor(ctx, a);
 
-    for (int i = 0; i < n; i++) {
-        ggml_vec_abs_f32(nc,
-                (float *) ((char *) dst->data  + i*( dst->nb[1])),
-                (float *) ((char *) src0->data + i*(src0->nb[1])));
-    }
+    result->op   = GGML_OP_MUL;
+    result->grad = is_node ? ggml_dup_tensor(ctx, result) : NULL;
+    result->src0 = a;
+    result->src1 = b;
+
+    return result;
 }
 
-static void ggml_compute_forward_abs(
-        const struct ggml_compute_params * params,
-        const struct ggml_tensor * src0,
-        struct ggml_tensor * dst) {
-    switch (src0->type) {
-        case GGML_TYPE_F32:
-            {
-                ggml_compute_forward_abs_f32(params, src0, dst);
-            } break;
-        case GGML_TYPE_I8:
-        case GGML_TYPE_I16:
-        case GGML_TYPE_I32:
-        case GGML_TYPE_F16:
-        case GGML_TYPE_COUNT:
-            {
-                assert(false);
-            } break;
-    }
+struct ggml_tensor * ggml_mul(
+        struct ggml_context * ctx,
+        struct ggml_tensor  * a,
+        struct ggml_tensor  * b) {
+    return ggml_mul_impl(ctx, a, b, false);
 }
 
-// ggml_compute_forward_sgn
+struct ggml_tensor * ggml_mul_inplace(
+        struct ggml_context * ctx,
+        struct ggml_tensor  * a,
+        struct ggml_tensor  * b) {
+    return ggml_mul_impl(ctx, a, b, true);
+}
 
-static void ggml_compute_forward_sgn_f32(
-        const struct ggml_compute_params * params,
-        const struct ggml_tensor * src0,
-        struct ggml_tensor * dst) {
-    assert(params->ith == 0);
-    assert(ggml_are_same_shape(src0, dst));
+// ggml_div
 
-    if (params->type == GGML_TASK_INIT || params->type == GGML_TASK_FINALIZE) {
-        return;
-    }
+struct ggml_tensor * ggml_div_impl(
+        struct ggml_context * ctx,
+        struct ggml_tensor * a,
+        struct ggml_tensor * b,
+        bool inplace) {
+    assert(ggml_are_same_shape(a, b));
 
-    const int n  = ggml_nrows(src0);
-    const int nc = src0->ne[0];
+    bool is_node = false;
 
-    assert(dst->nb[0]  == sizeof(float));
-    assert(src0->nb[0] == sizeof(float));
+    if (!inplace && (a->grad || b->grad)) {
+        is_node = true;
+    }
 
-    for (int i = 0; i < n; i++) {
-        ggml_vec_sgn_f32(nc,
-                (float *) ((char *) dst->data  + i*( dst->nb[1])),
-                (float *) ((char *) src0->data + i*(src0->nb[1])));
+    if (inplace) {
+        assert(is_node == false);
     }
+
+    struct ggml_tensor * result = inplace ? ggml_view_tensor(ctx, a) : ggml_dup_tensor(ctx, a);
+
+    result->op   = GGML_OP_DIV;
+    result->grad = is_node ? ggml_dup_tensor(ctx, result) : NULL;
+    result->src0 = a;
+    result->src1 = b;
+
+    return result;
 }
 
-static void ggml_compute_forward_sgn(
-        const struct ggml_compute_params * params,
-        const struct ggml_tensor * src0,
-        struct ggml_tensor * dst) {
-    switch (src0->type) {
-        case GGML_TYPE_F32:
-            {
-                ggml_compute_forward_sgn_f32(params, src0, dst);
-            } break;
-        case GGML_TYPE_I8:
-        case GGML_TYPE_I16:
-        case GGML_TYPE_I32:
-        case GGML_TYPE_F16:
-        case GGML_TYPE_COUNT:
-            {
-                assert(false);
-            } break;
-    }
+struct ggml_tensor * ggml_div(
+        struct ggml_context * ctx,
+        struct ggml_tensor  * a,
+        struct ggml_tensor  * b) {
+    return ggml_div_impl(ctx, a, b, false);
 }
 
-// ggml_compute_forward_neg
+struct ggml_tensor * ggml_div_inplace(
+        struct ggml_context * ctx,
+        struct ggml_tensor  * a,
+        struct ggml_tensor  * b) {
+    return ggml_div_impl(ctx, a, b, true);
+}
 
-static void ggml_compute_forward_neg_f32(
-        const struct ggml_compute_params * params,
-        const struct ggml_tensor * src0,
-        struct ggml_tensor * dst) {
-    assert(params->ith == 0);
-    assert(ggml_are_same_shape(src0, dst));
+// ggml_sqr
 
-    if (params->type == GGML_TASK_INIT || params->type == GGML_TASK_FINALIZE) {
-        return;
+struct ggml_tensor * ggml_sqr_impl(
+        struct ggml_context * ctx,
+        struct ggml_tensor * a,
+        bool inplace) {
+    bool is_node = false;
+
+    if (!inplace && (a->grad)) {
+        is_node = true;
     }
 
-    const int n  = ggml_nrows(src0);
-    const int nc = src0->ne[0];
+    struct ggml_tensor * result = inplace ? ggml_view_tensor(ctx, a) : ggml_dup_tensor(ctx, a);
 
-    assert(dst->nb[0]  == sizeof(float));
-    assert(src0->nb[0] == sizeof(float));
+    result->op   = GGML_OP_SQR;
+    result->grad = is_node ? ggml_dup_tensor(ctx, result) : NULL;
+    result->src0 = a;
+    result->src1 = NULL;
 
-    for (int i = 0; i < n; i++) {
-        ggml_vec_neg_f32(nc,
-                (float *) ((char *) dst->data  + i*( dst->nb[1])),
-                (float *) ((char *) src0->data + i*(src0->nb[1])));
-    }
+    return result;
 }
 
-static void ggml_compute_forward_neg(
-        const struct ggml_compute_params * params,
-        const struct ggml_tensor * src0,
-        struct ggml_tensor * dst) {
-    switch (src0->type) {
-        case GGML_TYPE_F32:
-            {
-                ggml_compute_forward_neg_f32(params, src0, dst);
-            } break;
-        case GGML_TYPE_I8:
-        case GGML_TYPE_I16:
-        case GGML_TYPE_I32:
-        case GGML_TYPE_F16:
-        case GGML_TYPE_COUNT:
-            {
-                assert(false);
-            } break;
-    }
+struct ggml_tensor * ggml_sqr(
+        struct ggml_context * ctx,
+        struct ggml_tensor  * a) {
+    return ggml_sqr_impl(ctx, a, false);
 }
 
-// ggml_compute_forward_step
+struct ggml_tensor * ggml_sqr_inplace(
+        struct ggml_context * ctx,
+        struct ggml_tensor  * a) {
+    return ggml_sqr_impl(ctx, a, true);
+}
 
-static void ggml_compute_forward_step_f32(
-        const struct ggml_compute_params * params,
-        const struct ggml_tensor * src0,
-        struct ggml_tensor * dst) {
-    assert(params->ith == 0);
-    assert(ggml_are_same_shape(src0, dst));
+// ggml_sqrt
 
-    if (params->type == GGML_TASK_INIT || params->type == GGML_TASK_FINALIZE) {
-        return;
+struct ggml_tensor * ggml_sqrt_impl(
+        struct ggml_context * ctx,
+        struct ggml_tensor * a,
+        bool inplace) {
+    bool is_node = false;
+
+    if (!inplace && (a->grad)) {
+        is_node = true;
     }
 
-    const int n  = ggml_nrows(src0);
-    const int nc = src0->ne[0];
+    struct ggml_tensor * result = inplace ? ggml_view_tensor(ctx, a) : ggml_dup_tensor(ctx, a);
 
-    assert(dst->nb[0]  == sizeof(float));
-    assert(src0->nb[0] == sizeof(float));
+    result->op   = GGML_OP_SQRT;
+    result->grad = is_node ? ggml_dup_tensor(ctx, result) : NULL;
+    result->src0 = a;
+    result->src1 = NULL;
 
-    for (int i = 0; i < n; i++) {
-        ggml_vec_step_f32(nc,
-                (float *) ((char *) dst->data  + i*( dst->nb[1])),
-                (float *) ((char *) src0->data + i*(src0->nb[1])));
-    }
+    return result;
 }
 
-static void ggml_compute_forward_step(
-        const struct ggml_compute_params * params,
-        const struct ggml_tensor * src0,
-        struct ggml_tensor * dst) {
-    switch (src0->type) {
-        case GGML_TYPE_F32:
-            {
-                ggml_compute_forward_step_f32(params, src0, dst);
-            } break;
-        case GGML_TYPE_I8:
-        case GGML_TYPE_I16:
-        case GGML_TYPE_I32:
-        case GGML_TYPE_F16:
-        case GGML_TYPE_COUNT:
-            {
-                assert(false);
-            } break;
-    }
+struct ggml_tensor * ggml_sqrt(
+        struct ggml_context * ctx,
+        struct ggml_tensor  * a) {
+    return ggml_sqrt_impl(ctx, a, false);
 }
 
-// ggml_compute_forward_relu
+struct ggml_tensor * ggml_sqrt_inplace(
+        struct ggml_context * ctx,
+        struct ggml_tensor  * a) {
+    return ggml_sqrt_impl(ctx, a, true);
+}
 
-static void ggml_compute_forward_relu_f32(
-        const struct ggml_compute_params * params,
-        const struct ggml_tensor * src0,
-        struct ggml_tensor * dst) {
-    assert(params->ith == 0);
-    assert(ggml_are_same_shape(src0, dst));
+// ggml_sum
 
-    if (params->type == GGML_TASK_INIT || params->type == GGML_TASK_FINALIZE) {
-        return;
-    }
+struct ggml_tensor * ggml_sum(
+        struct ggml_context * ctx,
+        struct ggml_tensor * a) {
+    bool is_node = false;
 
-    const int n  = ggml_nrows(src0);
-    const int nc = src0->ne[0];
+    if (a->grad) {
+        is_node = true;
+    }
 
-    assert(dst->nb[0]  == sizeof(float));
-    assert(src0->nb[0] == sizeof(float));
+    struct ggml_tensor * result = ggml_new_tensor_1d(ctx, a->type, 1);
 
-    for (int i = 0; i < n; i++) {
-        ggml_vec_relu_f32(nc,
-                (float *) ((char *) dst->data  + i*( dst->nb[1])),
-                (float *) ((char *) src0->data + i*(src0->nb[1])));
-    }
-}
+    result->op   = GGML_OP_SUM;
+    result->grad = is_node ? ggml_dup_tensor(ctx, result) : NULL;
+    result->src0 = a;
+    result->src1 = NULL;
 
-static void ggml_compute_forward_relu(
-        const struct ggml_compute_params * params,
-        const struct ggml_tensor * src0,
-        struct ggml_tensor * dst) {
-    switch (src0->type) {
-        case GGML_TYPE_F32:
-            {
-                ggml_compute_forward_relu_f32(params, src0, dst);
-            } break;
-        case GGML_TYPE_I8:
-        case GGML_TYPE_I16:
-        case GGML_TYPE_I32:
-        case GGML_TYPE_F16:
-        case GGML_TYPE_COUNT:
-            {
-                assert(false);
-            } break;
-    }
+    return result;
 }
 
-// ggml_compute_forward_gelu
+// ggml_mean
 
-static void ggml_compute_forward_gelu_f32(
-        const struct ggml_compute_params * params,
-        const struct ggml_tensor * src0,
-        struct ggml_tensor * dst) {
-    GGML_ASSERT(ggml_is_contiguous(src0));
-    GGML_ASSERT(ggml_is_contiguous(dst));
-    GGML_ASSERT(ggml_are_same_shape(src0, dst));
+struct ggml_tensor * ggml_mean(
+        struct ggml_context * ctx,
+        struct ggml_tensor * a) {
+    bool is_node = false;
 
-    if (params->type == GGML_TASK_INIT || params->type == GGML_TASK_FINALIZE) {
-        return;
+    if (a->grad) {
+        assert(false); // TODO: implement
+        is_node = true;
     }
 
-    const int ith = params->ith;
-    const int nth = params->nth;
+    int ne[GGML_MAX_DIMS] = { 1, a->ne[1], a->ne[2], a->ne[3] };
+    struct ggml_tensor * result = ggml_new_tensor(ctx, GGML_TYPE_F32, a->n_dims, ne);
 
-    const int nc = src0->ne[0];
-    const int nr = ggml_nrows(src0);
+    result->op   = GGML_OP_MEAN;
+    result->grad = is_node ? ggml_dup_tensor(ctx, result) : NULL;
+    result->src0 = a;
+    result->src1 = NULL;
 
-    // rows per thread
-    const int dr = (nr + nth - 1)/nth;
+    return result;
+}
 
-    // row range for this thread
-    const int ir0 = dr*ith;
-    const int ir1 = MIN(ir0 + dr, nr);
+// ggml_repeat
 
-    for (int i1 = ir0; i1 < ir1; i1++) {
-        ggml_vec_gelu_f32(nc,
-                (float *) ((char *) dst->data  + i1*( dst->nb[1])),
-                (float *) ((char *) src0->data + i1*(src0->nb[1])));
+struct ggml_tensor * ggml_repeat(
+        struct ggml_context * ctx,
+        struct ggml_tensor * a,
+        struct ggml_tensor * b) {
+    assert(ggml_can_repeat(a, b));
 
-#ifndef NDEBUG
-        for (int k = 0; k < nc; k++) {
-            const float x = ((float *) ((char *) dst->data + i1*( dst->nb[1])))[k];
-            UNUSED(x);
-            assert(!isnan(x));
-            assert(!isinf(x));
-        }
-#endif
+    bool is_node = false;
+
+    if (a->grad) {
+        is_node = true;
     }
-}
 
-static void ggml_compute_forward_gelu(
-        const struct ggml_compute_params * params,
-        const struct ggml_tensor * src0,
-        struct ggml_tensor * dst) {
-    switch (src0->type) {
-        case GGML_TYPE_F32:
-            {
-                ggml_compute_forward_gelu_f32(params, src0, dst);
-            } break;
-        case GGML_TYPE_I8:
-        case GGML_TYPE_I16:
-        case GGML_TYPE_I32:
-        case GGML_TYPE_F16:
-        case GGML_TYPE_COUNT:
-            {
-                assert(false);
-            } break;
+    if (ggml_are_same_shape(a, b) && !is_node) {
+        return a;
     }
+
+    struct ggml_tensor * result = ggml_new_tensor(ctx, a->type, b->n_dims, b->ne);
+
+    result->op   = GGML_OP_REPEAT;
+    result->grad = is_node ? ggml_dup_tensor(ctx, result) : NULL;
+    result->src0 = a;
+    result->src1 = NULL;
+
+    return result;
 }
 
-// ggml_compute_forward_norm
+// ggml_abs
 
-static void ggml_compute_forward_norm_f32(
-        const struct ggml_compute_params * params,
-        const struct ggml_tensor * src0,
-        struct ggml_tensor * dst) {
-    GGML_ASSERT(ggml_are_same_shape(src0, dst));
+struct ggml_tensor * ggml_abs_impl(
+        struct ggml_context * ctx,
+        struct ggml_tensor * a,
+        bool inplace) {
+    bool is_node = false;
 
-    if (params->type == GGML_TASK_INIT || params->type == GGML_TASK_FINALIZE) {
-        return;
+    if (!inplace && (a->grad)) {
+        is_node = true;
     }
 
-    GGML_ASSERT(src0->nb[0] == sizeof(float));
+    struct ggml_tensor * result = inplace ? ggml_view_tensor(ctx, a) : ggml_dup_tensor(ctx, a);
 
-    const int ith = params->ith;
-    const int nth = params->nth;
+    result->op   = GGML_OP_ABS;
+    result->grad = is_node ? ggml_dup_tensor(ctx, result) : NULL;
+    result->src0 = a;
+    result->src1 = NULL;
 
-    const int ne00 = src0->ne[0];
-    const int ne01 = src0->ne[1];
-    const int ne02 = src0->ne[2];
-    const int ne03 = src0->ne[3];
+    return result;
+}
 
-    const size_t nb01 = src0->nb[1];
-    const size_t nb02 = src0->nb[2];
-    const size_t nb03 = src0->nb[3];
+struct ggml_tensor * ggml_abs(
+        struct ggml_context * ctx,
+        struct ggml_tensor  * a) {
+    return ggml_abs_impl(ctx, a, false);
+}
 
-    const size_t nb1 = dst->nb[1];
-    const size_t nb2 = dst->nb[2];
-    const size_t nb3 = dst->nb[3];
+struct ggml_tensor * ggml_abs_inplace(
+        struct ggml_context * ctx,
+        struct ggml_tensor  * a) {
+    return ggml_abs_impl(ctx, a, true);
+}
 
-    const ggml_float eps = 1e-5f; // TODO: make this a parameter
 
-    // TODO: optimize
-    for (int i03 = 0; i03 < ne03; i03++) {
-        for (int i02 = 0; i02 < ne02; i02++) {
-            for (int i01 = ith; i01 < ne01; i01 += nth) {
-                const float * x = (float *) ((char *) src0->data + i01*nb01 + i02*nb02 + i03*nb03);
+// ggml_sgn
 
-                ggml_float mean = 0.0;
-                for (int i00 = 0; i00 < ne00; i00++) {
-                    mean += x[i00];
-                }
+struct ggml_tensor * ggml_sgn_impl(
+        struct ggml_context * ctx,
+        struct ggml_tensor * a,
+        bool inplace) {
+    bool is_node = false;
 
-                mean /= ne00;
+    if (!inplace && (a->grad)) {
+        is_node = true;
+    }
 
-                float * y = (float *) ((char *) dst->data + i01*nb1 + i02*nb2 + i03*nb3);
+    struct ggml_tensor * result = inplace ? ggml_view_tensor(ctx, a) : ggml_dup_tensor(ctx, a);
 
-                ggml_float sum2 = 0.0;
-                for (int i00 = 0; i00 < ne00; i00++) {
-                    ggml_float v = x[i00] - mean;
-                    y[i00] = v;
-                    sum2 += v*v;
-                }
+    result->op   = GGML_OP_SGN;
+    result->grad = is_node ? ggml_dup_tensor(ctx, result) : NULL;
+    result->src0 = a;
+    result->src1 = NULL;
 
-                const float scale = 1.0/sqrt(sum2/ne00 + eps);
+    return result;
+}
 
-                ggml_vec_scale_f32(ne00, y, scale);
-            }
-        }
-    }
+struct ggml_tensor * ggml_sgn(
+        struct ggml_context * ctx,
+        struct ggml_tensor  * a) {
+    return ggml_sgn_impl(ctx, a, false);
 }
 
-static void ggml_compute_forward_norm(
-        const struct ggml_compute_params * params,
-        const struct ggml_tensor * src0,
-        struct ggml_tensor * dst) {
-    switch (src0->type) {
-        case GGML_TYPE_F32:
-            {
-                ggml_compute_forward_norm_f32(params, src0, dst);
-            } break;
-        case GGML_TYPE_I8:
-        case GGML_TYPE_I16:
-        case GGML_TYPE_I32:
-        case GGML_TYPE_F16:
-        case GGML_TYPE_COUNT:
-            {
-                assert(false);
-            } break;
-    }
+struct ggml_tensor * ggml_sgn_inplace(
+        struct ggml_context * ctx,
+        struct ggml_tensor  * a) {
+    return ggml_sgn_impl(ctx, a, true);
 }
 
-// ggml_compute_forward_mul_mat
+// ggml_neg
 
-#if defined(GGML_USE_ACCELERATE) || defined(GGML_USE_OPENBLAS)
-// helper function to determine if it is better to use BLAS or not
-// for large matrices, BLAS is faster
-static bool ggml_compute_forward_mul_mat_use_blas(
-        const struct ggml_tensor * src0,
-        const struct ggml_tensor * src1,
-              struct ggml_tensor * dst) {
-    UNUSED(src0);
+struct ggml_tensor * ggml_neg_impl(
+        struct ggml_context * ctx,
+        struct ggml_tensor * a,
+        bool inplace) {
+    bool is_node = false;
 
-    const int ne10 = src1->ne[0];
+    if (!inplace && (a->grad)) {
+        is_node = true;
+    }
 
-    const int ne0 = dst->ne[0];
-    const int ne1 = dst->ne[1];
+    struct ggml_tensor * result = inplace ? ggml_view_tensor(ctx, a) : ggml_dup_tensor(ctx, a);
 
-    // TODO: find the optimal values for these
-    if (ggml_is_contiguous(src0) && ggml_is_contiguous(src1) && ne0 >= 32 && ne1 >= 32 && ne10 >= 32) {
-        //printf("BLAS: %d %d %d\n", ne0, ne1, ne10);
-        return true;
-    }
+    result->op   = GGML_OP_NEG;
+    result->grad = is_node ? ggml_dup_tensor(ctx, result) : NULL;
+    result->src0 = a;
+    result->src1 = NULL;
 
-    return false;
+    return result;
 }
-#endif
 
-static void ggml_compute_forward_mul_mat_f32(
-        const struct ggml_compute_params * params,
-        const struct ggml_tensor * src0,
-        const struct ggml_tensor * src1,
-              struct ggml_tensor * dst) {
-    int64_t t0 = ggml_perf_time_us();
-    UNUSED(t0);
+struct ggml_tensor * ggml_neg(
+        struct ggml_context * ctx,
+        struct ggml_tensor  * a) {
+    return ggml_neg_impl(ctx, a, false);
+}
 
-    const int ne00 = src0->ne[0];
-    const int ne01 = src0->ne[1];
-    const int ne02 = src0->ne[2];
-    const int ne03 = src0->ne[3];
+struct ggml_tensor * ggml_neg_inplace(
+        struct ggml_context * ctx,
+        struct ggml_tensor  * a) {
+    return ggml_neg_impl(ctx, a, true);
+}
 
-    const int ne10 = src1->ne[0];
-    const int ne11 = src1->ne[1];
-    const int ne12 = src1->ne[2];
-    const int ne13 = src1->ne[3];
+// ggml_step
 
-    const int ne0  = dst->ne[0];
-    const int ne1  = dst->ne[1];
-    const int ne2  = dst->ne[2];
-    const int ne3  = dst->ne[3];
-    const int ne   = ne0*ne1*ne2*ne3;
+struct ggml_tensor * ggml_step_impl(
+        struct ggml_context * ctx,
+        struct ggml_tensor * a,
+        bool inplace) {
+    bool is_node = false;
 
-    const int nb00 = src0->nb[0];
-    const int nb01 = src0->nb[1];
-    const int nb02 = src0->nb[2];
-    const int nb03 = src0->nb[3];
+    if (!inplace && (a->grad)) {
+        is_node = true;
+    }
 
-    const int nb10 = src1->nb[0];
-    const int nb11 = src1->nb[1];
-    const int nb12 = src1->nb[2];
-    const int nb13 = src1->nb[3];
+    struct ggml_tensor * result = inplace ? ggml_view_tensor(ctx, a) : ggml_dup_tensor(ctx, a);
 
-    const int nb0  = dst->nb[0];
-    const int nb1  = dst->nb[1];
-    const int nb2  = dst->nb[2];
-    const int nb3  = dst->nb[3];
+    result->op   = GGML_OP_STEP;
+    result->grad = is_node ? ggml_dup_tensor(ctx, result) : NULL;
+    result->src0 = a;
+    result->src1 = NULL;
 
-    const int ith = params->ith;
-    const int nth = params->nth;
+    return result;
+}
 
-    assert(ne02 == ne12);
-    assert(ne03 == ne13);
-    assert(ne2  == ne12);
-    assert(ne3  == ne13);
+struct ggml_tensor * ggml_step(
+        struct ggml_context * ctx,
+        struct ggml_tensor  * a) {
+    return ggml_step_impl(ctx, a, false);
+}
 
-    // TODO: we don't support permuted src0
-    assert(nb00 == sizeof(float) || nb01 == sizeof(float));
+struct ggml_tensor * ggml_step_inplace(
+        struct ggml_context * ctx,
+        struct ggml_tensor  * a) {
+    return ggml_step_impl(ctx, a, true);
+}
 
-    // dst cannot be transposed or permuted
-    assert(nb0 == sizeof(float));
-    assert(nb0 <= nb1);
-    assert(nb1 <= nb2);
-    assert(nb2 <= nb3);
+// ggml_relu
 
-    assert(ne0 == ne01);
-    assert(ne1 == ne11);
-    assert(ne2 == ne02);
-    assert(ne3 == ne03);
+struct ggml_tensor * ggml_relu_impl(
+        struct ggml_context * ctx,
+        struct ggml_tensor * a,
+        bool inplace) {
+    bool is_node = false;
 
-    // nb01 >= nb00 - src0 is not transposed
-    //   compute by src0 rows
-    //
-    // nb00 <  nb01 - src0 is transposed
-    //   compute by src0 columns
+    if (!inplace && (a->grad)) {
+        is_node = true;
+    }
 
-#if defined(GGML_USE_ACCELERATE) || defined(GGML_USE_OPENBLAS)
-    if (ggml_compute_forward_mul_mat_use_blas(src0, src1, dst)) {
-        GGML_ASSERT(nb10 == sizeof(float));
+    struct ggml_tensor * result = inplace ? ggml_view_tensor(ctx, a) : ggml_dup_tensor(ctx, a);
 
-        if (params->ith != 0) {
-            return;
-        }
+    result->op   = GGML_OP_RELU;
+    result->grad = is_node ? ggml_dup_tensor(ctx, result) : NULL;
+    result->src0 = a;
+    result->src1 = NULL;
 
-        if (params->type == GGML_TASK_INIT) {
-            return;
-        }
+    return result;
+}
 
-        if (params->type == GGML_TASK_FINALIZE) {
-            return;
-        }
+struct ggml_tensor * ggml_relu(
+        struct ggml_context * ctx,
+        struct ggml_tensor  * a) {
+    return ggml_relu_impl(ctx, a, false);
+}
 
-        for (int i03 = 0; i03 < ne03; i03++) {
-            for (int i02 = 0; i02 < ne02; i02++) {
-                const float * x = (float *) (src0->data);
-                const float * y = (float *) ((char *) src1->data + i02*nb12 + i03*nb13);
+struct ggml_tensor * ggml_relu_inplace(
+        struct ggml_context * ctx,
+        struct ggml_tensor  * a) {
+    return ggml_relu_impl(ctx, a, true);
+}
 
-                float * d = (float *) ((char *) dst->data + i02*nb2 + i03*nb3);
+// ggml_gelu
 
-                // zT = y * xT
-                {
-                    cblas_sgemm(CblasRowMajor, CblasNoTrans, CblasTrans,
-                            ne11, ne01, ne10,
-                            1.0f,    y, ne10,
-                                     x, ne10,
-                            0.0f,    d, ne01);
-                }
-            }
-        }
-
-        //printf("CBLAS F32 = %f ms, %d x %d x %d x %d\n", (ggml_perf_time_us() - t0)/1000.0, ne0, ne1, ne2, ne3);
-
-        return;
-    }
-#endif
-
-    if (params->type == GGML_TASK_INIT) {
-        if (nb01 >= nb00) {
-            return;
-        }
+struct ggml_tensor * ggml_gelu_impl(
+        struct ggml_context * ctx,
+        struct ggml_tensor * a,
+        bool inplace) {
+    bool is_node = false;
 
-        // TODO: fix this memset (wsize is overestimated)
-        memset(params->wdata, 0, params->wsize);
-        return;
+    if (!inplace && (a->grad)) {
+        is_node = true;
     }
 
-    if (params->type == GGML_TASK_FINALIZE) {
-        if (nb01 >= nb00) {
-            return;
-        }
+    struct ggml_tensor * result = inplace ? ggml_view_tensor(ctx, a) : ggml_dup_tensor(ctx, a);
 
-        // TODO: fix this memset (wsize is overestimated)
-        //assert(params->wsize == (ggml_nbytes(dst) + CACHE_LINE_SIZE)*nth);
+    result->op   = GGML_OP_GELU;
+    result->grad = is_node ? ggml_dup_tensor(ctx, result) : NULL;
+    result->src0 = a;
+    result->src1 = NULL;
 
-        float * const wdata = params->wdata;
+    return result;
+}
 
-        // cols per thread
-        const int dc = (ne + nth - 1)/nth;
+struct ggml_tensor * ggml_gelu(
+        struct ggml_context * ctx,
+        struct ggml_tensor  * a) {
+    return ggml_gelu_impl(ctx, a, false);
+}
 
-        // col range for this thread
-        const int ic0 = dc*ith;
-        const int ic1 = MIN(ic0 + dc, ne);
+struct ggml_tensor * ggml_gelu_inplace(
+        struct ggml_context * ctx,
+        struct ggml_tensor  * a) {
+    return ggml_gelu_impl(ctx, a, true);
+}
 
-        ggml_vec_cpy_f32(ic1 - ic0, (float *) dst->data + ic0, wdata + ic0);
+// ggml_norm
 
-        for (int k = 1; k < nth; k++) {
-            ggml_vec_acc_f32(ic1 - ic0, (float *) dst->data + ic0, wdata + (ne + CACHE_LINE_SIZE_F32)*k + ic0);
-        }
+struct ggml_tensor * ggml_norm_impl(
+        struct ggml_context * ctx,
+        struct ggml_tensor  * a,
+        bool inplace) {
+    bool is_node = false;
 
-        return;
+    if (!inplace && (a->grad)) {
+        assert(false); // TODO: implement backward
+        is_node = true;
     }
 
-    if (nb01 >= nb00) {
-        // TODO: do not support transposed src1
-        assert(nb10 == sizeof(float));
-
-        // parallelize by src0 rows using ggml_vec_dot_f32
-
-        // total rows in src0
-        const int nr = ne01*ne02*ne03;
+    struct ggml_tensor * result = inplace ? ggml_view_tensor(ctx, a) : ggml_dup_tensor(ctx, a);
 
-        // rows per thread
-        const int dr = (nr + nth - 1)/nth;
+    result->op   = GGML_OP_NORM;
+    result->grad = is_node ? ggml_dup_tensor(ctx, result) : NULL;
+    result->src0 = a;
+    result->src1 = NULL; // TODO: maybe store epsilon here?
 
-        // row range for this thread
-        const int ir0 = dr*ith;
-        const int ir1 = MIN(ir0 + dr, nr);
+    return result;
+}
 
-        for (int ir = ir0; ir < ir1; ++ir) {
-            // src0 indices
-            const int i03 = ir/(ne02*ne01);
-            const int i02 = (ir - i03*ne02*ne01)/ne01;
-            const int i01 = (ir - i03*ne02*ne01 - i02*ne01);
+struct ggml_tensor * ggml_norm(
+        struct ggml_context * ctx,
+        struct ggml_tensor  * a) {
+    return ggml_norm_impl(ctx, a, false);
+}
 
-            for (int ic = 0; ic < ne11; ++ic) {
-                // src1 indices
-                const int i13 = i03;
-                const int i12 = i02;
-                const int i11 = ic;
+struct ggml_tensor * ggml_norm_inplace(
+        struct ggml_context * ctx,
+        struct ggml_tensor  * a) {
+    return ggml_norm_impl(ctx, a, true);
+}
 
-                // dst indices
-                const int i0 = i01;
-                const int i1 = i11;
-                const int i2 = i02;
-                const int i3 = i03;
+// ggml_norm_affine
 
-                ggml_vec_dot_f32(ne00,
-                        (float *) ((char *)  dst->data + (i0*nb0 + i1*nb1 + i2*nb2 + i3*nb3)),
-                        (float *) ((char *) src0->data + (i01*nb01 + i02*nb02 + i03*nb03)),
-                        (float *) ((char *) src1->data + (i11*nb11 + i12*nb12 + i13*nb13)));
-            }
-        }
-    } else {
-        // parallelize by src1 columns using ggml_vec_mad_f32
-        // each thread has its own work data
-        // during FINALIZE we accumulate all work data into dst
+struct ggml_tensor * ggml_norm_affine(
+        struct ggml_context * ctx,
+        struct ggml_tensor  * a,
+        struct ggml_tensor  * w,
+        struct ggml_tensor  * b) {
+    GGML_ASSERT(ggml_is_vector(w) && w->ne[0] == a->ne[0]);
+    GGML_ASSERT(ggml_are_same_shape(w, b));
 
-        // total columns in src1
-        const int nc = ne10;
+    bool is_node = false;
 
-        // columns per thread
-        const int dc = (nc + nth - 1)/nth;
+    if (a->grad || w->grad || b->grad) {
+        GGML_ASSERT(false); // TODO: implement backward
+        is_node = true;
+    }
 
-        // column range for this thread
-        const int ic0 = dc*ith;
-        const int ic1 = MIN(ic0 + dc, nc);
+    struct ggml_tensor * result = ggml_dup_tensor(ctx, a);
 
-        // work data for thread
-        const int wo = (ne + CACHE_LINE_SIZE_F32)*ith;
-        float * const wdata = params->wdata;
+    result->op   = GGML_OP_NORM_AFFINE;
+    result->grad = is_node ? ggml_dup_tensor(ctx, result) : NULL;
+    result->src0 = a;
+    result->src1 = w;
+    result->opt[0] = b;
 
-        for (int i13 = 0; i13 < ne13; ++i13) {
-            for (int i12 = 0; i12 < ne12; ++i12) {
-                for (int i11 = 0; i11 < ne11; ++i11) {
-                    for (int ic = ic0; ic < ic1; ++ic) {
-                        // src1 indices
-                        const int i10 = ic;
+    return result;
+}
 
-                        // src0 indices
-                        const int i03 = i13;
-                        const int i02 = i12;
-                        const int i00 = ic;
+// ggml_mul_mat
 
-                        // dst indices
-                        const int i1 = i11;
-                        const int i2 = i12;
-                        const int i3 = i13;
+struct ggml_tensor * ggml_mul_mat(
+        struct ggml_context * ctx,
+        struct ggml_tensor  * a,
+        struct ggml_tensor  * b) {
+    assert(ggml_can_mul_mat(a, b));
 
-                        assert(sizeof(float)*(wo + i3*ne2*ne1*ne0 + i2*ne1*ne0 + i1*ne0 + ne01) <= params->wsize);
+    bool is_node = false;
 
-                        ggml_vec_mad_f32(ne01,
-                                (float *) (wdata + wo + i3*ne2*ne1*ne0 + i2*ne1*ne0 + i1*ne0),
-                                (float *) ((char *) src0->data + (i00*nb00 + i02*nb02 + i03*nb03)),
-                               *(float *) ((char *) src1->data + (i10*nb10 + i11*nb11 + i12*nb12 + i13*nb13)));
-                    }
-                }
-            }
-        }
+    if (a->grad || b->grad) {
+        is_node = true;
     }
 
-    //int64_t t1 = ggml_perf_time_us();
-    //static int64_t acc = 0;
-    //acc += t1 - t0;
-    //if (t1 - t0 > 10) {
-    //    printf("\n");
-    //    printf("ne00 = %5d, ne01 = %5d, ne02 = %5d, ne03 = %5d\n", ne00, ne01, ne02, ne03);
-    //    printf("nb00 = %5d, nb01 = %5d, nb02 = %5d, nb03 = %5d\n", nb00, nb01, nb02, nb03);
-    //    printf("ne10 = %5d, ne11 = %5d, ne12 = %5d, ne13 = %5d\n", ne10, ne11, ne12, ne13);
-    //    printf("nb10 = %5d, nb11 = %5d, nb12 = %5d, nb13 = %5d\n", nb10, nb11, nb12, nb13);
+    const int ne[4] = { a->ne[1], b->ne[1], a->ne[2], b->ne[3] };
+    struct ggml_tensor * result = ggml_new_tensor(ctx, GGML_TYPE_F32, MIN(a->n_dims, b->n_dims), ne);
 
-    //    printf("XXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXX task %d/%d: %d us, acc = %d\n", ith, nth, (int) (t1 - t0), (int) acc);
-    //}
-}
+    result->op   = GGML_OP_MUL_MAT;
+    result->grad = is_node ? ggml_dup_tensor(ctx, result) : NULL;
+    result->src0 = a;
+    result->src1 = b;
 
-static void ggml_compute_forward_mul_mat_f16_f32(
-        const struct ggml_compute_params * params,
-        const struct ggml_tensor * src0,
-        const struct ggml_tensor * src1,
-              struct ggml_tensor * dst) {
-    int64_t t0 = ggml_perf_time_us();
-    UNUSED(t0);
+    return result;
+}
 
-    const int ne00 = src0->ne[0];
-    const int ne01 = src0->ne[1];
-    const int ne02 = src0->ne[2];
-    const int ne03 = src0->ne[3];
+// ggml_mul_mat_bias
 
-    const int ne10 = src1->ne[0];
-    const int ne11 = src1->ne[1];
-    const int ne12 = src1->ne[2];
-    const int ne13 = src1->ne[3];
+struct ggml_tensor * ggml_mul_mat_bias(
+        struct ggml_context * ctx,
+        struct ggml_tensor  * a,
+        struct ggml_tensor  * b,
+        struct ggml_tensor  * c,
+        bool                  gelu) {
+    GGML_ASSERT(c == NULL || (ggml_is_vector(c) && c->ne[0] == a->ne[1] && c->type == GGML_TYPE_F32));
 
-    const int ne0  = dst->ne[0];
-    const int ne1  = dst->ne[1];
-    const int ne2  = dst->ne[2];
-    const int ne3  = dst->ne[3];
-    const int ne   = ne0*ne1*ne2*ne3;
+    if (a->grad || b->grad || (c && c->grad)) {
+        GGML_ASSERT(false); // TODO: implement backward
+    }
 
-    const int nb00 = src0->nb[0];
-    const int nb01 = src0->nb[1];
-    const int nb02 = src0->nb[2];
-    const int nb03 = src0->nb[3];
+    struct ggml_tensor * result = ggml_mul_mat(ctx, a, b);
 
-    const int nb10 = src1->nb[0];
-    const int nb11 = src1->nb[1];
-    const int nb12 = src1->nb[2];
-    const int nb13 = src1->nb[3];
+    result->opt[0] = c;
+    result->opt[1] = ggml_new_i32(ctx, gelu ? 1 : 0);
 
-    const int nb0  = dst->nb[0];
-    const int nb1  = dst->nb[1];
-    const int nb2  = dst->nb[2];
-    const int nb3  = dst->nb[3];
+    return result;
+}
 
-    const int ith = params->ith;
-    const int nth = params->nth;
+// ggml_scale
 
-    GGML_ASSERT(ne02 == ne12);
-    GGML_ASSERT(ne03 == ne13);
-    GGML_ASSERT(ne2  == ne12);
-    GGML_ASSERT(ne3  == ne13);
+struct ggml_tensor * ggml_scale_impl(
+        struct ggml_context * ctx,
+        struct ggml_tensor  * a,
+        struct ggml_tensor  * b,
+        bool inplace) {
+    assert(ggml_is_scalar(b));
+    assert(ggml_is_padded_1d(a));
 
-    // TODO: we don't support permuted src0
-    GGML_ASSERT(nb00 == sizeof(ggml_fp16_t) || nb01 == sizeof(ggml_fp16_t));
+    bool is_node = false;
 
-    // dst cannot be transposed or permuted
-    GGML_ASSERT(nb0 == sizeof(float));
-    GGML_ASSERT(nb0 <= nb1);
-    GGML_ASSERT(nb1 <= nb2);
-    GGML_ASSERT(nb2 <= nb3);
+    if (!inplace && (a->grad || b->grad)) {
+        assert(false); // TODO: implement backward
+        is_node = true;
+    }
 
-    GGML_ASSERT(ne0 == ne01);
-    GGML_ASSERT(ne1 == ne11);
-    GGML_ASSERT(ne2 == ne02);
-    GGML_ASSERT(ne3 == ne03);
+    // TODO: when implement backward, fix this:
+    //struct ggml_tensor * result = inplace ? ggml_view_tensor(ctx, a) : ggml_dup_tensor(ctx, a);
+    struct ggml_tensor * result = ggml_view_tensor(ctx, a);
 
-    // nb01 >= nb00 - src0 is not transposed
-    //   compute by src0 rows
-    //
-    // nb00 <  nb01 - src0 is transposed
-    //   compute by src0 columns
-
-#if defined(GGML_USE_ACCELERATE) || defined(GGML_USE_OPENBLAS)
-    if (ggml_compute_forward_mul_mat_use_blas(src0, src1, dst)) {
-        GGML_ASSERT(nb10 == sizeof(float));
-
-        if (params->ith != 0) {
-            return;
-        }
-
-        if (params->type == GGML_TASK_INIT) {
-            return;
-        }
+    result->op   = GGML_OP_SCALE;
+    result->grad = is_node ? ggml_dup_tensor(ctx, result) : NULL;
+    result->src0 = a;
+    result->src1 = b;
 
-        if (params->type == GGML_TASK_FINALIZE) {
-            return;
-        }
+    return result;
+}
 
-        float * const wdata = params->wdata;
+struct ggml_tensor * ggml_scale(
+        struct ggml_context * ctx,
+        struct ggml_tensor * a,
+        struct ggml_tensor * b) {
+    return ggml_scale_impl(ctx, a, b, false);
+}
 
-        for (int i03 = 0; i03 < ne03; i03++) {
-            for (int i02 = 0; i02 < ne02; i02++) {
-                {
-                    int id = 0;
-                    for (int i01 = 0; i01 < ne01; ++i01) {
-                        for (int i00 = 0; i00 < ne00; ++i00) {
-                            wdata[id++] = GGML_FP16_TO_FP32(*(ggml_fp16_t *) ((char *) src0->data + i03*nb03 + i02*nb02 + i01*nb01 + i00*nb00));
-                        }
-                    }
-                }
+struct ggml_tensor * ggml_scale_inplace(
+        struct ggml_context * ctx,
+        struct ggml_tensor * a,
+        struct ggml_tensor * b) {
+    return ggml_scale_impl(ctx, a, b, true);
+}
 
-                const float * x = wdata;
-                const float * y = (float *) ((char *) src1->data + i02*nb12 + i03*nb13);
+// ggml_cpy
 
-                //      float * z =                          wdata + ne00*ne01;
+struct ggml_tensor * ggml_cpy_impl(
+        struct ggml_context * ctx,
+        struct ggml_tensor  * a,
+        struct ggml_tensor  * b,
+        bool inplace) {
+    assert(ggml_nelements(a) == ggml_nelements(b));
 
-                // z = x * yT
-                //{
-                //    cblas_sgemm(CblasRowMajor, CblasNoTrans, CblasTrans,
-                //            ne01, ne11, ne00,
-                //            1.0f, x, ne00,
-                //                  y, ne00,
-                //            0.0f, z, ne11);
-                //}
+    bool is_node = false;
 
-                float * d = (float *) ((char *) dst->data + i02*nb2 + i03*nb3);
+    if (!inplace && (a->grad || b->grad)) {
+        assert(false); // TODO: implement backward
+        is_node = true;
+    }
 
-                // transpose z
-                //for (int j = 0; j < ne11; ++j) {
-                //    for (int i = 0; i < ne01; ++i) {
-                //        d[j*ne01 + i] = z[i*ne11 + j];
-                //    }
-                //}
+    // make a view of the destination
+    struct ggml_tensor * result = ggml_view_tensor(ctx, b);
 
-                {
-#if 1
-                    // zT = y * xT
-                    cblas_sgemm(CblasRowMajor, CblasNoTrans, CblasTrans,
-                            ne11, ne01, ne10,
-                            1.0f,    y, ne00,
-                                     x, ne00,
-                            0.0f,    d, ne01);
-#else
-                    // zT = (xT * y)T
-                    cblas_sgemm(CblasColMajor, CblasTrans, CblasNoTrans,
-                            ne01, ne11, ne10,
-                            1.0f,    x, ne00,
-                                     y, ne00,
-                            0.0f,    d, ne01);
-#endif
-                }
-            }
-        }
+    result->op   = GGML_OP_CPY;
+    result->grad = is_node ? ggml_dup_tensor(ctx, result) : NULL;
+    result->src0 = a;
+    result->src1 = b;
 
-        //printf("CBLAS = %f ms, %d x %d x %d x %d\n", (ggml_perf_time_us() - t0)/1000.0, ne0, ne1, ne2, ne3);
+    return result;
+}
 
-        return;
-    }
-#endif
+struct ggml_tensor * ggml_cpy(
+        struct ggml_context * ctx,
+        struct ggml_tensor * a,
+        struct ggml_tensor * b) {
+    return ggml_cpy_impl(ctx, a, b, false);
+}
 
-    if (params->type == GGML_TASK_INIT) {
-        if (nb01 >= nb00) {
-            ggml_fp16_t * const wdata = params->wdata;
+struct ggml_tensor * ggml_cpy_inplace(
+        struct ggml_context * ctx,
+        struct ggml_tensor * a,
+        struct ggml_tensor * b) {
+    return ggml_cpy_impl(ctx, a, b, true);
+}
 
-            int id = 0;
-            for (int i13 = 0; i13 < ne13; ++i13) {
-                for (int i12 = 0; i12 < ne12; ++i12) {
-                    for (int i11 = 0; i11 < ne11; ++i11) {
-                        for (int i10 = 0; i10 < ne10; ++i10) {
-                            wdata[id++] = GGML_FP32_TO_FP16(*(float *)((char *) src1->data + i13*nb13 + i12*nb12 + i11*nb11 + i10*nb10));
-                        }
-                    }
-                }
-            }
+// ggml_reshape
 
-            GGML_ASSERT(id*sizeof(ggml_fp16_t) <= params->wsize);
+struct ggml_tensor * ggml_reshape(
+        struct ggml_context * ctx,
+        struct ggml_tensor * a,
+        struct ggml_tensor * b) {
+    assert(ggml_is_contiguous(a));
+    assert(ggml_is_contiguous(b));
+    assert(ggml_nelements(a) == ggml_nelements(b));
 
-            return;
-        }
+    bool is_node = false;
 
-        // TODO: fix this memset (wsize is overestimated)
-        memset(params->wdata, 0, params->wsize);
-        return;
+    if (a->grad || b->grad) {
+        assert(false); // TODO: implement backward
+        is_node = true;
     }
 
-    if (params->type == GGML_TASK_FINALIZE) {
-        if (nb01 >= nb00) {
-            return;
-        }
-
-        // TODO: fix this memset (wsize is overestimated)
-        //assert(params->wsize == (ggml_nbytes(dst) + CACHE_LINE_SIZE)*nth);
-
-        ggml_fp16_t * const wdata = params->wdata;
+    struct ggml_tensor * result = ggml_new_tensor_impl(ctx, a->type, b->n_dims, b->ne, a, 0);
 
-        // cols per thread
-        const int dc = (ne + nth - 1)/nth;
+    result->op   = GGML_OP_RESHAPE;
+    result->grad = is_node ? ggml_dup_tensor(ctx, result) : NULL;
+    result->src0 = a;
+    result->src1 = NULL;
 
-        // col range for this thread
-        const int ic0 = dc*ith;
-        const int ic1 = MIN(ic0 + dc, ne);
+    return result;
+}
 
-        for (int i = ic0; i < ic1; ++i) {
-            ((float *) dst->data)[i] = GGML_FP16_TO_FP32(wdata[i]);
-        }
+struct ggml_tensor * ggml_reshape_2d(
+        struct ggml_context * ctx,
+        struct ggml_tensor  * a,
+        int                   ne0,
+        int                   ne1) {
+    assert(ggml_is_contiguous(a));
+    assert(ggml_nelements(a) == ne0*ne1);
 
-        for (int k = 1; k < nth; k++) {
-            for (int i = ic0; i < ic1; ++i) {
-                ((float *) dst->data)[i] += GGML_FP16_TO_FP32(wdata[(ne + CACHE_LINE_SIZE_F32)*k + i]);
-            }
-        }
+    bool is_node = false;
 
-        return;
+    if (a->grad) {
+        assert(false); // TODO: implement backward
+        is_node = true;
     }
 
-    if (nb01 >= nb00) {
-        // fp16 -> half the size, so divide by 2
-        // TODO: do not support transposed src1
-        assert(nb10/2 == sizeof(ggml_fp16_t));
+    const int ne[2] = { ne0, ne1 };
+    struct ggml_tensor * result = ggml_new_tensor_impl(ctx, a->type, 2, ne, a, 0);
 
-        // parallelize by src0 rows using ggml_vec_dot_f16
+    result->op   = GGML_OP_RESHAPE;
+    result->grad = is_node ? ggml_dup_tensor(ctx, result) : NULL;
+    result->src0 = a;
+    result->src1 = NULL;
 
-        // total rows in src0
-        const int nr = ne01*ne02*ne03;
+    return result;
+}
 
-        // rows per thread
-        const int dr = (nr + nth - 1)/nth;
+struct ggml_tensor * ggml_reshape_3d(
+        struct ggml_context * ctx,
+        struct ggml_tensor  * a,
+        int                   ne0,
+        int                   ne1,
+        int                   ne2) {
+    assert(ggml_is_contiguous(a));
+    assert(ggml_nelements(a) == ne0*ne1*ne2);
 
-        // row range for this thread
-        const int ir0 = dr*ith;
-        const int ir1 = MIN(ir0 + dr, nr);
+    bool is_node = false;
 
-        ggml_fp16_t * wdata = params->wdata;
+    if (a->grad) {
+        assert(false); // TODO: implement backward
+        is_node = true;
+    }
 
-        for (int ir = ir0; ir < ir1; ++ir) {
-            // src0 indices
-            const int i03 = ir/(ne02*ne01);
-            const int i02 = (ir - i03*ne02*ne01)/ne01;
-            const int i01 = (ir - i03*ne02*ne01 - i02*ne01);
+    const int ne[3] = { ne0, ne1, ne2 };
+    struct ggml_tensor * result = ggml_new_tensor_impl(ctx, a->type, 3, ne, a, 0);
 
-            const int i13 = i03;
-            const int i12 = i02;
+    result->op   = GGML_OP_RESHAPE;
+    result->grad = is_node ? ggml_dup_tensor(ctx, result) : NULL;
+    result->src0 = a;
+    result->src1 = NULL;
 
-            const int i0 = i01;
-            const int i2 = i02;
-            const int i3 = i03;
+    return result;
+}
 
-            ggml_fp16_t * src0_row = (ggml_fp16_t *) ((char *) src0->data + (i01*nb01 + i02*nb02 + i03*nb03));
-            ggml_fp16_t * src1_col =                                wdata + (       0 + i12*ne11 + i13*ne12*ne11)*ne00;
+// ggml_view_1d
 
-            float * dst_col = (float *) ((char *) dst->data + (i0*nb0 + 0*nb1 + i2*nb2 + i3*nb3));
+struct ggml_tensor * ggml_view_1d(
+        struct ggml_context * ctx,
+        struct ggml_tensor  * a,
+        int                   ne0,
+        size_t                offset) {
+    if (a->grad) {
+        assert(false); // gradient propagation is not supported
+    }
 
-            assert(ne00 % 32 == 0);
+    struct ggml_tensor * result = ggml_new_tensor_impl(ctx, a->type, 1, &ne0, a, offset);
 
-            for (int ic = 0; ic < ne11; ++ic) {
-                ggml_vec_dot_f16(ne00, &dst_col[ic*ne0], src0_row, src1_col + ic*ne00);
-            }
-        }
-    } else {
-        // parallelize by src1 columns using ggml_vec_mad_f16
-        // each thread has its own work data
-        // during FINALIZE we accumulate all work data into dst
+    result->op   = GGML_OP_VIEW;
+    result->grad = NULL;
+    result->src0 = a;
+    result->src1 = NULL; // TODO: maybe store the offset here?
 
-        // total columns in src1
-        const int nc = ne10;
-
-        // columns per thread
-        const int dc = (nc + nth - 1)/nth;
+    return result;
+}
 
-        // column range for this thread
-        const int ic0 = dc*ith;
-        const int ic1 = MIN(ic0 + dc, nc);
+// ggml_view_2d
 
-        // work data for thread
-        const int wo = (ne + CACHE_LINE_SIZE_F32)*ith;
-        ggml_fp16_t * const wdata = params->wdata;
+struct ggml_tensor * ggml_view_2d(
+        struct ggml_context * ctx,
+        struct ggml_tensor  * a,
+        int                   ne0,
+        int                   ne1,
+        size_t                nb1,
+        size_t                offset) {
+    if (a->grad) {
+        assert(false); // gradient propagation is not supported
+    }
 
-        for (int i13 = 0; i13 < ne13; ++i13) {
-            for (int i12 = 0; i12 < ne12; ++i12) {
-                for (int i11 = 0; i11 < ne11; ++i11) {
-                    // dst indices
-                    const int i1 = i11;
-                    const int i2 = i12;
-                    const int i3 = i13;
+    const int ne[GGML_MAX_DIMS] = { ne0, ne1, 1, 1 };
 
-                    ggml_fp16_t * dst_row = wdata + wo + i3*ne2*ne1*ne0 + i2*ne1*ne0 + i1*ne0;
+    struct ggml_tensor * result = ggml_new_tensor_impl(ctx, a->type, 2, ne, a, offset);
 
-                    for (int ic = ic0; ic < ic1; ++ic) {
-                        // src1 indices
-                        const int i10 = ic;
+    result->nb[1] = nb1;
+    result->nb[2] = result->nb[1]*ne1;
+    result->nb[3] = result->nb[2];
 
-                        // src0 indices
-                        const int i03 = i13;
-                        const int i02 = i12;
-                        const int i00 = ic;
+    result->op   = GGML_OP_VIEW;
+    result->grad = NULL;
+    result->src0 = a;
+    result->src1 = NULL; // TODO: maybe store the offset here?
 
-                        assert(sizeof(ggml_fp16_t)*(wo + i3*ne2*ne1*ne0 + i2*ne1*ne0 + i1*ne0 + ne01) <= params->wsize);
+    return result;
+}
 
-                        ggml_fp16_t * src0_col =  (ggml_fp16_t *) ((char *) src0->data + (i00*nb00 + i02*nb02 + i03*nb03));
-                        float         src1_val = *      (float *) ((char *) src1->data + (i10*nb10 + i11*nb11 + i12*nb12 + i13*nb13));
+// ggml_permute
 
-                        ggml_vec_mad_f16(ne01, dst_row, src0_col, src1_val);
-                    }
-                }
-            }
-        }
-    }
+struct ggml_tensor * ggml_permute(
+        struct ggml_context * ctx,
+        struct ggml_tensor  * a,
+        int                   axis0,
+        int                   axis1,
+        int                   axis2,
+        int                   axis3) {
+    assert(axis0 >= 0 && axis0 < GGML_MAX_DIMS);
+    assert(axis1 >= 0 && axis1 < GGML_MAX_DIMS);
+    assert(axis2 >= 0 && axis2 < GGML_MAX_DIMS);
+    assert(axis3 >= 0 && axis3 < GGML_MAX_DIMS);
 
-    //int64_t t1 = ggml_time_us();
-    //static int64_t acc = 0;
-    //acc += t1 - t0;
-    //if (t1 - t0 > 10) {
-    //    printf("\n");
-    //    printf("ne00 = %5d, ne01 = %5d, ne02 = %5d, ne03 = %5d\n", ne00, ne01, ne02, ne03);
-    //    printf("nb00 = %5d, nb01 = %5d, nb02 = %5d, nb03 = %5d\n", nb00, nb01, nb02, nb03);
-    //    printf("ne10 = %5d, ne11 = %5d, ne12 = %5d, ne13 = %5d\n", ne10, ne11, ne12, ne13);
+    assert(axis0 != axis1);
+    assert(axis0 != axis2);
+    assert(axis0 != axis3);
+    assert(axis1 != axis2);
+    assert(axis1 != axis3);
+    assert(axis2 != axis3);
 
-    //    printf("XXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXX task %d/%d: %d us, acc = %d\n", ith, nth, (int) (t1 - t0), (int) acc);
-    //}
-}
+    bool is_node = false;
 
-static void ggml_compute_forward_mul_mat(
-        const struct ggml_compute_params * params,
-        const struct ggml_tensor * src0,
-        const struct ggml_tensor * src1,
-        struct ggml_tensor * dst) {
-    switch (src0->type) {
-        case GGML_TYPE_F16:
-            {
-                ggml_compute_forward_mul_mat_f16_f32(params, src0, src1, dst);
-            } break;
-        case GGML_TYPE_F32:
-            {
-                ggml_compute_forward_mul_mat_f32(params, src0, src1, dst);
-            } break;
-        case GGML_TYPE_I8:
-        case GGML_TYPE_I16:
-        case GGML_TYPE_I32:
-        case GGML_TYPE_COUNT:
-            {
-                assert(false);
-            } break;
+    if (a->grad) {
+        assert(false); // TODO: implement backward
+        is_node = true;
     }
-}
-
-// ggml_compute_forward_scale
 
-static void ggml_compute_forward_scale_f32(
-        const struct ggml_compute_params * params,
-        const struct ggml_tensor * src0,
-        const struct ggml_tensor * src1,
-        struct ggml_tensor * dst) {
-    GGML_ASSERT(ggml_is_contiguous(src0));
-    GGML_ASSERT(ggml_is_contiguous(dst));
-    GGML_ASSERT(ggml_are_same_shape(src0, dst));
-    GGML_ASSERT(ggml_is_scalar(src1));
+    struct ggml_tensor * result = ggml_view_tensor(ctx, a);
 
-    if (params->type == GGML_TASK_INIT || params->type == GGML_TASK_FINALIZE) {
-        return;
-    }
+    int ne[GGML_MAX_DIMS];
+    int nb[GGML_MAX_DIMS];
 
-    // scale factor
-    const float v = *(float *) src1->data;
+    ne[axis0] = a->ne[0];
+    ne[axis1] = a->ne[1];
+    ne[axis2] = a->ne[2];
+    ne[axis3] = a->ne[3];
 
-    const int ith = params->ith;
-    const int nth = params->nth;
+    nb[axis0] = a->nb[0];
+    nb[axis1] = a->nb[1];
+    nb[axis2] = a->nb[2];
+    nb[axis3] = a->nb[3];
 
-    const int nc = src0->ne[0];
-    const int nr = ggml_nrows(src0);
+    result->ne[0] = ne[0];
+    result->ne[1] = ne[1];
+    result->ne[2] = ne[2];
+    result->ne[3] = ne[3];
 
-    // rows per thread
-    const int dr = (nr + nth - 1)/nth;
+    result->nb[0] = nb[0];
+    result->nb[1] = nb[1];
+    result->nb[2] = nb[2];
+    result->nb[3] = nb[3];
 
-    // row range for this thread
-    const int ir0 = dr*ith;
-    const int ir1 = MIN(ir0 + dr, nr);
+    result->op   = GGML_OP_PERMUTE;
+    result->grad = is_node ? ggml_dup_tensor(ctx, result) : NULL;
+    result->src0 = a;
+    result->src1 = NULL; // TODO: maybe store the permutation here?
 
-    for (int i1 = ir0; i1 < ir1; i1++) {
-        ggml_vec_scale_f32(nc, (float *) ((char *) dst->data + i1*(dst->nb[1])), v);
-    }
+    return result;
 }
 
-static void ggml_compute_forward_scale(
-        const struct ggml_compute_params * params,
-        const struct ggml_tensor * src0,
-        const struct ggml_tensor * src1,
-        struct ggml_tensor * dst) {
-    switch (src0->type) {
-        case GGML_TYPE_F32:
-            {
-                ggml_compute_forward_scale_f32(params, src0, src1, dst);
-            } break;
-        case GGML_TYPE_I8:
-        case GGML_TYPE_I16:
-        case GGML_TYPE_I32:
-        case GGML_TYPE_F16:
-        case GGML_TYPE_COUNT:
-            {
-                assert(false);
-            } break;
-    }
-}
+// ggml_transpose
 
-// ggml_compute_forward_cpy
+struct ggml_tensor * ggml_transpose(
+        struct ggml_context * ctx,
+        struct ggml_tensor  * a) {
+    bool is_node = false;
 
-static void ggml_compute_forward_cpy(
-        const struct ggml_compute_params * params,
-        const struct ggml_tensor * src0,
-        struct ggml_tensor * dst) {
-    ggml_compute_forward_dup(params, src0, dst);
-}
+    if (a->grad) {
+        assert(false); // TODO: implement backward
+        is_node = true;
+    }
 
-// ggml_compute_forward_reshape
+    struct ggml_tensor * result = ggml_view_tensor(ctx, a);
 
-static void ggml_compute_forward_reshape(
-        const struct ggml_compute_params * params,
-        const struct ggml_tensor * src0,
-        struct ggml_tensor * dst) {
-    // NOP
-    UNUSED(params);
-    UNUSED(src0);
-    UNUSED(dst);
-}
+    result->ne[0] = a->ne[1];
+    result->ne[1] = a->ne[0];
 
-// ggml_compute_forward_view
+    result->nb[0] = a->nb[1];
+    result->nb[1] = a->nb[0];
 
-static void ggml_compute_forward_view(
-        const struct ggml_compute_params * params,
-        const struct ggml_tensor * src0) {
-    // NOP
-    UNUSED(params);
-    UNUSED(src0);
+    result->op   = GGML_OP_TRANSPOSE;
+    result->grad = is_node ? ggml_dup_tensor(ctx, result) : NULL;
+    result->src0 = a;
+    result->src1 = NULL;
+
+    return result;
 }
 
-// ggml_compute_forward_permute
+// ggml_get_rows
 
-static void ggml_compute_forward_permute(
-        const struct ggml_compute_params * params,
-        const struct ggml_tensor * src0) {
-    // NOP
-    UNUSED(params);
-    UNUSED(src0);
-}
+struct ggml_tensor * ggml_get_rows(
+        struct ggml_context * ctx,
+        struct ggml_tensor  * a,
+        struct ggml_tensor  * b) {
+    assert(ggml_is_matrix(a) && ggml_is_vector(b) && b->type == GGML_TYPE_I32);
 
-// ggml_compute_forward_transpose
+    bool is_node = false;
 
-static void ggml_compute_forward_transpose(
-        const struct ggml_compute_params * params,
-        const struct ggml_tensor * src0) {
-    // NOP
-    UNUSED(params);
-    UNUSED(src0);
-}
+    if (a->grad || b->grad) {
+        assert(false); // TODO: implement backward
+        is_node = true;
+    }
 
-// ggml_compute_forward_get_rows
+    // TODO: implement non F32 return
+    //struct ggml_tensor * result = ggml_new_tensor_2d(ctx, a->type, a->ne[0], b->ne[0]);
+    struct ggml_tensor * result = ggml_new_tensor_2d(ctx, GGML_TYPE_F32, a->ne[0], b->ne[0]);
 
-static void ggml_compute_forward_get_rows_f16(
-        const struct ggml_compute_params * params,
-        const struct ggml_tensor * src0,
-        const struct ggml_tensor * src1,
-              struct ggml_tensor * dst) {
-    assert(params->ith == 0);
-
-    if (params->type == GGML_TASK_INIT || params->type == GGML_TASK_FINALIZE) {
-        return;
-    }
+    result->op   = GGML_OP_GET_ROWS;
+    result->grad = is_node ? ggml_dup_tensor(ctx, result) : NULL;
+    result->src0 = a;
+    result->src1 = b;
 
-    const int nc = src0->ne[0];
-    const int nr = ggml_nelements(src1);
+    return result;
+}
 
-    assert( dst->ne[0] == nc);
-    assert( dst->ne[1] == nr);
-    assert(src0->nb[0] == sizeof(ggml_fp16_t));
+// ggml_diag_mask_inf
 
-    for (int i = 0; i < nr; ++i) {
-        const int r = ((int32_t *) src1->data)[i];
+struct ggml_tensor * ggml_diag_mask_inf(
+        struct ggml_context * ctx,
+        struct ggml_tensor  * a,
+        int                   n_past) {
+    bool is_node = false;
 
-        for (int j = 0; j < nc; ++j) {
-            ggml_fp16_t v = ((ggml_fp16_t *) ((char *) src0->data + r*src0->nb[1]))[j];
-            ((float *) ((char *)  dst->data + i*dst->nb[1]))[j] = GGML_FP16_TO_FP32(v);
-        }
+    if (a->grad) {
+        assert(false); // TODO: implement backward
+        is_node = true;
     }
-}
 
-static void ggml_compute_forward_get_rows_f32(
-        const struct ggml_compute_params * params,
-        const struct ggml_tensor * src0,
-        const struct ggml_tensor * src1,
-              struct ggml_tensor * dst) {
-    assert(params->ith == 0);
+    // TODO: when implement backward, fix this:
+    //struct ggml_tensor * result = inplace ? ggml_view_tensor(ctx, a) : ggml_dup_tensor(ctx, a);
+    struct ggml_tensor * result = ggml_view_tensor(ctx, a);
 
-    if (params->type == GGML_TASK_INIT || params->type == GGML_TASK_FINALIZE) {
-        return;
-    }
+    ggml_scratch_save(ctx);
 
-    const int nc = src0->ne[0];
-    const int nr = ggml_nelements(src1);
+    struct ggml_tensor * b = ggml_new_tensor_1d(ctx, GGML_TYPE_I32, 1);
 
-    assert( dst->ne[0] == nc);
-    assert( dst->ne[1] == nr);
-    assert(src0->nb[0] == sizeof(float));
+    ggml_scratch_load(ctx);
 
-    for (int i = 0; i < nr; ++i) {
-        const int r = ((int32_t *) src1->data)[i];
+    ((int32_t *) b->data)[0] = n_past;
 
-        ggml_vec_cpy_f32(nc,
-                (float *) ((char *)  dst->data + i*dst->nb[1]),
-                (float *) ((char *) src0->data + r*src0->nb[1]));
-    }
+    result->op   = GGML_OP_DIAG_MASK_INF;
+    result->grad = is_node ? ggml_dup_tensor(ctx, result) : NULL;
+    result->src0 = a;
+    result->src1 = b;
+
+    return result;
 }
 
-static void ggml_compute_forward_get_rows(
-        const struct ggml_compute_params * params,
-        const struct ggml_tensor * src0,
-        const struct ggml_tensor * src1,
-        struct ggml_tensor * dst) {
-    switch (src0->type) {
-        case GGML_TYPE_F16:
-            {
-                ggml_compute_forward_get_rows_f16(params, src0, src1, dst);
-            } break;
-        case GGML_TYPE_F32:
-            {
-                ggml_compute_forward_get_rows_f32(params, src0, src1, dst);
-            } break;
-        case GGML_TYPE_I8:
-        case GGML_TYPE_I16:
-        case GGML_TYPE_I32:
-        case GGML_TYPE_COUNT:
-            {
-                assert(false);
-            } break;
+// ggml_soft_max
+
+struct ggml_tensor * ggml_soft_max(
+        struct ggml_context * ctx,
+        struct ggml_tensor  * a) {
+    bool is_node = false;
+
+    if (a->grad) {
+        assert(false); // TODO: implement backward
+        is_node = true;
     }
+
+    // TODO: when implement backward, fix this:
+    //struct ggml_tensor * result = inplace ? ggml_view_tensor(ctx, a) : ggml_dup_tensor(ctx, a);
+    struct ggml_tensor * result = ggml_view_tensor(ctx, a);
+
+    result->op   = GGML_OP_SOFT_MAX;
+    result->grad = is_node ? ggml_dup_tensor(ctx, result) : NULL;
+    result->src0 = a;
+    result->src1 = NULL;
+
+    return result;
 }
 
-// ggml_compute_forward_diag_mask_inf
+// ggml_soft_max_ext
 
-static void ggml_compute_forward_diag_mask_inf_f32(
-        const struct ggml_compute_params * params,
-        const struct ggml_tensor * src0,
-        const struct ggml_tensor * src1,
-        struct ggml_tensor * dst) {
-    assert(params->ith == 0);
-    assert(src1->type == GGML_TYPE_I32);
-    assert(ggml_nelements(src1) == 1);
+struct ggml_tensor * ggml_soft_max_ext(
+        struct ggml_context * ctx,
+        struct ggml_tensor  * a,
+        float                 scale,
+        int                   n_past) {
+    struct ggml_tensor * result = ggml_soft_max(ctx, a);
 
-    if (params->type == GGML_TASK_INIT || params->type == GGML_TASK_FINALIZE) {
-        return;
-    }
+    ggml_scratch_save(ctx);
 
-    const int n_past = ((int32_t *) src1->data)[0];
+    struct ggml_tensor * b = ggml_new_tensor_1d(ctx, GGML_TYPE_F32, 1);
+    struct ggml_tensor * c = ggml_new_tensor_1d(ctx, GGML_TYPE_I32, 1);
 
-    // TODO: handle transposed/permuted matrices
+    ggml_scratch_load(ctx);
 
-    const int n  = ggml_nrows(src0);
-    const int nc = src0->ne[0];
-    const int nr = src0->ne[1];
-    const int nz = n/nr;
+    ((float   *) b->data)[0] = scale;
+    ((int32_t *) c->data)[0] = n_past;
 
-    assert( dst->nb[0] == sizeof(float));
-    assert(src0->nb[0] == sizeof(float));
+    result->src1   = b;
+    result->opt[0] = c;
 
-    for (int k = 0; k < nz; k++) {
-        for (int j = 0; j < nr; j++) {
-            for (int i = n_past; i < nc; i++) {
-                if (i > n_past + j) {
-                    *(float *)((char *) dst->data + k*dst->nb[2] + j*dst->nb[1] + i*dst->nb[0]) = -INFINITY;
-                }
-            }
-        }
-    }
+    return result;
 }
 
-static void ggml_compute_forward_diag_mask_inf(
-        const struct ggml_compute_params * params,
-        const struct ggml_tensor * src0,
-        const struct ggml_tensor * src1,
-        struct ggml_tensor * dst) {
-    switch (src0->type) {
-        case GGML_TYPE_F32:
-            {
-                ggml_compute_forward_diag_mask_inf_f32(params, src0, src1, dst);
-            } break;
-        case GGML_TYPE_I8:
-        case GGML_TYPE_I16:
-        case GGML_TYPE_I32:
-        case GGML_TYPE_F16:
-        case GGML_TYPE_COUNT:
-            {
-                assert(false);
-            } break;
+// ggml_rope
+
+struct ggml_tensor * ggml_rope(
+        struct ggml_context * ctx,
+        struct ggml_tensor  * a,
+        int                   n_past,
+        int                   n_dims,
+        int                   mode) {
+    assert(n_past >= 0);
+    bool is_node = false;
+
+    if (a->grad) {
+        assert(false); // TODO: implement backward
+        is_node = true;
     }
-}
 
-// ggml_compute_forward_soft_max
+    // TODO: when implement backward, fix this:
+    //struct ggml_tensor * result = inplace ? ggml_view_tensor(ctx, a) : ggml_dup_tensor(ctx, a);
+    struct ggml_tensor * result = ggml_view_tensor(ctx, a);
 
-static void ggml_compute_forward_soft_max_f32(
-        const struct ggml_compute_params * params,
-        const struct ggml_tensor * src0,
-        struct ggml_tensor * dst) {
-    GGML_ASSERT(ggml_is_contiguous(src0));
-    GGML_ASSERT(ggml_is_contiguous(dst));
-    GGML_ASSERT(ggml_are_same_shape(src0, dst));
+    ggml_scratch_save(ctx);
 
-    if (params->type == GGML_TASK_INIT || params->type == GGML_TASK_FINALIZE) {
-        return;
-    }
+    struct ggml_tensor * b = ggml_new_tensor_1d(ctx, GGML_TYPE_I32, 3);
 
-    // TODO: handle transposed/permuted matrices
+    ggml_scratch_load(ctx);
 
-    const int ith = params->ith;
-    const int nth = params->nth;
+    ((int32_t *) b->data)[0] = n_past;
+    ((int32_t *) b->data)[1] = n_dims;
+    ((int32_t *) b->data)[2] = mode;
 
-    const int nc = src0->ne[0];
-    const int nr = ggml_nrows(src0);
+    result->op   = GGML_OP_ROPE;
+    result->grad = is_node ? ggml_dup_tensor(ctx, result) : NULL;
+    result->src0 = a;
+    result->src1 = b;
 
-    // rows per thread
-    const int dr = (nr + nth - 1)/nth;
+    return result;
+}
 
-    // row range for this thread
-    const int ir0 = dr*ith;
-    const int ir1 = MIN(ir0 + dr, nr);
+// ggml_conv_1d_1s
 
-    for (int i1 = ir0; i1 < ir1; i1++) {
-        float *p = (float *)((char *) dst->data + i1*dst->nb[1]);
+struct ggml_tensor * ggml_conv_1d_1s(
+        struct ggml_context * ctx,
+        struct ggml_tensor  * a,
+        struct ggml_tensor  * b) {
+    assert(ggml_is_matrix(b));
+    assert(a->ne[1] == b->ne[1]);
+    assert(a->ne[3] == 1);
+    bool is_node = false;
 
-#ifndef NDEBUG
-        for (int i = 0; i < nc; ++i) {
-            assert(!isnan(p[i]));
-        }
-#endif
+    if (a->grad || b->grad) {
+        assert(false); // TODO: implement backward
+        is_node = true;
+    }
 
-        float max = -INFINITY;
-        ggml_vec_max_f32(nc, &max, p);
+    const int ne[4] = { b->ne[0], a->ne[2], 1, 1, };
+    struct ggml_tensor * result = ggml_new_tensor(ctx, GGML_TYPE_F32, 2, ne);
 
-        ggml_float sum = 0.0;
+    result->op   = GGML_OP_CONV_1D_1S;
+    result->grad = is_node ? ggml_dup_tensor(ctx, result) : NULL;
+    result->src0 = a;
+    result->src1 = b;
 
-        uint16_t scvt;
-        for (int i = 0; i < nc; i++) {
-            if (p[i] == -INFINITY) {
-                p[i] = 0.0f;
-            } else {
-                //const float val = (p[i] == -INFINITY) ? 0.0 : exp(p[i] - max);
-                ggml_fp16_t s = GGML_FP32_TO_FP16(p[i] - max);
-                memcpy(&scvt, &s, sizeof(scvt));
-                const float val = GGML_FP16_TO_FP32(table_exp_f16[scvt]);
-                sum += val;
-                p[i] = val;
-            }
-        }
+    return result;
+}
 
-        assert(sum > 0.0f);
+// ggml_conv_1d_2s
 
-        sum = 1.0/sum;
-        ggml_vec_scale_f32(nc, p, sum);
+struct ggml_tensor * ggml_conv_1d_2s(
+        struct ggml_context * ctx,
+        struct ggml_tensor  * a,
+        struct ggml_tensor  * b) {
+    assert(ggml_is_matrix(b));
+    assert(a->ne[1] == b->ne[1]);
+    assert(a->ne[3] == 1);
+    bool is_node = false;
 
-#ifndef NDEBUG
-        for (int i = 0; i < nc; ++i) {
-            assert(!isnan(p[i]));
-            assert(!isinf(p[i]));
-        }
-#endif
+    if (a->grad || b->grad) {
+        assert(false); // TODO: implement backward
+        is_node = true;
     }
-}
 
-static void ggml_compute_forward_soft_max(
-        const struct ggml_compute_params * params,
-        const struct ggml_tensor * src0,
-        struct ggml_tensor * dst) {
-    switch (src0->type) {
-        case GGML_TYPE_F32:
-            {
-                ggml_compute_forward_soft_max_f32(params, src0, dst);
-            } break;
-        case GGML_TYPE_I8:
-        case GGML_TYPE_I16:
-        case GGML_TYPE_I32:
-        case GGML_TYPE_F16:
-        case GGML_TYPE_COUNT:
-            {
-                assert(false);
-            } break;
-    }
+    const int ne[4] = { b->ne[0]/2, a->ne[2], 1, 1, };
+    struct ggml_tensor * result = ggml_new_tensor(ctx, GGML_TYPE_F32, 2, ne);
+
+    result->op   = GGML_OP_CONV_1D_2S;
+    result->grad = is_node ? ggml_dup_tensor(ctx, result) : NULL;
+    result->src0 = a;
+    result->src1 = b;
+
+    return result;
 }
 
-// ggml_compute_forward_rope
+// ggml_conv_1d_1s_bias
 
-static void ggml_compute_forward_rope_f32(
-        const struct ggml_compute_params * params,
-        const struct ggml_tensor * src0,
-        const struct ggml_tensor * src1,
-        struct ggml_tensor * dst) {
-    assert(params->ith == 0);
-    assert(src1->type == GGML_TYPE_I32);
-    assert(ggml_nelements(src1) == 3);
+struct ggml_tensor * ggml_conv_1d_1s_bias(
+        struct ggml_context * ctx,
+        struct ggml_tensor  * a,
+        struct ggml_tensor  * b,
+        struct ggml_tensor  * c,
+        bool                  gelu) {
+    GGML_ASSERT(c == NULL || (ggml_nelements(c) == a->ne[2] && c->type == GGML_TYPE_F32));
 
-    if (params->type == GGML_TASK_INIT || params->type == GGML_TASK_FINALIZE) {
-        return;
-    }
+    struct ggml_tensor * result = ggml_conv_1d_1s(ctx, a, b);
 
-    const int n_past = ((int32_t *) src1->data)[0];
-    const int n_dims = ((int32_t *) src1->data)[1];
-    const int mode   = ((int32_t *) src1->data)[2];
+    result->opt[0] = c;
+    result->opt[1] = ggml_new_i32(ctx, gelu ? 1 : 0);
 
-    //const int ne0 = src0->ne[0];
-    const int ne1 = src0->ne[1];
-    const int ne2 = src0->ne[2];
-    const int ne3 = src0->ne[3];
+    return result;
+}
 
-    const int nb0 = src0->nb[0];
-    const int nb1 = src0->nb[1];
-    const int nb2 = src0->nb[2];
-    const int nb3 = src0->nb[3];
+// ggml_conv_1d_2s_bias
 
-    //printf("ne0: %d, ne1: %d, ne2: %d, ne3: %d\n", ne0, ne1, ne2, ne3);
-    //printf("n_past = %d, ne2 = %d\n", n_past, ne2);
+struct ggml_tensor * ggml_conv_1d_2s_bias(
+        struct ggml_context * ctx,
+        struct ggml_tensor  * a,
+        struct ggml_tensor  * b,
+        struct ggml_tensor  * c,
+        bool                  gelu) {
+    GGML_ASSERT(c == NULL || (ggml_nelements(c) == a->ne[2] && c->type == GGML_TYPE_F32));
 
-    assert(nb0 == sizeof(float));
+    struct ggml_tensor * result = ggml_conv_1d_2s(ctx, a, b);
 
-    // TODO: optimize
-    for (int i3 = 0; i3 < ne3; i3++) {
-        for (int i2 = (mode == 0 ? 0 : n_past); i2 < ne2; i2++) {
-            const int p = (mode == 0 ? n_past + i2 : i2);
-            for (int i1 = 0; i1 < ne1; i1++) {
-                for (int i0 = 0; i0 < n_dims; i0 += 2) {
-                    const double theta = pow(10000.0, ((double)-i0)/n_dims);
+    result->opt[0] = c;
+    result->opt[1] = ggml_new_i32(ctx, gelu ? 1 : 0);
 
-                    const double cos_theta = cos(p*theta);
-                    const double sin_theta = sin(p*theta);
+    return result;
+}
 
-                    const float * const src = (float *)((char *) src0->data + i3*nb3 + i2*nb2 + i1*nb1 + i0*nb0);
-                          float * dst_data  = (float *)((char *)  dst->data + i3*nb3 + i2*nb2 + i1*nb1 + i0*nb0);
+// ggml_flash_attn
 
-                    double x0 = src[0];
-                    double x1 = src[1];
+struct ggml_tensor * ggml_flash_attn(
+        struct ggml_context * ctx,
+        struct ggml_tensor  * q,
+        struct ggml_tensor  * k,
+        struct ggml_tensor  * v,
+        bool                  masked) {
+    assert(ggml_can_mul_mat(k, q));
+    // TODO: check if vT can be multiplied by (k*qT)
+    GGML_ASSERT(k->type == v->type);
 
-                    dst_data[0] = x0*cos_theta - x1*sin_theta;
-                    dst_data[1] = x0*sin_theta + x1*cos_theta;
-                }
-            }
-        }
-    }
-}
+    bool is_node = false;
 
-static void ggml_compute_forward_rope(
-        const struct ggml_compute_params * params,
-        const struct ggml_tensor * src0,
-        const struct ggml_tensor * src1,
-        struct ggml_tensor * dst) {
-    switch (src0->type) {
-        case GGML_TYPE_F32:
-            {
-                ggml_compute_forward_rope_f32(params, src0, src1, dst);
-            } break;
-        case GGML_TYPE_I8:
-        case GGML_TYPE_I16:
-        case GGML_TYPE_I32:
-        case GGML_TYPE_F16:
-        case GGML_TYPE_COUNT:
-            {
-                assert(false);
-            } break;
+    if (q->grad || k->grad || v->grad) {
+        GGML_ASSERT(false); // TODO: implement backward
+        is_node = true;
     }
+
+    //struct ggml_tensor * result = ggml_dup_tensor(ctx, q);
+    struct ggml_tensor * result = ggml_new_tensor(ctx, GGML_TYPE_F32, 4, q->ne);
+
+    result->op   = GGML_OP_FLASH_ATTN;
+    result->grad = is_node ? ggml_dup_tensor(ctx, result) : NULL;
+    result->src0 = q;
+    result->src1 = k;
+    result->opt[0] = v;
+    result->opt[1] = ggml_new_i32(ctx, masked ? 1 : 0);
+
+    return result;
 }
 
-// ggml_compute_forward_conv_1d_1s
+// ggml_flash_ff
 
-static void ggml_compute_forward_conv_1d_1s_f16_f32(
-        const struct ggml_compute_params * params,
-        const struct ggml_tensor * src0,
-        const struct ggml_tensor * src1,
-              struct ggml_tensor * dst) {
-    GGML_ASSERT(src0->type == GGML_TYPE_F16);
-    GGML_ASSERT(src1->type == GGML_TYPE_F32);
-    GGML_ASSERT( dst->type == GGML_TYPE_F32);
+struct ggml_tensor * ggml_flash_ff(
+        struct ggml_context * ctx,
+        struct ggml_tensor  * a,
+        struct ggml_tensor  * b0,
+        struct ggml_tensor  * b1,
+        struct ggml_tensor  * c0,
+        struct ggml_tensor  * c1) {
+    assert(ggml_can_mul_mat(b0, a));
+    // TODO: more checks
 
-    int64_t t0 = ggml_perf_time_us();
-    UNUSED(t0);
+    bool is_node = false;
 
-    const int ne00 = src0->ne[0];
-    const int ne01 = src0->ne[1];
-    const int ne02 = src0->ne[2];
-    //const int ne03 = src0->ne[3];
+    if (a->grad || b0->grad || b1->grad || c0->grad || c1->grad) {
+        GGML_ASSERT(false); // TODO: implement backward
+        is_node = true;
+    }
 
-    const int ne10 = src1->ne[0];
-    const int ne11 = src1->ne[1];
-    //const int ne12 = src1->ne[2];
-    //const int ne13 = src1->ne[3];
+    //struct ggml_tensor * result = ggml_dup_tensor(ctx, a);
+    struct ggml_tensor * result = ggml_new_tensor(ctx, GGML_TYPE_F32, 4, a->ne);
 
-    //const int ne0  = dst->ne[0];
-    //const int ne1  = dst->ne[1];
-    //const int ne2  = dst->ne[2];
-    //const int ne3  = dst->ne[3];
-    //const int ne   = ne0*ne1*ne2*ne3;
+    result->op   = GGML_OP_FLASH_FF;
+    result->grad = is_node ? ggml_dup_tensor(ctx, result) : NULL;
+    result->src0 = a;
+    result->src1 = b0;
+    result->opt[0] = b1;
+    result->opt[1] = c0;
+    result->opt[2] = c1;
 
-    const int nb00 = src0->nb[0];
-    const int nb01 = src0->nb[1];
-    const int nb02 = src0->nb[2];
-    //const int nb03 = src0->nb[3];
+    return result;
+}
 
-    const int nb10 = src1->nb[0];
-    const int nb11 = src1->nb[1];
-    //const int nb12 = src1->nb[2];
-    //const int nb13 = src1->nb[3];
+////////////////////////////////////////////////////////////////////////////////
 
-    //const int nb0  = dst->nb[0];
-    const int nb1  = dst->nb[1];
-    //const int nb2  = dst->nb[2];
-    //const int nb3  = dst->nb[3];
+void ggml_set_param(
+        struct ggml_context * ctx,
+        struct ggml_tensor * tensor) {
+    tensor->is_param = true;
 
-    const int ith = params->ith;
-    const int nth = params->nth;
+    assert(tensor->grad == NULL);
+    tensor->grad = ggml_dup_tensor(ctx, tensor);
+}
 
-    const int nk = ne00;
-    const int nh = nk/2;
+// ggml_compute_forward_dup
 
-    const int ew0 = ggml_up32(ne01);
+static void ggml_compute_forward_dup_f16(
+        const struct ggml_compute_params * params,
+        const struct ggml_tensor * src0,
+        struct ggml_tensor * dst) {
+    assert(ggml_is_contiguous(dst));
+    assert(ggml_nelements(dst) == ggml_nelements(src0));
 
-    GGML_ASSERT(ne00 % 2 == 1); // TODO: support even kernel sizes
-    GGML_ASSERT(nb00 == sizeof(ggml_fp16_t));
-    GGML_ASSERT(nb10 == sizeof(float));
+    if (params->type == GGML_TASK_INIT || params->type == GGML_TASK_FINALIZE) {
+        return;
+    }
 
-    if (params->type == GGML_TASK_INIT) {
-        // TODO: fix this memset (wsize is overestimated)
-        memset(params->wdata, 0, params->wsize);
+    const int ith = params->ith;
+    const int nth = params->nth;
 
-        // prepare kernel data (src0)
-        {
-            ggml_fp16_t * const wdata = (ggml_fp16_t *) params->wdata + 0;
+    const int ne00 = src0->ne[0];
+    const int ne01 = src0->ne[1];
+    const int ne02 = src0->ne[2];
+    const int ne03 = src0->ne[3];
 
-            for (int i02 = 0; i02 < ne02; i02++) {
-                for (int i01 = 0; i01 < ne01; i01++) {
-                    const ggml_fp16_t * const src = (ggml_fp16_t *)((char *) src0->data + i02*nb02 + i01*nb01);
-                    ggml_fp16_t * dst_data = wdata + i02*ew0*ne00;
-                    for (int i00 = 0; i00 < ne00; i00++) {
-                        dst_data[i00*ew0 + i01] = src[i00];
-                    }
-                }
-            }
-        }
+    const size_t nb00 = src0->nb[0];
+    const size_t nb01 = src0->nb[1];
+    const size_t nb02 = src0->nb[2];
+    const size_t nb03 = src0->nb[3];
 
-        // prepare source data (src1)
-        {
-            ggml_fp16_t * const wdata = (ggml_fp16_t *) params->wdata + ne02*ew0*ne00;
+    if (ggml_is_contiguous(src0) && src0->type == dst->type) {
+        // parallelize by elements
+        const int ne = ggml_nelements(dst);
+        const int de = (ne + nth - 1)/nth;
 
-            for (int i11 = 0; i11 < ne11; i11++) {
-                const float * const src = (float *)((char *) src1->data + i11*nb11);
-                ggml_fp16_t * dst_data = wdata;
-                for (int i10 = 0; i10 < ne10; i10++) {
-                    dst_data[(i10 + nh)*ew0 + i11] = GGML_FP32_TO_FP16(src[i10]);
-                }
-            }
-        }
+        const int ie0 = MIN(de*ith, ne);
+        const int ie1 = MIN(ie0 + de, ne);
 
-        return;
-    }
+        const size_t ts = GGML_TYPE_SIZE[src0->type];
 
-    if (params->type == GGML_TASK_FINALIZE) {
+        memcpy((char *) dst->data + ie0*ts, (char *) src0->data + ie0*ts, (ie1 - ie0)*ts);
         return;
     }
 
-    // total rows in dst
-    const int nr = ne02;
+    // parallelize by src0 rows - row ir of src0 goes to the elements [ir*ne00, (ir + 1)*ne00) of dst
+
+    // total rows in src0
+    const int nr = ne01*ne02*ne03;
 
     // rows per thread
     const int dr = (nr + nth - 1)/nth;
@@ -5403,264 +5011,139 @@ static void ggml_compute_forward_conv_1d_1s_f16_f32(
     const int ir0 = dr*ith;
     const int ir1 = MIN(ir0 + dr, nr);
 
-    for (int i1 = ir0; i1 < ir1; i1++) {
-        float * dst_data = (float *)((char *) dst->data + i1*nb1);
-        for (int i0 = 0; i0 < ne10; ++i0) {
-            dst_data[i0] = 0;
-            for (int k = -nh; k <= nh; k++) {
-                float v = 0.0f;
-                ggml_vec_dot_f16(ew0, &v,
-                        (ggml_fp16_t *) params->wdata +   i1*ew0*ne00 +      (nh + k)*ew0,
-                        (ggml_fp16_t *) params->wdata + ne02*ew0*ne00 + (i0 + nh + k)*ew0);
-
-                dst_data[i0] += v;
-            }
-        }
-    }
-}
+    if (src0->nb[0] == sizeof(ggml_fp16_t)) {
+        if (dst->type == GGML_TYPE_F16) {
+            const size_t rs = ne00*nb00;
 
-static void ggml_compute_forward_conv_1d_1s_f32(
-        const struct ggml_compute_params * params,
-        const struct ggml_tensor * src0,
-        const struct ggml_tensor * src1,
-              struct ggml_tensor * dst) {
-    GGML_ASSERT(src0->type == GGML_TYPE_F32);
-    GGML_ASSERT(src1->type == GGML_TYPE_F32);
-    GGML_ASSERT( dst->type == GGML_TYPE_F32);
+            for (int ir = ir0; ir < ir1; ir++) {
+                const int i03 = ir/(ne02*ne01);
+                const int i02 = (ir - i03*ne02*ne01)/ne01;
+                const int i01 = (ir - i03*ne02*ne01 - i02*ne01);
 
-    int64_t t0 = ggml_perf_time_us();
-    UNUSED(t0);
+                const char * src0_ptr = (char *) src0->data + i01*nb01 + i02*nb02 + i03*nb03;
+                char * dst_ptr = (char *) dst->data + ir*rs;
 
-    const int ne00 = src0->ne[0];
-    const int ne01 = src0->ne[1];
-    const int ne02 = src0->ne[2];
-    //const int ne03 = src0->ne[3];
+                memcpy(dst_ptr, src0_ptr, rs);
+            }
+        } else if (dst->type == GGML_TYPE_F32) {
+            float * dst_ptr = (float *) dst->data;
 
-    const int ne10 = src1->ne[0];
-    const int ne11 = src1->ne[1];
-    //const int ne12 = src1->ne[2];
-    //const int ne13 = src1->ne[3];
+            for (int ir = ir0; ir < ir1; ir++) {
+                const int i03 = ir/(ne02*ne01);
+                const int i02 = (ir - i03*ne02*ne01)/ne01;
+                const int i01 = (ir - i03*ne02*ne01 - i02*ne01);
 
-    //const int ne0  = dst->ne[0];
-    //const int ne1  = dst->ne[1];
-    //const int ne2  = dst->ne[2];
-    //const int ne3  = dst->ne[3];
-    //const int ne   = ne0*ne1*ne2*ne3;
+                const ggml_fp16_t * src0_ptr = (ggml_fp16_t *) ((char *) src0->data + i01*nb01 + i02*nb02 + i03*nb03);
 
-    const int nb00 = src0->nb[0];
-    const int nb01 = src0->nb[1];
-    const int nb02 = src0->nb[2];
-    //const int nb03 = src0->nb[3];
+                ggml_vec_cvt_f16_f32(ne00, dst_ptr + ir*ne00, src0_ptr);
+            }
+        } else {
+            GGML_ASSERT(false); // TODO: implement
+        }
+#if defined(GGML_VEC_TRANSPOSE)
+    } else if (src0->nb[1] == sizeof(ggml_fp16_t) && (dst->type == GGML_TYPE_F32 || dst->type == GGML_TYPE_F16)) {
+        // dim 1 of src0 is contiguous in memory (e.g. a transposed or permuted view) - copy the runs of src0 rows
+        // within each ne00 x ne01 matrix with a blocked transpose
+        const size_t ts = GGML_TYPE_SIZE[dst->type];
 
-    const int nb10 = src1->nb[0];
-    const int nb11 = src1->nb[1];
-    //const int nb12 = src1->nb[2];
-    //const int nb13 = src1->nb[3];
+        for (int ir = ir0; ir < ir1; ) {
+            const int i03 = ir/(ne02*ne01);
+            const int i02 = (ir - i03*ne02*ne01)/ne01;
+            const int i01 = (ir - i03*ne02*ne01 - i02*ne01);
 
-    //const int nb0  = dst->nb[0];
-    const int nb1  = dst->nb[1];
-    //const int nb2  = dst->nb[2];
-    //const int nb3  = dst->nb[3];
-
-    const int ith = params->ith;
-    const int nth = params->nth;
+            // rows left in the current src0 matrix
+            const int nrt = MIN(ir1 - ir, ne01 - i01);
 
-    const int nk = ne00;
-    const int nh = nk/2;
-
-    const int ew0 = ggml_up32(ne01);
-
-    GGML_ASSERT(ne00 % 2 == 1); // TODO: support even kernel sizes
-    GGML_ASSERT(nb00 == sizeof(float));
-    GGML_ASSERT(nb10 == sizeof(float));
+            ggml_vec_transpose(ne00, nrt,
+                    (char *) dst->data + (size_t) ir*ne00*ts, ne00, dst->type == GGML_TYPE_F16,
+                    (char *) src0->data + i01*nb01 + i02*nb02 + i03*nb03, nb00/sizeof(ggml_fp16_t), true);
 
-    if (params->type == GGML_TASK_INIT) {
-        // TODO: fix this memset (wsize is overestimated)
-        memset(params->wdata, 0, params->wsize);
+            ir += nrt;
+        }
+#endif
+    } else {
+        //printf("%s: this is not optimal - fix me\n", __func__);
 
-        // prepare kernel data (src0)
-        {
-            float * const wdata = (float *) params->wdata + 0;
+        if (dst->type == GGML_TYPE_F32) {
+            float * dst_ptr = (float *) dst->data;
 
-            for (int i02 = 0; i02 < ne02; i02++) {
-                for (int i01 = 0; i01 < ne01; i01++) {
-                    const float * const src = (float *)((char *) src0->data + i02*nb02 + i01*nb01);
-                    float * dst_data = wdata + i02*ew0*ne00;
-                    for (int i00 = 0; i00 < ne00; i00++) {
-                        dst_data[i00*ew0 + i01] = src[i00];
-                    }
-                }
-            }
-        }
+            for (int ir = ir0; ir < ir1; ir++) {
+                const int i03 = ir/(ne02*ne01);
+                const int i02 = (ir - i03*ne02*ne01)/ne01;
+                const int i01 = (ir - i03*ne02*ne01 - i02*ne01);
 
-        // prepare source data (src1)
-        {
-            float * const wdata = (float *) params->wdata + ne02*ew0*ne00;
+                int id = ir*ne00;
+                for (int i00 = 0; i00 < ne00; i00++) {
+                    const ggml_fp16_t * src0_ptr = (ggml_fp16_t *) ((char *) src0->data + i00*nb00 + i01*nb01 + i02*nb02 + i03*nb03);
 
-            for (int i11 = 0; i11 < ne11; i11++) {
-                const float * const src = (float *)((char *) src1->data + i11*nb11);
-                float * dst_data = wdata;
-                for (int i10 = 0; i10 < ne10; i10++) {
-                    dst_data[(i10 + nh)*ew0 + i11] = src[i10];
+                    dst_ptr[id] = GGML_FP16_TO_FP32(*src0_ptr);
+                    id++;
                 }
             }
-        }
-
-        return;
-    }
-
-    if (params->type == GGML_TASK_FINALIZE) {
-        return;
-    }
-
-    // total rows in dst
-    const int nr = ne02;
+        } else if (dst->type == GGML_TYPE_F16) {
+            ggml_fp16_t * dst_ptr = (ggml_fp16_t *) dst->data;
 
-    // rows per thread
-    const int dr = (nr + nth - 1)/nth;
+            for (int ir = ir0; ir < ir1; ir++) {
+                const int i03 = ir/(ne02*ne01);
+                const int i02 = (ir - i03*ne02*ne01)/ne01;
+                const int i01 = (ir - i03*ne02*ne01 - i02*ne01);
 
-    // row range for this thread
-    const int ir0 = dr*ith;
-    const int ir1 = MIN(ir0 + dr, nr);
+                int id = ir*ne00;
+                for (int i00 = 0; i00 < ne00; i00++) {
+                    const ggml_fp16_t * src0_ptr = (ggml_fp16_t *) ((char *) src0->data + i00*nb00 + i01*nb01 + i02*nb02 + i03*nb03);
 
-    for (int i1 = ir0; i1 < ir1; i1++) {
-        float * dst_data = (float *)((char *) dst->data + i1*nb1);
-        for (int i0 = 0; i0 < ne10; ++i0) {
-            dst_data[i0] = 0;
-            for (int k = -nh; k <= nh; k++) {
-                float v = 0.0f;
-                ggml_vec_dot_f32(ew0, &v,
-                        (float *) params->wdata +   i1*ew0*ne00 +      (nh + k)*ew0,
-                        (float *) params->wdata + ne02*ew0*ne00 + (i0 + nh + k)*ew0);
-
-                dst_data[i0] += v;
+                    dst_ptr[id] = *src0_ptr;
+                    id++;
+                }
             }
+        } else {
+            GGML_ASSERT(false); // TODO: implement
         }
     }
 }
 
-static void ggml_compute_forward_conv_1d_1s(
+static void ggml_compute_forward_dup_f32(
         const struct ggml_compute_params * params,
         const struct ggml_tensor * src0,
-        const struct ggml_tensor * src1,
         struct ggml_tensor * dst) {
-    switch (src0->type) {
-        case GGML_TYPE_F16:
-            {
-                ggml_compute_forward_conv_1d_1s_f16_f32(params, src0, src1, dst);
-            } break;
-        case GGML_TYPE_F32:
-            {
-                ggml_compute_forward_conv_1d_1s_f32(params, src0, src1, dst);
-            } break;
-        case GGML_TYPE_I8:
-        case GGML_TYPE_I16:
-        case GGML_TYPE_I32:
-        case GGML_TYPE_COUNT:
-            {
-                GGML_ASSERT(false);
-            } break;
-    }
-}
-
-// ggml_compute_forward_conv_1d_2s
+    GGML_ASSERT(ggml_is_contiguous(dst));
+    GGML_ASSERT(ggml_nelements(dst) == ggml_nelements(src0));
 
-static void ggml_compute_forward_conv_1d_2s_f16_f32(
-        const struct ggml_compute_params * params,
-        const struct ggml_tensor * src0,
-        const struct ggml_tensor * src1,
-              struct ggml_tensor * dst) {
-    GGML_ASSERT(src0->type == GGML_TYPE_F16);
-    GGML_ASSERT(src1->type == GGML_TYPE_F32);
-    GGML_ASSERT( dst->type == GGML_TYPE_F32);
+    if (params->type == GGML_TASK_INIT || params->type == GGML_TASK_FINALIZE) {
+        return;
+    }
 
-    int64_t t0 = ggml_perf_time_us();
-    UNUSED(t0);
+    const int ith = params->ith;
+    const int nth = params->nth;
 
     const int ne00 = src0->ne[0];
     const int ne01 = src0->ne[1];
     const int ne02 = src0->ne[2];
-    //const int ne03 = src0->ne[3];
-
-    const int ne10 = src1->ne[0];
-    const int ne11 = src1->ne[1];
-    //const int ne12 = src1->ne[2];
-    //const int ne13 = src1->ne[3];
-
-    //const int ne0  = dst->ne[0];
-    //const int ne1  = dst->ne[1];
-    //const int ne2  = dst->ne[2];
-    //const int ne3  = dst->ne[3];
-    //const int ne   = ne0*ne1*ne2*ne3;
-
-    const int nb00 = src0->nb[0];
-    const int nb01 = src0->nb[1];
-    const int nb02 = src0->nb[2];
-    //const int nb03 = src0->nb[3];
-
-    const int nb10 = src1->nb[0];
-    const int nb11 = src1->nb[1];
-    //const int nb12 = src1->nb[2];
-    //const int nb13 = src1->nb[3];
-
-    //const int nb0  = dst->nb[0];
-    const int nb1  = dst->nb[1];
-    //const int nb2  = dst->nb[2];
-    //const int nb3  = dst->nb[3];
-
-    const int ith = params->ith;
-    const int nth = params->nth;
-
-    const int nk = ne00;
-    const int nh = nk/2;
-
-    const int ew0 = ggml_up32(ne01);
-
-    GGML_ASSERT(ne00 % 2 == 1); // TODO: support even kernel sizes
-    GGML_ASSERT(nb00 == sizeof(ggml_fp16_t));
-    GGML_ASSERT(nb10 == sizeof(float));
-
-    if (params->type == GGML_TASK_INIT) {
-        // TODO: fix this memset (wsize is overestimated)
-        memset(params->wdata, 0, params->wsize);
+    const int ne03 = src0->ne[3];
 
-        // prepare kernel data (src0)
-        {
-            ggml_fp16_t * const wdata = (ggml_fp16_t *) params->wdata + 0;
+    const size_t nb00 = src0->nb[0];
+    const size_t nb01 = src0->nb[1];
+    const size_t nb02 = src0->nb[2];
+    const size_t nb03 = src0->nb[3];
 
-            for (int i02 = 0; i02 < ne02; i02++) {
-                for (int i01 = 0; i01 < ne01; i01++) {
-                    const ggml_fp16_t * const src = (ggml_fp16_t *)((char *) src0->data + i02*nb02 + i01*nb01);
-                    ggml_fp16_t * dst_data = wdata + i02*ew0*ne00;
-                    for (int i00 = 0; i00 < ne00; i00++) {
-                        dst_data[i00*ew0 + i01] = src[i00];
-                    }
-                }
-            }
-        }
+    if (ggml_is_contiguous(src0) && src0->type == dst->type) {
+        // parallelize by elements
+        const int ne = ggml_nelements(dst);
+        const int de = (ne + nth - 1)/nth;
 
-        // prepare source data (src1)
-        {
-            ggml_fp16_t * const wdata = (ggml_fp16_t *) params->wdata + ne02*ew0*ne00;
+        const int ie0 = MIN(de*ith, ne);
+        const int ie1 = MIN(ie0 + de, ne);
 
-            for (int i11 = 0; i11 < ne11; i11++) {
-                const float * const src = (float *)((char *) src1->data + i11*nb11);
-                ggml_fp16_t * dst_data = wdata;
-                for (int i10 = 0; i10 < ne10; i10++) {
-                    dst_data[(i10 + nh)*ew0 + i11] = GGML_FP32_TO_FP16(src[i10]);
-                }
-            }
-        }
+        const size_t ts = GGML_TYPE_SIZE[src0->type];
 
+        memcpy((char *) dst->data + ie0*ts, (char *) src0->data + ie0*ts, (ie1 - ie0)*ts);
         return;
     }
 
-    if (params->type == GGML_TASK_FINALIZE) {
-        return;
-    }
+    // parallelize by src0 rows - row ir of src0 goes to the elements [ir*ne00, (ir + 1)*ne00) of dst
 
-    // total rows in dst
-    const int nr = ne02;
+    // total rows in src0
+    const int nr = ne01*ne02*ne03;
 
     // rows per thread
     const int dr = (nr + nth - 1)/nth;
@@ -5669,159 +5152,115 @@ static void ggml_compute_forward_conv_1d_2s_f16_f32(
     const int ir0 = dr*ith;
     const int ir1 = MIN(ir0 + dr, nr);
 
-    for (int i1 = ir0; i1 < ir1; i1++) {
-        float * dst_data = (float *)((char *) dst->data + i1*nb1);
-        for (int i0 = 0; i0 < ne10; i0 += 2) {
-            dst_data[i0/2] = 0;
-            for (int k = -nh; k <= nh; k++) {
-                float v = 0.0f;
-                ggml_vec_dot_f16(ew0, &v,
-                        (ggml_fp16_t *) params->wdata +   i1*ew0*ne00 +      (nh + k)*ew0,
-                        (ggml_fp16_t *) params->wdata + ne02*ew0*ne00 + (i0 + nh + k)*ew0);
-
-                dst_data[i0/2] += v;
-            }
-        }
-    }
-}
-
-static void ggml_compute_forward_conv_1d_2s_f32(
-        const struct ggml_compute_params * params,
-        const struct ggml_tensor * src0,
-        const struct ggml_tensor * src1,
-              struct ggml_tensor * dst) {
-    GGML_ASSERT(src0->type == GGML_TYPE_F32);
-    GGML_ASSERT(src1->type == GGML_TYPE_F32);
-    GGML_ASSERT( dst->type == GGML_TYPE_F32);
-
-    int64_t t0 = ggml_perf_time_us();
-    UNUSED(t0);
-
-    const int ne00 = src0->ne[0];
-    const int ne01 = src0->ne[1];
-    const int ne02 = src0->ne[2];
-    //const int ne03 = src0->ne[3];
+    if (src0->nb[0] == sizeof(float)) {
+        if (dst->type == GGML_TYPE_F32) {
+            const size_t rs = ne00*nb00;
 
-    const int ne10 = src1->ne[0];
-    const int ne11 = src1->ne[1];
-    //const int ne12 = src1->ne[2];
-    //const int ne13 = src1->ne[3];
+            for (int ir = ir0; ir < ir1; ir++) {
+                const int i03 = ir/(ne02*ne01);
+                const int i02 = (ir - i03*ne02*ne01)/ne01;
+                const int i01 = (ir - i03*ne02*ne01 - i02*ne01);
 
-    //const int ne0  = dst->ne[0];
-    //const int ne1  = dst->ne[1];
-    //const int ne2  = dst->ne[2];
-    //const int ne3  = dst->ne[3];
-    //const int ne   = ne0*ne1*ne2*ne3;
+                const char * src0_ptr = (char *) src0->data + i01*nb01 + i02*nb02 + i03*nb03;
+                char * dst_ptr = (char *) dst->data + ir*rs;
 
-    const int nb00 = src0->nb[0];
-    const int nb01 = src0->nb[1];
-    const int nb02 = src0->nb[2];
-    //const int nb03 = src0->nb[3];
+                memcpy(dst_ptr, src0_ptr, rs);
+            }
+        } else if (dst->type == GGML_TYPE_F16) {
+            ggml_fp16_t * dst_ptr = (ggml_fp16_t *) dst->data;
 
-    const int nb10 = src1->nb[0];
-    const int nb11 = src1->nb[1];
-    //const int nb12 = src1->nb[2];
-    //const int nb13 = src1->nb[3];
+            for (int ir = ir0; ir < ir1; ir++) {
+                const int i03 = ir/(ne02*ne01);
+                const int i02 = (ir - i03*ne02*ne01)/ne01;
+                const int i01 = (ir - i03*ne02*ne01 - i02*ne01);
 
-    //const int nb0  = dst->nb[0];
-    const int nb1  = dst->nb[1];
-    //const int nb2  = dst->nb[2];
-    //const int nb3  = dst->nb[3];
+                const float * src0_ptr = (float *) ((char *) src0->data + i01*nb01 + i02*nb02 + i03*nb03);
 
-    const int ith = params->ith;
-    const int nth = params->nth;
+                ggml_vec_cvt_f32_f16(ne00, dst_ptr + ir*ne00, src0_ptr);
+            }
+        } else {
+            GGML_ASSERT(false); // TODO: implement
+        }
+#if defined(GGML_VEC_TRANSPOSE)
+    } else if (src0->nb[1] == sizeof(float) && (dst->type == GGML_TYPE_F32 || dst->type == GGML_TYPE_F16)) {
+        // dim 1 of src0 is contiguous in memory (e.g. a transposed or permuted view) - copy the runs of src0 rows
+        // within each ne00 x ne01 matrix with a blocked transpose
+        const size_t ts = GGML_TYPE_SIZE[dst->type];
 
-    const int nk = ne00;
-    const int nh = nk/2;
+        for (int ir = ir0; ir < ir1; ) {
+            const int i03 = ir/(ne02*ne01);
+            const int i02 = (ir - i03*ne02*ne01)/ne01;
+            const int i01 = (ir - i03*ne02*ne01 - i02*ne01);
 
-    const int ew0 = ggml_up32(ne01);
+            // rows left in the current src0 matrix
+            const int nrt = MIN(ir1 - ir, ne01 - i01);
 
-    GGML_ASSERT(ne00 % 2 == 1); // TODO: support even kernel sizes
-    GGML_ASSERT(nb00 == sizeof(float));
-    GGML_ASSERT(nb10 == sizeof(float));
+            ggml_vec_transpose(ne00, nrt,
+                    (char *) dst->data + (size_t) ir*ne00*ts, ne00, dst->type == GGML_TYPE_F16,
+                    (char *) src0->data + i01*nb01 + i02*nb02 + i03*nb03, nb00/sizeof(float), false);
 
-    if (params->type == GGML_TASK_INIT) {
-        // TODO: fix this memset (wsize is overestimated)
-        memset(params->wdata, 0, params->wsize);
+            ir += nrt;
+        }
+#endif
+    } else {
+        //printf("%s: this is not optimal - fix me\n", __func__);
 
-        // prepare kernel data (src0)
-        {
-            float * const wdata = (float *) params->wdata + 0;
+        if (dst->type == GGML_TYPE_F32) {
+            float * dst_ptr = (float *) dst->data;
 
-            for (int i02 = 0; i02 < ne02; i02++) {
-                for (int i01 = 0; i01 < ne01; i01++) {
-                    const float * const src = (float *)((char *) src0->data + i02*nb02 + i01*nb01);
-                    float * dst_data = wdata + i02*ew0*ne00;
-                    for (int i00 = 0; i00 < ne00; i00++) {
-                        dst_data[i00*ew0 + i01] = src[i00];
-                    }
-                }
-            }
-        }
+            for (int ir = ir0; ir < ir1; ir++) {
+                const int i03 = ir/(ne02*ne01);
+                const int i02 = (ir - i03*ne02*ne01)/ne01;
+                const int i01 = (ir - i03*ne02*ne01 - i02*ne01);
 
-        // prepare source data (src1)
-        {
-            float * const wdata = (float *) params->wdata + ne02*ew0*ne00;
+                int id = ir*ne00;
+                for (int i00 = 0; i00 < ne00; i00++) {
+                    const float * src0_ptr = (float *) ((char *) src0->data + i00*nb00 + i01*nb01 + i02*nb02 + i03*nb03);
 
-            for (int i11 = 0; i11 < ne11; i11++) {
-                const float * const src = (float *)((char *) src1->data + i11*nb11);
-                float * dst_data = wdata;
-                for (int i10 = 0; i10 < ne10; i10++) {
-                    dst_data[(i10 + nh)*ew0 + i11] = src[i10];
+                    dst_ptr[id] = *src0_ptr;
+                    id++;
                 }
             }
-        }
-
-        return;
-    }
-
-    if (params->type == GGML_TASK_FINALIZE) {
-        return;
-    }
-
-    // total rows in dst
-    const int nr = ne02;
+        } else if (dst->type == GGML_TYPE_F16) {
+            ggml_fp16_t * dst_ptr = (ggml_fp16_t *) dst->data;
 
-    // rows per thread
-    const int dr = (nr + nth - 1)/nth;
+            for (int ir = ir0; ir < ir1; ir++) {
+                const int i03 = ir/(ne02*ne01);
+                const int i02 = (ir - i03*ne02*ne01)/ne01;
+                const int i01 = (ir - i03*ne02*ne01 - i02*ne01);
 
-    // row range for this thread
-    const int ir0 = dr*ith;
-    const int ir1 = MIN(ir0 + dr, nr);
+                int id = ir*ne00;
+                for (int i00 = 0; i00 < ne00; i00++) {
+                    const float * src0_ptr = (float *) ((char *) src0->data + i00*nb00 + i01*nb01 + i02*nb02 + i03*nb03);
 
-    for (int i1 = ir0; i1 < ir1; i1++) {
-        float * dst_data = (float *)((char *) dst->data + i1*nb1);
-        for (int i0 = 0; i0 < ne10; i0 += 2) {
-            dst_data[i0/2] = 0;
-            for (int k = -nh; k <= nh; k++) {
-                float v = 0.0f;
-                ggml_vec_dot_f32(ew0, &v,
-                        (float *) params->wdata +   i1*ew0*ne00 +      (nh + k)*ew0,
-                        (float *) params->wdata + ne02*ew0*ne00 + (i0 + nh + k)*ew0);
-
-                dst_data[i0/2] += v;
+                    dst_ptr[id] = GGML_FP32_TO_FP16(*src0_ptr);
+                    id++;
+                }
             }
+        } else {
+            GGML_ASSERT(false); // TODO: implement
         }
     }
 }
 
-static void ggml_compute_forward_conv_1d_2s(
+static void ggml_compute_forward_dup(
         const struct ggml_compute_params * params,
         const struct ggml_tensor * src0,
-        const struct ggml_tensor * src1,
         struct ggml_tensor * dst) {
     switch (src0->type) {
         case GGML_TYPE_F16:
             {
-                ggml_compute_forward_conv_1d_2s_f16_f32(params, src0, src1, dst);
+                ggml_compute_forward_dup_f16(params, src0, dst);
             } break;
         case GGML_TYPE_F32:
             {
-                ggml_compute_forward_conv_1d_2s_f32(params, src0, src1, dst);
+                ggml_compute_forward_dup_f32(params, src0, dst);
             } break;
         case GGML_TYPE_I8:
         case GGML_TYPE_I16:
         case GGML_TYPE_I32:
+        case GGML_TYPE_Q4_0:
+        case GGML_TYPE_Q8_0:
         case GGML_TYPE_COUNT:
             {
                 GGML_ASSERT(false);
@@ -5829,482 +5268,467 @@ static void ggml_compute_forward_conv_1d_2s(
     }
 }
 
-// ggml_compute_forward_flash_attn
+// ggml_compute_forward_add
 
-static void ggml_compute_forward_flash_attn_f32(
+static void ggml_compute_forward_add_f32(
         const struct ggml_compute_params * params,
-        const struct ggml_tensor * q,
-        const struct ggml_tensor * k,
-        const struct ggml_tensor * v,
-        const bool masked,
-             struct ggml_tensor * dst) {
-    int64_t t0 = ggml_perf_time_us();
-    UNUSED(t0);
+        const struct ggml_tensor * src0,
+        const struct ggml_tensor * src1,
+        struct ggml_tensor * dst) {
+    GGML_ASSERT(ggml_are_same_shape(src0, src1) && ggml_are_same_shape(src0, dst));
 
-    const int neq0 = q->ne[0];
-    const int neq1 = q->ne[1];
-    const int neq2 = q->ne[2];
-    const int neq3 = q->ne[3];
+    if (params->type == GGML_TASK_INIT || params->type == GGML_TASK_FINALIZE) {
+        return;
+    }
 
-    const int nek0 = k->ne[0];
-    const int nek1 = k->ne[1];
-    //const int nek2 = k->ne[2];
-    //const int nek3 = k->ne[3];
+    const int ith = params->ith;
+    const int nth = params->nth;
 
-    //const int nev0 = v->ne[0];
-    const int nev1 = v->ne[1];
-    //const int nev2 = v->ne[2];
-    //const int nev3 = v->ne[3];
+    const int n  = ggml_nrows(src0);
+    const int nc = src0->ne[0];
 
-    const int ne0  = dst->ne[0];
-    const int ne1  = dst->ne[1];
-    //const int ne2  = dst->ne[2];
-    //const int ne3  = dst->ne[3];
+    const size_t nb00 = src0->nb[0];
+    const size_t nb01 = src0->nb[1];
 
-    const int nbk0 = k->nb[0];
-    const int nbk1 = k->nb[1];
-    const int nbk2 = k->nb[2];
-    const int nbk3 = k->nb[3];
+    const size_t nb10 = src1->nb[0];
+    const size_t nb11 = src1->nb[1];
 
-    const int nbq0 = q->nb[0];
-    const int nbq1 = q->nb[1];
-    const int nbq2 = q->nb[2];
-    const int nbq3 = q->nb[3];
+    const size_t nb0 = dst->nb[0];
+    const size_t nb1 = dst->nb[1];
 
-    const int nbv0 = v->nb[0];
-    const int nbv1 = v->nb[1];
-    const int nbv2 = v->nb[2];
-    const int nbv3 = v->nb[3];
+    GGML_ASSERT( nb0 == sizeof(float));
+    GGML_ASSERT(nb00 == sizeof(float));
 
-    const int nb0  = dst->nb[0];
-    const int nb1  = dst->nb[1];
-    const int nb2  = dst->nb[2];
-    const int nb3  = dst->nb[3];
-
-    const int ith = params->ith;
-    const int nth = params->nth;
-
-    const int D = neq0;
-    const int N = neq1;
-    const int P = nek1 - N;
-    const int M = P + N;
-
-    const int Mup = ggml_up(M, GGML_SOFT_MAX_UNROLL);
+    if (nb10 == sizeof(float)) {
+        const int j0 = (n/nth)*ith;
+        const int j1 = ith == nth - 1 ? n : (n/nth)*(ith + 1);
 
-    GGML_ASSERT(ne0 == D);
-    GGML_ASSERT(ne1 == N);
-    GGML_ASSERT(P >= 0);
+        for (int j = j0; j < j1; j++) {
+            ggml_vec_add_f32(nc,
+                    (float *) ((char *) dst->data  + j*nb1),
+                    (float *) ((char *) src0->data + j*nb01),
+                    (float *) ((char *) src1->data + j*nb11));
+        }
+    } else {
+        // src1 is not contiguous
+        for (int j = ith; j < n; j += nth) {
+            float * dst_ptr  = (float *) ((char *) dst->data  + j*nb1);
+            float * src0_ptr = (float *) ((char *) src0->data + j*nb01);
+            for (int i = 0; i < nc; i++) {
+                float * src1_ptr = (float *) ((char *) src1->data + j*nb11 + i*nb10);
 
-    GGML_ASSERT(nbq0 == sizeof(float));
-    GGML_ASSERT(nbk0 == sizeof(float));
-    GGML_ASSERT(nbv0 == sizeof(float));
+                dst_ptr[i] = src0_ptr[i] + *src1_ptr;
+            }
+        }
+    }
+}
 
-    GGML_ASSERT(neq0 == D);
-    GGML_ASSERT(nek0 == D);
-    GGML_ASSERT(nev1 == D);
+static void ggml_compute_forward_add(
+        const struct ggml_compute_params * params,
+        const struct ggml_tensor * src0,
+        const struct ggml_tensor * src1,
+        struct ggml_tensor * dst) {
+    switch (src0->type) {
+        case GGML_TYPE_F32:
+            {
+                ggml_compute_forward_add_f32(params, src0, src1, dst);
+            } break;
+        case GGML_TYPE_I8:
+        case GGML_TYPE_I16:
+        case GGML_TYPE_I32:
+        case GGML_TYPE_F16:
+        case GGML_TYPE_Q4_0:
+        case GGML_TYPE_Q8_0:
+        case GGML_TYPE_COUNT:
+            {
+                assert(false);
+            } break;
+    }
+}
 
-    GGML_ASSERT(neq1 == N);
-    GGML_ASSERT(nek1 == N + P);
-    GGML_ASSERT(nev1 == D);
+// ggml_compute_forward_sub
 
-    // dst cannot be transposed or permuted
-    GGML_ASSERT(nb0 == sizeof(float));
-    GGML_ASSERT(nb0 <= nb1);
-    GGML_ASSERT(nb1 <= nb2);
-    GGML_ASSERT(nb2 <= nb3);
+static void ggml_compute_forward_sub_f32(
+        const struct ggml_compute_params * params,
+        const struct ggml_tensor * src0,
+        const struct ggml_tensor * src1,
+        struct ggml_tensor * dst) {
+    assert(ggml_are_same_shape(src0, src1) && ggml_are_same_shape(src0, dst));
 
-    if (params->type == GGML_TASK_INIT) {
+    if (params->type == GGML_TASK_INIT || params->type == GGML_TASK_FINALIZE) {
         return;
     }
 
-    if (params->type == GGML_TASK_FINALIZE) {
-        return;
-    }
+    const int ith = params->ith;
+    const int nth = params->nth;
 
-    // parallelize by q rows using ggml_vec_dot_f32
+    const int n  = ggml_nrows(src0);
+    const int nc = src0->ne[0];
 
-    // total rows in q
-    const int nr = neq1*neq2*neq3;
+    assert( dst->nb[0] == sizeof(float));
+    assert(src0->nb[0] == sizeof(float));
+    assert(src1->nb[0] == sizeof(float));
 
     // rows per thread
-    const int dr = (nr + nth - 1)/nth;
+    const int dr = (n + nth - 1)/nth;
 
     // row range for this thread
     const int ir0 = dr*ith;
-    const int ir1 = MIN(ir0 + dr, nr);
+    const int ir1 = MIN(ir0 + dr, n);
 
-    const float scale = 1.0/sqrt((double) D);
+    for (int i = ir0; i < ir1; i++) {
+        ggml_vec_sub_f32(nc,
+                (float *) ((char *) dst->data  + i*( dst->nb[1])),
+                (float *) ((char *) src0->data + i*(src0->nb[1])),
+                (float *) ((char *) src1->data + i*(src1->nb[1])));
+    }
+}
 
-    //printf("P=%d N=%d D=%d ir0=%d ir1=%d scale = %f\n", P, N, D, ir0, ir1, scale);
+static void ggml_compute_forward_sub(
+        const struct ggml_compute_params * params,
+        const struct ggml_tensor * src0,
+        const struct ggml_tensor * src1,
+        struct ggml_tensor * dst) {
+    switch (src0->type) {
+        case GGML_TYPE_F32:
+            {
+                ggml_compute_forward_sub_f32(params, src0, src1, dst);
+            } break;
+        case GGML_TYPE_I8:
+        case GGML_TYPE_I16:
+        case GGML_TYPE_I32:
+        case GGML_TYPE_F16:
+        case GGML_TYPE_Q4_0:
+        case GGML_TYPE_Q8_0:
+        case GGML_TYPE_COUNT:
+            {
+                assert(false);
+            } break;
+    }
+}
 
-    for (int ir = ir0; ir < ir1; ++ir) {
-        // q indices
-        const int iq3 = ir/(neq2*neq1);
-        const int iq2 = (ir - iq3*neq2*neq1)/neq1;
-        const int iq1 = (ir - iq3*neq2*neq1 - iq2*neq1);
+// ggml_compute_forward_mul
 
-        float * S = (float *) params->wdata + ith*(Mup + CACHE_LINE_SIZE_F32);
+static void ggml_compute_forward_mul_f32(
+        const struct ggml_compute_params * params,
+        const struct ggml_tensor * src0,
+        const struct ggml_tensor * src1,
+        struct ggml_tensor * dst) {
+    assert(ggml_are_same_shape(src0, src1) && ggml_are_same_shape(src0, dst));
 
-        for (int i = M; i < Mup; ++i) {
-            S[i] = -INFINITY;
-        }
+    if (params->type == GGML_TASK_INIT || params->type == GGML_TASK_FINALIZE) {
+        return;
+    }
 
-        for (int ic = 0; ic < nek1; ++ic) {
-            // k indices
-            const int ik3 = iq3;
-            const int ik2 = iq2;
-            const int ik1 = ic;
+    const int ith = params->ith;
+    const int nth = params->nth;
 
-            // S indices
-            const int i1 = ik1;
+    const int n  = ggml_nrows(src0);
+    const int nc = src0->ne[0];
 
-            ggml_vec_dot_f32(neq0,
-                    S + i1,
-                    (float *) ((char *) k->data + (ik1*nbk1 + ik2*nbk2 + ik3*nbk3)),
-                    (float *) ((char *) q->data + (iq1*nbq1 + iq2*nbq2 + iq3*nbq3)));
-        }
+    assert( dst->nb[0] == sizeof(float));
+    assert(src0->nb[0] == sizeof(float));
+    assert(src1->nb[0] == sizeof(float));
 
-        // scale
-        ggml_vec_scale_f32(nek1, S, scale);
+    // rows per thread
+    const int dr = (n + nth - 1)/nth;
 
-        if (masked) {
-            for (int i = P; i < M; i++) {
-                if (i > P + iq1) {
-                    S[i] = -INFINITY;
-                }
-            }
-        }
+    // row range for this thread
+    const int ir0 = dr*ith;
+    const int ir1 = MIN(ir0 + dr, n);
 
-        // softmax
-        {
-            float max = -INFINITY;
-            ggml_vec_max_f32(M, &max, S);
+    for (int i = ir0; i < ir1; i++) {
+        ggml_vec_mul_f32(nc,
+                (float *) ((char *) dst->data  + i*( dst->nb[1])),
+                (float *) ((char *) src0->data + i*(src0->nb[1])),
+                (float *) ((char *) src1->data + i*(src1->nb[1])));
+    }
+}
 
-            float sum = 0.0f;
+static void ggml_compute_forward_mul(
+        const struct ggml_compute_params * params,
+        const struct ggml_tensor * src0,
+        const struct ggml_tensor * src1,
+        struct ggml_tensor * dst) {
+    switch (src0->type) {
+        case GGML_TYPE_F32:
             {
-#ifdef GGML_SOFT_MAX_ACCELERATE
-                max = -max;
-                vDSP_vsadd(S, 1, &max, S, 1, Mup);
-                vvexpf(S, S, &Mup);
-                ggml_vec_sum_f32(Mup, &sum, S);
-#else
-                uint16_t   scvt[GGML_SOFT_MAX_UNROLL];
-                ggml_float sump[GGML_SOFT_MAX_UNROLL] = { 0.0 };
+                ggml_compute_forward_mul_f32(params, src0, src1, dst);
+            } break;
+        case GGML_TYPE_I8:
+        case GGML_TYPE_I16:
+        case GGML_TYPE_I32:
+        case GGML_TYPE_F16:
+        case GGML_TYPE_Q4_0:
+        case GGML_TYPE_Q8_0:
+        case GGML_TYPE_COUNT:
+            {
+                assert(false);
+            } break;
+    }
+}
 
-                for (int i = 0; i < Mup; i += GGML_SOFT_MAX_UNROLL) {
-                    float * SS = S + i;
+// ggml_compute_forward_div
 
-                    for (int j = 0; j < GGML_SOFT_MAX_UNROLL; ++j) {
-                        if (SS[j] == -INFINITY) {
-                            SS[j] = 0.0f;
-                        } else {
-                            ggml_fp16_t s = GGML_FP32_TO_FP16(SS[j] - max);
-                            memcpy(&scvt[j], &s, sizeof(uint16_t));
-                            const float val = GGML_FP16_TO_FP32(table_exp_f16[scvt[j]]);
-                            sump[j] += val;
-                            SS[j] = val;
-                        }
-                    }
-                }
+static void ggml_compute_forward_div_f32(
+        const struct ggml_compute_params * params,
+        const struct ggml_tensor * src0,
+        const struct ggml_tensor * src1,
+        struct ggml_tensor * dst) {
+    assert(ggml_are_same_shape(src0, src1) && ggml_are_same_shape(src0, dst));
 
-                for (int i = 0; i < GGML_SOFT_MAX_UNROLL; i++) {
-                    sum += sump[i];
-                }
-#endif
-            }
+    if (params->type == GGML_TASK_INIT || params->type == GGML_TASK_FINALIZE) {
+        return;
+    }
 
-            assert(sum > 0.0f);
+    const int ith = params->ith;
+    const int nth = params->nth;
 
-            sum = 1.0/sum;
-            ggml_vec_scale_f32(M, S, sum);
+    const int n  = ggml_nrows(src0);
+    const int nc = src0->ne[0];
 
-#ifndef NDEBUG
-            for (int i = 0; i < M; ++i) {
-                assert(!isnan(S[i]));
-                assert(!isinf(S[i]));
-            }
-#endif
-        }
+    assert( dst->nb[0] == sizeof(float));
+    assert(src0->nb[0] == sizeof(float));
+    assert(src1->nb[0] == sizeof(float));
 
-        for (int ic = 0; ic < nev1; ++ic) {
-            // dst indices
-            const int i1 = iq1;
-            const int i2 = iq2;
-            const int i3 = iq3;
+    // rows per thread
+    const int dr = (n + nth - 1)/nth;
 
-            ggml_vec_dot_f32(nek1,
-                    (float *) ((char *) dst->data + (ic*nb0 + i1*nb1  + i2*nb2  + i3*nb3)),
-                    (float *) ((char *) v->data   + (         ic*nbv1 + i2*nbv2 + i3*nbv3)),
-                    S);
-        }
+    // row range for this thread
+    const int ir0 = dr*ith;
+    const int ir1 = MIN(ir0 + dr, n);
+
+    for (int i = ir0; i < ir1; i++) {
+        ggml_vec_div_f32(nc,
+                (float *) ((char *) dst->data  + i*( dst->nb[1])),
+                (float *) ((char *) src0->data + i*(src0->nb[1])),
+                (float *) ((char *) src1->data + i*(src1->nb[1])));
     }
 }
 
-static void ggml_compute_forward_flash_attn_f16(
+static void ggml_compute_forward_div(
         const struct ggml_compute_params * params,
-        const struct ggml_tensor * q,
-        const struct ggml_tensor * k,
-        const struct ggml_tensor * v,
-        const bool masked,
-             struct ggml_tensor * dst) {
-    int64_t t0 = ggml_perf_time_us();
-    UNUSED(t0);
-
-    const int neq0 = q->ne[0];
-    const int neq1 = q->ne[1];
-    const int neq2 = q->ne[2];
-    const int neq3 = q->ne[3];
+        const struct ggml_tensor * src0,
+        const struct ggml_tensor * src1,
+        struct ggml_tensor * dst) {
+    switch (src0->type) {
+        case GGML_TYPE_F32:
+            {
+                ggml_compute_forward_div_f32(params, src0, src1, dst);
+            } break;
+        case GGML_TYPE_I8:
+        case GGML_TYPE_I16:
+        case GGML_TYPE_I32:
+        case GGML_TYPE_F16:
+        case GGML_TYPE_Q4_0:
+        case GGML_TYPE_Q8_0:
+        case GGML_TYPE_COUNT:
+            {
+                assert(false);
+            } break;
+    }
+}
 
-    const int nek0 = k->ne[0];
-    const int nek1 = k->ne[1];
-    //const int nek2 = k->ne[2];
-    //const int nek3 = k->ne[3];
+// ggml_compute_forward_sqr
 
-    //const int nev0 = v->ne[0];
-    const int nev1 = v->ne[1];
-    //const int nev2 = v->ne[2];
-    //const int nev3 = v->ne[3];
+static void ggml_compute_forward_sqr_f32(
+        const struct ggml_compute_params * params,
+        const struct ggml_tensor * src0,
+        struct ggml_tensor * dst) {
+    assert(ggml_are_same_shape(src0, dst));
 
-    const int ne0  = dst->ne[0];
-    const int ne1  = dst->ne[1];
-    //const int ne2  = dst->ne[2];
-    //const int ne3  = dst->ne[3];
+    if (params->type == GGML_TASK_INIT || params->type == GGML_TASK_FINALIZE) {
+        return;
+    }
 
-    const int nbk0 = k->nb[0];
-    const int nbk1 = k->nb[1];
-    const int nbk2 = k->nb[2];
-    const int nbk3 = k->nb[3];
+    const int ith = params->ith;
+    const int nth = params->nth;
 
-    const int nbq0 = q->nb[0];
-    const int nbq1 = q->nb[1];
-    const int nbq2 = q->nb[2];
-    const int nbq3 = q->nb[3];
+    const int n     = ggml_nrows(src0);
+    const int nc    = src0->ne[0];
 
-    const int nbv0 = v->nb[0];
-    const int nbv1 = v->nb[1];
-    const int nbv2 = v->nb[2];
-    const int nbv3 = v->nb[3];
-
-    const int nb0  = dst->nb[0];
-    const int nb1  = dst->nb[1];
-    const int nb2  = dst->nb[2];
-    const int nb3  = dst->nb[3];
-
-    const int ith = params->ith;
-    const int nth = params->nth;
-
-    const int D = neq0;
-    const int N = neq1;
-    const int P = nek1 - N;
-    const int M = P + N;
+    assert( dst->nb[0] == sizeof(float));
+    assert(src0->nb[0] == sizeof(float));
 
-    const int Mup = ggml_up(M, GGML_SOFT_MAX_UNROLL);
+    // rows per thread
+    const int dr = (n + nth - 1)/nth;
 
-    GGML_ASSERT(ne0 == D);
-    GGML_ASSERT(ne1 == N);
-    GGML_ASSERT(P >= 0);
+    // row range for this thread
+    const int ir0 = dr*ith;
+    const int ir1 = MIN(ir0 + dr, n);
 
-    GGML_ASSERT(nbq0 == sizeof(ggml_fp16_t));
-    GGML_ASSERT(nbk0 == sizeof(ggml_fp16_t));
-    GGML_ASSERT(nbv0 == sizeof(ggml_fp16_t));
+    for (int i = ir0; i < ir1; i++) {
+        ggml_vec_sqr_f32(nc,
+                (float *) ((char *) dst->data  + i*( dst->nb[1])),
+                (float *) ((char *) src0->data + i*(src0->nb[1])));
+    }
+}
 
-    GGML_ASSERT(neq0 == D);
-    GGML_ASSERT(nek0 == D);
-    GGML_ASSERT(nev1 == D);
+static void ggml_compute_forward_sqr(
+        const struct ggml_compute_params * params,
+        const struct ggml_tensor * src0,
+        struct ggml_tensor * dst) {
+    switch (src0->type) {
+        case GGML_TYPE_F32:
+            {
+                ggml_compute_forward_sqr_f32(params, src0, dst);
+            } break;
+        case GGML_TYPE_I8:
+        case GGML_TYPE_I16:
+        case GGML_TYPE_I32:
+        case GGML_TYPE_F16:
+        case GGML_TYPE_Q4_0:
+        case GGML_TYPE_Q8_0:
+        case GGML_TYPE_COUNT:
+            {
+                assert(false);
+            } break;
+    }
+}
 
-    GGML_ASSERT(neq1 == N);
-    GGML_ASSERT(nek1 == N + P);
-    GGML_ASSERT(nev1 == D);
+// ggml_compute_forward_sqrt
 
-    // dst cannot be transposed or permuted
-    GGML_ASSERT(nb0 == sizeof(float));
-    GGML_ASSERT(nb0 <= nb1);
-    GGML_ASSERT(nb1 <= nb2);
-    GGML_ASSERT(nb2 <= nb3);
+static void ggml_compute_forward_sqrt_f32(
+        const struct ggml_compute_params * params,
+        const struct ggml_tensor * src0,
+        struct ggml_tensor * dst) {
+    assert(ggml_are_same_shape(src0, dst));
 
-    if (params->type == GGML_TASK_INIT) {
+    if (params->type == GGML_TASK_INIT || params->type == GGML_TASK_FINALIZE) {
         return;
     }
 
-    if (params->type == GGML_TASK_FINALIZE) {
-        return;
-    }
+    const int ith = params->ith;
+    const int nth = params->nth;
 
-    // parallelize by q rows using ggml_vec_dot_f32
+    const int n  = ggml_nrows(src0);
+    const int nc = src0->ne[0];
 
-    // total rows in q
-    const int nr = neq1*neq2*neq3;
+    assert( dst->nb[0] == sizeof(float));
+    assert(src0->nb[0] == sizeof(float));
 
     // rows per thread
-    const int dr = (nr + nth - 1)/nth;
+    const int dr = (n + nth - 1)/nth;
 
     // row range for this thread
     const int ir0 = dr*ith;
-    const int ir1 = MIN(ir0 + dr, nr);
+    const int ir1 = MIN(ir0 + dr, n);
 
-    const float scale = 1.0/sqrt((double) D);
+    for (int i = ir0; i < ir1; i++) {
+        ggml_vec_sqrt_f32(nc,
+                (float *) ((char *) dst->data  + i*( dst->nb[1])),
+                (float *) ((char *) src0->data + i*(src0->nb[1])));
+    }
+}
 
-    //printf("P=%d N=%d D=%d ir0=%d ir1=%d scale = %f\n", P, N, D, ir0, ir1, scale);
+static void ggml_compute_forward_sqrt(
+        const struct ggml_compute_params * params,
+        const struct ggml_tensor * src0,
+        struct ggml_tensor * dst) {
+    switch (src0->type) {
+        case GGML_TYPE_F32:
+            {
+                ggml_compute_forward_sqrt_f32(params, src0, dst);
+            } break;
+        case GGML_TYPE_I8:
+        case GGML_TYPE_I16:
+        case GGML_TYPE_I32:
+        case GGML_TYPE_F16:
+        case GGML_TYPE_Q4_0:
+        case GGML_TYPE_Q8_0:
+        case GGML_TYPE_COUNT:
+            {
+                assert(false);
+            } break;
+    }
+}
 
-    for (int ir = ir0; ir < ir1; ++ir) {
-        // q indices
-        const int iq3 = ir/(neq2*neq1);
-        const int iq2 = (ir - iq3*neq2*neq1)/neq1;
-        const int iq1 = (ir - iq3*neq2*neq1 - iq2*neq1);
+// ggml_compute_forward_sum
 
-        float * S = (float *) params->wdata + ith*(2*Mup + CACHE_LINE_SIZE_F32);
+static void ggml_compute_forward_sum_f32(
+        const struct ggml_compute_params * params,
+        const struct ggml_tensor * src0,
+        struct ggml_tensor * dst) {
+    assert(ggml_is_scalar(dst));
 
-        for (int i = M; i < Mup; ++i) {
-            S[i] = -INFINITY;
-        }
+    if (params->type == GGML_TASK_INIT) {
+        return;
+    }
 
-        if (GGML_VEC_DOT_UNROLL > 2 || nek1 % GGML_VEC_DOT_UNROLL != 0) {
-            for (int ic = 0; ic < nek1; ++ic) {
-                // k indices
-                const int ik3 = iq3;
-                const int ik2 = iq2;
-                const int ik1 = ic;
+    // each thread sums its rows into its own cache line of the work data
+    float * const wdata = params->wdata;
 
-                // S indices
-                const int i1 = ik1;
+    assert(params->wsize >= sizeof(float)*CACHE_LINE_SIZE_F32*params->nth);
 
-                ggml_vec_dot_f16(neq0,
-                        S + i1,
-                        (ggml_fp16_t *) ((char *) k->data + (ik1*nbk1 + ik2*nbk2 + ik3*nbk3)),
-                        (ggml_fp16_t *) ((char *) q->data + (iq1*nbq1 + iq2*nbq2 + iq3*nbq3)));
-            }
-        } else {
-            for (int ic = 0; ic < nek1; ic += GGML_VEC_DOT_UNROLL) {
-                // k indices
-                const int ik3 = iq3;
-                const int ik2 = iq2;
-                const int ik1 = ic;
-
-                // S indices
-                const int i1 = ik1;
-
-                ggml_vec_dot_f16_unroll(neq0, nbk1,
-                        S + i1,
-                        ((char *) k->data + (ik1*nbk1 + ik2*nbk2 + ik3*nbk3)),
-                        (ggml_fp16_t *) ((char *) q->data + (iq1*nbq1 + iq2*nbq2 + iq3*nbq3)));
-            }
+    if (params->type == GGML_TASK_FINALIZE) {
+        if (params->ith != 0) {
+            return;
         }
 
-        // scale
-        ggml_vec_scale_f32(nek1, S, scale);
-
-        if (masked) {
-            for (int i = P; i < M; i++) {
-                if (i > P + iq1) {
-                    S[i] = -INFINITY;
-                }
-            }
+        ggml_float sum = 0.0;
+        for (int k = 0; k < params->nth; k++) {
+            sum += wdata[k*CACHE_LINE_SIZE_F32];
         }
 
-        // softmax
-        {
-            float max = -INFINITY;
-            ggml_vec_max_f32(M, &max, S);
+        *(float *) (dst->data) = sum;
+        return;
+    }
 
-            float sum = 0.0f;
-            {
-#ifdef GGML_SOFT_MAX_ACCELERATE
-                max = -max;
-                vDSP_vsadd(S, 1, &max, S, 1, Mup);
-                vvexpf(S, S, &Mup);
-                ggml_vec_sum_f32(Mup, &sum, S);
-#else
-                uint16_t   scvt[GGML_SOFT_MAX_UNROLL];
-                ggml_float sump[GGML_SOFT_MAX_UNROLL] = { 0.0 };
+    assert(src0->nb[0] == sizeof(float));
 
-                for (int i = 0; i < Mup; i += GGML_SOFT_MAX_UNROLL) {
-                    float * SS = S + i;
+    const int ith = params->ith;
+    const int nth = params->nth;
 
-                    for (int j = 0; j < GGML_SOFT_MAX_UNROLL; ++j) {
-                        if (SS[j] == -INFINITY) {
-                            SS[j] = 0.0f;
-                        } else {
-                            ggml_fp16_t s = GGML_FP32_TO_FP16(SS[j] - max);
-                            memcpy(&scvt[j], &s, sizeof(uint16_t));
-                            const float val = GGML_FP16_TO_FP32(table_exp_f16[scvt[j]]);
-                            sump[j] += val;
-                            SS[j] = val;
-                        }
-                    }
-                }
+    const int ne00 = src0->ne[0];
+    const int ne01 = src0->ne[1];
+    const int ne02 = src0->ne[2];
+    const int ne03 = src0->ne[3];
 
-                for (int i = 0; i < GGML_SOFT_MAX_UNROLL; i++) {
-                    sum += sump[i];
-                }
-#endif
-            }
+    const size_t nb01 = src0->nb[1];
+    const size_t nb02 = src0->nb[2];
+    const size_t nb03 = src0->nb[3];
 
-            assert(sum > 0.0f);
+    // total rows in src0
+    const int nr = ne01*ne02*ne03;
 
-            sum = 1.0/sum;
-            ggml_vec_scale_f32(M, S, sum);
+    // rows per thread
+    const int dr = (nr + nth - 1)/nth;
 
-#ifndef NDEBUG
-            for (int i = 0; i < M; ++i) {
-                assert(!isnan(S[i]));
-                assert(!isinf(S[i]));
-            }
-#endif
-        }
+    // row range for this thread
+    const int ir0 = dr*ith;
+    const int ir1 = MIN(ir0 + dr, nr);
 
-        ggml_fp16_t * S16 = (ggml_fp16_t *) ((float *) params->wdata + ith*(2*Mup + CACHE_LINE_SIZE_F32) + Mup);
+    ggml_float sum = 0.0;
 
-        for (int i = 0; i < M; i++) {
-            S16[i] = GGML_FP32_TO_FP16(S[i]);
-        }
+    for (int ir = ir0; ir < ir1; ir++) {
+        const int i03 = ir/(ne02*ne01);
+        const int i02 = (ir - i03*ne02*ne01)/ne01;
+        const int i01 = (ir - i03*ne02*ne01 - i02*ne01);
 
-        if (GGML_VEC_DOT_UNROLL == 1 || (nev1 % GGML_VEC_DOT_UNROLL != 0)) {
-            for (int ic = 0; ic < nev1; ++ic) {
-                // dst indices
-                const int i1 = iq1;
-                const int i2 = iq2;
-                const int i3 = iq3;
+        float row_sum = 0.0f;
+        ggml_vec_sum_f32(ne00, &row_sum, (float *) ((char *) src0->data + i01*nb01 + i02*nb02 + i03*nb03));
 
-                ggml_vec_dot_f16(nek1,
-                        (float *)       ((char *) dst->data + (ic*nb0 + i1*nb1  + i2*nb2  + i3*nb3)),
-                        (ggml_fp16_t *) ((char *) v->data   + (         ic*nbv1 + i2*nbv2 + i3*nbv3)),
-                        S16);
-            }
-        } else {
-            for (int ic = 0; ic < nev1; ic += GGML_VEC_DOT_UNROLL) {
-                // dst indices
-                const int i1 = iq1;
-                const int i2 = iq2;
-                const int i3 = iq3;
-
-                ggml_vec_dot_f16_unroll(nek1, nbv1,
-                        (float *) ((char *) dst->data + (ic*nb0 + i1*nb1  + i2*nb2  + i3*nb3)),
-                        ((char *) v->data   + (         ic*nbv1 + i2*nbv2 + i3*nbv3)),
-                        S16);
-            }
-        }
+        sum += row_sum;
     }
+
+    wdata[ith*CACHE_LINE_SIZE_F32] = sum;
 }
 
-static void ggml_compute_forward_flash_attn(
+static void ggml_compute_forward_sum(
         const struct ggml_compute_params * params,
-        const struct ggml_tensor * q,
-        const struct ggml_tensor * k,
-        const struct ggml_tensor * v,
-        const bool masked,
+        const struct ggml_tensor * src0,
         struct ggml_tensor * dst) {
-    switch (q->type) {
-        case GGML_TYPE_F16:
-            {
-                ggml_compute_forward_flash_attn_f16(params, q, k, v, masked, dst);
-            } break;
+    switch (src0->type) {
         case GGML_TYPE_F32:
             {
-                ggml_compute_forward_flash_attn_f32(params, q, k, v, masked, dst);
+                ggml_compute_forward_sum_f32(params, src0, dst);
             } break;
         case GGML_TYPE_I8:
         case GGML_TYPE_I16:
         case GGML_TYPE_I32:
+        case GGML_TYPE_F16:
+        case GGML_TYPE_Q4_0:
+        case GGML_TYPE_Q8_0:
         case GGML_TYPE_COUNT:
             {
                 assert(false);
@@ -6312,124 +5736,127 @@ static void ggml_compute_forward_flash_attn(
     }
 }
 
-// ggml_compute_forward_flash_ff
+// ggml_compute_forward_mean
 
-static void ggml_compute_forward_flash_ff_f16(
+static void ggml_compute_forward_mean_f32(
         const struct ggml_compute_params * params,
-        const struct ggml_tensor * a,  // F16
-        const struct ggml_tensor * b0, // F16 fc_w
-        const struct ggml_tensor * b1, // F32 fc_b
-        const struct ggml_tensor * c0, // F16 proj_w
-        const struct ggml_tensor * c1, // F32 proj_b
+        const struct ggml_tensor * src0,
         struct ggml_tensor * dst) {
-    int64_t t0 = ggml_perf_time_us();
-    UNUSED(t0);
-
-    const int nea0 = a->ne[0];
-    const int nea1 = a->ne[1];
-    const int nea2 = a->ne[2];
-    const int nea3 = a->ne[3];
+    if (params->type == GGML_TASK_INIT || params->type == GGML_TASK_FINALIZE) {
+        return;
+    }
 
-    const int neb00 = b0->ne[0];
-    const int neb01 = b0->ne[1];
-    //const int neb02 = b0->ne[2];
-    //const int neb03 = b0->ne[3];
+    assert(src0->nb[0] == sizeof(float));
 
-    const int neb10 = b1->ne[0];
-    const int neb11 = b1->ne[1];
-    //const int neb12 = b1->ne[2];
-    //const int neb13 = b1->ne[3];
+    const int ith = params->ith;
+    const int nth = params->nth;
 
-    const int nec00 = c0->ne[0];
-    const int nec01 = c0->ne[1];
-    //const int nec02 = c0->ne[2];
-    //const int nec03 = c0->ne[3];
+    const int ne00 = src0->ne[0];
+    const int ne01 = src0->ne[1];
+    const int ne02 = src0->ne[2];
+    const int ne03 = src0->ne[3];
 
-    const int nec10 = c1->ne[0];
-    const int nec11 = c1->ne[1];
-    //const int nec12 = c1->ne[2];
-    //const int nec13 = c1->ne[3];
+    const size_t nb01 = src0->nb[1];
+    const size_t nb02 = src0->nb[2];
+    const size_t nb03 = src0->nb[3];
 
     const int ne0 = dst->ne[0];
     const int ne1 = dst->ne[1];
     const int ne2 = dst->ne[2];
-    //const int ne3 = dst->ne[3];
+    const int ne3 = dst->ne[3];
 
-    const int nba0 = a->nb[0];
-    const int nba1 = a->nb[1];
-    const int nba2 = a->nb[2];
-    const int nba3 = a->nb[3];
+    assert(ne0 == 1);
+    assert(ne1 == ne01);
+    assert(ne2 == ne02);
+    assert(ne3 == ne03);
 
-    const int nbb00 = b0->nb[0];
-    const int nbb01 = b0->nb[1];
-    const int nbb02 = b0->nb[2];
-    const int nbb03 = b0->nb[3];
+    UNUSED(ne0);
+    UNUSED(ne1);
+    UNUSED(ne2);
+    UNUSED(ne3);
 
-    const int nbb10 = b1->nb[0];
-    //const int nbb11 = b1->nb[1];
-    //const int nbb12 = b1->nb[2];
-    //const int nbb13 = b1->nb[3];
+    const size_t nb1 = dst->nb[1];
+    const size_t nb2 = dst->nb[2];
+    const size_t nb3 = dst->nb[3];
 
-    const int nbc00 = c0->nb[0];
-    const int nbc01 = c0->nb[1];
-    const int nbc02 = c0->nb[2];
-    const int nbc03 = c0->nb[3];
+    // total rows in src0
+    const int nr = ne01*ne02*ne03;
 
-    const int nbc10 = c1->nb[0];
-    //const int nbc11 = c1->nb[1];
-    //const int nbc12 = c1->nb[2];
-    //const int nbc13 = c1->nb[3];
+    // rows per thread
+    const int dr = (nr + nth - 1)/nth;
 
-    const int nb0 = dst->nb[0];
-    const int nb1 = dst->nb[1];
-    const int nb2 = dst->nb[2];
-    const int nb3 = dst->nb[3];
-
-    const int ith = params->ith;
-    const int nth = params->nth;
+    // row range for this thread
+    const int ir0 = dr*ith;
+    const int ir1 = MIN(ir0 + dr, nr);
 
-    const int D = nea0;
-    //const int N = nea1;
-    const int M = neb01;
+    for (int ir = ir0; ir < ir1; ir++) {
+        const int i03 = ir/(ne02*ne01);
+        const int i02 = (ir - i03*ne02*ne01)/ne01;
+        const int i01 = (ir - i03*ne02*ne01 - i02*ne01);
 
-    GGML_ASSERT(ne0 == nea0);
-    GGML_ASSERT(ne1 == nea1);
-    GGML_ASSERT(ne2 == nea2);
+        ggml_vec_sum_f32(ne00,
+                (float *) ((char *)  dst->data + i01*nb1  + i02*nb2  + i03*nb3),
+                (float *) ((char *) src0->data + i01*nb01 + i02*nb02 + i03*nb03));
 
-    GGML_ASSERT(nba0  == sizeof(ggml_fp16_t));
-    GGML_ASSERT(nbb00 == sizeof(ggml_fp16_t));
-    GGML_ASSERT(nbb10 == sizeof(float));
-    GGML_ASSERT(nbc00 == sizeof(ggml_fp16_t));
-    GGML_ASSERT(nbc10 == sizeof(float));
+        *(float *) ((char *) dst->data + i01*nb1 + i02*nb2 + i03*nb3) /= (float) ne00;
+    }
+}
 
-    GGML_ASSERT(neb00 == D);
-    GGML_ASSERT(neb01 == M);
-    GGML_ASSERT(neb10 == M);
-    GGML_ASSERT(neb11 == 1);
+static void ggml_compute_forward_mean(
+        const struct ggml_compute_params * params,
+        const struct ggml_tensor * src0,
+        struct ggml_tensor * dst) {
+    switch (src0->type) {
+        case GGML_TYPE_F32:
+            {
+                ggml_compute_forward_mean_f32(params, src0, dst);
+            } break;
+        case GGML_TYPE_I8:
+        case GGML_TYPE_I16:
+        case GGML_TYPE_I32:
+        case GGML_TYPE_F16:
+        case GGML_TYPE_Q4_0:
+        case GGML_TYPE_Q8_0:
+        case GGML_TYPE_COUNT:
+            {
+                assert(false);
+            } break;
+    }
+}
 
-    GGML_ASSERT(nec00 == M);
-    GGML_ASSERT(nec01 == D);
-    GGML_ASSERT(nec10 == D);
-    GGML_ASSERT(nec11 == 1);
+// ggml_compute_forward_repeat
 
-    // dst cannot be transposed or permuted
-    GGML_ASSERT(nb0 == sizeof(float));
-    GGML_ASSERT(nb0 <= nb1);
-    GGML_ASSERT(nb1 <= nb2);
-    GGML_ASSERT(nb2 <= nb3);
+static void ggml_compute_forward_repeat_f32(
+        const struct ggml_compute_params * params,
+        const struct ggml_tensor * src0,
+        struct ggml_tensor * dst) {
+    assert(ggml_can_repeat(src0, dst));
 
-    if (params->type == GGML_TASK_INIT) {
+    if (params->type == GGML_TASK_INIT || params->type == GGML_TASK_FINALIZE) {
         return;
     }
 
-    if (params->type == GGML_TASK_FINALIZE) {
-        return;
-    }
+    const int ith = params->ith;
+    const int nth = params->nth;
 
-    // parallelize by a rows using ggml_vec_dot_f32
+    // TODO: implement support for rank > 2 tensors
+    assert(src0->ne[2] == 1);
+    assert(src0->ne[3] == 1);
+    assert( dst->ne[2] == 1);
+    assert( dst->ne[3] == 1);
 
-    // total rows in a
-    const int nr = nea1*nea2*nea3;
+    const int nc  = dst->ne[0];
+    const int nr  = dst->ne[1];
+    const int nc0 = src0->ne[0];
+    const int nr0 = src0->ne[1];
+    const int ncr = nc/nc0; // guaranteed to be an integer due to the check in ggml_can_repeat
+    const int nrr = nr/nr0; // guaranteed to be an integer due to the check in ggml_can_repeat
+
+    // TODO: support for transposed / permuted tensors
+    assert( dst->nb[0] == sizeof(float));
+    assert(src0->nb[0] == sizeof(float));
+
+    UNUSED(nrr);
 
     // rows per thread
     const int dr = (nr + nth - 1)/nth;
@@ -6438,82 +5865,90 @@ static void ggml_compute_forward_flash_ff_f16(
     const int ir0 = dr*ith;
     const int ir1 = MIN(ir0 + dr, nr);
 
-    for (int ir = ir0; ir < ir1; ++ir) {
-        // a indices
-        const int ia3 = ir/(nea2*nea1);
-        const int ia2 = (ir - ia3*nea2*nea1)/nea1;
-        const int ia1 = (ir - ia3*nea2*nea1 - ia2*nea1);
-
-        float * S = (float *) params->wdata + ith*(2*M + CACHE_LINE_SIZE_F32);
+    // dst row ir is made of ncr copies of src0 row ir % nr0
+    for (int ir = ir0; ir < ir1; ir++) {
+        const int k = ir % nr0;
 
-        for (int ic = 0; ic < neb01; ++ic) {
-            // b0 indices
-            const int ib03 = ia3;
-            const int ib02 = ia2;
-            const int ib01 = ic;
+        for (int j = 0; j < ncr; j++) {
+            ggml_vec_cpy_f32(nc0,
+                    (float *) ((char *)  dst->data + ir*( dst->nb[1]) + j*nc0*( dst->nb[0])),
+                    (float *) ((char *) src0->data +  k*(src0->nb[1])));
+        }
+    }
+}
 
-            // S indices
-            const int i1 = ib01;
+static void ggml_compute_forward_repeat(
+        const struct ggml_compute_params * params,
+        const struct ggml_tensor * src0,
+        struct ggml_tensor * dst) {
+    switch (src0->type) {
+        case GGML_TYPE_F32:
+            {
+                ggml_compute_forward_repeat_f32(params, src0, dst);
+            } break;
+        case GGML_TYPE_I8:
+        case GGML_TYPE_I16:
+        case GGML_TYPE_I32:
+        case GGML_TYPE_F16:
+        case GGML_TYPE_Q4_0:
+        case GGML_TYPE_Q8_0:
+        case GGML_TYPE_COUNT:
+            {
+                assert(false);
+            } break;
+    }
+}
 
-            ggml_vec_dot_f16(nea0,
-                    S + i1,
-                    (ggml_fp16_t *) ((char *) b0->data + (ib01*nbb01 + ib02*nbb02 + ib03*nbb03)),
-                    (ggml_fp16_t *) ((char *)  a->data + ( ia1*nba1  +  ia2*nba2  +  ia3*nba3)));
-        }
+// ggml_compute_forward_abs
 
-        ggml_vec_add_f32(neb01, S, S, (float *) b1->data);
-        //ggml_vec_gelu_f32(neb01, S, S);
+static void ggml_compute_forward_abs_f32(
+        const struct ggml_compute_params * params,
+        const struct ggml_tensor * src0,
+        struct ggml_tensor * dst) {
+    assert(ggml_are_same_shape(src0, dst));
 
-        ggml_fp16_t * S16 = (ggml_fp16_t *) ((float *) params->wdata + ith*(2*M + CACHE_LINE_SIZE_F32) + M);
+    if (params->type == GGML_TASK_INIT || params->type == GGML_TASK_FINALIZE) {
+        return;
+    }
 
-        for (int i = 0; i < M; i++) {
-            S16[i] = GGML_FP32_TO_FP16(S[i]);
-        }
+    const int ith = params->ith;
+    const int nth = params->nth;
 
-        ggml_vec_gelu_f16(neb01, S16, S16);
+    const int n  = ggml_nrows(src0);
+    const int nc = src0->ne[0];
 
-        {
-            // dst indices
-            const int i1 = ia1;
-            const int i2 = ia2;
-            const int i3 = ia3;
+    assert(dst->nb[0]  == sizeof(float));
+    assert(src0->nb[0] == sizeof(float));
 
-            for (int ic = 0; ic < nec01; ++ic) {
+    // rows per thread
+    const int dr = (n + nth - 1)/nth;
 
-                ggml_vec_dot_f16(neb01,
-                        (float *)       ((char *) dst->data + (ic*nb0 + i1*nb1   + i2*nb2   + i3*nb3)),
-                        (ggml_fp16_t *) ((char *) c0->data  + (         ic*nbc01 + i2*nbc02 + i3*nbc03)),
-                        S16);
-            }
+    // row range for this thread
+    const int ir0 = dr*ith;
+    const int ir1 = MIN(ir0 + dr, n);
 
-            ggml_vec_add_f32(nec01,
-                    (float *) ((char *) dst->data + (i1*nb1 + i2*nb2 + i3*nb3)),
-                    (float *) ((char *) dst->data + (i1*nb1 + i2*nb2 + i3*nb3)),
-                    (float *) c1->data);
-        }
+    for (int i = ir0; i < ir1; i++) {
+        ggml_vec_abs_f32(nc,
+                (float *) ((char *) dst->data  + i*( dst->nb[1])),
+                (float *) ((char *) src0->data + i*(src0->nb[1])));
     }
 }
 
-static void ggml_compute_forward_flash_ff(
+static void ggml_compute_forward_abs(
         const struct ggml_compute_params * params,
-        const struct ggml_tensor * a,
-        const struct ggml_tensor * b0,
-        const struct ggml_tensor * b1,
-        const struct ggml_tensor * c0,
-        const struct ggml_tensor * c1,
+        const struct ggml_tensor * src0,
         struct ggml_tensor * dst) {
-    switch (b0->type) {
-        case GGML_TYPE_F16:
-            {
-                ggml_compute_forward_flash_ff_f16(params, a, b0, b1, c0, c1, dst);
-            } break;
+    switch (src0->type) {
         case GGML_TYPE_F32:
             {
-                GGML_ASSERT(false); // TODO
+                ggml_compute_forward_abs_f32(params, src0, dst);
             } break;
         case GGML_TYPE_I8:
         case GGML_TYPE_I16:
         case GGML_TYPE_I32:
+        case GGML_TYPE_F16:
+        case GGML_TYPE_Q4_0:
+        case GGML_TYPE_Q8_0:
         case GGML_TYPE_COUNT:
             {
                 assert(false);
@@ -6521,345 +5956,3703 @@ static void ggml_compute_forward_flash_ff(
     }
 }
 
-/////////////////////////////////
+// ggml_compute_forward_sgn
 
-static void ggml_compute_forward(struct ggml_compute_params * params, struct ggml_tensor * tensor) {
-    assert(params);
+static void ggml_compute_forward_sgn_f32(
+        const struct ggml_compute_params * params,
+        const struct ggml_tensor * src0,
+        struct ggml_tensor * dst) {
+    assert(ggml_are_same_shape(src0, dst));
 
-    switch (tensor->op) {
-        case GGML_OP_DUP:
-            {
-                ggml_compute_forward_dup(params, tensor->src0, tensor);
-            } break;
-        case GGML_OP_ADD:
-            {
-                ggml_compute_forward_add(params, tensor->src0, tensor->src1, tensor);
-            } break;
-        case GGML_OP_SUB:
-            {
-                ggml_compute_forward_sub(params, tensor->src0, tensor->src1, tensor);
-            } break;
-        case GGML_OP_MUL:
+    if (params->type == GGML_TASK_INIT || params->type == GGML_TASK_FINALIZE) {
+        return;
+    }
+
+    const int ith = params->ith;
+    const int nth = params->nth;
+
+    const int n  = ggml_nrows(src0);
+    const int nc = src0->ne[0];
+
+    assert(dst->nb[0]  == sizeof(float));
+    assert(src0->nb[0] == sizeof(float));
+
+    // rows per thread
+    const int dr = (n + nth - 1)/nth;
+
+    // row range for this thread
+    const int ir0 = dr*ith;
+    const int ir1 = MIN(ir0 + dr, n);
+
+    for (int i = ir0; i < ir1; i++) {
+        ggml_vec_sgn_f32(nc,
+                (float *) ((char *) dst->data  + i*( dst->nb[1])),
+                (float *) ((char *) src0->data + i*(src0->nb[1])));
+    }
+}
+
+static void ggml_compute_forward_sgn(
+        const struct ggml_compute_params * params,
+        const struct ggml_tensor * src0,
+        struct ggml_tensor * dst) {
+    switch (src0->type) {
+        case GGML_TYPE_F32:
             {
-                ggml_compute_forward_mul(params, tensor->src0, tensor->src1, tensor);
+                ggml_compute_forward_sgn_f32(params, src0, dst);
             } break;
-        case GGML_OP_DIV:
+        case GGML_TYPE_I8:
+        case GGML_TYPE_I16:
+        case GGML_TYPE_I32:
+        case GGML_TYPE_F16:
+        case GGML_TYPE_Q4_0:
+        case GGML_TYPE_Q8_0:
+        case GGML_TYPE_COUNT:
             {
-                ggml_compute_forward_div(params, tensor->src0, tensor->src1, tensor);
+                assert(false);
             } break;
-        case GGML_OP_SQR:
-            {
-                ggml_compute_forward_sqr(params, tensor->src0, tensor);
-            } break;
-        case GGML_OP_SQRT:
-            {
-                ggml_compute_forward_sqrt(params, tensor->src0, tensor);
-            } break;
-        case GGML_OP_SUM:
-            {
-                ggml_compute_forward_sum(params, tensor->src0, tensor);
-            } break;
-        case GGML_OP_MEAN:
-            {
-                ggml_compute_forward_mean(params, tensor->src0, tensor);
-            } break;
-        case GGML_OP_REPEAT:
-            {
-                ggml_compute_forward_repeat(params, tensor->src0, tensor);
-            } break;
-        case GGML_OP_ABS:
-            {
-                ggml_compute_forward_abs(params, tensor->src0, tensor);
-            } break;
-        case GGML_OP_SGN:
-            {
-                ggml_compute_forward_sgn(params, tensor->src0, tensor);
-            } break;
-        case GGML_OP_NEG:
-            {
-                ggml_compute_forward_neg(params, tensor->src0, tensor);
-            } break;
-        case GGML_OP_STEP:
-            {
-                ggml_compute_forward_step(params, tensor->src0, tensor);
-            } break;
-        case GGML_OP_RELU:
-            {
-                ggml_compute_forward_relu(params, tensor->src0, tensor);
-            } break;
-        case GGML_OP_GELU:
-            {
-                ggml_compute_forward_gelu(params, tensor->src0, tensor);
-            } break;
-        case GGML_OP_NORM:
-            {
-                ggml_compute_forward_norm(params, tensor->src0, tensor);
-            } break;
-        case GGML_OP_MUL_MAT:
-            {
-                ggml_compute_forward_mul_mat(params, tensor->src0, tensor->src1, tensor);
-            } break;
-        case GGML_OP_SCALE:
-            {
-                ggml_compute_forward_scale(params, tensor->src0, tensor->src1, tensor);
-            } break;
-        case GGML_OP_CPY:
-            {
-                ggml_compute_forward_cpy(params, tensor->src0, tensor);
-            } break;
-        case GGML_OP_RESHAPE:
-            {
-                ggml_compute_forward_reshape(params, tensor->src0, tensor);
-            } break;
-        case GGML_OP_VIEW:
-            {
-                ggml_compute_forward_view(params, tensor->src0);
-            } break;
-        case GGML_OP_PERMUTE:
-            {
-                ggml_compute_forward_permute(params, tensor->src0);
-            } break;
-        case GGML_OP_TRANSPOSE:
-            {
-                ggml_compute_forward_transpose(params, tensor->src0);
-            } break;
-        case GGML_OP_GET_ROWS:
-            {
-                ggml_compute_forward_get_rows(params, tensor->src0, tensor->src1, tensor);
-            } break;
-        case GGML_OP_DIAG_MASK_INF:
-            {
-                ggml_compute_forward_diag_mask_inf(params, tensor->src0, tensor->src1, tensor);
-            } break;
-        case GGML_OP_SOFT_MAX:
-            {
-                ggml_compute_forward_soft_max(params, tensor->src0, tensor);
-            } break;
-        case GGML_OP_ROPE:
-            {
-                ggml_compute_forward_rope(params, tensor->src0, tensor->src1, tensor);
-            } break;
-        case GGML_OP_CONV_1D_1S:
+    }
+}
+
+// ggml_compute_forward_neg
+
+static void ggml_compute_forward_neg_f32(
+        const struct ggml_compute_params * params,
+        const struct ggml_tensor * src0,
+        struct ggml_tensor * dst) {
+    assert(ggml_are_same_shape(src0, dst));
+
+    if (params->type == GGML_TASK_INIT || params->type == GGML_TASK_FINALIZE) {
+        return;
+    }
+
+    const int ith = params->ith;
+    const int nth = params->nth;
+
+    const int n  = ggml_nrows(src0);
+    const int nc = src0->ne[0];
+
+    assert(dst->nb[0]  == sizeof(float));
+    assert(src0->nb[0] == sizeof(float));
+
+    // rows per thread
+    const int dr = (n + nth - 1)/nth;
+
+    // row range for this thread
+    const int ir0 = dr*ith;
+    const int ir1 = MIN(ir0 + dr, n);
+
+    for (int i = ir0; i < ir1; i++) {
+        ggml_vec_neg_f32(nc,
+                (float *) ((char *) dst->data  + i*( dst->nb[1])),
+                (float *) ((char *) src0->data + i*(src0->nb[1])));
+    }
+}
+
+static void ggml_compute_forward_neg(
+        const struct ggml_compute_params * params,
+        const struct ggml_tensor * src0,
+        struct ggml_tensor * dst) {
+    switch (src0->type) {
+        case GGML_TYPE_F32:
             {
-                ggml_compute_forward_conv_1d_1s(params, tensor->src0, tensor->src1, tensor);
+                ggml_compute_forward_neg_f32(params, src0, dst);
             } break;
-        case GGML_OP_CONV_1D_2S:
+        case GGML_TYPE_I8:
+        case GGML_TYPE_I16:
+        case GGML_TYPE_I32:
+        case GGML_TYPE_F16:
+        case GGML_TYPE_Q4_0:
+        case GGML_TYPE_Q8_0:
+        case GGML_TYPE_COUNT:
             {
-                ggml_compute_forward_conv_1d_2s(params, tensor->src0, tensor->src1, tensor);
+                assert(false);
             } break;
-        case GGML_OP_FLASH_ATTN:
+    }
+}
+
+// ggml_compute_forward_step
+
+static void ggml_compute_forward_step_f32(
+        const struct ggml_compute_params * params,
+        const struct ggml_tensor * src0,
+        struct ggml_tensor * dst) {
+    assert(ggml_are_same_shape(src0, dst));
+
+    if (params->type == GGML_TASK_INIT || params->type == GGML_TASK_FINALIZE) {
+        return;
+    }
+
+    const int ith = params->ith;
+    const int nth = params->nth;
+
+    const int n  = ggml_nrows(src0);
+    const int nc = src0->ne[0];
+
+    assert(dst->nb[0]  == sizeof(float));
+    assert(src0->nb[0] == sizeof(float));
+
+    // rows per thread
+    const int dr = (n + nth - 1)/nth;
+
+    // row range for this thread
+    const int ir0 = dr*ith;
+    const int ir1 = MIN(ir0 + dr, n);
+
+    for (int i = ir0; i < ir1; i++) {
+        ggml_vec_step_f32(nc,
+                (float *) ((char *) dst->data  + i*( dst->nb[1])),
+                (float *) ((char *) src0->data + i*(src0->nb[1])));
+    }
+}
+
+static void ggml_compute_forward_step(
+        const struct ggml_compute_params * params,
+        const struct ggml_tensor * src0,
+        struct ggml_tensor * dst) {
+    switch (src0->type) {
+        case GGML_TYPE_F32:
             {
-                int32_t t = ggml_get_i32_1d(tensor->opt[1], 0);
-                GGML_ASSERT(t == 0 || t == 1);
-                bool masked = t != 0;
-                ggml_compute_forward_flash_attn(params, tensor->src0, tensor->src1, tensor->opt[0], masked, tensor);
+                ggml_compute_forward_step_f32(params, src0, dst);
             } break;
-        case GGML_OP_FLASH_FF:
+        case GGML_TYPE_I8:
+        case GGML_TYPE_I16:
+        case GGML_TYPE_I32:
+        case GGML_TYPE_F16:
+        case GGML_TYPE_Q4_0:
+        case GGML_TYPE_Q8_0:
+        case GGML_TYPE_COUNT:
             {
-                ggml_compute_forward_flash_ff(params, tensor->src0, tensor->src1, tensor->opt[0], tensor->opt[1], tensor->opt[2], tensor);
+                assert(false);
             } break;
-        case GGML_OP_NONE:
+    }
+}
+
+// ggml_compute_forward_relu
+
+static void ggml_compute_forward_relu_f32(
+        const struct ggml_compute_params * params,
+        const struct ggml_tensor * src0,
+        struct ggml_tensor * dst) {
+    assert(ggml_are_same_shape(src0, dst));
+
+    if (params->type == GGML_TASK_INIT || params->type == GGML_TASK_FINALIZE) {
+        return;
+    }
+
+    const int ith = params->ith;
+    const int nth = params->nth;
+
+    const int n  = ggml_nrows(src0);
+    const int nc = src0->ne[0];
+
+    assert(dst->nb[0]  == sizeof(float));
+    assert(src0->nb[0] == sizeof(float));
+
+    // rows per thread
+    const int dr = (n + nth - 1)/nth;
+
+    // row range for this thread
+    const int ir0 = dr*ith;
+    const int ir1 = MIN(ir0 + dr, n);
+
+    for (int i = ir0; i < ir1; i++) {
+        ggml_vec_relu_f32(nc,
+                (float *) ((char *) dst->data  + i*( dst->nb[1])),
+                (float *) ((char *) src0->data + i*(src0->nb[1])));
+    }
+}
+
+static void ggml_compute_forward_relu(
+        const struct ggml_compute_params * params,
+        const struct ggml_tensor * src0,
+        struct ggml_tensor * dst) {
+    switch (src0->type) {
+        case GGML_TYPE_F32:
             {
-                // nop
+                ggml_compute_forward_relu_f32(params, src0, dst);
             } break;
-        case GGML_OP_COUNT:
+        case GGML_TYPE_I8:
+        case GGML_TYPE_I16:
+        case GGML_TYPE_I32:
+        case GGML_TYPE_F16:
+        case GGML_TYPE_Q4_0:
+        case GGML_TYPE_Q8_0:
+        case GGML_TYPE_COUNT:
             {
-                GGML_ASSERT(false);
+                assert(false);
             } break;
     }
 }
 
-////////////////////////////////////////////////////////////////////////////////
+// ggml_compute_forward_gelu
 
-static void ggml_compute_backward(struct ggml_context * ctx, struct ggml_tensor * tensor, bool inplace) {
-    struct ggml_tensor * src0 = tensor->src0;
-    struct ggml_tensor * src1 = tensor->src1;
+static void ggml_compute_forward_gelu_f32(
+        const struct ggml_compute_params * params,
+        const struct ggml_tensor * src0,
+        struct ggml_tensor * dst) {
+    GGML_ASSERT(ggml_is_contiguous(src0));
+    GGML_ASSERT(ggml_is_contiguous(dst));
+    GGML_ASSERT(ggml_are_same_shape(src0, dst));
 
-    switch (tensor->op) {
-        case GGML_OP_DUP:
+    if (params->type == GGML_TASK_INIT || params->type == GGML_TASK_FINALIZE) {
+        return;
+    }
+
+    const int ith = params->ith;
+    const int nth = params->nth;
+
+    const int nc = src0->ne[0];
+    const int nr = ggml_nrows(src0);
+
+    // rows per thread
+    const int dr = (nr + nth - 1)/nth;
+
+    // row range for this thread
+    const int ir0 = dr*ith;
+    const int ir1 = MIN(ir0 + dr, nr);
+
+    for (int i1 = ir0; i1 < ir1; i1++) {
+        ggml_vec_gelu_f32(nc,
+                (float *) ((char *) dst->data  + i1*( dst->nb[1])),
+                (float *) ((char *) src0->data + i1*(src0->nb[1])));
+
+#ifndef NDEBUG
+        for (int k = 0; k < nc; k++) {
+            const float x = ((float *) ((char *) dst->data + i1*( dst->nb[1])))[k];
+            UNUSED(x);
+            assert(!isnan(x));
+            assert(!isinf(x));
+        }
+#endif
+    }
+}
+
+static void ggml_compute_forward_gelu(
+        const struct ggml_compute_params * params,
+        const struct ggml_tensor * src0,
+        struct ggml_tensor * dst) {
+    switch (src0->type) {
+        case GGML_TYPE_F32:
             {
-                if (src0->grad) {
-                    src0->grad = ggml_add_impl(ctx, src0->grad, tensor->grad, inplace);
-                }
+                ggml_compute_forward_gelu_f32(params, src0, dst);
             } break;
-        case GGML_OP_ADD:
+        case GGML_TYPE_I8:
+        case GGML_TYPE_I16:
+        case GGML_TYPE_I32:
+        case GGML_TYPE_F16:
+        case GGML_TYPE_Q4_0:
+        case GGML_TYPE_Q8_0:
+        case GGML_TYPE_COUNT:
             {
-                if (src0->grad) {
-                    src0->grad = ggml_add_impl(ctx, src0->grad, tensor->grad, inplace);
-                }
-                if (src1->grad) {
-                    src1->grad = ggml_add_impl(ctx, src1->grad, tensor->grad, inplace);
-                }
+                assert(false);
             } break;
-        case GGML_OP_SUB:
-            {
-                if (src0->grad) {
-                    src0->grad = ggml_add_impl(ctx, src0->grad, tensor->grad, inplace);
+    }
+}
+
+// ggml_compute_forward_norm
+
+static void ggml_compute_forward_norm_f32(
+        const struct ggml_compute_params * params,
+        const struct ggml_tensor * src0,
+        struct ggml_tensor * dst) {
+    GGML_ASSERT(ggml_are_same_shape(src0, dst));
+
+    if (params->type == GGML_TASK_INIT || params->type == GGML_TASK_FINALIZE) {
+        return;
+    }
+
+    GGML_ASSERT(src0->nb[0] == sizeof(float));
+
+    const int ith = params->ith;
+    const int nth = params->nth;
+
+    const int ne00 = src0->ne[0];
+    const int ne01 = src0->ne[1];
+    const int ne02 = src0->ne[2];
+    const int ne03 = src0->ne[3];
+
+    const size_t nb01 = src0->nb[1];
+    const size_t nb02 = src0->nb[2];
+    const size_t nb03 = src0->nb[3];
+
+    const size_t nb1 = dst->nb[1];
+    const size_t nb2 = dst->nb[2];
+    const size_t nb3 = dst->nb[3];
+
+    const ggml_float eps = 1e-5f; // TODO: make this a parameter
+
+    // TODO: optimize
+    for (int i03 = 0; i03 < ne03; i03++) {
+        for (int i02 = 0; i02 < ne02; i02++) {
+            for (int i01 = ith; i01 < ne01; i01 += nth) {
+                const float * x = (float *) ((char *) src0->data + i01*nb01 + i02*nb02 + i03*nb03);
+
+                ggml_float mean = 0.0;
+                for (int i00 = 0; i00 < ne00; i00++) {
+                    mean += x[i00];
                 }
-                if (src1->grad) {
-                    src1->grad = ggml_sub_impl(ctx, src1->grad, tensor->grad, inplace);
+
+                mean /= ne00;
+
+                float * y = (float *) ((char *) dst->data + i01*nb1 + i02*nb2 + i03*nb3);
+
+                ggml_float sum2 = 0.0;
+                for (int i00 = 0; i00 < ne00; i00++) {
+                    ggml_float v = x[i00] - mean;
+                    y[i00] = v;
+                    sum2 += v*v;
                 }
-            } break;
-        case GGML_OP_MUL:
+
+                const float scale = 1.0/sqrt(sum2/ne00 + eps);
+
+                ggml_vec_scale_f32(ne00, y, scale);
+            }
+        }
+    }
+}
+
+static void ggml_compute_forward_norm(
+        const struct ggml_compute_params * params,
+        const struct ggml_tensor * src0,
+        struct ggml_tensor * dst) {
+    switch (src0->type) {
+        case GGML_TYPE_F32:
             {
-                if (src0->grad) {
-                    src0->grad =
-                        ggml_add_impl(ctx,
-                                src0->grad,
-                                ggml_mul(ctx, src1, tensor->grad),
-                                inplace);
-                }
-                if (src1->grad) {
-                    src1->grad =
-                        ggml_add_impl(ctx,
-                                src1->grad,
-                                ggml_mul(ctx, src0, tensor->grad),
-                                inplace);
-                }
+                ggml_compute_forward_norm_f32(params, src0, dst);
             } break;
-        case GGML_OP_DIV:
+        case GGML_TYPE_I8:
+        case GGML_TYPE_I16:
+        case GGML_TYPE_I32:
+        case GGML_TYPE_F16:
+        case GGML_TYPE_Q4_0:
+        case GGML_TYPE_Q8_0:
+        case GGML_TYPE_COUNT:
             {
-                if (src0->grad) {
-                    src0->grad =
-                        ggml_add_impl(ctx,
-                                src0->grad,
-                                ggml_div(ctx, tensor->grad, src1),
-                                inplace);
-                }
-                if (src1->grad) {
-                    src1->grad =
-                        ggml_sub_impl(ctx,
-                                src1->grad,
-                                ggml_mul(ctx,
-                                    tensor->grad,
-                                    ggml_div(ctx, tensor, src1)),
-                                inplace);
-                }
+                assert(false);
             } break;
-        case GGML_OP_SQR:
+    }
+}
+
+// ggml_compute_forward_norm_affine
+
+static void ggml_compute_forward_norm_affine_f32(
+        const struct ggml_compute_params * params,
+        const struct ggml_tensor * src0,
+        const struct ggml_tensor * src1,
+        const struct ggml_tensor * opt0,
+        struct ggml_tensor * dst) {
+    GGML_ASSERT(ggml_are_same_shape(src0, dst));
+
+    if (params->type == GGML_TASK_INIT || params->type == GGML_TASK_FINALIZE) {
+        return;
+    }
+
+    GGML_ASSERT(src0->nb[0] == sizeof(float));
+    GGML_ASSERT(src1->type == GGML_TYPE_F32 && src1->nb[0] == sizeof(float));
+    GGML_ASSERT(opt0->type == GGML_TYPE_F32 && opt0->nb[0] == sizeof(float));
+
+    const int ith = params->ith;
+    const int nth = params->nth;
+
+    const int ne00 = src0->ne[0];
+    const int ne01 = src0->ne[1];
+    const int ne02 = src0->ne[2];
+    const int ne03 = src0->ne[3];
+
+    const size_t nb01 = src0->nb[1];
+    const size_t nb02 = src0->nb[2];
+    const size_t nb03 = src0->nb[3];
+
+    const size_t nb1 = dst->nb[1];
+    const size_t nb2 = dst->nb[2];
+    const size_t nb3 = dst->nb[3];
+
+    const float eps = 1e-5f; // TODO: make this a parameter
+
+    const float * w = (float *) src1->data;
+    const float * b = (float *) opt0->data;
+
+    for (int i03 = 0; i03 < ne03; i03++) {
+        for (int i02 = 0; i02 < ne02; i02++) {
+            for (int i01 = ith; i01 < ne01; i01 += nth) {
+                ggml_vec_norm_affine_f32(ne00,
+                        (float *) ((char *)  dst->data + i01*nb1  + i02*nb2  + i03*nb3),
+                        (float *) ((char *) src0->data + i01*nb01 + i02*nb02 + i03*nb03),
+                        w, b, eps);
+            }
+        }
+    }
+}
+
+static void ggml_compute_forward_norm_affine(
+        const struct ggml_compute_params * params,
+        const struct ggml_tensor * src0,
+        const struct ggml_tensor * src1,
+        const struct ggml_tensor * opt0,
+        struct ggml_tensor * dst) {
+    switch (src0->type) {
+        case GGML_TYPE_F32:
             {
-                if (src0->grad) {
-                    src0->grad =
-                        ggml_add_impl(ctx,
-                                src0->grad,
-                                ggml_mul(ctx,
-                                    ggml_mul(ctx, src0, tensor->grad),
-                                    ggml_repeat(ctx, ggml_new_f32(ctx, 2.0f), src0)),
-                                inplace);
-                }
+                ggml_compute_forward_norm_affine_f32(params, src0, src1, opt0, dst);
             } break;
-        case GGML_OP_SQRT:
+        case GGML_TYPE_I8:
+        case GGML_TYPE_I16:
+        case GGML_TYPE_I32:
+        case GGML_TYPE_F16:
+        case GGML_TYPE_Q4_0:
+        case GGML_TYPE_Q8_0:
+        case GGML_TYPE_COUNT:
             {
-                if (src0->grad) {
-                    src0->grad =
-                        ggml_add_impl(ctx,
-                                src0->grad,
-                                ggml_div(ctx,
-                                    ggml_repeat(ctx, ggml_new_f32(ctx, 0.5f), tensor),
-                                    tensor),
-                                inplace);
-                }
+                assert(false);
             } break;
-        case GGML_OP_SUM:
-            {
-                if (src0->grad) {
-                    src0->grad =
-                        ggml_add_impl(ctx,
-                                src0->grad,
-                                ggml_repeat(ctx, tensor->grad, src0->grad),
-                                inplace);
-                }
-            } break;
-        case GGML_OP_MEAN:
-            {
-                assert(false); // TODO: implement
-            } break;
-        case GGML_OP_REPEAT:
-            {
-                if (src0->grad) {
-                    src0->grad =
-                        ggml_add_impl(ctx,
-                                src0->grad,
-                                ggml_sum(ctx, tensor->grad),
-                                inplace);
-                }
-            } break;
-        case GGML_OP_ABS:
-            {
-                if (src0->grad) {
-                    src0->grad =
-                        ggml_add_impl(ctx,
-                                src0->grad,
-                                ggml_mul(ctx,
-                                    ggml_sgn(ctx, src0),
-                                    tensor->grad),
-                                inplace);
+    }
+}
+
+// ggml_compute_forward_mul_mat
+
+#if defined(GGML_USE_ACCELERATE) || defined(GGML_USE_OPENBLAS)
+// helper function to determine if it is better to use BLAS or not
+// for large matrices, BLAS is faster
+static bool ggml_compute_forward_mul_mat_use_blas(
+        const struct ggml_tensor * src0,
+        const struct ggml_tensor * src1,
+              struct ggml_tensor * dst) {
+    const int ne10 = src1->ne[0];
+
+    const int ne0 = dst->ne[0];
+    const int ne1 = dst->ne[1];
+
+    if (!ggml_is_contiguous(src0) || !ggml_is_contiguous(src1)) {
+        return false;
+    }
+
+    // see ggml_tune_graph()
+    if (dst->kernel != GGML_TUNE_KERNEL_AUTO) {
+        return dst->kernel == GGML_TUNE_KERNEL_BLAS;
+    }
+
+    if (ne0 >= 32 && ne1 >= 32 && ne10 >= 32) {
+        //printf("BLAS: %d %d %d\n", ne0, ne1, ne10);
+        return true;
+    }
+
+    return false;
+}
+#endif
+
+// the optional epilogue of ggml_mul_mat_bias - y = gelu(y + c) for n consecutive values of a dst row
+inline static void ggml_vec_mul_mat_epilogue_f32(const int n, float * y, const float * c, const bool gelu) {
+    if (c) {
+        ggml_vec_acc_f32(n, y, c);
+    }
+    if (gelu) {
+        ggml_vec_gelu_f32(n, y, y);
+    }
+}
+
+// apply the epilogue to the dst values computed from the src0 rows [ir0, ir1)
+static void ggml_compute_forward_mul_mat_epilogue(
+        const struct ggml_tensor * bias,
+        const bool gelu,
+              struct ggml_tensor * dst,
+        const int ir0,
+        const int ir1) {
+    if (bias == NULL && !gelu) {
+        return;
+    }
+
+    const int ne0 = dst->ne[0];
+    const int ne1 = dst->ne[1];
+    const int ne2 = dst->ne[2];
+
+    const size_t nb1 = dst->nb[1];
+    const size_t nb2 = dst->nb[2];
+    const size_t nb3 = dst->nb[3];
+
+    const float * c = bias ? (const float *) bias->data : NULL;
+
+    for (int ir = ir0; ir < ir1; ) {
+        // the src0 row index is the dst column index
+        const int i3 = ir/(ne2*ne0);
+        const int i2 = (ir - i3*ne2*ne0)/ne0;
+        const int i0 = (ir - i3*ne2*ne0 - i2*ne0);
+
+        const int n = MIN(ir1 - ir, ne0 - i0);
+
+        for (int i1 = 0; i1 < ne1; ++i1) {
+            float * y = (float *) ((char *) dst->data + i1*nb1 + i2*nb2 + i3*nb3) + i0;
+            ggml_vec_mul_mat_epilogue_f32(n, y, c ? c + i0 : NULL, gelu);
+        }
+
+        ir += n;
+    }
+}
+
+// apply the epilogue to the values [i0, i1) of a contiguous dst
+static void ggml_compute_forward_mul_mat_epilogue_flat(
+        const struct ggml_tensor * bias,
+        const bool gelu,
+              struct ggml_tensor * dst,
+        const int i0,
+        const int i1) {
+    if (bias == NULL && !gelu) {
+        return;
+    }
+
+    const int ne0 = dst->ne[0];
+
+    const float * c = bias ? (const float *) bias->data : NULL;
+
+    for (int i = i0; i < i1; ) {
+        const int n = MIN(i1 - i, ne0 - i%ne0);
+        ggml_vec_mul_mat_epilogue_f32(n, (float *) dst->data + i, c ? c + i%ne0 : NULL, gelu);
+        i += n;
+    }
+}
+
+static void ggml_compute_forward_mul_mat_f32(
+        const struct ggml_compute_params * params,
+        const struct ggml_tensor * src0,
+        const struct ggml_tensor * src1,
+        const struct ggml_tensor * bias,
+        const bool gelu,
+              struct ggml_tensor * dst) {
+    int64_t t0 = ggml_perf_time_us();
+    UNUSED(t0);
+
+    const int ne00 = src0->ne[0];
+    const int ne01 = src0->ne[1];
+    const int ne02 = src0->ne[2];
+    const int ne03 = src0->ne[3];
+
+    const int ne10 = src1->ne[0];
+    const int ne11 = src1->ne[1];
+    const int ne12 = src1->ne[2];
+    const int ne13 = src1->ne[3];
+
+    const int ne0  = dst->ne[0];
+    const int ne1  = dst->ne[1];
+    const int ne2  = dst->ne[2];
+    const int ne3  = dst->ne[3];
+    const int ne   = ne0*ne1*ne2*ne3;
+
+    const int nb00 = src0->nb[0];
+    const int nb01 = src0->nb[1];
+    const int nb02 = src0->nb[2];
+    const int nb03 = src0->nb[3];
+
+    const int nb10 = src1->nb[0];
+    const int nb11 = src1->nb[1];
+    const int nb12 = src1->nb[2];
+    const int nb13 = src1->nb[3];
+
+    const int nb0  = dst->nb[0];
+    const int nb1  = dst->nb[1];
+    const int nb2  = dst->nb[2];
+    const int nb3  = dst->nb[3];
+
+    const int ith = params->ith;
+    const int nth = params->nth;
+
+    assert(ne02 == ne12);
+    assert(ne03 == ne13);
+    assert(ne2  == ne12);
+    assert(ne3  == ne13);
+
+    // TODO: we don't support permuted src0
+    assert(nb00 == sizeof(float) || nb01 == sizeof(float));
+
+    // dst cannot be transposed or permuted
+    assert(nb0 == sizeof(float));
+    assert(nb0 <= nb1);
+    assert(nb1 <= nb2);
+    assert(nb2 <= nb3);
+
+    assert(ne0 == ne01);
+    assert(ne1 == ne11);
+    assert(ne2 == ne02);
+    assert(ne3 == ne03);
+
+    // nb01 >= nb00 - src0 is not transposed
+    //   compute by src0 rows
+    //
+    // nb00 <  nb01 - src0 is transposed
+    //   compute by src0 columns
+
+#if defined(GGML_USE_ACCELERATE) || defined(GGML_USE_OPENBLAS)
+    if (ggml_compute_forward_mul_mat_use_blas(src0, src1, dst)) {
+        GGML_ASSERT(nb10 == sizeof(float));
+
+        if (params->ith != 0) {
+            return;
+        }
+
+        if (params->type == GGML_TASK_INIT) {
+            return;
+        }
+
+        if (params->type == GGML_TASK_FINALIZE) {
+            return;
+        }
+
+        for (int i03 = 0; i03 < ne03; i03++) {
+            for (int i02 = 0; i02 < ne02; i02++) {
+                const float * x = (float *) (src0->data);
+                const float * y = (float *) ((char *) src1->data + i02*nb12 + i03*nb13);
+
+                float * d = (float *) ((char *) dst->data + i02*nb2 + i03*nb3);
+
+                // zT = y * xT
+                {
+                    cblas_sgemm(CblasRowMajor, CblasNoTrans, CblasTrans,
+                            ne11, ne01, ne10,
+                            1.0f,    y, ne10,
+                                     x, ne10,
+                            0.0f,    d, ne01);
                 }
-            } break;
-        case GGML_OP_SGN:
-            {
-                if (src0->grad) {
-                    // noop
+            }
+        }
+
+        ggml_compute_forward_mul_mat_epilogue(bias, gelu, dst, 0, ne01*ne02*ne03);
+
+        //printf("CBLAS F32 = %f ms, %d x %d x %d x %d\n", (ggml_perf_time_us() - t0)/1000.0, ne0, ne1, ne2, ne3);
+
+        return;
+    }
+#endif
+
+    if (params->type == GGML_TASK_INIT) {
+        if (nb01 >= nb00) {
+            return;
+        }
+
+        // TODO: fix this memset (wsize is overestimated)
+        memset(params->wdata, 0, params->wsize);
+        return;
+    }
+
+    if (params->type == GGML_TASK_FINALIZE) {
+        if (nb01 >= nb00) {
+            return;
+        }
+
+        // TODO: fix this memset (wsize is overestimated)
+        //assert(params->wsize == (ggml_nbytes(dst) + CACHE_LINE_SIZE)*nth);
+
+        float * const wdata = params->wdata;
+
+        // cols per thread
+        const int dc = (ne + nth - 1)/nth;
+
+        // col range for this thread
+        const int ic0 = dc*ith;
+        const int ic1 = MIN(ic0 + dc, ne);
+
+        ggml_vec_cpy_f32(ic1 - ic0, (float *) dst->data + ic0, wdata + ic0);
+
+        for (int k = 1; k < nth; k++) {
+            ggml_vec_acc_f32(ic1 - ic0, (float *) dst->data + ic0, wdata + (ne + CACHE_LINE_SIZE_F32)*k + ic0);
+        }
+
+        ggml_compute_forward_mul_mat_epilogue_flat(bias, gelu, dst, ic0, ic1);
+
+        return;
+    }
+
+    if (nb01 >= nb00) {
+        // TODO: do not support transposed src1
+        assert(nb10 == sizeof(float));
+
+        // parallelize by src0 rows using ggml_vec_dot_f32
+
+        // total rows in src0
+        const int nr = ne01*ne02*ne03;
+
+        // rows per chunk
+        const int dr = ggml_task_chunk_size(params, dst, nr, 1);
+        const int nchunk = (nr + dr - 1)/dr;
+
+        for (int ik = ggml_task_chunk_first(params, nchunk); ik < nchunk; ik = ggml_task_chunk_next(params, nchunk)) {
+            // row range for this chunk
+            const int ir0 = dr*ik;
+            const int ir1 = MIN(ir0 + dr, nr);
+
+            for (int ir = ir0; ir < ir1; ++ir) {
+                // src0 indices
+                const int i03 = ir/(ne02*ne01);
+                const int i02 = (ir - i03*ne02*ne01)/ne01;
+                const int i01 = (ir - i03*ne02*ne01 - i02*ne01);
+
+                for (int ic = 0; ic < ne11; ++ic) {
+                    // src1 indices
+                    const int i13 = i03;
+                    const int i12 = i02;
+                    const int i11 = ic;
+
+                    // dst indices
+                    const int i0 = i01;
+                    const int i1 = i11;
+                    const int i2 = i02;
+                    const int i3 = i03;
+
+                    ggml_vec_dot_f32(ne00,
+                            (float *) ((char *)  dst->data + (i0*nb0 + i1*nb1 + i2*nb2 + i3*nb3)),
+                            (float *) ((char *) src0->data + (i01*nb01 + i02*nb02 + i03*nb03)),
+                            (float *) ((char *) src1->data + (i11*nb11 + i12*nb12 + i13*nb13)));
                 }
-            } break;
-        case GGML_OP_NEG:
-            {
-                if (src0->grad) {
-                    src0->grad = ggml_sub_impl(ctx, src0->grad, tensor->grad, inplace);
-                }
-            } break;
-        case GGML_OP_STEP:
-            {
-                if (src0->grad) {
-                    // noop
-                }
-            } break;
-        case GGML_OP_RELU:
-            {
-                if (src0->grad) {
-                    src0->grad = ggml_sub_impl(ctx,
-                            src0->grad,
-                            ggml_mul(ctx,
-                                ggml_step(ctx, src0),
-                                tensor->grad),
-                            inplace);
+
+                ggml_compute_forward_mul_mat_epilogue(bias, gelu, dst, ir, ir + 1);
+            }
+        }
+    } else {
+        // parallelize by src1 columns using ggml_vec_mad_f32
+        // each thread has its own work data
+        // during FINALIZE we accumulate all work data into dst
+
+        // total columns in src1
+        const int nc = ne10;
+
+        // columns per thread - the partial sums are accumulated per thread, so the columns are not claimed
+        // dynamically to keep the result independent of the scheduling
+        const int dc = (nc + nth - 1)/nth;
+
+        // column range for this thread
+        const int ic0 = dc*ith;
+        const int ic1 = MIN(ic0 + dc, nc);
+
+        // work data for thread
+        const int wo = (ne + CACHE_LINE_SIZE_F32)*ith;
+        float * const wdata = params->wdata;
+
+        for (int i13 = 0; i13 < ne13; ++i13) {
+            for (int i12 = 0; i12 < ne12; ++i12) {
+                for (int i11 = 0; i11 < ne11; ++i11) {
+                    for (int ic = ic0; ic < ic1; ++ic) {
+                        // src1 indices
+                        const int i10 = ic;
+
+                        // src0 indices
+                        const int i03 = i13;
+                        const int i02 = i12;
+                        const int i00 = ic;
+
+                        // dst indices
+                        const int i1 = i11;
+                        const int i2 = i12;
+                        const int i3 = i13;
+
+                        assert(sizeof(float)*(wo + i3*ne2*ne1*ne0 + i2*ne1*ne0 + i1*ne0 + ne01) <= params->wsize);
+
+                        ggml_vec_mad_f32(ne01,
+                                (float *) (wdata + wo + i3*ne2*ne1*ne0 + i2*ne1*ne0 + i1*ne0),
+                                (float *) ((char *) src0->data + (i00*nb00 + i02*nb02 + i03*nb03)),
+                               *(float *) ((char *) src1->data + (i10*nb10 + i11*nb11 + i12*nb12 + i13*nb13)));
+                    }
                 }
-            } break;
-        case GGML_OP_GELU:
-            {
-                assert(false); // TODO: not implemented
-            } break;
-        case GGML_OP_NORM:
-            {
-                assert(false); // TODO: not implemented
-            } break;
-        case GGML_OP_MUL_MAT:
-            {
-                if (src0->grad) {
-                    // TODO: this requires outer product - ggml_out_prod(ctx, src1, tensor->grad);
-                    assert(false);
+            }
+        }
+    }
+
+    //int64_t t1 = ggml_perf_time_us();
+    //static int64_t acc = 0;
+    //acc += t1 - t0;
+    //if (t1 - t0 > 10) {
+    //    printf("\n");
+    //    printf("ne00 = %5d, ne01 = %5d, ne02 = %5d, ne03 = %5d\n", ne00, ne01, ne02, ne03);
+    //    printf("nb00 = %5d, nb01 = %5d, nb02 = %5d, nb03 = %5d\n", nb00, nb01, nb02, nb03);
+    //    printf("ne10 = %5d, ne11 = %5d, ne12 = %5d, ne13 = %5d\n", ne10, ne11, ne12, ne13);
+    //    printf("nb10 = %5d, nb11 = %5d, nb12 = %5d, nb13 = %5d\n", nb10, nb11, nb12, nb13);
+
+    //    printf("XXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXX task %d/%d: %d us, acc = %d\n", ith, nth, (int) (t1 - t0), (int) acc);
+    //}
+}
+
+// blocked GEMM used for the large f16 x f32 matrix multiplications (e.g. the encoder with n_ctx = 1500 columns)
+//
+//   dst[i1][i0] = sum_k src0[i0][k]*src1[i1][k]
+//
+// during COMPUTE each thread converts blocks of GGML_GEMM_MC x GGML_GEMM_KC values of its src0 rows into panels of
+// GGML_GEMM_MR rows - [MC/MR][KC][MR] - and multiplies them with GGML_GEMM_NR rows of src1 at a time using a
+// register-blocked micro-kernel, so that the src0 block stays in L2 and the current src1 rows stay in L1
+// src1 is read in place, so the only work memory is one src0 block per thread
+//
+// with runtime CPU dispatch the micro-kernel can be replaced by a wider one - the panels then have ggml_gemm_mr() rows
+//
+
+#if defined(GGML_SIMD)
+#define GGML_GEMM_MR (2*GGML_F32_EPR)
+#else
+#define GGML_GEMM_MR 8
+#endif
+
+// the widest micro-kernel (AVX-512)
+#define GGML_GEMM_MR_MAX 32
+
+#define GGML_GEMM_NR 6
+#define GGML_GEMM_MC 128
+#define GGML_GEMM_KC 256
+
+// number of src0 rows computed by the micro-kernel
+static inline int ggml_gemm_mr(void) {
+#if defined(GGML_CPU_DISPATCH)
+    if (ggml_vec_fns.gemm_ukernel) {
+        return ggml_vec_fns.gemm_mr;
+    }
+#endif
+    return GGML_GEMM_MR;
+}
+
+// c[j*ldc + i] (+)= sum_l a[l*MR + i]*b[j*ldb + l], i < MR, j < NR
+static void ggml_gemm_f32_ukernel(
+        const int k,
+        const float * restrict a,
+        const float * restrict b,
+        const int ldb,
+              float * restrict c,
+        const int ldc,
+        const bool acc) {
+#if defined(GGML_CPU_DISPATCH)
+    if (ggml_vec_fns.gemm_ukernel) {
+        ggml_vec_fns.gemm_ukernel(k, a, b, ldb, c, ldc, acc);
+        return;
+    }
+#endif
+
+#if defined(GGML_SIMD)
+    GGML_F32_VEC c00 = GGML_F32_VEC_ZERO, c01 = GGML_F32_VEC_ZERO;
+    GGML_F32_VEC c10 = GGML_F32_VEC_ZERO, c11 = GGML_F32_VEC_ZERO;
+    GGML_F32_VEC c20 = GGML_F32_VEC_ZERO, c21 = GGML_F32_VEC_ZERO;
+    GGML_F32_VEC c30 = GGML_F32_VEC_ZERO, c31 = GGML_F32_VEC_ZERO;
+    GGML_F32_VEC c40 = GGML_F32_VEC_ZERO, c41 = GGML_F32_VEC_ZERO;
+    GGML_F32_VEC c50 = GGML_F32_VEC_ZERO, c51 = GGML_F32_VEC_ZERO;
+
+    const float * b0 = b + 0*ldb;
+    const float * b1 = b + 1*ldb;
+    const float * b2 = b + 2*ldb;
+    const float * b3 = b + 3*ldb;
+    const float * b4 = b + 4*ldb;
+    const float * b5 = b + 5*ldb;
+
+    for (int l = 0; l < k; ++l) {
+        const GGML_F32_VEC a0 = GGML_F32_VEC_LOAD(a);
+        const GGML_F32_VEC a1 = GGML_F32_VEC_LOAD(a + GGML_F32_EPR);
+
+        GGML_F32_VEC bj;
+
+        bj = GGML_F32_VEC_SET1(b0[l]); c00 = GGML_F32_VEC_FMA(c00, a0, bj); c01 = GGML_F32_VEC_FMA(c01, a1, bj);
+        bj = GGML_F32_VEC_SET1(b1[l]); c10 = GGML_F32_VEC_FMA(c10, a0, bj); c11 = GGML_F32_VEC_FMA(c11, a1, bj);
+        bj = GGML_F32_VEC_SET1(b2[l]); c20 = GGML_F32_VEC_FMA(c20, a0, bj); c21 = GGML_F32_VEC_FMA(c21, a1, bj);
+        bj = GGML_F32_VEC_SET1(b3[l]); c30 = GGML_F32_VEC_FMA(c30, a0, bj); c31 = GGML_F32_VEC_FMA(c31, a1, bj);
+        bj = GGML_F32_VEC_SET1(b4[l]); c40 = GGML_F32_VEC_FMA(c40, a0, bj); c41 = GGML_F32_VEC_FMA(c41, a1, bj);
+        bj = GGML_F32_VEC_SET1(b5[l]); c50 = GGML_F32_VEC_FMA(c50, a0, bj); c51 = GGML_F32_VEC_FMA(c51, a1, bj);
+
+        a += GGML_GEMM_MR;
+    }
+
+    if (acc) {
+        c00 = GGML_F32_VEC_ADD(c00, GGML_F32_VEC_LOAD(c + 0*ldc)); c01 = GGML_F32_VEC_ADD(c01, GGML_F32_VEC_LOAD(c + 0*ldc + GGML_F32_EPR));
+        c10 = GGML_F32_VEC_ADD(c10, GGML_F32_VEC_LOAD(c + 1*ldc)); c11 = GGML_F32_VEC_ADD(c11, GGML_F32_VEC_LOAD(c + 1*ldc + GGML_F32_EPR));
+        c20 = GGML_F32_VEC_ADD(c20, GGML_F32_VEC_LOAD(c + 2*ldc)); c21 = GGML_F32_VEC_ADD(c21, GGML_F32_VEC_LOAD(c + 2*ldc + GGML_F32_EPR));
+        c30 = GGML_F32_VEC_ADD(c30, GGML_F32_VEC_LOAD(c + 3*ldc)); c31 = GGML_F32_VEC_ADD(c31, GGML_F32_VEC_LOAD(c + 3*ldc + GGML_F32_EPR));
+        c40 = GGML_F32_VEC_ADD(c40, GGML_F32_VEC_LOAD(c + 4*ldc)); c41 = GGML_F32_VEC_ADD(c41, GGML_F32_VEC_LOAD(c + 4*ldc + GGML_F32_EPR));
+        c50 = GGML_F32_VEC_ADD(c50, GGML_F32_VEC_LOAD(c + 5*ldc)); c51 = GGML_F32_VEC_ADD(c51, GGML_F32_VEC_LOAD(c + 5*ldc + GGML_F32_EPR));
+    }
+
+    GGML_F32_VEC_STORE(c + 0*ldc, c00); GGML_F32_VEC_STORE(c + 0*ldc + GGML_F32_EPR, c01);
+    GGML_F32_VEC_STORE(c + 1*ldc, c10); GGML_F32_VEC_STORE(c + 1*ldc + GGML_F32_EPR, c11);
+    GGML_F32_VEC_STORE(c + 2*ldc, c20); GGML_F32_VEC_STORE(c + 2*ldc + GGML_F32_EPR, c21);
+    GGML_F32_VEC_STORE(c + 3*ldc, c30); GGML_F32_VEC_STORE(c + 3*ldc + GGML_F32_EPR, c31);
+    GGML_F32_VEC_STORE(c + 4*ldc, c40); GGML_F32_VEC_STORE(c + 4*ldc + GGML_F32_EPR, c41);
+    GGML_F32_VEC_STORE(c + 5*ldc, c50); GGML_F32_VEC_STORE(c + 5*ldc + GGML_F32_EPR, c51);
+#else
+    float sum[GGML_GEMM_NR][GGML_GEMM_MR] = { { 0.0f } };
+
+    for (int l = 0; l < k; ++l) {
+        for (int j = 0; j < GGML_GEMM_NR; ++j) {
+            for (int i = 0; i < GGML_GEMM_MR; ++i) {
+                sum[j][i] += a[i]*b[j*ldb + l];
+            }
+        }
+
+        a += GGML_GEMM_MR;
+    }
+
+    for (int j = 0; j < GGML_GEMM_NR; ++j) {
+        for (int i = 0; i < GGML_GEMM_MR; ++i) {
+            c[j*ldc + i] = acc ? c[j*ldc + i] + sum[j][i] : sum[j][i];
+        }
+    }
+#endif
+}
+
+#if defined(GGML_CPU_DISPATCH)
+
+#if defined(GGML_CPU_DISPATCH_AVX2)
+// MR = 16
+GGML_TARGET_AVX2 static void ggml_gemm_f32_ukernel_avx2(
+        const int k,
+        const float * restrict a,
+        const float * restrict b,
+        const int ldb,
+              float * restrict c,
+        const int ldc,
+        const bool acc) {
+    __m256 c0[GGML_GEMM_NR];
+    __m256 c1[GGML_GEMM_NR];
+
+    for (int j = 0; j < GGML_GEMM_NR; ++j) {
+        c0[j] = _mm256_setzero_ps();
+        c1[j] = _mm256_setzero_ps();
+    }
+
+    for (int l = 0; l < k; ++l) {
+        const __m256 a0 = _mm256_loadu_ps(a + 0);
+        const __m256 a1 = _mm256_loadu_ps(a + 8);
+
+        for (int j = 0; j < GGML_GEMM_NR; ++j) {
+            const __m256 bj = _mm256_set1_ps(b[j*ldb + l]);
+
+            c0[j] = _mm256_fmadd_ps(a0, bj, c0[j]);
+            c1[j] = _mm256_fmadd_ps(a1, bj, c1[j]);
+        }
+
+        a += 16;
+    }
+
+    for (int j = 0; j < GGML_GEMM_NR; ++j) {
+        if (acc) {
+            c0[j] = _mm256_add_ps(c0[j], _mm256_loadu_ps(c + j*ldc + 0));
+            c1[j] = _mm256_add_ps(c1[j], _mm256_loadu_ps(c + j*ldc + 8));
+        }
+
+        _mm256_storeu_ps(c + j*ldc + 0, c0[j]);
+        _mm256_storeu_ps(c + j*ldc + 8, c1[j]);
+    }
+}
+#endif
+
+// MR = 32
+GGML_TARGET_AVX512 static void ggml_gemm_f32_ukernel_avx512(
+        const int k,
+        const float * restrict a,
+        const float * restrict b,
+        const int ldb,
+              float * restrict c,
+        const int ldc,
+        const bool acc) {
+    __m512 c0[GGML_GEMM_NR];
+    __m512 c1[GGML_GEMM_NR];
+
+    for (int j = 0; j < GGML_GEMM_NR; ++j) {
+        c0[j] = _mm512_setzero_ps();
+        c1[j] = _mm512_setzero_ps();
+    }
+
+    for (int l = 0; l < k; ++l) {
+        const __m512 a0 = _mm512_loadu_ps(a +  0);
+        const __m512 a1 = _mm512_loadu_ps(a + 16);
+
+        for (int j = 0; j < GGML_GEMM_NR; ++j) {
+            const __m512 bj = _mm512_set1_ps(b[j*ldb + l]);
+
+            c0[j] = _mm512_fmadd_ps(a0, bj, c0[j]);
+            c1[j] = _mm512_fmadd_ps(a1, bj, c1[j]);
+        }
+
+        a += 32;
+    }
+
+    for (int j = 0; j < GGML_GEMM_NR; ++j) {
+        if (acc) {
+            c0[j] = _mm512_add_ps(c0[j], _mm512_loadu_ps(c + j*ldc +  0));
+            c1[j] = _mm512_add_ps(c1[j], _mm512_loadu_ps(c + j*ldc + 16));
+        }
+
+        _mm512_storeu_ps(c + j*ldc +  0, c0[j]);
+        _mm512_storeu_ps(c + j*ldc + 16, c1[j]);
+    }
+}
+
+struct ggml_x86_features {
+    bool avx2;        // AVX2 + FMA + F16C
+    bool avx512;      // AVX512F + AVX512BW + AVX512VL
+    bool avx512_vnni;
+};
+
+// the OS also has to save the YMM state (XCR0 bits 1 and 2) for AVX2 and the ZMM state (XCR0 bits 5, 6 and 7) for AVX-512
+static struct ggml_x86_features ggml_x86_features_detect(void) {
+    struct ggml_x86_features res = { false, false, false };
+
+    unsigned int eax, ebx, ecx, edx;
+
+    if (!__get_cpuid(1, &eax, &ebx, &ecx, &edx)) {
+        return res;
+    }
+
+    const bool fma     = (ecx >> 12) & 1;
+    const bool osxsave = (ecx >> 27) & 1;
+    const bool avx     = (ecx >> 28) & 1;
+    const bool f16c    = (ecx >> 29) & 1;
+
+    if (!(osxsave && avx)) {
+        return res;
+    }
+
+    unsigned int xcr0, xcr0_hi;
+    __asm__ volatile("xgetbv" : "=a"(xcr0), "=d"(xcr0_hi) : "c"(0));
+    UNUSED(xcr0_hi);
+
+    if ((xcr0 & 0x6) != 0x6 || __get_cpuid_max(0, NULL) < 7) {
+        return res;
+    }
+
+    __cpuid_count(7, 0, eax, ebx, ecx, edx);
+
+    const bool avx2     = (ebx >>  5) & 1;
+    const bool avx512f  = (ebx >> 16) & 1;
+    const bool avx512bw = (ebx >> 30) & 1;
+    const bool avx512vl = (ebx >> 31) & 1;
+    const bool vnni     = (ecx >> 11) & 1;
+
+    res.avx2        = avx2 && fma && f16c;
+    res.avx512      = res.avx2 && (xcr0 & 0xE0) == 0xE0 && avx512f && avx512bw && avx512vl;
+    res.avx512_vnni = res.avx512 && vnni;
+
+    return res;
+}
+
+// select the kernels for the current CPU - called once by ggml_init
+static void ggml_vec_fns_init(void) {
+    const struct ggml_x86_features features = ggml_x86_features_detect();
+
+    if (features.avx512) {
+        ggml_vec_fns = (struct ggml_vec_fns_t) {
+            /*.isa           =*/ GGML_VEC_ISA_AVX512,
+            /*.vnni          =*/ features.avx512_vnni,
+            /*.dot_f32       =*/ ggml_vec_dot_f32_avx512,
+            /*.dot_f16       =*/ ggml_vec_dot_f16_avx512,
+            /*.mad_f32       =*/ ggml_vec_mad_f32_avx512,
+            /*.mad_f16       =*/ ggml_vec_mad_f16_avx512,
+            /*.scale_f32     =*/ ggml_vec_scale_f32_avx512,
+            /*.gemv_f16      =*/ ggml_vec_gemv_f16_avx512,
+            /*.cvt_f16_f32   =*/ ggml_vec_cvt_f16_f32_avx512,
+            /*.cvt_f32_f16   =*/ ggml_vec_cvt_f32_f16_avx512,
+            /*.soft_max_f32  =*/ ggml_vec_soft_max_f32_avx512,
+            /*.dot_q4_0_q8_0 =*/ features.avx512_vnni ? ggml_vec_dot_q4_0_q8_0_vnni : NULL,
+            /*.dot_q8_0_q8_0 =*/ features.avx512_vnni ? ggml_vec_dot_q8_0_q8_0_vnni : NULL,
+            /*.gemm_ukernel  =*/ ggml_gemm_f32_ukernel_avx512,
+            /*.gemm_mr       =*/ 32,
+        };
+
+        return;
+    }
+
+#if defined(GGML_CPU_DISPATCH_AVX2)
+    if (features.avx2) {
+        ggml_vec_fns = (struct ggml_vec_fns_t) {
+            /*.isa           =*/ GGML_VEC_ISA_AVX2,
+            /*.vnni          =*/ false,
+            /*.dot_f32       =*/ ggml_vec_dot_f32_avx2,
+            /*.dot_f16       =*/ ggml_vec_dot_f16_avx2,
+            /*.mad_f32       =*/ ggml_vec_mad_f32_avx2,
+            /*.mad_f16       =*/ ggml_vec_mad_f16_avx2,
+            /*.scale_f32     =*/ NULL,
+            /*.gemv_f16      =*/ ggml_vec_gemv_f16_avx2,
+            /*.cvt_f16_f32   =*/ ggml_vec_cvt_f16_f32_avx2,
+            /*.cvt_f32_f16   =*/ ggml_vec_cvt_f32_f16_avx2,
+            /*.soft_max_f32  =*/ NULL,
+            /*.dot_q4_0_q8_0 =*/ NULL,
+            /*.dot_q8_0_q8_0 =*/ NULL,
+            /*.gemm_ukernel  =*/ ggml_gemm_f32_ukernel_avx2,
+            /*.gemm_mr       =*/ 16,
+        };
+    }
+#endif
+}
+
+#endif
+
+// work buffer: one src0 block per thread
+static size_t ggml_gemm_f16_f32_wsize(int nth) {
+    return sizeof(float)*nth*(GGML_GEMM_MC*GGML_GEMM_KC + CACHE_LINE_SIZE_F32);
+}
+
+// multiply the src0 rows [ir0, ir1) with src1
+// the bias and the GELU of ggml_mul_mat_bias are applied to each panel of NR dst rows right after its last KC block
+static void ggml_gemm_f16_f32(
+        const struct ggml_tensor * src0,
+        const struct ggml_tensor * src1,
+        const struct ggml_tensor * bias,
+        const bool gelu,
+              struct ggml_tensor * dst,
+              float * restrict wdata,
+        const int ir0,
+        const int ir1) {
+    const int ne00 = src0->ne[0];
+    const int ne01 = src0->ne[1];
+    const int ne02 = src0->ne[2];
+
+    const int ne11 = src1->ne[1];
+
+    const size_t nb01 = src0->nb[1];
+    const size_t nb02 = src0->nb[2];
+    const size_t nb03 = src0->nb[3];
+
+    const size_t nb11 = src1->nb[1];
+    const size_t nb12 = src1->nb[2];
+    const size_t nb13 = src1->nb[3];
+
+    const size_t nb1 = dst->nb[1];
+    const size_t nb2 = dst->nb[2];
+    const size_t nb3 = dst->nb[3];
+
+    const int ldb = nb11/sizeof(float);
+    const int ldc = nb1/sizeof(float);
+
+    const int gemm_mr = ggml_gemm_mr();
+
+    GGML_ASSERT(gemm_mr <= GGML_GEMM_MR_MAX && GGML_GEMM_MC % gemm_mr == 0);
+    GGML_ASSERT(ne11 >= GGML_GEMM_NR);
+
+    float tile[GGML_GEMM_NR*GGML_GEMM_MR_MAX];
+
+    const bool epilogue = bias != NULL || gelu;
+
+    for (int ir = ir0; ir < ir1; ) {
+        // the rows of the current src0 matrix
+        const int i03 = ir/(ne02*ne01);
+        const int i02 = (ir - i03*ne02*ne01)/ne01;
+        const int i01 = (ir - i03*ne02*ne01 - i02*ne01);
+
+        const int nr = MIN(ir1 - ir, ne01 - i01);
+
+        const char * y = (const char *) src1->data + i02*nb12 + i03*nb13;
+
+        char * d = (char *) dst->data + i02*nb2 + i03*nb3;
+
+        for (int k0 = 0; k0 < ne00; k0 += GGML_GEMM_KC) {
+            const int kb = MIN(GGML_GEMM_KC, ne00 - k0);
+
+            for (int m0 = 0; m0 < nr; m0 += GGML_GEMM_MC) {
+                const int mb = MIN(GGML_GEMM_MC, nr - m0);
+
+                // pack the src0 block
+                for (int p = 0; p < mb; p += gemm_mr) {
+                    float * ap = wdata + p*kb;
+
+                    for (int i = 0; i < gemm_mr; ++i) {
+                        if (p + i < mb) {
+                            const ggml_fp16_t * x = (const ggml_fp16_t *) ((const char *) src0->data + (i01 + m0 + p + i)*nb01 + i02*nb02 + i03*nb03) + k0;
+                            for (int l = 0; l < kb; ++l) {
+                                ap[l*gemm_mr + i] = GGML_FP16_TO_FP32(x[l]);
+                            }
+                        } else {
+                            for (int l = 0; l < kb; ++l) {
+                                ap[l*gemm_mr + i] = 0.0f;
+                            }
+                        }
+                    }
                 }
-                if (src1->grad) {
-                    src1->grad =
-                        ggml_add_impl(ctx,
-                                src1->grad,
-                                // TODO: fix transpose, the node will break the graph connections
-                                ggml_mul_mat(ctx, ggml_transpose(ctx, src0), tensor->grad),
-                                inplace);
+
+                for (int n0 = 0; n0 < ne11; n0 += GGML_GEMM_NR) {
+                    // the last panel is shifted back to overlap the previous one (ne11 >= NR), so that the
+                    // micro-kernel never reads past the src1 rows - only the new columns are written back
+                    const int n1 = MIN(n0, ne11 - GGML_GEMM_NR);
+                    const int j0 = n0 - n1;
+
+                    const float * b = (const float *) (y + n1*nb11) + k0;
+
+                    for (int p = 0; p < mb; p += gemm_mr) {
+                        const int mr = MIN(gemm_mr, mb - p);
+
+                        float * c = (float *) (d + n1*nb1) + i01 + m0 + p;
+
+                        if (mr == gemm_mr && j0 == 0) {
+                            ggml_gemm_f32_ukernel(kb, wdata + p*kb, b, ldb, c, ldc, k0 > 0);
+                        } else {
+                            ggml_gemm_f32_ukernel(kb, wdata + p*kb, b, ldb, tile, gemm_mr, false);
+
+                            for (int j = j0; j < GGML_GEMM_NR; ++j) {
+                                for (int i = 0; i < mr; ++i) {
+                                    c[j*ldc + i] = k0 > 0 ? c[j*ldc + i] + tile[j*gemm_mr + i] : tile[j*gemm_mr + i];
+                                }
+                            }
+                        }
+                    }
+
+                    // the panel is complete after the last KC block
+                    if (epilogue && k0 + kb == ne00) {
+                        const float * cb = bias ? (const float *) bias->data + i01 + m0 : NULL;
+                        for (int j = j0; j < GGML_GEMM_NR; ++j) {
+                            ggml_vec_mul_mat_epilogue_f32(mb, (float *) (d + (n1 + j)*nb1) + i01 + m0, cb, gelu);
+                        }
+                    }
                 }
-            } break;
-        case GGML_OP_SCALE:
-            {
-                GGML_ASSERT(false); // TODO: not implemented
-            } break;
-        case GGML_OP_CPY:
-            {
-                GGML_ASSERT(false); // TODO: not implemented
-            } break;
-        case GGML_OP_RESHAPE:
-            {
-                GGML_ASSERT(false); // TODO: not implemented
-            } break;
+            }
+        }
+
+        ir += nr;
+    }
+}
+
+// use the blocked GEMM when src1 has enough columns to amortize the packing
+static bool ggml_compute_forward_mul_mat_use_gemm(
+        const struct ggml_tensor * src0,
+        const struct ggml_tensor * src1,
+              struct ggml_tensor * dst) {
+    const int ne10 = src1->ne[0];
+
+    const int ne0 = dst->ne[0];
+    const int ne1 = dst->ne[1];
+
+    if (src0->nb[0] != sizeof(ggml_fp16_t) || src0->nb[1] < src0->nb[0] || src1->nb[0] != sizeof(float)) {
+        return false;
+    }
+
+    // see ggml_tune_graph() - the GEMM needs at least NR columns of src1, whatever the tuning file says
+    if (dst->kernel != GGML_TUNE_KERNEL_AUTO) {
+        return dst->kernel == GGML_TUNE_KERNEL_GEMM && ne1 >= GGML_GEMM_NR;
+    }
+
+    if (ne0 >= 32 && ne1 >= 32 && ne10 >= 32) {
+        return true;
+    }
+
+    return false;
+}
+
+static void ggml_compute_forward_mul_mat_f16_f32(
+        const struct ggml_compute_params * params,
+        const struct ggml_tensor * src0,
+        const struct ggml_tensor * src1,
+        const struct ggml_tensor * bias,
+        const bool gelu,
+              struct ggml_tensor * dst) {
+    int64_t t0 = ggml_perf_time_us();
+    UNUSED(t0);
+
+    const int ne00 = src0->ne[0];
+    const int ne01 = src0->ne[1];
+    const int ne02 = src0->ne[2];
+    const int ne03 = src0->ne[3];
+
+    const int ne10 = src1->ne[0];
+    const int ne11 = src1->ne[1];
+    const int ne12 = src1->ne[2];
+    const int ne13 = src1->ne[3];
+
+    const int ne0  = dst->ne[0];
+    const int ne1  = dst->ne[1];
+    const int ne2  = dst->ne[2];
+    const int ne3  = dst->ne[3];
+    const int ne   = ne0*ne1*ne2*ne3;
+
+    const int nb00 = src0->nb[0];
+    const int nb01 = src0->nb[1];
+    const int nb02 = src0->nb[2];
+    const int nb03 = src0->nb[3];
+
+    const int nb10 = src1->nb[0];
+    const int nb11 = src1->nb[1];
+    const int nb12 = src1->nb[2];
+    const int nb13 = src1->nb[3];
+
+    const int nb0  = dst->nb[0];
+    const int nb1  = dst->nb[1];
+    const int nb2  = dst->nb[2];
+    const int nb3  = dst->nb[3];
+
+    const int ith = params->ith;
+    const int nth = params->nth;
+
+    GGML_ASSERT(ne02 == ne12);
+    GGML_ASSERT(ne03 == ne13);
+    GGML_ASSERT(ne2  == ne12);
+    GGML_ASSERT(ne3  == ne13);
+
+    // TODO: we don't support permuted src0
+    GGML_ASSERT(nb00 == sizeof(ggml_fp16_t) || nb01 == sizeof(ggml_fp16_t));
+
+    // dst cannot be transposed or permuted
+    GGML_ASSERT(nb0 == sizeof(float));
+    GGML_ASSERT(nb0 <= nb1);
+    GGML_ASSERT(nb1 <= nb2);
+    GGML_ASSERT(nb2 <= nb3);
+
+    GGML_ASSERT(ne0 == ne01);
+    GGML_ASSERT(ne1 == ne11);
+    GGML_ASSERT(ne2 == ne02);
+    GGML_ASSERT(ne3 == ne03);
+
+    // nb01 >= nb00 - src0 is not transposed
+    //   compute by src0 rows
+    //
+    // nb00 <  nb01 - src0 is transposed
+    //   compute by src0 columns
+
+#if defined(GGML_USE_ACCELERATE) || defined(GGML_USE_OPENBLAS)
+    if (ggml_compute_forward_mul_mat_use_blas(src0, src1, dst)) {
+        GGML_ASSERT(nb10 == sizeof(float));
+
+        if (params->ith != 0) {
+            return;
+        }
+
+        if (params->type == GGML_TASK_INIT) {
+            return;
+        }
+
+        if (params->type == GGML_TASK_FINALIZE) {
+            return;
+        }
+
+        float * const wdata = params->wdata;
+
+        // the F32 copy of src0 kept by the cache - converted only by the first call
+        bool fill = true;
+        float * const wcached = ggml_wcache_acquire(params->wcache, src0, &fill);
+
+        for (int i03 = 0; i03 < ne03; i03++) {
+            for (int i02 = 0; i02 < ne02; i02++) {
+                float * const x = wcached ? wcached + (i03*ne02 + i02)*ne01*ne00 : wdata;
+
+                if (fill) {
+                    int id = 0;
+                    for (int i01 = 0; i01 < ne01; ++i01) {
+                        for (int i00 = 0; i00 < ne00; ++i00) {
+                            x[id++] = GGML_FP16_TO_FP32(*(ggml_fp16_t *) ((char *) src0->data + i03*nb03 + i02*nb02 + i01*nb01 + i00*nb00));
+                        }
+                    }
+                }
+
+                const float * y = (float *) ((char *) src1->data + i02*nb12 + i03*nb13);
+
+                //      float * z =                          wdata + ne00*ne01;
+
+                // z = x * yT
+                //{
+                //    cblas_sgemm(CblasRowMajor, CblasNoTrans, CblasTrans,
+                //            ne01, ne11, ne00,
+                //            1.0f, x, ne00,
+                //                  y, ne00,
+                //            0.0f, z, ne11);
+                //}
+
+                float * d = (float *) ((char *) dst->data + i02*nb2 + i03*nb3);
+
+                // transpose z
+                //for (int j = 0; j < ne11; ++j) {
+                //    for (int i = 0; i < ne01; ++i) {
+                //        d[j*ne01 + i] = z[i*ne11 + j];
+                //    }
+                //}
+
+                {
+#if 1
+                    // zT = y * xT
+                    cblas_sgemm(CblasRowMajor, CblasNoTrans, CblasTrans,
+                            ne11, ne01, ne10,
+                            1.0f,    y, ne00,
+                                     x, ne00,
+                            0.0f,    d, ne01);
+#else
+                    // zT = (xT * y)T
+                    cblas_sgemm(CblasColMajor, CblasTrans, CblasNoTrans,
+                            ne01, ne11, ne10,
+                            1.0f,    x, ne00,
+                                     y, ne00,
+                            0.0f,    d, ne01);
+#endif
+                }
+            }
+        }
+
+        if (wcached && fill) {
+            ggml_wcache_release(params->wcache, src0);
+        }
+
+        ggml_compute_forward_mul_mat_epilogue(bias, gelu, dst, 0, ne01*ne02*ne03);
+
+        //printf("CBLAS = %f ms, %d x %d x %d x %d\n", (ggml_perf_time_us() - t0)/1000.0, ne0, ne1, ne2, ne3);
+
+        return;
+    }
+#endif
+
+    if (ggml_compute_forward_mul_mat_use_gemm(src0, src1, dst)) {
+        float * const wdata = params->wdata;
+
+        if (params->type == GGML_TASK_INIT) {
+            GGML_ASSERT(ggml_gemm_f16_f32_wsize(nth) <= params->wsize);
+            return;
+        }
+
+        if (params->type == GGML_TASK_FINALIZE) {
+            return;
+        }
+
+        // total rows in src0
+        const int nr = ne01*ne02*ne03;
+
+        // rows per chunk - multiple of the micro-kernel rows
+        const int dr = ggml_task_chunk_size(params, dst, nr, ggml_gemm_mr());
+        const int nchunk = (nr + dr - 1)/dr;
+
+        for (int ik = ggml_task_chunk_first(params, nchunk); ik < nchunk; ik = ggml_task_chunk_next(params, nchunk)) {
+            // row range for this chunk
+            const int ir0 = dr*ik;
+            const int ir1 = MIN(ir0 + dr, nr);
+
+            ggml_gemm_f16_f32(src0, src1, bias, gelu, dst, wdata + ith*(GGML_GEMM_MC*GGML_GEMM_KC + CACHE_LINE_SIZE_F32), ir0, ir1);
+        }
+
+        //printf("GEMM = %f ms, %d x %d x %d x %d\n", (ggml_perf_time_us() - t0)/1000.0, ne0, ne1, ne2, ne3);
+
+        return;
+    }
+
+    if (params->type == GGML_TASK_INIT) {
+        if (nb01 >= nb00) {
+            ggml_fp16_t * const wdata = params->wdata;
+
+            int id = 0;
+            for (int i13 = 0; i13 < ne13; ++i13) {
+                for (int i12 = 0; i12 < ne12; ++i12) {
+                    for (int i11 = 0; i11 < ne11; ++i11) {
+                        if (nb10 == sizeof(float)) {
+                            ggml_vec_cvt_f32_f16(ne10, wdata + id, (float *) ((char *) src1->data + i13*nb13 + i12*nb12 + i11*nb11));
+                            id += ne10;
+                        } else {
+                            for (int i10 = 0; i10 < ne10; ++i10) {
+                                wdata[id++] = GGML_FP32_TO_FP16(*(float *)((char *) src1->data + i13*nb13 + i12*nb12 + i11*nb11 + i10*nb10));
+                            }
+                        }
+                    }
+                }
+            }
+
+            GGML_ASSERT(id*sizeof(ggml_fp16_t) <= params->wsize);
+
+            return;
+        }
+
+        // TODO: fix this memset (wsize is overestimated)
+        memset(params->wdata, 0, params->wsize);
+        return;
+    }
+
+    if (params->type == GGML_TASK_FINALIZE) {
+        if (nb01 >= nb00) {
+            return;
+        }
+
+        // TODO: fix this memset (wsize is overestimated)
+        //assert(params->wsize == (ggml_nbytes(dst) + CACHE_LINE_SIZE)*nth);
+
+        ggml_fp16_t * const wdata = params->wdata;
+
+        // cols per thread
+        const int dc = (ne + nth - 1)/nth;
+
+        // col range for this thread
+        const int ic0 = dc*ith;
+        const int ic1 = MIN(ic0 + dc, ne);
+
+        for (int i = ic0; i < ic1; ++i) {
+            ((float *) dst->data)[i] = GGML_FP16_TO_FP32(wdata[i]);
+        }
+
+        for (int k = 1; k < nth; k++) {
+            for (int i = ic0; i < ic1; ++i) {
+                ((float *) dst->data)[i] += GGML_FP16_TO_FP32(wdata[(ne + CACHE_LINE_SIZE_F32)*k + i]);
+            }
+        }
+
+        ggml_compute_forward_mul_mat_epilogue_flat(bias, gelu, dst, ic0, ic1);
+
+        return;
+    }
+
+    if (nb01 >= nb00) {
+        // fp16 -> half the size, so divide by 2
+        // TODO: do not support transposed src1
+        assert(nb10/2 == sizeof(ggml_fp16_t));
+
+        // parallelize by src0 rows using ggml_vec_dot_f16
+
+        // total rows in src0
+        const int nr = ne01*ne02*ne03;
+
+        ggml_fp16_t * wdata = params->wdata;
+
+        if (ne11 == 1 && nb00 == sizeof(ggml_fp16_t)) {
+            // mat x vec (e.g. decoding a single token) - the rows of each chunk form a contiguous slab of src0,
+            // rounded to GGML_VEC_GEMV_UNROLL rows so that only the last slab has leftover rows
+            const int drv = ggml_task_chunk_size(params, dst, nr, GGML_VEC_GEMV_UNROLL);
+            const int nchunkv = (nr + drv - 1)/drv;
+
+            for (int ik = ggml_task_chunk_first(params, nchunkv); ik < nchunkv; ik = ggml_task_chunk_next(params, nchunkv)) {
+                const int irv0 = drv*ik;
+                const int irv1 = MIN(irv0 + drv, nr);
+
+                for (int ir = irv0; ir < irv1; ) {
+                    const int i03 = ir/(ne02*ne01);
+                    const int i02 = (ir - i03*ne02*ne01)/ne01;
+                    const int i01 = (ir - i03*ne02*ne01 - i02*ne01);
+
+                    // rows left in the current src0 matrix
+                    const int nrv = MIN(irv1 - ir, ne01 - i01);
+
+                    char        * src0_row = (char *) src0->data + (i01*nb01 + i02*nb02 + i03*nb03);
+                    ggml_fp16_t * src1_col = wdata + (i02 + i03*ne12)*ne00;
+
+                    float * dst_col = (float *) ((char *) dst->data + (i01*nb0 + i02*nb2 + i03*nb3));
+
+                    int i = 0;
+                    for (; i + GGML_VEC_GEMV_UNROLL <= nrv; i += GGML_VEC_GEMV_UNROLL) {
+                        ggml_vec_gemv_f16(ne00, nb01, dst_col + i, src0_row + i*nb01, src1_col);
+                    }
+                    for (; i < nrv; ++i) {
+                        ggml_vec_dot_f16(ne00, dst_col + i, (ggml_fp16_t *) (src0_row + i*nb01), src1_col);
+                    }
+
+                    ir += nrv;
+                }
+
+                ggml_compute_forward_mul_mat_epilogue(bias, gelu, dst, irv0, irv1);
+            }
+
+            return;
+        }
+
+        // rows per chunk
+        const int dr = ggml_task_chunk_size(params, dst, nr, 1);
+        const int nchunk = (nr + dr - 1)/dr;
+
+        for (int ik = ggml_task_chunk_first(params, nchunk); ik < nchunk; ik = ggml_task_chunk_next(params, nchunk)) {
+            // row range for this chunk
+            const int ir0 = dr*ik;
+            const int ir1 = MIN(ir0 + dr, nr);
+
+            for (int ir = ir0; ir < ir1; ++ir) {
+                // src0 indices
+                const int i03 = ir/(ne02*ne01);
+                const int i02 = (ir - i03*ne02*ne01)/ne01;
+                const int i01 = (ir - i03*ne02*ne01 - i02*ne01);
+
+                const int i13 = i03;
+                const int i12 = i02;
+
+                const int i0 = i01;
+                const int i2 = i02;
+                const int i3 = i03;
+
+                ggml_fp16_t * src0_row = (ggml_fp16_t *) ((char *) src0->data + (i01*nb01 + i02*nb02 + i03*nb03));
+                ggml_fp16_t * src1_col =                                wdata + (       0 + i12*ne11 + i13*ne12*ne11)*ne00;
+
+                float * dst_col = (float *) ((char *) dst->data + (i0*nb0 + 0*nb1 + i2*nb2 + i3*nb3));
+
+                assert(ne00 % 32 == 0);
+
+                for (int ic = 0; ic < ne11; ++ic) {
+                    ggml_vec_dot_f16(ne00, &dst_col[ic*ne0], src0_row, src1_col + ic*ne00);
+                }
+
+                ggml_compute_forward_mul_mat_epilogue(bias, gelu, dst, ir, ir + 1);
+            }
+        }
+    } else {
+        // parallelize by src1 columns using ggml_vec_mad_f16
+        // each thread has its own work data
+        // during FINALIZE we accumulate all work data into dst
+
+        // total columns in src1
+        const int nc = ne10;
+
+        // columns per thread - the partial sums are accumulated per thread, so the columns are not claimed
+        // dynamically to keep the result independent of the scheduling
+        const int dc = (nc + nth - 1)/nth;
+
+        // column range for this thread
+        const int ic0 = dc*ith;
+        const int ic1 = MIN(ic0 + dc, nc);
+
+        // work data for thread
+        const int wo = (ne + CACHE_LINE_SIZE_F32)*ith;
+        ggml_fp16_t * const wdata = params->wdata;
+
+        for (int i13 = 0; i13 < ne13; ++i13) {
+            for (int i12 = 0; i12 < ne12; ++i12) {
+                for (int i11 = 0; i11 < ne11; ++i11) {
+                    // dst indices
+                    const int i1 = i11;
+                    const int i2 = i12;
+                    const int i3 = i13;
+
+                    ggml_fp16_t * dst_row = wdata + wo + i3*ne2*ne1*ne0 + i2*ne1*ne0 + i1*ne0;
+
+                    for (int ic = ic0; ic < ic1; ++ic) {
+                        // src1 indices
+                        const int i10 = ic;
+
+                        // src0 indices
+                        const int i03 = i13;
+                        const int i02 = i12;
+                        const int i00 = ic;
+
+                        assert(sizeof(ggml_fp16_t)*(wo + i3*ne2*ne1*ne0 + i2*ne1*ne0 + i1*ne0 + ne01) <= params->wsize);
+
+                        ggml_fp16_t * src0_col =  (ggml_fp16_t *) ((char *) src0->data + (i00*nb00 + i02*nb02 + i03*nb03));
+                        float         src1_val = *      (float *) ((char *) src1->data + (i10*nb10 + i11*nb11 + i12*nb12 + i13*nb13));
+
+                        ggml_vec_mad_f16(ne01, dst_row, src0_col, src1_val);
+                    }
+                }
+            }
+        }
+    }
+
+    //int64_t t1 = ggml_time_us();
+    //static int64_t acc = 0;
+    //acc += t1 - t0;
+    //if (t1 - t0 > 10) {
+    //    printf("\n");
+    //    printf("ne00 = %5d, ne01 = %5d, ne02 = %5d, ne03 = %5d\n", ne00, ne01, ne02, ne03);
+    //    printf("nb00 = %5d, nb01 = %5d, nb02 = %5d, nb03 = %5d\n", nb00, nb01, nb02, nb03);
+    //    printf("ne10 = %5d, ne11 = %5d, ne12 = %5d, ne13 = %5d\n", ne10, ne11, ne12, ne13);
+
+    //    printf("XXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXX task %d/%d: %d us, acc = %d\n", ith, nth, (int) (t1 - t0), (int) acc);
+    //}
+}
+
+static void ggml_compute_forward_mul_mat_q_f32(
+        const struct ggml_compute_params * params,
+        const struct ggml_tensor * src0,
+        const struct ggml_tensor * src1,
+        const struct ggml_tensor * bias,
+        const bool gelu,
+              struct ggml_tensor * dst) {
+    int64_t t0 = ggml_perf_time_us();
+    UNUSED(t0);
+
+    const int ne00 = src0->ne[0];
+    const int ne01 = src0->ne[1];
+    const int ne02 = src0->ne[2];
+    const int ne03 = src0->ne[3];
+
+    const int ne10 = src1->ne[0];
+    const int ne11 = src1->ne[1];
+    const int ne12 = src1->ne[2];
+    const int ne13 = src1->ne[3];
+
+    const int ne0  = dst->ne[0];
+    const int ne1  = dst->ne[1];
+    const int ne2  = dst->ne[2];
+    const int ne3  = dst->ne[3];
+
+    const int nb00 = src0->nb[0];
+    const int nb01 = src0->nb[1];
+    const int nb02 = src0->nb[2];
+    const int nb03 = src0->nb[3];
+
+    const int nb10 = src1->nb[0];
+    const int nb11 = src1->nb[1];
+    const int nb12 = src1->nb[2];
+    const int nb13 = src1->nb[3];
+
+    const int nb0  = dst->nb[0];
+    const int nb1  = dst->nb[1];
+    const int nb2  = dst->nb[2];
+    const int nb3  = dst->nb[3];
+
+    const enum ggml_type type = src0->type;
+
+    const quantize_row_q_t   quantize_row_q   = quantize_fns[GGML_TYPE_Q8_0].quantize_row_q;
+    const dequantize_row_q_t dequantize_row_q = quantize_fns[type].dequantize_row_q;
+    const vec_dot_q_t        vec_dot_q        = quantize_fns[type].vec_dot_q;
+
+    UNUSED(dequantize_row_q);
+
+    GGML_ASSERT(ne02 == ne12);
+    GGML_ASSERT(ne03 == ne13);
+    GGML_ASSERT(ne2  == ne12);
+    GGML_ASSERT(ne3  == ne13);
+
+    // we don't support permuted or transposed src0
+    GGML_ASSERT(nb00 == (int) GGML_TYPE_SIZE[type]);
+
+    // dst cannot be transposed or permuted
+    GGML_ASSERT(nb0 == sizeof(float));
+    GGML_ASSERT(nb0 <= nb1);
+    GGML_ASSERT(nb1 <= nb2);
+    GGML_ASSERT(nb2 <= nb3);
+
+    GGML_ASSERT(ne0 == ne01);
+    GGML_ASSERT(ne1 == ne11);
+    GGML_ASSERT(ne2 == ne02);
+    GGML_ASSERT(ne3 == ne03);
+
+    GGML_ASSERT(ne00 % QK == 0);
+
+    // compute by src0 rows
+
+#if defined(GGML_USE_ACCELERATE) || defined(GGML_USE_OPENBLAS)
+    if (ggml_compute_forward_mul_mat_use_blas(src0, src1, dst)) {
+        GGML_ASSERT(nb10 == sizeof(float));
+
+        if (params->ith != 0) {
+            return;
+        }
+
+        if (params->type == GGML_TASK_INIT) {
+            return;
+        }
+
+        if (params->type == GGML_TASK_FINALIZE) {
+            return;
+        }
+
+        float * const wdata = params->wdata;
+
+        // the F32 copy of src0 kept by the cache - dequantized only by the first call
+        bool fill = true;
+        float * const wcached = ggml_wcache_acquire(params->wcache, src0, &fill);
+
+        for (int i03 = 0; i03 < ne03; i03++) {
+            for (int i02 = 0; i02 < ne02; i02++) {
+                float * const x = wcached ? wcached + (i03*ne02 + i02)*ne01*ne00 : wdata;
+
+                if (fill) {
+                    for (int i01 = 0; i01 < ne01; ++i01) {
+                        dequantize_row_q((char *) src0->data + i03*nb03 + i02*nb02 + i01*nb01, x + i01*ne00, ne00);
+                    }
+                }
+
+                const float * y = (float *) ((char *) src1->data + i02*nb12 + i03*nb13);
+
+                float * d = (float *) ((char *) dst->data + i02*nb2 + i03*nb3);
+
+                // zT = y * xT
+                cblas_sgemm(CblasRowMajor, CblasNoTrans, CblasTrans,
+                        ne11, ne01, ne10,
+                        1.0f,    y, ne10,
+                                 x, ne00,
+                        0.0f,    d, ne01);
+            }
+        }
+
+        if (wcached && fill) {
+            ggml_wcache_release(params->wcache, src0);
+        }
+
+        ggml_compute_forward_mul_mat_epilogue(bias, gelu, dst, 0, ne01*ne02*ne03);
+
+        //printf("CBLAS Q = %f ms, %d x %d x %d x %d\n", (ggml_perf_time_us() - t0)/1000.0, ne0, ne1, ne2, ne3);
+
+        return;
+    }
+#endif
+
+    // size of a quantized src1 row
+    const size_t row_size = (ne10/QK)*GGML_TYPE_SIZE[GGML_TYPE_Q8_0];
+
+    if (params->type == GGML_TASK_INIT) {
+        GGML_ASSERT(nb10 == sizeof(float));
+
+        char * wdata = params->wdata;
+
+        for (int i13 = 0; i13 < ne13; ++i13) {
+            for (int i12 = 0; i12 < ne12; ++i12) {
+                for (int i11 = 0; i11 < ne11; ++i11) {
+                    quantize_row_q((float *)((char *) src1->data + i13*nb13 + i12*nb12 + i11*nb11), (void *) wdata, ne10);
+                    wdata += row_size;
+                }
+            }
+        }
+
+        GGML_ASSERT((size_t) (wdata - (char *) params->wdata) <= params->wsize);
+
+        return;
+    }
+
+    if (params->type == GGML_TASK_FINALIZE) {
+        return;
+    }
+
+    // parallelize by src0 rows using vec_dot_q
+
+    // total rows in src0
+    const int nr = ne01*ne02*ne03;
+
+    // rows per chunk
+    const int dr = ggml_task_chunk_size(params, dst, nr, 1);
+    const int nchunk = (nr + dr - 1)/dr;
+
+    char * wdata = params->wdata;
+
+    for (int ik = ggml_task_chunk_first(params, nchunk); ik < nchunk; ik = ggml_task_chunk_next(params, nchunk)) {
+        // row range for this chunk
+        const int ir0 = dr*ik;
+        const int ir1 = MIN(ir0 + dr, nr);
+
+        for (int ir = ir0; ir < ir1; ++ir) {
+            // src0 indices
+            const int i03 = ir/(ne02*ne01);
+            const int i02 = (ir - i03*ne02*ne01)/ne01;
+            const int i01 = (ir - i03*ne02*ne01 - i02*ne01);
+
+            const int i13 = i03;
+            const int i12 = i02;
+
+            const int i0 = i01;
+            const int i2 = i02;
+            const int i3 = i03;
+
+            void * src0_row = (void *) ((char *) src0->data + (i01*nb01 + i02*nb02 + i03*nb03));
+            char * src1_col =          ((char *)      wdata + (      (0 + i12*ne11 + i13*ne12*ne11)*row_size));
+
+            float * dst_col = (float *) ((char *) dst->data + (i0*nb0 + 0*nb1 + i2*nb2 + i3*nb3));
+
+            for (int ic = 0; ic < ne11; ++ic) {
+                vec_dot_q(ne00, &dst_col[ic*ne0], src0_row, (void *) (src1_col + ic*row_size));
+            }
+
+            ggml_compute_forward_mul_mat_epilogue(bias, gelu, dst, ir, ir + 1);
+        }
+    }
+
+    //int64_t t1 = ggml_time_us();
+    //static int64_t acc = 0;
+    //acc += t1 - t0;
+    //if (t1 - t0 > 10) {
+    //    printf("\n");
+    //    printf("ne00 = %5d, ne01 = %5d, ne02 = %5d, ne03 = %5d\n", ne00, ne01, ne02, ne03);
+    //    printf("nb00 = %5d, nb01 = %5d, nb02 = %5d, nb03 = %5d\n", nb00, nb01, nb02, nb03);
+    //    printf("ne10 = %5d, ne11 = %5d, ne12 = %5d, ne13 = %5d\n", ne10, ne11, ne12, ne13);
+
+    //    printf("XXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXX task %d/%d: %d us, acc = %d\n", ith, nth, (int) (t1 - t0), (int) acc);
+    //}
+}
+
+static void ggml_compute_forward_mul_mat(
+        const struct ggml_compute_params * params,
+        const struct ggml_tensor * src0,
+        const struct ggml_tensor * src1,
+        const struct ggml_tensor * bias,
+        const bool gelu,
+        struct ggml_tensor * dst) {
+    switch (src0->type) {
+        case GGML_TYPE_F16:
+            {
+                ggml_compute_forward_mul_mat_f16_f32(params, src0, src1, bias, gelu, dst);
+            } break;
+        case GGML_TYPE_F32:
+            {
+                ggml_compute_forward_mul_mat_f32(params, src0, src1, bias, gelu, dst);
+            } break;
+        case GGML_TYPE_Q4_0:
+        case GGML_TYPE_Q8_0:
+            {
+                ggml_compute_forward_mul_mat_q_f32(params, src0, src1, bias, gelu, dst);
+            } break;
+        case GGML_TYPE_I8:
+        case GGML_TYPE_I16:
+        case GGML_TYPE_I32:
+        case GGML_TYPE_COUNT:
+            {
+                assert(false);
+            } break;
+    }
+}
+
+// ggml_compute_forward_scale
+
+static void ggml_compute_forward_scale_f32(
+        const struct ggml_compute_params * params,
+        const struct ggml_tensor * src0,
+        const struct ggml_tensor * src1,
+        struct ggml_tensor * dst) {
+    GGML_ASSERT(ggml_is_contiguous(src0));
+    GGML_ASSERT(ggml_is_contiguous(dst));
+    GGML_ASSERT(ggml_are_same_shape(src0, dst));
+    GGML_ASSERT(ggml_is_scalar(src1));
+
+    if (params->type == GGML_TASK_INIT || params->type == GGML_TASK_FINALIZE) {
+        return;
+    }
+
+    // scale factor
+    const float v = *(float *) src1->data;
+
+    const int ith = params->ith;
+    const int nth = params->nth;
+
+    const int nc = src0->ne[0];
+    const int nr = ggml_nrows(src0);
+
+    // rows per thread
+    const int dr = (nr + nth - 1)/nth;
+
+    // row range for this thread
+    const int ir0 = dr*ith;
+    const int ir1 = MIN(ir0 + dr, nr);
+
+    for (int i1 = ir0; i1 < ir1; i1++) {
+        ggml_vec_scale_f32(nc, (float *) ((char *) dst->data + i1*(dst->nb[1])), v);
+    }
+}
+
+static void ggml_compute_forward_scale(
+        const struct ggml_compute_params * params,
+        const struct ggml_tensor * src0,
+        const struct ggml_tensor * src1,
+        struct ggml_tensor * dst) {
+    switch (src0->type) {
+        case GGML_TYPE_F32:
+            {
+                ggml_compute_forward_scale_f32(params, src0, src1, dst);
+            } break;
+        case GGML_TYPE_I8:
+        case GGML_TYPE_I16:
+        case GGML_TYPE_I32:
+        case GGML_TYPE_F16:
+        case GGML_TYPE_Q4_0:
+        case GGML_TYPE_Q8_0:
+        case GGML_TYPE_COUNT:
+            {
+                assert(false);
+            } break;
+    }
+}
+
+// ggml_compute_forward_cpy
+
+static void ggml_compute_forward_cpy(
+        const struct ggml_compute_params * params,
+        const struct ggml_tensor * src0,
+        struct ggml_tensor * dst) {
+    ggml_compute_forward_dup(params, src0, dst);
+}
+
+// ggml_compute_forward_reshape
+
+static void ggml_compute_forward_reshape(
+        const struct ggml_compute_params * params,
+        const struct ggml_tensor * src0,
+        struct ggml_tensor * dst) {
+    // NOP
+    UNUSED(params);
+    UNUSED(src0);
+    UNUSED(dst);
+}
+
+// ggml_compute_forward_view
+
+static void ggml_compute_forward_view(
+        const struct ggml_compute_params * params,
+        const struct ggml_tensor * src0) {
+    // NOP
+    UNUSED(params);
+    UNUSED(src0);
+}
+
+// ggml_compute_forward_permute
+
+static void ggml_compute_forward_permute(
+        const struct ggml_compute_params * params,
+        const struct ggml_tensor * src0) {
+    // NOP
+    UNUSED(params);
+    UNUSED(src0);
+}
+
+// ggml_compute_forward_transpose
+
+static void ggml_compute_forward_transpose(
+        const struct ggml_compute_params * params,
+        const struct ggml_tensor * src0) {
+    // NOP
+    UNUSED(params);
+    UNUSED(src0);
+}
+
+// ggml_compute_forward_get_rows
+
+static void ggml_compute_forward_get_rows_q(
+        const struct ggml_compute_params * params,
+        const struct ggml_tensor * src0,
+        const struct ggml_tensor * src1,
+              struct ggml_tensor * dst) {
+    assert(params->ith == 0);
+
+    if (params->type == GGML_TASK_INIT || params->type == GGML_TASK_FINALIZE) {
+        return;
+    }
+
+    const int nc = src0->ne[0];
+    const int nr = ggml_nelements(src1);
+
+    const enum ggml_type type = src0->type;
+    const dequantize_row_q_t dequantize_row_q = quantize_fns[type].dequantize_row_q;
+
+    assert( dst->ne[0] == nc);
+    assert( dst->ne[1] == nr);
+    assert(src0->nb[0] == GGML_TYPE_SIZE[type]);
+
+    for (int i = 0; i < nr; ++i) {
+        const int r = ((int32_t *) src1->data)[i];
+
+        dequantize_row_q(
+                (const void *) ((char *) src0->data + r*src0->nb[1]),
+                     (float *) ((char *)  dst->data + i*dst->nb[1]), nc);
+    }
+}
+
+static void ggml_compute_forward_get_rows_f16(
+        const struct ggml_compute_params * params,
+        const struct ggml_tensor * src0,
+        const struct ggml_tensor * src1,
+              struct ggml_tensor * dst) {
+    assert(params->ith == 0);
+
+    if (params->type == GGML_TASK_INIT || params->type == GGML_TASK_FINALIZE) {
+        return;
+    }
+
+    const int nc = src0->ne[0];
+    const int nr = ggml_nelements(src1);
+
+    assert( dst->ne[0] == nc);
+    assert( dst->ne[1] == nr);
+    assert(src0->nb[0] == sizeof(ggml_fp16_t));
+
+    for (int i = 0; i < nr; ++i) {
+        const int r = ((int32_t *) src1->data)[i];
+
+        for (int j = 0; j < nc; ++j) {
+            ggml_fp16_t v = ((ggml_fp16_t *) ((char *) src0->data + r*src0->nb[1]))[j];
+            ((float *) ((char *)  dst->data + i*dst->nb[1]))[j] = GGML_FP16_TO_FP32(v);
+        }
+    }
+}
+
+static void ggml_compute_forward_get_rows_f32(
+        const struct ggml_compute_params * params,
+        const struct ggml_tensor * src0,
+        const struct ggml_tensor * src1,
+              struct ggml_tensor * dst) {
+    assert(params->ith == 0);
+
+    if (params->type == GGML_TASK_INIT || params->type == GGML_TASK_FINALIZE) {
+        return;
+    }
+
+    const int nc = src0->ne[0];
+    const int nr = ggml_nelements(src1);
+
+    assert( dst->ne[0] == nc);
+    assert( dst->ne[1] == nr);
+    assert(src0->nb[0] == sizeof(float));
+
+    for (int i = 0; i < nr; ++i) {
+        const int r = ((int32_t *) src1->data)[i];
+
+        ggml_vec_cpy_f32(nc,
+                (float *) ((char *)  dst->data + i*dst->nb[1]),
+                (float *) ((char *) src0->data + r*src0->nb[1]));
+    }
+}
+
+static void ggml_compute_forward_get_rows(
+        const struct ggml_compute_params * params,
+        const struct ggml_tensor * src0,
+        const struct ggml_tensor * src1,
+        struct ggml_tensor * dst) {
+    switch (src0->type) {
+        case GGML_TYPE_F16:
+            {
+                ggml_compute_forward_get_rows_f16(params, src0, src1, dst);
+            } break;
+        case GGML_TYPE_F32:
+            {
+                ggml_compute_forward_get_rows_f32(params, src0, src1, dst);
+            } break;
+        case GGML_TYPE_Q4_0:
+        case GGML_TYPE_Q8_0:
+            {
+                ggml_compute_forward_get_rows_q(params, src0, src1, dst);
+            } break;
+        case GGML_TYPE_I8:
+        case GGML_TYPE_I16:
+        case GGML_TYPE_I32:
+        case GGML_TYPE_COUNT:
+            {
+                assert(false);
+            } break;
+    }
+}
+
+// ggml_compute_forward_diag_mask_inf
+
+static void ggml_compute_forward_diag_mask_inf_f32(
+        const struct ggml_compute_params * params,
+        const struct ggml_tensor * src0,
+        const struct ggml_tensor * src1,
+        struct ggml_tensor * dst) {
+    assert(params->ith == 0);
+    assert(src1->type == GGML_TYPE_I32);
+    assert(ggml_nelements(src1) == 1);
+
+    if (params->type == GGML_TASK_INIT || params->type == GGML_TASK_FINALIZE) {
+        return;
+    }
+
+    const int n_past = ((int32_t *) src1->data)[0];
+
+    // TODO: handle transposed/permuted matrices
+
+    const int n  = ggml_nrows(src0);
+    const int nc = src0->ne[0];
+    const int nr = src0->ne[1];
+    const int nz = n/nr;
+
+    assert( dst->nb[0] == sizeof(float));
+    assert(src0->nb[0] == sizeof(float));
+
+    for (int k = 0; k < nz; k++) {
+        for (int j = 0; j < nr; j++) {
+            for (int i = n_past; i < nc; i++) {
+                if (i > n_past + j) {
+                    *(float *)((char *) dst->data + k*dst->nb[2] + j*dst->nb[1] + i*dst->nb[0]) = -INFINITY;
+                }
+            }
+        }
+    }
+}
+
+static void ggml_compute_forward_diag_mask_inf(
+        const struct ggml_compute_params * params,
+        const struct ggml_tensor * src0,
+        const struct ggml_tensor * src1,
+        struct ggml_tensor * dst) {
+    switch (src0->type) {
+        case GGML_TYPE_F32:
+            {
+                ggml_compute_forward_diag_mask_inf_f32(params, src0, src1, dst);
+            } break;
+        case GGML_TYPE_I8:
+        case GGML_TYPE_I16:
+        case GGML_TYPE_I32:
+        case GGML_TYPE_F16:
+        case GGML_TYPE_Q4_0:
+        case GGML_TYPE_Q8_0:
+        case GGML_TYPE_COUNT:
+            {
+                assert(false);
+            } break;
+    }
+}
+
+// ggml_compute_forward_soft_max
+
+static void ggml_compute_forward_soft_max_f32(
+        const struct ggml_compute_params * params,
+        const struct ggml_tensor * src0,
+        const struct ggml_tensor * src1,
+        const struct ggml_tensor * opt0,
+        struct ggml_tensor * dst) {
+    GGML_ASSERT(ggml_is_contiguous(src0));
+    GGML_ASSERT(ggml_is_contiguous(dst));
+    GGML_ASSERT(ggml_are_same_shape(src0, dst));
+
+    if (params->type == GGML_TASK_INIT || params->type == GGML_TASK_FINALIZE) {
+        return;
+    }
+
+    // the scale and the causal mask of ggml_soft_max_ext
+    const float scale  = src1 ? ((float   *) src1->data)[0] :  1.0f;
+    const int   n_past = opt0 ? ((int32_t *) opt0->data)[0] : -1;
+
+    // TODO: handle transposed/permuted matrices
+
+    const int nc   = src0->ne[0];
+    const int nr   = ggml_nrows(src0);
+    const int ne01 = src0->ne[1];
+
+    // rows per chunk
+    const int dr = ggml_task_chunk_size(params, dst, nr, 1);
+    const int nchunk = (nr + dr - 1)/dr;
+
+    for (int ik = ggml_task_chunk_first(params, nchunk); ik < nchunk; ik = ggml_task_chunk_next(params, nchunk)) {
+        const int ir0 = dr*ik;
+        const int ir1 = MIN(ir0 + dr, nr);
+
+        for (int i1 = ir0; i1 < ir1; i1++) {
+            const float * x = (float *) ((char *) src0->data + i1*src0->nb[1]);
+                  float * y = (float *) ((char *)  dst->data + i1*dst->nb[1]);
+
+            // number of unmasked elements in the row
+            const int nv = n_past < 0 ? nc : MIN(nc, n_past + i1%ne01 + 1);
+
+#ifndef NDEBUG
+            for (int i = 0; i < nv; ++i) {
+                assert(!isnan(x[i]));
+            }
+#endif
+
+            // the max of scale*x - scale*max(x) only holds for scale >= 0
+            float max = -INFINITY;
+            if (scale >= 0.0f) {
+                ggml_vec_max_f32(nv, &max, x);
+                max *= scale;
+            } else {
+                for (int i = 0; i < nv; ++i) {
+                    max = MAX(max, scale*x[i]);
+                }
+            }
+
+            const ggml_float sum = ggml_vec_soft_max_f32(nv, y, x, scale, max);
+
+            assert(sum > 0.0);
+
+            ggml_vec_scale_f32(nv, y, 1.0/sum);
+            ggml_vec_set_f32(nc - nv, y + nv, 0.0f);
+
+#ifndef NDEBUG
+            for (int i = 0; i < nc; ++i) {
+                assert(!isnan(y[i]));
+                assert(!isinf(y[i]));
+            }
+#endif
+        }
+    }
+}
+
+static void ggml_compute_forward_soft_max(
+        const struct ggml_compute_params * params,
+        const struct ggml_tensor * src0,
+        const struct ggml_tensor * src1,
+        const struct ggml_tensor * opt0,
+        struct ggml_tensor * dst) {
+    switch (src0->type) {
+        case GGML_TYPE_F32:
+            {
+                ggml_compute_forward_soft_max_f32(params, src0, src1, opt0, dst);
+            } break;
+        case GGML_TYPE_I8:
+        case GGML_TYPE_I16:
+        case GGML_TYPE_I32:
+        case GGML_TYPE_F16:
+        case GGML_TYPE_Q4_0:
+        case GGML_TYPE_Q8_0:
+        case GGML_TYPE_COUNT:
+            {
+                assert(false);
+            } break;
+    }
+}
+
+// ggml_compute_forward_rope
+
+static void ggml_compute_forward_rope_f32(
+        const struct ggml_compute_params * params,
+        const struct ggml_tensor * src0,
+        const struct ggml_tensor * src1,
+        struct ggml_tensor * dst) {
+    assert(params->ith == 0);
+    assert(src1->type == GGML_TYPE_I32);
+    assert(ggml_nelements(src1) == 3);
+
+    if (params->type == GGML_TASK_INIT || params->type == GGML_TASK_FINALIZE) {
+        return;
+    }
+
+    const int n_past = ((int32_t *) src1->data)[0];
+    const int n_dims = ((int32_t *) src1->data)[1];
+    const int mode   = ((int32_t *) src1->data)[2];
+
+    //const int ne0 = src0->ne[0];
+    const int ne1 = src0->ne[1];
+    const int ne2 = src0->ne[2];
+    const int ne3 = src0->ne[3];
+
+    const int nb0 = src0->nb[0];
+    const int nb1 = src0->nb[1];
+    const int nb2 = src0->nb[2];
+    const int nb3 = src0->nb[3];
+
+    //printf("ne0: %d, ne1: %d, ne2: %d, ne3: %d\n", ne0, ne1, ne2, ne3);
+    //printf("n_past = %d, ne2 = %d\n", n_past, ne2);
+
+    assert(nb0 == sizeof(float));
+
+    // TODO: optimize
+    for (int i3 = 0; i3 < ne3; i3++) {
+        for (int i2 = (mode == 0 ? 0 : n_past); i2 < ne2; i2++) {
+            const int p = (mode == 0 ? n_past + i2 : i2);
+            for (int i1 = 0; i1 < ne1; i1++) {
+                for (int i0 = 0; i0 < n_dims; i0 += 2) {
+                    const double theta = pow(10000.0, ((double)-i0)/n_dims);
+
+                    const double cos_theta = cos(p*theta);
+                    const double sin_theta = sin(p*theta);
+
+                    const float * const src = (float *)((char *) src0->data + i3*nb3 + i2*nb2 + i1*nb1 + i0*nb0);
+                          float * dst_data  = (float *)((char *)  dst->data + i3*nb3 + i2*nb2 + i1*nb1 + i0*nb0);
+
+                    double x0 = src[0];
+                    double x1 = src[1];
+
+                    dst_data[0] = x0*cos_theta - x1*sin_theta;
+                    dst_data[1] = x0*sin_theta + x1*cos_theta;
+                }
+            }
+        }
+    }
+}
+
+static void ggml_compute_forward_rope(
+        const struct ggml_compute_params * params,
+        const struct ggml_tensor * src0,
+        const struct ggml_tensor * src1,
+        struct ggml_tensor * dst) {
+    switch (src0->type) {
+        case GGML_TYPE_F32:
+            {
+                ggml_compute_forward_rope_f32(params, src0, src1, dst);
+            } break;
+        case GGML_TYPE_I8:
+        case GGML_TYPE_I16:
+        case GGML_TYPE_I32:
+        case GGML_TYPE_F16:
+        case GGML_TYPE_Q4_0:
+        case GGML_TYPE_Q8_0:
+        case GGML_TYPE_COUNT:
+            {
+                assert(false);
+            } break;
+    }
+}
+
+// ggml_compute_forward_conv_1d
+//
+// the convolutions (stride s, padding nk/2) are computed as a GEMM over the implicit im2col of the input:
+//
+//   dst[i1][i0] = sum_{i01,k} src0[i1][i01][k]*src1[i01][s*i0 + k - nk/2]
+//
+// the im2col matrix has one row of ne01*nk values per output position i0 and is never stored - its blocks are packed
+// directly from src1 into the GGML_GEMM_MR panels of the blocked GEMM (see ggml_gemm_f16_f32), with zeros at the
+// borders. the kernel is converted to F32 once during INIT and is read in place as the second operand, so the output
+// positions stay contiguous in dst and the rows are split between the threads like the src0 rows of mul_mat
+//
+// the bias and the GELU of ggml_conv_1d_1s_bias() / ggml_conv_1d_2s_bias() are applied to each panel of NR output
+// channels right after its last KC block
+//
+
+// work buffer: the F32 kernel, followed by one im2col block per thread
+static size_t ggml_conv_1d_wsize(const struct ggml_tensor * src0, int nth) {
+    const int nw = ggml_up(src0->ne[0]*src0->ne[1]*src0->ne[2], CACHE_LINE_SIZE_F32);
+
+    return sizeof(float)*(nw + nth*(GGML_GEMM_MC*GGML_GEMM_KC + CACHE_LINE_SIZE_F32));
+}
+
+// compute the output positions [ir0, ir1) of all the output channels
+static void ggml_conv_1d_gemm(
+        const struct ggml_tensor * src1,
+        const float * restrict w,
+        const struct ggml_tensor * bias,
+        const bool gelu,
+              struct ggml_tensor * dst,
+        const int s,
+        const int nk,
+              float * restrict wdata,
+        const int ir0,
+        const int ir1) {
+    const int ne10 = src1->ne[0];
+    const int ne11 = src1->ne[1];
+
+    const int ne1 = dst->ne[1];
+
+    const size_t nb11 = src1->nb[1];
+    const size_t nb1  = dst->nb[1];
+
+    const int nh = nk/2;
+
+    // im2col row length
+    const int nw = nk*ne11;
+
+    const int ldc = nb1/sizeof(float);
+
+    const int gemm_mr = ggml_gemm_mr();
+
+    GGML_ASSERT(gemm_mr <= GGML_GEMM_MR_MAX && GGML_GEMM_MC % gemm_mr == 0);
+    GGML_ASSERT(ne1 >= GGML_GEMM_NR);
+
+    float tile[GGML_GEMM_NR*GGML_GEMM_MR_MAX];
+
+    const bool epilogue = bias != NULL || gelu;
+
+    for (int k0 = 0; k0 < nw; k0 += GGML_GEMM_KC) {
+        const int kb = MIN(GGML_GEMM_KC, nw - k0);
+
+        for (int m0 = ir0; m0 < ir1; m0 += GGML_GEMM_MC) {
+            const int mb = MIN(GGML_GEMM_MC, ir1 - m0);
+
+            // pack the im2col block
+            for (int p = 0; p < mb; p += gemm_mr) {
+                float * ap = wdata + p*kb;
+
+                const int mr = MIN(gemm_mr, mb - p);
+
+                for (int l = 0; l < kb; ++l) {
+                    const int i01 = (k0 + l)/nk;
+                    const int k   = (k0 + l) - i01*nk;
+
+                    const float * x = (const float *) ((const char *) src1->data + i01*nb11);
+
+                    for (int i = 0; i < gemm_mr; ++i) {
+                        const int i10 = s*(m0 + p + i) + k - nh;
+
+                        ap[l*gemm_mr + i] = i < mr && i10 >= 0 && i10 < ne10 ? x[i10] : 0.0f;
+                    }
+                }
+            }
+
+            for (int n0 = 0; n0 < ne1; n0 += GGML_GEMM_NR) {
+                // the last panel is shifted back to overlap the previous one, as in ggml_gemm_f16_f32
+                const int n1 = MIN(n0, ne1 - GGML_GEMM_NR);
+                const int j0 = n0 - n1;
+
+                const float * b = w + n1*nw + k0;
+
+                for (int p = 0; p < mb; p += gemm_mr) {
+                    const int mr = MIN(gemm_mr, mb - p);
+
+                    float * c = (float *) ((char *) dst->data + n1*nb1) + m0 + p;
+
+                    if (mr == gemm_mr && j0 == 0) {
+                        ggml_gemm_f32_ukernel(kb, wdata + p*kb, b, nw, c, ldc, k0 > 0);
+                    } else {
+                        ggml_gemm_f32_ukernel(kb, wdata + p*kb, b, nw, tile, gemm_mr, false);
+
+                        for (int j = j0; j < GGML_GEMM_NR; ++j) {
+                            for (int i = 0; i < mr; ++i) {
+                                c[j*ldc + i] = k0 > 0 ? c[j*ldc + i] + tile[j*gemm_mr + i] : tile[j*gemm_mr + i];
+                            }
+                        }
+                    }
+                }
+
+                // the panel is complete after the last KC block
+                if (epilogue && k0 + kb == nw) {
+                    for (int j = j0; j < GGML_GEMM_NR; ++j) {
+                        float * y = (float *) ((char *) dst->data + (n1 + j)*nb1) + m0;
+
+                        if (bias) {
+                            ggml_vec_acc1_f32(mb, y, ((const float *) bias->data)[n1 + j]);
+                        }
+                        if (gelu) {
+                            ggml_vec_gelu_f32(mb, y, y);
+                        }
+                    }
+                }
+            }
+        }
+    }
+}
+
+static void ggml_compute_forward_conv_1d(
+        const struct ggml_compute_params * params,
+        const struct ggml_tensor * src0,
+        const struct ggml_tensor * src1,
+        const struct ggml_tensor * bias,
+        const bool gelu,
+        const int s,
+              struct ggml_tensor * dst) {
+    GGML_ASSERT(src0->type == GGML_TYPE_F16 || src0->type == GGML_TYPE_F32);
+    GGML_ASSERT(src1->type == GGML_TYPE_F32);
+    GGML_ASSERT( dst->type == GGML_TYPE_F32);
+
+    int64_t t0 = ggml_perf_time_us();
+    UNUSED(t0);
+
+    const int ne00 = src0->ne[0];
+    const int ne01 = src0->ne[1];
+    const int ne02 = src0->ne[2];
+
+    const int ne0 = dst->ne[0];
+
+    const size_t nb00 = src0->nb[0];
+    const size_t nb01 = src0->nb[1];
+    const size_t nb02 = src0->nb[2];
+
+    const size_t nb10 = src1->nb[0];
+
+    const int ith = params->ith;
+    const int nth = params->nth;
+
+    GGML_ASSERT(ne00 % 2 == 1); // TODO: support even kernel sizes
+    GGML_ASSERT(nb00 == GGML_TYPE_SIZE[src0->type]);
+    GGML_ASSERT(nb10 == sizeof(float));
+    GGML_ASSERT(dst->nb[0] == sizeof(float));
+    GGML_ASSERT(bias == NULL || (ggml_nelements(bias) == ne02 && ggml_is_contiguous(bias)));
+
+    float * const w = params->wdata;
+
+    if (params->type == GGML_TASK_INIT) {
+        GGML_ASSERT(ggml_conv_1d_wsize(src0, nth) <= params->wsize);
+
+        // the kernel in F32 - [ne02][ne01*ne00]
+        for (int i02 = 0; i02 < ne02; i02++) {
+            for (int i01 = 0; i01 < ne01; i01++) {
+                const char * x = (const char *) src0->data + i02*nb02 + i01*nb01;
+                float * y = w + (i02*ne01 + i01)*ne00;
+
+                if (src0->type == GGML_TYPE_F16) {
+                    ggml_vec_cvt_f16_f32(ne00, y, (const ggml_fp16_t *) x);
+                } else {
+                    ggml_vec_cpy_f32(ne00, y, (const float *) x);
+                }
+            }
+        }
+
+        return;
+    }
+
+    if (params->type == GGML_TASK_FINALIZE) {
+        return;
+    }
+
+    float * const wdata = w + ggml_up(ne00*ne01*ne02, CACHE_LINE_SIZE_F32) + ith*(GGML_GEMM_MC*GGML_GEMM_KC + CACHE_LINE_SIZE_F32);
+
+    // total output positions
+    const int nr = ne0;
+
+    // positions per chunk - multiple of the micro-kernel rows
+    const int dr = ggml_task_chunk_size(params, dst, nr, ggml_gemm_mr());
+    const int nchunk = (nr + dr - 1)/dr;
+
+    for (int ik = ggml_task_chunk_first(params, nchunk); ik < nchunk; ik = ggml_task_chunk_next(params, nchunk)) {
+        // position range for this chunk
+        const int ir0 = dr*ik;
+        const int ir1 = MIN(ir0 + dr, nr);
+
+        ggml_conv_1d_gemm(src1, w, bias, gelu, dst, s, ne00, wdata, ir0, ir1);
+    }
+}
+
+// ggml_compute_forward_flash_attn
+//
+// tiled attention with an online softmax:
+//
+//   - the work is split in blocks of GGML_FLASH_ATTN_BQ query rows of the same head
+//   - each block walks over the keys in tiles of BK keys and never materializes a full score row
+//   - after each tile the running max m and sum l of every query are updated and the partial output O is rescaled by
+//     exp(m_old - m_new), so the result is exact and the scratch per thread does not depend on the number of keys
+//
+// the blocks are computed in one of two ways:
+//
+//   - panels: the K and V tiles are converted to F32 once per block and the queries are processed in panels of
+//     ggml_gemm_mr() with the register-blocked GEMM micro-kernel, in the transposed form
+//
+//       S^T = K*Q^T  - the panel of Q^T is the packed operand, the K rows are read as they are
+//       O^T = V*P^T  - the tile of P^T is already laid out as a packed panel, the V rows are read as they are
+//
+//   - rows: blocks with few queries (e.g. decoding, N = 1) are computed row by row with the mat x vec kernels, directly
+//     on the K and V tiles
+//
+// BK is chosen so that the F32 K and V tiles of a block take GGML_FLASH_ATTN_KV_TILE bytes - for the Whisper heads
+// (D = 64) this is 128 keys - and stay in L2 while all the queries of the block are multiplied with them
+//
+// K and V must have the same type (F16 or F32) and V is expected transposed - [M, D, ...] with contiguous key rows
+//
+
+static inline int ggml_flash_attn_bk(const int D) {
+    const int bk = GGML_FLASH_ATTN_KV_TILE/(2*D*(int) sizeof(float));
+
+    return MAX(GGML_GEMM_MR_MAX, bk - bk % GGML_GEMM_MR_MAX);
+}
+
+// per-thread scratch in floats
+static size_t ggml_flash_attn_wsize(const int D) {
+    const int BQ  = GGML_FLASH_ATTN_BQ;
+    const int BK  = ggml_flash_attn_bk(D);
+    const int D6  = (D + GGML_GEMM_NR - 1)/GGML_GEMM_NR*GGML_GEMM_NR;
+    const int BK6 = (BK + GGML_GEMM_NR - 1)/GGML_GEMM_NR*GGML_GEMM_NR;
+
+    // Q block, scores, probabilities, output, running max and sum
+    const size_t rows  = BQ*D + BQ*BK + BQ*BK + BQ*D + 2*BQ;
+
+    // Q^T panels, K and V tiles, S^T panel, O^T panels, running max, sum and correction
+    const size_t gemm  = BQ*D + BK6*D + D6*BK + BK6*GGML_GEMM_MR_MAX + BQ*D6 + 3*BQ;
+
+    return MAX(rows, gemm) + CACHE_LINE_SIZE_F32;
+}
+
+// load the row r of the query block into y as F32, multiplied by s
+static inline void ggml_flash_attn_load_q(const struct ggml_tensor * q, const int iq1, const int iq2, const int iq3, float * y, const float s) {
+    const char * x = (const char *) q->data + (iq1*q->nb[1] + iq2*q->nb[2] + iq3*q->nb[3]);
+
+    if (q->type == GGML_TYPE_F16) {
+        ggml_vec_cvt_f16_f32(q->ne[0], y, (const ggml_fp16_t *) x);
+    } else {
+        memcpy(y, x, q->ne[0]*sizeof(float));
+    }
+
+    if (s != 1.0f) {
+        ggml_vec_scale_f32(q->ne[0], y, s);
+    }
+}
+
+// load n consecutive K/V values as F32
+static inline void ggml_flash_attn_load_kv(const int n, float * y, const void * x, const bool is_f16) {
+    if (is_f16) {
+        ggml_vec_cvt_f16_f32(n, y, (const ggml_fp16_t *) x);
+    } else {
+        memcpy(y, x, n*sizeof(float));
+    }
+}
+
+// the block of nq query rows starting at iq1, by panels
+static void ggml_flash_attn_block_gemm(
+        const struct ggml_tensor * q,
+        const struct ggml_tensor * k,
+        const struct ggml_tensor * v,
+        const bool masked,
+             struct ggml_tensor * dst,
+        const int iq1,
+        const int nq,
+        const int iq2,
+        const int iq3,
+             float * wdata) {
+    const int D  = q->ne[0];
+    const int M  = k->ne[1];
+    const int P  = M - q->ne[1];
+    const int BQ = GGML_FLASH_ATTN_BQ;
+    const int BK = ggml_flash_attn_bk(D);
+    const int NR = GGML_GEMM_NR;
+    const int MR = ggml_gemm_mr();
+
+    const int D6  = (D + NR - 1)/NR*NR;
+    const int BK6 = (BK + NR - 1)/NR*NR;
+
+    const bool is_f16 = k->type == GGML_TYPE_F16;
+    const size_t ts = GGML_TYPE_SIZE[k->type];
+
+    GGML_ASSERT(MR <= GGML_GEMM_MR_MAX && BQ % MR == 0);
+
+    // number of query panels
+    const int np = (nq + MR - 1)/MR;
+
+    float * Qp = wdata;                      // [np][D][MR]
+    float * Kt = Qp + BQ*D;                  // [BK6][D]
+    float * Vt = Kt + BK6*D;                 // [D6][BK]
+    float * St = Vt + D6*BK;                 // [BK6][MR]
+    float * Ot = St + BK6*GGML_GEMM_MR_MAX;  // [np][D6][MR]
+    float * Ml = Ot + BQ*D6;
+    float * Ls = Ml + BQ;
+    float * Cs = Ls + BQ;
+
+    // pack the scaled queries - the lanes past nq are zero
+    {
+        const float scale = 1.0/sqrt((double) D);
+
+        float * qr = St; // the S^T panel is free at this point
+
+        for (int r = 0; r < np*MR; ++r) {
+            float * a = Qp + (r/MR)*D*MR + r%MR;
+
+            if (r < nq) {
+                ggml_flash_attn_load_q(q, iq1 + r, iq2, iq3, qr, scale);
+                for (int c = 0; c < D; ++c) {
+                    a[c*MR] = qr[c];
+                }
+            } else {
+                for (int c = 0; c < D; ++c) {
+                    a[c*MR] = 0.0f;
+                }
+            }
+
+            Ml[r] = -INFINITY;
+            Ls[r] = 0.0f;
+        }
+    }
+
+    ggml_vec_set_f32(np*D6*MR, Ot, 0.0f);
+
+    // padding rows of the V tile
+    ggml_vec_set_f32((D6 - D)*BK, Vt + D*BK, 0.0f);
+
+    // keys visible to the last query of the block
+    const int mk = masked ? MIN(M, P + iq1 + nq) : M;
+
+    for (int j0 = 0; j0 < mk; j0 += BK) {
+        const int nk  = MIN(BK, mk - j0);
+        const int nk6 = (nk + NR - 1)/NR*NR;
+
+        for (int j = 0; j < nk; ++j) {
+            ggml_flash_attn_load_kv(D, Kt + j*D, (const char *) k->data + ((j0 + j)*k->nb[1] + iq2*k->nb[2] + iq3*k->nb[3]), is_f16);
+        }
+        ggml_vec_set_f32((nk6 - nk)*D, Kt + nk*D, 0.0f);
+
+        for (int d = 0; d < D; ++d) {
+            ggml_flash_attn_load_kv(nk, Vt + d*BK, (const char *) v->data + (j0*ts + d*v->nb[1] + iq2*v->nb[2] + iq3*v->nb[3]), is_f16);
+        }
+
+        for (int p = 0; p < np; ++p) {
+            const int r0 = p*MR;
+
+            // the panel does not see any key of the tile
+            if (masked && P + iq1 + MIN(nq, r0 + MR) - 1 < j0) {
+                continue;
+            }
+
+            float * ml = Ml + r0;
+            float * ls = Ls + r0;
+            float * cs = Cs + r0;
+
+            float * ot = Ot + p*D6*MR;
+
+            // S^T = K*Q^T
+            for (int j = 0; j < nk6; j += NR) {
+                ggml_gemm_f32_ukernel(D, Qp + p*D*MR, Kt + j*D, D, St + j*MR, MR, false);
+            }
+
+            if (masked) {
+                for (int j = 0; j < nk; ++j) {
+                    // key j0 + j is hidden from the lanes i < j0 + j - P - iq1 - r0
+                    const int n = MIN(MR, j0 + j - P - iq1 - r0);
+                    if (n > 0) {
+                        ggml_vec_set_f32(n, St + j*MR, -INFINITY);
+                    }
+                }
+            }
+
+            // online softmax over the columns
+            for (int i = 0; i < MR; ++i) {
+                cs[i] = -INFINITY;
+            }
+            for (int j = 0; j < nk; ++j) {
+                for (int i = 0; i < MR; ++i) {
+                    cs[i] = MAX(cs[i], St[j*MR + i]);
+                }
+            }
+            for (int i = 0; i < MR; ++i) {
+                const float m = MAX(ml[i], cs[i]);
+                cs[i] = expf(ml[i] - m);
+                ml[i] = m;
+            }
+            for (int j = 0; j < nk; ++j) {
+                for (int i = 0; i < MR; ++i) {
+                    St[j*MR + i] -= ml[i];
+                }
+            }
+
+            ggml_vec_soft_max_f32(nk*MR, St, St, 1.0f, 0.0f);
+
+            for (int i = 0; i < MR; ++i) {
+                ls[i] *= cs[i];
+            }
+            for (int j = 0; j < nk; ++j) {
+                for (int i = 0; i < MR; ++i) {
+                    ls[i] += St[j*MR + i];
+                }
+            }
+
+            for (int d = 0; d < D; ++d) {
+                for (int i = 0; i < MR; ++i) {
+                    ot[d*MR + i] *= cs[i];
+                }
+            }
+
+            // O^T += V*P^T
+            for (int d = 0; d < D6; d += NR) {
+                ggml_gemm_f32_ukernel(nk, St, Vt + d*BK, BK, ot + d*MR, MR, true);
+            }
+        }
+    }
+
+    // dst = O/l
+    for (int r = 0; r < nq; ++r) {
+        const float * ot = Ot + (r/MR)*D6*MR + r%MR;
+        const float il = 1.0f/Ls[r];
+
+        float * y = (float *) ((char *) dst->data + ((iq1 + r)*dst->nb[1] + iq2*dst->nb[2] + iq3*dst->nb[3]));
+
+        for (int d = 0; d < D; ++d) {
+            y[d] = ot[d*MR]*il;
+        }
+    }
+}
+
+// the block of nq query rows starting at iq1, row by row
+static void ggml_flash_attn_block_rows(
+        const struct ggml_tensor * q,
+        const struct ggml_tensor * k,
+        const struct ggml_tensor * v,
+        const bool masked,
+             struct ggml_tensor * dst,
+        const int iq1,
+        const int nq,
+        const int iq2,
+        const int iq3,
+             float * wdata) {
+    const int D  = q->ne[0];
+    const int M  = k->ne[1];
+    const int P  = M - q->ne[1];
+    const int BQ = GGML_FLASH_ATTN_BQ;
+    const int BK = ggml_flash_attn_bk(D);
+
+    const bool is_f16 = k->type == GGML_TYPE_F16;
+    const size_t ts = GGML_TYPE_SIZE[k->type];
+
+    const int nbk1 = k->nb[1];
+    const int nbv1 = v->nb[1];
+
+    const float scale = 1.0/sqrt((double) D);
+
+    void  * Qb = wdata;                 // [BQ][D] in the type of K
+    float * S  = wdata + BQ*D;          // [BQ][BK] scores, then probabilities
+    void  * Pb = S + BQ*BK;             // [BQ][BK] probabilities in the type of V
+    float * O  = (float *) Pb + BQ*BK;  // [BQ][D] unnormalized output
+    float * Ml = O + BQ*D;              // running max
+    float * Ls = Ml + BQ;               // running sum
+
+    // number of visible keys of each row in the current tile
+    int nv[GGML_FLASH_ATTN_BQ];
+
+    for (int r = 0; r < nq; ++r) {
+        if (is_f16) {
+            ggml_flash_attn_load_q(q, iq1 + r, iq2, iq3, O, 1.0f);
+            ggml_vec_cvt_f32_f16(D, (ggml_fp16_t *) Qb + r*D, O);
+        } else {
+            ggml_flash_attn_load_q(q, iq1 + r, iq2, iq3, (float *) Qb + r*D, 1.0f);
+        }
+
+        Ml[r] = -INFINITY;
+        Ls[r] = 0.0f;
+    }
+
+    ggml_vec_set_f32(nq*D, O, 0.0f);
+
+    // keys visible to the last row of the block
+    const int mk = masked ? MIN(M, P + iq1 + nq) : M;
+
+    for (int j0 = 0; j0 < mk; j0 += BK) {
+        const int nk = MIN(BK, mk - j0);
+
+        char * kt = (char *) k->data + (j0*nbk1 + iq2*k->nb[2] + iq3*k->nb[3]);
+        char * vt = (char *) v->data + (j0*ts  + iq2*v->nb[2] + iq3*v->nb[3]);
+
+        // S = K*Q for the tile - the K rows are reused by all the query rows
+        if (is_f16) {
+            int j = 0;
+            for (; j + GGML_VEC_GEMV_UNROLL <= nk; j += GGML_VEC_GEMV_UNROLL) {
+                for (int r = 0; r < nq; ++r) {
+                    ggml_vec_gemv_f16(D, nbk1, S + r*BK + j, kt + j*nbk1, (ggml_fp16_t *) Qb + r*D);
+                }
+            }
+            for (; j < nk; ++j) {
+                for (int r = 0; r < nq; ++r) {
+                    ggml_vec_dot_f16(D, S + r*BK + j, (ggml_fp16_t *) (kt + j*nbk1), (ggml_fp16_t *) Qb + r*D);
+                }
+            }
+        } else {
+            for (int j = 0; j < nk; ++j) {
+                for (int r = 0; r < nq; ++r) {
+                    ggml_vec_dot_f32(D, S + r*BK + j, (float *) (kt + j*nbk1), (float *) Qb + r*D);
+                }
+            }
+        }
+
+        // online softmax
+        for (int r = 0; r < nq; ++r) {
+            nv[r] = masked ? MIN(nk, P + iq1 + r + 1 - j0) : nk;
+
+            if (nv[r] <= 0) {
+                continue;
+            }
+
+            float * s = S + r*BK;
+
+            float mt = -INFINITY;
+            ggml_vec_max_f32(nv[r], &mt, s);
+
+            const float m = MAX(Ml[r], scale*mt);
+
+            if (m > Ml[r]) {
+                const float c = expf(Ml[r] - m);
+
+                ggml_vec_scale_f32(D, O + r*D, c);
+                Ls[r] *= c;
+                Ml[r]  = m;
+            }
+
+            Ls[r] += ggml_vec_soft_max_f32(nv[r], s, s, scale, m);
+
+            if (is_f16) {
+                ggml_vec_cvt_f32_f16(nv[r], (ggml_fp16_t *) Pb + r*BK, s);
+            }
+        }
+
+        // O += V*P for the tile - the V rows are reused by all the query rows
+        if (is_f16) {
+            float t[GGML_VEC_GEMV_UNROLL];
+
+            int d = 0;
+            for (; d + GGML_VEC_GEMV_UNROLL <= D; d += GGML_VEC_GEMV_UNROLL) {
+                for (int r = 0; r < nq; ++r) {
+                    if (nv[r] <= 0) {
+                        continue;
+                    }
+
+                    ggml_vec_gemv_f16(nv[r], nbv1, t, vt + d*nbv1, (ggml_fp16_t *) Pb + r*BK);
+
+                    for (int u = 0; u < GGML_VEC_GEMV_UNROLL; ++u) {
+                        O[r*D + d + u] += t[u];
+                    }
+                }
+            }
+            for (; d < D; ++d) {
+                for (int r = 0; r < nq; ++r) {
+                    if (nv[r] <= 0) {
+                        continue;
+                    }
+
+                    ggml_vec_dot_f16(nv[r], t, (ggml_fp16_t *) (vt + d*nbv1), (ggml_fp16_t *) Pb + r*BK);
+
+                    O[r*D + d] += t[0];
+                }
+            }
+        } else {
+            for (int d = 0; d < D; ++d) {
+                for (int r = 0; r < nq; ++r) {
+                    if (nv[r] <= 0) {
+                        continue;
+                    }
+
+                    float t;
+                    ggml_vec_dot_f32(nv[r], &t, (float *) (vt + d*nbv1), S + r*BK);
+
+                    O[r*D + d] += t;
+                }
+            }
+        }
+    }
+
+    // dst = O/l
+    for (int r = 0; r < nq; ++r) {
+        float * y = (float *) ((char *) dst->data + ((iq1 + r)*dst->nb[1] + iq2*dst->nb[2] + iq3*dst->nb[3]));
+
+        ggml_vec_cpy_f32  (D, y, O + r*D);
+        ggml_vec_scale_f32(D, y, 1.0f/Ls[r]);
+    }
+}
+
+static void ggml_compute_forward_flash_attn_tiled(
+        const struct ggml_compute_params * params,
+        const struct ggml_tensor * q,
+        const struct ggml_tensor * k,
+        const struct ggml_tensor * v,
+        const bool masked,
+             struct ggml_tensor * dst) {
+    int64_t t0 = ggml_perf_time_us();
+    UNUSED(t0);
+
+    const int neq0 = q->ne[0];
+    const int neq1 = q->ne[1];
+    const int neq2 = q->ne[2];
+    const int neq3 = q->ne[3];
+
+    const int nek0 = k->ne[0];
+    const int nek1 = k->ne[1];
+
+    const int nev0 = v->ne[0];
+    const int nev1 = v->ne[1];
+
+    const int ne0  = dst->ne[0];
+    const int ne1  = dst->ne[1];
+
+    const int nb0  = dst->nb[0];
+    const int nb1  = dst->nb[1];
+    const int nb2  = dst->nb[2];
+    const int nb3  = dst->nb[3];
+
+    const int ith = params->ith;
+
+    const int D = neq0;
+    const int N = neq1;
+    const int P = nek1 - N;
+    const int M = P + N;
+
+    const int BQ = GGML_FLASH_ATTN_BQ;
+
+    GGML_ASSERT(ne0 == D);
+    GGML_ASSERT(ne1 == N);
+    GGML_ASSERT(P >= 0);
+
+    GGML_ASSERT(k->type == GGML_TYPE_F16 || k->type == GGML_TYPE_F32);
+    GGML_ASSERT(q->type == GGML_TYPE_F16 || q->type == GGML_TYPE_F32);
+    GGML_ASSERT(v->type == k->type);
+
+    GGML_ASSERT(q->nb[0] == GGML_TYPE_SIZE[q->type]);
+    GGML_ASSERT(k->nb[0] == GGML_TYPE_SIZE[k->type]);
+    GGML_ASSERT(v->nb[0] == GGML_TYPE_SIZE[v->type]);
+
+    GGML_ASSERT(nek0 == D);
+    GGML_ASSERT(nev0 == M);
+    GGML_ASSERT(nev1 == D);
+
+    // dst cannot be transposed or permuted
+    GGML_ASSERT(nb0 == sizeof(float));
+    GGML_ASSERT(nb0 <= nb1);
+    GGML_ASSERT(nb1 <= nb2);
+    GGML_ASSERT(nb2 <= nb3);
+
+    if (params->type == GGML_TASK_INIT) {
+        return;
+    }
+
+    if (params->type == GGML_TASK_FINALIZE) {
+        return;
+    }
+
+    float * wdata = (float *) params->wdata + ith*ggml_flash_attn_wsize(D);
+
+    // the panels pay off once a block fills at least half of one
+    const int nq_gemm = ggml_gemm_mr()/2;
+
+    // blocks of BQ query rows - N = 1 (decoding) gives one block per head
+    const int nbq = (N + BQ - 1)/BQ;
+    const int nb  = nbq*neq2*neq3;
+
+    // the masked blocks have uneven cost, so they are claimed in chunks
+    const int dr = ggml_task_chunk_size(params, dst, nb, 1);
+    const int nchunk = (nb + dr - 1)/dr;
+
+    for (int ik = ggml_task_chunk_first(params, nchunk); ik < nchunk; ik = ggml_task_chunk_next(params, nchunk)) {
+        const int ib0 = dr*ik;
+        const int ib1 = MIN(ib0 + dr, nb);
+
+        for (int ib = ib0; ib < ib1; ib++) {
+            const int iq3 = ib/(neq2*nbq);
+            const int iq2 = (ib - iq3*neq2*nbq)/nbq;
+            const int iq1 = (ib - iq3*neq2*nbq - iq2*nbq)*BQ;
+
+            const int nq = MIN(BQ, N - iq1);
+
+            if (nq >= nq_gemm) {
+                ggml_flash_attn_block_gemm(q, k, v, masked, dst, iq1, nq, iq2, iq3, wdata);
+            } else {
+                ggml_flash_attn_block_rows(q, k, v, masked, dst, iq1, nq, iq2, iq3, wdata);
+            }
+
+#ifndef NDEBUG
+            for (int r = 0; r < nq; ++r) {
+                const float * y = (const float *) ((const char *) dst->data + ((iq1 + r)*nb1 + iq2*nb2 + iq3*nb3));
+                for (int i = 0; i < D; ++i) {
+                    assert(!isnan(y[i]));
+                    assert(!isinf(y[i]));
+                }
+            }
+#endif
+        }
+    }
+}
+
+static void ggml_compute_forward_flash_attn(
+        const struct ggml_compute_params * params,
+        const struct ggml_tensor * q,
+        const struct ggml_tensor * k,
+        const struct ggml_tensor * v,
+        const bool masked,
+        struct ggml_tensor * dst) {
+    switch (k->type) {
+        case GGML_TYPE_F16:
+        case GGML_TYPE_F32:
+            {
+                ggml_compute_forward_flash_attn_tiled(params, q, k, v, masked, dst);
+            } break;
+        case GGML_TYPE_I8:
+        case GGML_TYPE_I16:
+        case GGML_TYPE_I32:
+        case GGML_TYPE_Q4_0:
+        case GGML_TYPE_Q8_0:
+        case GGML_TYPE_COUNT:
+            {
+                assert(false);
+            } break;
+    }
+}
+
+// ggml_compute_forward_flash_ff
+
+static void ggml_compute_forward_flash_ff_f16(
+        const struct ggml_compute_params * params,
+        const struct ggml_tensor * a,  // F16
+        const struct ggml_tensor * b0, // F16 fc_w
+        const struct ggml_tensor * b1, // F32 fc_b
+        const struct ggml_tensor * c0, // F16 proj_w
+        const struct ggml_tensor * c1, // F32 proj_b
+        struct ggml_tensor * dst) {
+    int64_t t0 = ggml_perf_time_us();
+    UNUSED(t0);
+
+    const int nea0 = a->ne[0];
+    const int nea1 = a->ne[1];
+    const int nea2 = a->ne[2];
+    const int nea3 = a->ne[3];
+
+    const int neb00 = b0->ne[0];
+    const int neb01 = b0->ne[1];
+    //const int neb02 = b0->ne[2];
+    //const int neb03 = b0->ne[3];
+
+    const int neb10 = b1->ne[0];
+    const int neb11 = b1->ne[1];
+    //const int neb12 = b1->ne[2];
+    //const int neb13 = b1->ne[3];
+
+    const int nec00 = c0->ne[0];
+    const int nec01 = c0->ne[1];
+    //const int nec02 = c0->ne[2];
+    //const int nec03 = c0->ne[3];
+
+    const int nec10 = c1->ne[0];
+    const int nec11 = c1->ne[1];
+    //const int nec12 = c1->ne[2];
+    //const int nec13 = c1->ne[3];
+
+    const int ne0 = dst->ne[0];
+    const int ne1 = dst->ne[1];
+    const int ne2 = dst->ne[2];
+    //const int ne3 = dst->ne[3];
+
+    const int nba0 = a->nb[0];
+    const int nba1 = a->nb[1];
+    const int nba2 = a->nb[2];
+    const int nba3 = a->nb[3];
+
+    const int nbb00 = b0->nb[0];
+    const int nbb01 = b0->nb[1];
+    const int nbb02 = b0->nb[2];
+    const int nbb03 = b0->nb[3];
+
+    const int nbb10 = b1->nb[0];
+    //const int nbb11 = b1->nb[1];
+    //const int nbb12 = b1->nb[2];
+    //const int nbb13 = b1->nb[3];
+
+    const int nbc00 = c0->nb[0];
+    const int nbc01 = c0->nb[1];
+    const int nbc02 = c0->nb[2];
+    const int nbc03 = c0->nb[3];
+
+    const int nbc10 = c1->nb[0];
+    //const int nbc11 = c1->nb[1];
+    //const int nbc12 = c1->nb[2];
+    //const int nbc13 = c1->nb[3];
+
+    const int nb0 = dst->nb[0];
+    const int nb1 = dst->nb[1];
+    const int nb2 = dst->nb[2];
+    const int nb3 = dst->nb[3];
+
+    const int ith = params->ith;
+    const int nth = params->nth;
+
+    const int D = nea0;
+    //const int N = nea1;
+    const int M = neb01;
+
+    GGML_ASSERT(ne0 == nea0);
+    GGML_ASSERT(ne1 == nea1);
+    GGML_ASSERT(ne2 == nea2);
+
+    GGML_ASSERT(nba0  == sizeof(ggml_fp16_t));
+    GGML_ASSERT(nbb00 == sizeof(ggml_fp16_t));
+    GGML_ASSERT(nbb10 == sizeof(float));
+    GGML_ASSERT(nbc00 == sizeof(ggml_fp16_t));
+    GGML_ASSERT(nbc10 == sizeof(float));
+
+    GGML_ASSERT(neb00 == D);
+    GGML_ASSERT(neb01 == M);
+    GGML_ASSERT(neb10 == M);
+    GGML_ASSERT(neb11 == 1);
+
+    GGML_ASSERT(nec00 == M);
+    GGML_ASSERT(nec01 == D);
+    GGML_ASSERT(nec10 == D);
+    GGML_ASSERT(nec11 == 1);
+
+    // dst cannot be transposed or permuted
+    GGML_ASSERT(nb0 == sizeof(float));
+    GGML_ASSERT(nb0 <= nb1);
+    GGML_ASSERT(nb1 <= nb2);
+    GGML_ASSERT(nb2 <= nb3);
+
+    if (params->type == GGML_TASK_INIT) {
+        return;
+    }
+
+    if (params->type == GGML_TASK_FINALIZE) {
+        return;
+    }
+
+    // parallelize by a rows using ggml_vec_dot_f32
+
+    // total rows in a
+    const int nr = nea1*nea2*nea3;
+
+    // rows per thread
+    const int dr = (nr + nth - 1)/nth;
+
+    // row range for this thread
+    const int ir0 = dr*ith;
+    const int ir1 = MIN(ir0 + dr, nr);
+
+    for (int ir = ir0; ir < ir1; ++ir) {
+        // a indices
+        const int ia3 = ir/(nea2*nea1);
+        const int ia2 = (ir - ia3*nea2*nea1)/nea1;
+        const int ia1 = (ir - ia3*nea2*nea1 - ia2*nea1);
+
+        float * S = (float *) params->wdata + ith*(2*M + CACHE_LINE_SIZE_F32);
+
+        for (int ic = 0; ic < neb01; ++ic) {
+            // b0 indices
+            const int ib03 = ia3;
+            const int ib02 = ia2;
+            const int ib01 = ic;
+
+            // S indices
+            const int i1 = ib01;
+
+            ggml_vec_dot_f16(nea0,
+                    S + i1,
+                    (ggml_fp16_t *) ((char *) b0->data + (ib01*nbb01 + ib02*nbb02 + ib03*nbb03)),
+                    (ggml_fp16_t *) ((char *)  a->data + ( ia1*nba1  +  ia2*nba2  +  ia3*nba3)));
+        }
+
+        ggml_vec_add_f32(neb01, S, S, (float *) b1->data);
+        //ggml_vec_gelu_f32(neb01, S, S);
+
+        ggml_fp16_t * S16 = (ggml_fp16_t *) ((float *) params->wdata + ith*(2*M + CACHE_LINE_SIZE_F32) + M);
+
+        for (int i = 0; i < M; i++) {
+            S16[i] = GGML_FP32_TO_FP16(S[i]);
+        }
+
+        ggml_vec_gelu_f16(neb01, S16, S16);
+
+        {
+            // dst indices
+            const int i1 = ia1;
+            const int i2 = ia2;
+            const int i3 = ia3;
+
+            for (int ic = 0; ic < nec01; ++ic) {
+
+                ggml_vec_dot_f16(neb01,
+                        (float *)       ((char *) dst->data + (ic*nb0 + i1*nb1   + i2*nb2   + i3*nb3)),
+                        (ggml_fp16_t *) ((char *) c0->data  + (         ic*nbc01 + i2*nbc02 + i3*nbc03)),
+                        S16);
+            }
+
+            ggml_vec_add_f32(nec01,
+                    (float *) ((char *) dst->data + (i1*nb1 + i2*nb2 + i3*nb3)),
+                    (float *) ((char *) dst->data + (i1*nb1 + i2*nb2 + i3*nb3)),
+                    (float *) c1->data);
+        }
+    }
+}
+
+static void ggml_compute_forward_flash_ff(
+        const struct ggml_compute_params * params,
+        const struct ggml_tensor * a,
+        const struct ggml_tensor * b0,
+        const struct ggml_tensor * b1,
+        const struct ggml_tensor * c0,
+        const struct ggml_tensor * c1,
+        struct ggml_tensor * dst) {
+    switch (b0->type) {
+        case GGML_TYPE_F16:
+            {
+                ggml_compute_forward_flash_ff_f16(params, a, b0, b1, c0, c1, dst);
+            } break;
+        case GGML_TYPE_F32:
+            {
+                GGML_ASSERT(false); // TODO
+            } break;
+        case GGML_TYPE_I8:
+        case GGML_TYPE_I16:
+        case GGML_TYPE_I32:
+        case GGML_TYPE_Q4_0:
+        case GGML_TYPE_Q8_0:
+        case GGML_TYPE_COUNT:
+            {
+                assert(false);
+            } break;
+    }
+}
+
+/////////////////////////////////
+
+static void ggml_compute_forward(struct ggml_compute_params * params, struct ggml_tensor * tensor) {
+    assert(params);
+
+    switch (tensor->op) {
+        case GGML_OP_DUP:
+            {
+                ggml_compute_forward_dup(params, tensor->src0, tensor);
+            } break;
+        case GGML_OP_ADD:
+            {
+                ggml_compute_forward_add(params, tensor->src0, tensor->src1, tensor);
+            } break;
+        case GGML_OP_SUB:
+            {
+                ggml_compute_forward_sub(params, tensor->src0, tensor->src1, tensor);
+            } break;
+        case GGML_OP_MUL:
+            {
+                ggml_compute_forward_mul(params, tensor->src0, tensor->src1, tensor);
+            } break;
+        case GGML_OP_DIV:
+            {
+                ggml_compute_forward_div(params, tensor->src0, tensor->src1, tensor);
+            } break;
+        case GGML_OP_SQR:
+            {
+                ggml_compute_forward_sqr(params, tensor->src0, tensor);
+            } break;
+        case GGML_OP_SQRT:
+            {
+                ggml_compute_forward_sqrt(params, tensor->src0, tensor);
+            } break;
+        case GGML_OP_SUM:
+            {
+                ggml_compute_forward_sum(params, tensor->src0, tensor);
+            } break;
+        case GGML_OP_MEAN:
+            {
+                ggml_compute_forward_mean(params, tensor->src0, tensor);
+            } break;
+        case GGML_OP_REPEAT:
+            {
+                ggml_compute_forward_repeat(params, tensor->src0, tensor);
+            } break;
+        case GGML_OP_ABS:
+            {
+                ggml_compute_forward_abs(params, tensor->src0, tensor);
+            } break;
+        case GGML_OP_SGN:
+            {
+                ggml_compute_forward_sgn(params, tensor->src0, tensor);
+            } break;
+        case GGML_OP_NEG:
+            {
+                ggml_compute_forward_neg(params, tensor->src0, tensor);
+            } break;
+        case GGML_OP_STEP:
+            {
+                ggml_compute_forward_step(params, tensor->src0, tensor);
+            } break;
+        case GGML_OP_RELU:
+            {
+                ggml_compute_forward_relu(params, tensor->src0, tensor);
+            } break;
+        case GGML_OP_GELU:
+            {
+                ggml_compute_forward_gelu(params, tensor->src0, tensor);
+            } break;
+        case GGML_OP_NORM:
+            {
+                ggml_compute_forward_norm(params, tensor->src0, tensor);
+            } break;
+        case GGML_OP_NORM_AFFINE:
+            {
+                ggml_compute_forward_norm_affine(params, tensor->src0, tensor->src1, tensor->opt[0], tensor);
+            } break;
+        case GGML_OP_MUL_MAT:
+            {
+                bool gelu = false;
+                if (tensor->opt[1]) {
+                    int32_t t = ggml_get_i32_1d(tensor->opt[1], 0);
+                    GGML_ASSERT(t == 0 || t == 1);
+                    gelu = t != 0;
+                }
+                ggml_compute_forward_mul_mat(params, tensor->src0, tensor->src1, tensor->opt[0], gelu, tensor);
+            } break;
+        case GGML_OP_SCALE:
+            {
+                ggml_compute_forward_scale(params, tensor->src0, tensor->src1, tensor);
+            } break;
+        case GGML_OP_CPY:
+            {
+                ggml_compute_forward_cpy(params, tensor->src0, tensor);
+            } break;
+        case GGML_OP_RESHAPE:
+            {
+                ggml_compute_forward_reshape(params, tensor->src0, tensor);
+            } break;
+        case GGML_OP_VIEW:
+            {
+                ggml_compute_forward_view(params, tensor->src0);
+            } break;
+        case GGML_OP_PERMUTE:
+            {
+                ggml_compute_forward_permute(params, tensor->src0);
+            } break;
+        case GGML_OP_TRANSPOSE:
+            {
+                ggml_compute_forward_transpose(params, tensor->src0);
+            } break;
+        case GGML_OP_GET_ROWS:
+            {
+                ggml_compute_forward_get_rows(params, tensor->src0, tensor->src1, tensor);
+            } break;
+        case GGML_OP_DIAG_MASK_INF:
+            {
+                ggml_compute_forward_diag_mask_inf(params, tensor->src0, tensor->src1, tensor);
+            } break;
+        case GGML_OP_SOFT_MAX:
+            {
+                ggml_compute_forward_soft_max(params, tensor->src0, tensor->src1, tensor->opt[0], tensor);
+            } break;
+        case GGML_OP_ROPE:
+            {
+                ggml_compute_forward_rope(params, tensor->src0, tensor->src1, tensor);
+            } break;
+        case GGML_OP_CONV_1D_1S:
+        case GGML_OP_CONV_1D_2S:
+            {
+                bool gelu = false;
+                if (tensor->opt[1]) {
+                    int32_t t = ggml_get_i32_1d(tensor->opt[1], 0);
+                    GGML_ASSERT(t == 0 || t == 1);
+                    gelu = t != 0;
+                }
+                const int s = tensor->op == GGML_OP_CONV_1D_1S ? 1 : 2;
+                ggml_compute_forward_conv_1d(params, tensor->src0, tensor->src1, tensor->opt[0], gelu, s, tensor);
+            } break;
+        case GGML_OP_FLASH_ATTN:
+            {
+                int32_t t = ggml_get_i32_1d(tensor->opt[1], 0);
+                GGML_ASSERT(t == 0 || t == 1);
+                bool masked = t != 0;
+                ggml_compute_forward_flash_attn(params, tensor->src0, tensor->src1, tensor->opt[0], masked, tensor);
+            } break;
+        case GGML_OP_FLASH_FF:
+            {
+                ggml_compute_forward_flash_ff(params, tensor->src0, tensor->src1, tensor->opt[0], tensor->opt[1], tensor->opt[2], tensor);
+            } break;
+        case GGML_OP_NONE:
+            {
+                // nop
+            } break;
+        case GGML_OP_COUNT:
+            {
+                GGML_ASSERT(false);
+            } break;
+    }
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+static void ggml_compute_backward(struct ggml_context * ctx, struct ggml_tensor * tensor, bool inplace) {
+    struct ggml_tensor * src0 = tensor->src0;
+    struct ggml_tensor * src1 = tensor->src1;
+
+    switch (tensor->op) {
+        case GGML_OP_DUP:
+            {
+                if (src0->grad) {
+                    src0->grad = ggml_add_impl(ctx, src0->grad, tensor->grad, inplace);
+                }
+            } break;
+        case GGML_OP_ADD:
+            {
+                if (src0->grad) {
+                    src0->grad = ggml_add_impl(ctx, src0->grad, tensor->grad, inplace);
+                }
+                if (src1->grad) {
+                    src1->grad = ggml_add_impl(ctx, src1->grad, tensor->grad, inplace);
+                }
+            } break;
+        case GGML_OP_SUB:
+            {
+                if (src0->grad) {
+                    src0->grad = ggml_add_impl(ctx, src0->grad, tensor->grad, inplace);
+                }
+                if (src1->grad) {
+                    src1->grad = ggml_sub_impl(ctx, src1->grad, tensor->grad, inplace);
+                }
+            } break;
+        case GGML_OP_MUL:
+            {
+                if (src0->grad) {
+                    src0->grad =
+                        ggml_add_impl(ctx,
+                                src0->grad,
+                                ggml_mul(ctx, src1, tensor->grad),
+                                inplace);
+                }
+                if (src1->grad) {
+                    src1->grad =
+                        ggml_add_impl(ctx,
+                                src1->grad,
+                                ggml_mul(ctx, src0, tensor->grad),
+                                inplace);
+                }
+            } break;
+        case GGML_OP_DIV:
+            {
+                if (src0->grad) {
+                    src0->grad =
+                        ggml_add_impl(ctx,
+                                src0->grad,
+                                ggml_div(ctx, tensor->grad, src1),
+                                inplace);
+                }
+                if (src1->grad) {
+                    src1->grad =
+                        ggml_sub_impl(ctx,
+                                src1->grad,
+                                ggml_mul(ctx,
+                                    tensor->grad,
+                                    ggml_div(ctx, tensor, src1)),
+                                inplace);
+                }
+            } break;
+        case GGML_OP_SQR:
+            {
+                if (src0->grad) {
+                    src0->grad =
+                        ggml_add_impl(ctx,
+                                src0->grad,
+                                ggml_mul(ctx,
+                                    ggml_mul(ctx, src0, tensor->grad),
+                                    ggml_repeat(ctx, ggml_new_f32(ctx, 2.0f), src0)),
+                                inplace);
+                }
+            } break;
+        case GGML_OP_SQRT:
+            {
+                if (src0->grad) {
+                    src0->grad =
+                        ggml_add_impl(ctx,
+                                src0->grad,
+                                ggml_div(ctx,
+                                    ggml_repeat(ctx, ggml_new_f32(ctx, 0.5f), tensor),
+                                    tensor),
+                                inplace);
+                }
+            } break;
+        case GGML_OP_SUM:
+            {
+                if (src0->grad) {
+                    src0->grad =
+                        ggml_add_impl(ctx,
+                                src0->grad,
+                                ggml_repeat(ctx, tensor->grad, src0->grad),
+                                inplace);
+                }
+            } break;
+        case GGML_OP_MEAN:
+            {
+                assert(false); // TODO: implement
+            } break;
+        case GGML_OP_REPEAT:
+            {
+                if (src0->grad) {
+                    src0->grad =
+                        ggml_add_impl(ctx,
+                                src0->grad,
+                                ggml_sum(ctx, tensor->grad),
+                                inplace);
+                }
+            } break;
+        case GGML_OP_ABS:
+            {
+                if (src0->grad) {
+                    src0->grad =
+                        ggml_add_impl(ctx,
+                                src0->grad,
+                                ggml_mul(ctx,
+                                    ggml_sgn(ctx, src0),
+                                    tensor->grad),
+                                inplace);
+                }
+            } break;
+        case GGML_OP_SGN:
+            {
+                if (src0->grad) {
+                    // noop
+                }
+            } break;
+        case GGML_OP_NEG:
+            {
+                if (src0->grad) {
+                    src0->grad = ggml_sub_impl(ctx, src0->grad, tensor->grad, inplace);
+                }
+            } break;
+        case GGML_OP_STEP:
+            {
+                if (src0->grad) {
+                    // noop
+                }
+            } break;
+        case GGML_OP_RELU:
+            {
+                if (src0->grad) {
+                    src0->grad = ggml_sub_impl(ctx,
+                            src0->grad,
+                            ggml_mul(ctx,
+                                ggml_step(ctx, src0),
+                                tensor->grad),
+                            inplace);
+                }
+            } break;
+        case GGML_OP_GELU:
+            {
+                assert(false); // TODO: not implemented
+            } break;
+        case GGML_OP_NORM:
+            {
+                assert(false); // TODO: not implemented
+            } break;
+        case GGML_OP_NORM_AFFINE:
+            {
+                assert(false); // TODO: not implemented
+            } break;
+        case GGML_OP_MUL_MAT:
+            {
+                if (src0->grad) {
+                    // TODO: this requires outer product - ggml_out_prod(ctx, src1, tensor->grad);
+                    assert(false);
+                }
+                if (src1->grad) {
+                    src1->grad =
+                        ggml_add_impl(ctx,
+                                src1->grad,
+                                // TODO: fix transpose, the node will break the graph connections
+                                ggml_mul_mat(ctx, ggml_transpose(ctx, src0), tensor->grad),
+                                inplace);
+                }
+            } break;
+        case GGML_OP_SCALE:
+            {
+                GGML_ASSERT(false); // TODO: not implemented
+            } break;
+        case GGML_OP_CPY:
+            {
+                GGML_ASSERT(false); // TODO: not implemented
+            } break;
+        case GGML_OP_RESHAPE:
+            {
+                GGML_ASSERT(false); // TODO: not implemented
+            } break;
         case GGML_OP_VIEW:
             {
                 GGML_ASSERT(false); // not supported
@@ -6889,706 +9682,2531 @@ static void ggml_compute_backward(struct ggml_context * ctx, struct ggml_tensor
                 GGML_ASSERT(false); // TODO: not implemented
             } break;
         case GGML_OP_CONV_1D_1S:
-            {
-                GGML_ASSERT(false); // TODO: not implemented
-            } break;
+            {
+                GGML_ASSERT(false); // TODO: not implemented
+            } break;
+        case GGML_OP_CONV_1D_2S:
+            {
+                GGML_ASSERT(false); // TODO: not implemented
+            } break;
+        case GGML_OP_FLASH_ATTN:
+            {
+                GGML_ASSERT(false); // not supported
+            } break;
+        case GGML_OP_FLASH_FF:
+            {
+                GGML_ASSERT(false); // not supported
+            } break;
+        case GGML_OP_NONE:
+            {
+                // nop
+            } break;
+        case GGML_OP_COUNT:
+            {
+                GGML_ASSERT(false);
+            } break;
+    }
+}
+
+static void ggml_visit_parents(struct ggml_cgraph * cgraph, struct ggml_tensor * node) {
+    if (node->grad == NULL) {
+        // this usually happens when we generate intermediate nodes from constants in the backward pass
+        // it can also happen during forward pass, if the user performs computations with constants
+        if (node->op != GGML_OP_NONE) {
+            //GGML_PRINT_DEBUG("%s: warning: node %p has no grad, but op %d\n", __func__, (void *) node, node->op);
+        }
+    }
+
+    // check if already visited
+    for (int i = 0; i < cgraph->n_nodes; i++) {
+        if (cgraph->nodes[i] == node) {
+            return;
+        }
+    }
+
+    for (int i = 0; i < cgraph->n_leafs; i++) {
+        if (cgraph->leafs[i] == node) {
+            return;
+        }
+    }
+
+    if (node->src0) {
+        ggml_visit_parents(cgraph, node->src0);
+    }
+
+    if (node->src1) {
+        ggml_visit_parents(cgraph, node->src1);
+    }
+
+    for (int i = 0; i < GGML_MAX_OPT; ++i) {
+        if (node->opt[i]) {
+            ggml_visit_parents(cgraph, node->opt[i]);
+        }
+    }
+
+    if (node->op == GGML_OP_NONE && node->grad == NULL) {
+        // reached a leaf node, not part of the gradient graph (e.g. a constant)
+        assert(cgraph->n_leafs < GGML_MAX_NODES);
+
+        cgraph->leafs[cgraph->n_leafs] = node;
+        cgraph->n_leafs++;
+    } else {
+        assert(cgraph->n_nodes < GGML_MAX_NODES);
+
+        cgraph->nodes[cgraph->n_nodes] = node;
+        cgraph->grads[cgraph->n_nodes] = node->grad;
+        cgraph->n_nodes++;
+    }
+}
+
+static void ggml_build_forward_impl(struct ggml_cgraph * cgraph, struct ggml_tensor * tensor, bool expand) {
+    if (!expand) {
+        cgraph->n_nodes = 0;
+        cgraph->n_leafs = 0;
+    }
+
+    const int n0 = cgraph->n_nodes;
+    UNUSED(n0);
+
+    ggml_visit_parents(cgraph, tensor);
+
+    const int n_new = cgraph->n_nodes - n0;
+    GGML_PRINT_DEBUG("%s: visited %d new nodes\n", __func__, n_new);
+
+    if (n_new > 0) {
+        // the last added node should always be starting point
+        assert(cgraph->nodes[cgraph->n_nodes - 1] == tensor);
+    }
+}
+
+void ggml_build_forward_expand(struct ggml_cgraph * cgraph, struct ggml_tensor * tensor) {
+    ggml_build_forward_impl(cgraph, tensor, true);
+}
+
+struct ggml_cgraph ggml_build_forward(struct ggml_tensor * tensor) {
+    struct ggml_cgraph result = {
+        /*.n_nodes      =*/ 0,
+        /*.n_leafs      =*/ 0,
+        /*.n_threads    =*/ 0,
+        /*.threadpool   =*/ NULL,
+        /*.work_size    =*/ 0,
+        /*.work         =*/ NULL,
+        /*.nodes        =*/ { NULL },
+        /*.grads        =*/ { NULL },
+        /*.leafs        =*/ { NULL },
+        /*.trace        =*/ NULL,
+        /*.tune         =*/ NULL,
+        /*.wcache       =*/ NULL,
+        /*.perf         =*/ false,
+        /*.perf_runs    =*/ 0,
+        /*.perf_cycles  =*/ 0,
+        /*.perf_time_us =*/ 0,
+    };
+
+    ggml_build_forward_impl(&result, tensor, false);
+
+    return result;
+}
+
+struct ggml_cgraph ggml_build_backward(struct ggml_context * ctx, struct ggml_cgraph * gf, bool keep) {
+    struct ggml_cgraph result = *gf;
+
+    assert(gf->n_nodes > 0);
+
+    // if we are keeping the gradient graph, we have to detach the gradient nodes from the original graph
+    if (keep) {
+        for (int i = 0; i < gf->n_nodes; i++) {
+            struct ggml_tensor * node = gf->nodes[i];
+
+            if (node->grad) {
+                node->grad = ggml_dup_tensor(ctx, node);
+                gf->grads[i] = node->grad;
+            }
+        }
+    }
+
+    for (int i = gf->n_nodes - 1; i >= 0; i--) {
+        struct ggml_tensor * node = gf->nodes[i];
+
+        // because we detached the grad nodes from the original graph, we can afford inplace operations
+        if (node->grad) {
+            ggml_compute_backward(ctx, node, keep);
+        }
+    }
+
+    for (int i = gf->n_nodes - 1; i >= 0; i--) {
+        struct ggml_tensor * node = gf->nodes[i];
+
+        if (node->is_param) {
+            GGML_PRINT_DEBUG("%s: found root node %p\n", __func__, (void *) node);
+            ggml_build_forward_impl(&result, node->grad, true);
+        }
+    }
+
+    return result;
+}
+
+//
+// thread data
+//
+// synchronization is done via busy loops
+// I tried using spin locks, but not sure how to use them correctly - the things I tried were slower than busy loops
+//
+// a thread that has been busy-waiting for more than GGML_N_SPIN iterations goes to sleep on a condition variable
+// so that idle workers do not keep the cores busy (e.g. during single-threaded ops or between graphs)
+//
+
+#ifdef __APPLE__
+
+//#include <os/lock.h>
+//
+//typedef os_unfair_lock ggml_lock_t;
+//
+//#define ggml_lock_init(x)    UNUSED(x)
+//#define ggml_lock_destroy(x) UNUSED(x)
+//#define ggml_lock_lock       os_unfair_lock_lock
+//#define ggml_lock_unlock     os_unfair_lock_unlock
+//
+//#define GGML_LOCK_INITIALIZER OS_UNFAIR_LOCK_INIT
+
+typedef int ggml_lock_t;
+
+#define ggml_lock_init(x)    UNUSED(x)
+#define ggml_lock_destroy(x) UNUSED(x)
+#define ggml_lock_lock(x)    UNUSED(x)
+#define ggml_lock_unlock(x)  UNUSED(x)
+
+#define GGML_LOCK_INITIALIZER 0
+
+typedef pthread_t ggml_thread_t;
+
+#define ggml_thread_create pthread_create
+#define ggml_thread_join   pthread_join
+
+#else
+
+//typedef pthread_spinlock_t ggml_lock_t;
+
+//#define ggml_lock_init(x) pthread_spin_init(x, PTHREAD_PROCESS_PRIVATE)
+//#define ggml_lock_destroy pthread_spin_destroy
+//#define ggml_lock_lock    pthread_spin_lock
+//#define ggml_lock_unlock  pthread_spin_unlock
+
+typedef int ggml_lock_t;
+
+#define ggml_lock_init(x)    UNUSED(x)
+#define ggml_lock_destroy(x) UNUSED(x)
+#define ggml_lock_lock(x)    UNUSED(x)
+#define ggml_lock_unlock(x)  UNUSED(x)
+
+#define GGML_LOCK_INITIALIZER 0
+
+typedef pthread_t ggml_thread_t;
+
+#define ggml_thread_create pthread_create
+#define ggml_thread_join   pthread_join
+
+#endif
+
+typedef pthread_mutex_t ggml_mutex_t;
+typedef pthread_cond_t  ggml_cond_t;
+
+#define ggml_mutex_init(x)    pthread_mutex_init(x, NULL)
+#define ggml_mutex_destroy    pthread_mutex_destroy
+#define ggml_mutex_lock       pthread_mutex_lock
+#define ggml_mutex_unlock     pthread_mutex_unlock
+
+#define ggml_cond_init(x)     pthread_cond_init(x, NULL)
+#define ggml_cond_destroy     pthread_cond_destroy
+#define ggml_cond_wait        pthread_cond_wait
+#define ggml_cond_broadcast   pthread_cond_broadcast
+
+//
+// NUMA
+//
+
+#define GGML_NUMA_MAX_NODES 8
+
+#if defined(__linux__)
+#ifndef MPOL_PREFERRED
+#define MPOL_PREFERRED  1
+#define MPOL_INTERLEAVE 3
+#endif
+#ifndef MPOL_MF_MOVE
+#define MPOL_MF_MOVE (1 << 1)
+#endif
+#endif
+
+// the NUMA nodes with CPUs that the process may run on - detected by ggml_init()
+struct ggml_numa_nodes {
+    int n_nodes;
+
+    int id[GGML_NUMA_MAX_NODES]; // id of the node in the system
+#if defined(__linux__)
+    cpu_set_t cpus[GGML_NUMA_MAX_NODES];
+#endif
+};
+
+static struct ggml_numa_nodes g_numa = { .n_nodes = 1 };
+
+static void ggml_numa_init(void) {
+#if defined(__linux__)
+    cpu_set_t allowed;
+    if (sched_getaffinity(0, sizeof(allowed), &allowed) != 0) {
+        return;
+    }
+
+    int n = 0;
+
+    for (int id = 0; id < 64 && n < GGML_NUMA_MAX_NODES; id++) {
+        char path[64];
+        snprintf(path, sizeof(path), "/sys/devices/system/node/node%d/cpulist", id);
+
+        FILE * f = fopen(path, "r");
+        if (f == NULL) {
+            continue;
+        }
+
+        cpu_set_t * cpus = &g_numa.cpus[n];
+        CPU_ZERO(cpus);
+
+        // e.g. "0-15,32-47"
+        int cpu0 = 0;
+        while (fscanf(f, "%d", &cpu0) == 1) {
+            int cpu1 = cpu0;
+
+            int c = fgetc(f);
+            if (c == '-') {
+                if (fscanf(f, "%d", &cpu1) != 1) {
+                    break;
+                }
+                c = fgetc(f);
+            }
+
+            for (int cpu = cpu0; cpu <= cpu1 && cpu < CPU_SETSIZE; cpu++) {
+                if (CPU_ISSET(cpu, &allowed)) {
+                    CPU_SET(cpu, cpus);
+                }
+            }
+
+            if (c != ',') {
+                break;
+            }
+        }
+
+        fclose(f);
+
+        // memory-only nodes and nodes outside of the CPU set of the process get no threads
+        if (CPU_COUNT(cpus) > 0) {
+            g_numa.id[n++] = id;
+        }
+    }
+
+    g_numa.n_nodes = MAX(1, n);
+
+    GGML_PRINT_DEBUG("%s: %d NUMA nodes\n", __func__, g_numa.n_nodes);
+#endif
+}
+
+// pin the calling thread to the CPUs of the NUMA node g
+static void ggml_numa_set_affinity(int g) {
+#if defined(__linux__)
+    const int rc = pthread_setaffinity_np(pthread_self(), sizeof(cpu_set_t), &g_numa.cpus[g]);
+    if (rc != 0) {
+        GGML_PRINT_DEBUG("%s: failed to pin the thread to node %d: %d\n", __func__, g_numa.id[g], rc);
+    }
+#else
+    UNUSED(g);
+#endif
+}
+
+bool ggml_thread_set_affinity(const int * cpus, int n_cpus) {
+    if (n_cpus <= 0) {
+        return false;
+    }
+
+#if defined(__linux__)
+    cpu_set_t set;
+    CPU_ZERO(&set);
+
+    for (int i = 0; i < n_cpus; i++) {
+        if (cpus[i] < 0 || cpus[i] >= CPU_SETSIZE) {
+            return false;
+        }
+        CPU_SET(cpus[i], &set);
+    }
+
+    return pthread_setaffinity_np(pthread_self(), sizeof(set), &set) == 0;
+#elif defined(_WIN32)
+    DWORD_PTR mask = 0;
+
+    for (int i = 0; i < n_cpus; i++) {
+        if (cpus[i] < 0 || cpus[i] >= (int) (8*sizeof(mask))) {
+            return false;
+        }
+        mask |= (DWORD_PTR) 1 << cpus[i];
+    }
+
+    return SetThreadAffinityMask(GetCurrentThread(), mask) != 0;
+#else
+    UNUSED(cpus);
+    return false;
+#endif
+}
+
+bool ggml_thread_check_affinity(const int * cpus, int n_cpus) {
+    if (n_cpus <= 0) {
+        return false;
+    }
+
+#if defined(__linux__)
+    cpu_set_t allowed;
+    if (sched_getaffinity(0, sizeof(allowed), &allowed) != 0) {
+        return false;
+    }
+
+    for (int i = 0; i < n_cpus; i++) {
+        if (cpus[i] < 0 || cpus[i] >= CPU_SETSIZE || !CPU_ISSET(cpus[i], &allowed)) {
+            return false;
+        }
+    }
+
+    return true;
+#elif defined(_WIN32)
+    DWORD_PTR process_mask;
+    DWORD_PTR system_mask;
+    if (!GetProcessAffinityMask(GetCurrentProcess(), &process_mask, &system_mask)) {
+        return false;
+    }
+
+    for (int i = 0; i < n_cpus; i++) {
+        if (cpus[i] < 0 || cpus[i] >= (int) (8*sizeof(process_mask)) || !(process_mask & ((DWORD_PTR) 1 << cpus[i]))) {
+            return false;
+        }
+    }
+
+    return true;
+#else
+    UNUSED(cpus);
+    return false;
+#endif
+}
+
+// the affinity of a thread before it is pinned, see ggml_thread_affinity_save()
+struct ggml_thread_affinity {
+    bool saved;
+#if defined(__linux__)
+    cpu_set_t cpus;
+#elif defined(_WIN32)
+    DWORD_PTR mask;
+#endif
+};
+
+static void ggml_thread_affinity_save(struct ggml_thread_affinity * affinity) {
+    affinity->saved = false;
+
+#if defined(__linux__)
+    affinity->saved = pthread_getaffinity_np(pthread_self(), sizeof(affinity->cpus), &affinity->cpus) == 0;
+#elif defined(_WIN32)
+    // there is no getter - SetThreadAffinityMask() returns the previous mask
+    DWORD_PTR process_mask;
+    DWORD_PTR system_mask;
+    if (GetProcessAffinityMask(GetCurrentProcess(), &process_mask, &system_mask)) {
+        affinity->mask  = SetThreadAffinityMask(GetCurrentThread(), process_mask);
+        affinity->saved = affinity->mask != 0;
+        if (affinity->saved) {
+            SetThreadAffinityMask(GetCurrentThread(), affinity->mask);
+        }
+    }
+#endif
+}
+
+static void ggml_thread_affinity_restore(const struct ggml_thread_affinity * affinity) {
+    if (!affinity->saved) {
+        return;
+    }
+
+#if defined(__linux__)
+    pthread_setaffinity_np(pthread_self(), sizeof(affinity->cpus), &affinity->cpus);
+#elif defined(_WIN32)
+    SetThreadAffinityMask(GetCurrentThread(), affinity->mask);
+#endif
+}
+
+// set the memory policy of the pages that are mostly in [data, data + size) and move them accordingly
+static bool ggml_numa_mbind(void * data, size_t size, int mode, unsigned long mask) {
+#if defined(__linux__) && defined(SYS_mbind)
+    const uintptr_t page = sysconf(_SC_PAGESIZE);
+
+    const uintptr_t p0 = ((uintptr_t) data        + page/2)/page*page;
+    const uintptr_t p1 = ((uintptr_t) data + size + page/2)/page*page;
+
+    if (p1 <= p0) {
+        return true;
+    }
+
+    return syscall(SYS_mbind, p0, p1 - p0, mode, &mask, 8*sizeof(mask) + 1, MPOL_MF_MOVE) == 0;
+#else
+    UNUSED(data);
+    UNUSED(size);
+    UNUSED(mode);
+    UNUSED(mask);
+    return true;
+#endif
+}
+
+int ggml_numa_n_nodes(void) {
+    return g_numa.n_nodes;
+}
+
+bool ggml_numa_interleave(void * data, size_t size) {
+    if (g_numa.n_nodes <= 1) {
+        return true;
+    }
+
+#if defined(__linux__)
+    unsigned long mask = 0;
+    for (int g = 0; g < g_numa.n_nodes; g++) {
+        mask |= 1UL << g_numa.id[g];
+    }
+
+    return ggml_numa_mbind(data, size, MPOL_INTERLEAVE, mask);
+#else
+    UNUSED(data);
+    UNUSED(size);
+    return true;
+#endif
+}
+
+bool ggml_numa_distribute(const struct ggml_tensor * tensor) {
+    const int n = g_numa.n_nodes;
+    if (n <= 1) {
+        return true;
+    }
+
+    GGML_ASSERT(ggml_is_contiguous(tensor));
+
+    // the same split as the blocks of chunks of the rows of src0 in ggml_task_chunk_next()
+    const int64_t nr = ggml_nrows(tensor);
+
+    bool ok = true;
+
+#if defined(__linux__)
+    for (int g = 0; g < n; g++) {
+        const int64_t ir0 = g*nr/n;
+        const int64_t ir1 = (g + 1)*nr/n;
+
+        ok = ggml_numa_mbind((char *) tensor->data + ir0*tensor->nb[1], (ir1 - ir0)*tensor->nb[1], MPOL_PREFERRED, 1UL << g_numa.id[g]) && ok;
+    }
+#endif
+
+    return ok;
+}
+
+//
+// tracing
+//
+
+struct ggml_trace_event {
+    const char * name;
+    const char * cat;
+
+    int64_t t_start_us;
+    int64_t t_end_us;
+};
+
+// each thread writes only to its own buffer, so no synchronization is needed
+struct ggml_trace_thread {
+    struct ggml_trace_event * events; // [n_max_events], allocated at the first event of the thread
+    int n_events;
+    int n_dropped;
+};
+
+struct ggml_trace {
+    int n_threads;
+    int n_max_events;
+
+    int64_t t_start_us;
+
+    struct ggml_trace_thread * threads; // [n_threads]
+};
+
+static const char * GGML_TASK_LABEL[] = {
+    "INIT",
+    "COMPUTE",
+    "FINALIZE",
+};
+
+struct ggml_trace * ggml_trace_new(int n_threads, int n_max_events) {
+    GGML_ASSERT(n_threads > 0 && n_max_events > 0);
+
+    struct ggml_trace * trace = malloc(sizeof(struct ggml_trace));
+
+    trace->n_threads    = n_threads;
+    trace->n_max_events = n_max_events;
+    trace->t_start_us   = ggml_time_us();
+    trace->threads      = calloc(n_threads, sizeof(struct ggml_trace_thread));
+
+    return trace;
+}
+
+void ggml_trace_free(struct ggml_trace * trace) {
+    if (trace == NULL) {
+        return;
+    }
+
+    for (int i = 0; i < trace->n_threads; i++) {
+        free(trace->threads[i].events);
+    }
+
+    free(trace->threads);
+    free(trace);
+}
+
+void ggml_trace_reset(struct ggml_trace * trace) {
+    for (int i = 0; i < trace->n_threads; i++) {
+        trace->threads[i].n_events  = 0;
+        trace->threads[i].n_dropped = 0;
+    }
+
+    trace->t_start_us = ggml_time_us();
+}
+
+void ggml_trace_add(struct ggml_trace * trace, int ith, const char * name, const char * cat, int64_t t_start_us, int64_t t_end_us) {
+    if (ith >= trace->n_threads) {
+        return;
+    }
+
+    struct ggml_trace_thread * thread = &trace->threads[ith];
+
+    if (thread->n_events == trace->n_max_events) {
+        thread->n_dropped++;
+        return;
+    }
+
+    if (thread->events == NULL) {
+        thread->events = malloc(trace->n_max_events*sizeof(struct ggml_trace_event));
+    }
+
+    thread->events[thread->n_events++] = (struct ggml_trace_event) {
+        .name       = name,
+        .cat        = cat,
+        .t_start_us = t_start_us,
+        .t_end_us   = t_end_us,
+    };
+}
+
+bool ggml_trace_dump_json(const struct ggml_trace * trace, const char * filename) {
+    FILE * fp = fopen(filename, "w");
+    if (fp == NULL) {
+        return false;
+    }
+
+    fprintf(fp, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n");
+
+    int n_dropped = 0;
+    bool first = true;
+
+    for (int i = 0; i < trace->n_threads; i++) {
+        const struct ggml_trace_thread * thread = &trace->threads[i];
+
+        n_dropped += thread->n_dropped;
+
+        if (thread->n_events == 0) {
+            continue;
+        }
+
+        fprintf(fp, "%s{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":0,\"tid\":%d,\"args\":{\"name\":\"thread %d\"}}",
+                first ? "" : ",\n", i, i);
+        first = false;
+
+        for (int j = 0; j < thread->n_events; j++) {
+            const struct ggml_trace_event * e = &thread->events[j];
+
+            fprintf(fp, ",\n{\"name\":\"%s\",\"cat\":\"%s\",\"ph\":\"X\",\"pid\":0,\"tid\":%d,\"ts\":%lld,\"dur\":%lld}",
+                    e->name, e->cat, i, (long long) (e->t_start_us - trace->t_start_us), (long long) (e->t_end_us - e->t_start_us));
+        }
+    }
+
+    fprintf(fp, "\n]}\n");
+    fclose(fp);
+
+    if (n_dropped > 0) {
+        fprintf(stderr, "%s: %d events were dropped - increase n_max_events\n", __func__, n_dropped);
+    }
+
+    return true;
+}
+
+// add the span [*t_us, now] to the timeline of the main thread and move *t_us to now
+static inline void ggml_trace_end(struct ggml_trace * trace, const char * name, const char * cat, int64_t * t_us) {
+    if (trace) {
+        const int64_t t_end_us = ggml_time_us();
+        ggml_trace_add(trace, 0, name, cat, *t_us, t_end_us);
+        *t_us = t_end_us;
+    }
+}
+
+//
+// thread pool
+//
+
+struct ggml_compute_state_shared {
+    ggml_lock_t spin;
+
+    int n_threads;
+    int n_numa; // number of NUMA nodes the threads are spread over - see ggml_threadpool_new_numa()
+
+    // thread ith runs on cpus[ith % n_cpus] - see ggml_threadpool_new_cpus()
+    int * cpus;
+    int   n_cpus;
+
+    // synchronization primitives
+    atomic_int  n_launch; // incremented by the main thread to launch the next task
+    atomic_int  n_ready;  // number of workers that have finished the current task
+    atomic_bool active;   // true while a graph is being computed - otherwise the workers sleep
+    atomic_bool stop;     // stop all threads
+
+    // a waiting thread busy-waits for n_spin iterations and then goes to sleep
+    atomic_int n_spin;
+
+    // used to put the threads to sleep
+    atomic_int  n_sleeping;   // number of workers waiting on cond_launch
+    atomic_bool main_waiting; // the main thread is waiting on cond_ready
+
+    ggml_mutex_t mutex;
+    ggml_cond_t  cond_launch;
+    ggml_cond_t  cond_ready;
+};
+
+// independent nodes computed at the same time - the threads claim the tasks of all the nodes one at a time from
+// a shared counter (see ggml_graph_schedule)
+struct ggml_compute_step {
+    int n_nodes;
+    int n_tasks;
+
+    struct ggml_tensor * nodes[GGML_MAX_CONCURRENT];
+
+    int        task0[GGML_MAX_CONCURRENT + 1]; // the tasks of node k are [task0[k], task0[k + 1])
+    atomic_int next;                           // the next task to claim
+
+    struct ggml_task_chunk chunk[GGML_MAX_CONCURRENT]; // see ggml_task_chunk_next()
+};
+
+static void ggml_compute_step_run(struct ggml_compute_step * step, struct ggml_trace * trace, int ith) {
+    for (int t = atomic_fetch_add(&step->next, 1); t < step->n_tasks; t = atomic_fetch_add(&step->next, 1)) {
+        int k = 0;
+        while (t >= step->task0[k + 1]) {
+            k++;
+        }
+
+        struct ggml_tensor * node = step->nodes[k];
+
+        struct ggml_compute_params params = {
+            /*.type  =*/ GGML_TASK_COMPUTE,
+            /*.ith   =*/ t - step->task0[k],
+            /*.nth   =*/ node->n_tasks,
+            /*.wsize =*/ 0,
+            /*.wdata =*/ NULL,
+            /*.n_numa =*/ 1,
+            /*.chunk =*/ &step->chunk[k],
+            /*.wcache =*/ NULL,
+        };
+
+        const int64_t t_start_us = trace ? ggml_time_us() : 0;
+
+        ggml_compute_forward(&params, node);
+
+        if (trace) {
+            ggml_trace_add(trace, ith, GGML_OP_LABEL[node->op], GGML_TASK_LABEL[GGML_TASK_COMPUTE], t_start_us, ggml_time_us());
+        }
+    }
+}
+
+struct ggml_compute_state {
+    ggml_thread_t thrd;
+
+    struct ggml_compute_params params;
+    struct ggml_tensor * node;
+    struct ggml_trace  * trace;
+
+    struct ggml_compute_step * step; // if not NULL, compute the step instead of the task of node
+
+    struct ggml_compute_state_shared * shared;
+};
+
+struct ggml_threadpool {
+    int n_threads; // including the thread that calls ggml_graph_compute()
+
+    struct ggml_thread_affinity affinity; // of the calling thread before ggml_threadpool_begin() pinned it
+
+    struct ggml_compute_state_shared shared;
+    struct ggml_compute_state * workers; // [n_threads - 1]
+};
+
+static thread_ret_t ggml_graph_compute_thread(void * data) {
+    struct ggml_compute_state * state = (struct ggml_compute_state *) data;
+    struct ggml_compute_state_shared * shared = state->shared;
+
+    const int n_workers = shared->n_threads - 1;
+
+    if (shared->n_cpus > 0) {
+        if (!ggml_thread_set_affinity(&shared->cpus[state->params.ith % shared->n_cpus], 1)) {
+            GGML_PRINT_DEBUG("%s: failed to pin thread %d to CPU %d\n", __func__, state->params.ith, shared->cpus[state->params.ith % shared->n_cpus]);
+        }
+    } else if (shared->n_numa > 1) {
+        ggml_numa_set_affinity(ggml_numa_group(state->params.ith, shared->n_threads, shared->n_numa));
+    }
+
+    int n_launch = 0;
+
+    while (true) {
+        // wait for work
+        // don't spin if there is no graph being computed
+        const int n_spin = atomic_load(&shared->active) ? atomic_load(&shared->n_spin) : 0;
+
+        for (int i = 0; atomic_load(&shared->n_launch) == n_launch; ++i) {
+            // check if we should stop
+            if (atomic_load(&shared->stop)) {
+                return 0;
+            }
+
+            if (i < n_spin) {
+                ggml_lock_lock  (&shared->spin);
+                ggml_lock_unlock(&shared->spin);
+                continue;
+            }
+
+            ggml_mutex_lock(&shared->mutex);
+            atomic_fetch_add(&shared->n_sleeping, 1);
+            while (atomic_load(&shared->n_launch) == n_launch && !atomic_load(&shared->stop)) {
+                ggml_cond_wait(&shared->cond_launch, &shared->mutex);
+            }
+            atomic_fetch_sub(&shared->n_sleeping, 1);
+            ggml_mutex_unlock(&shared->mutex);
+        }
+
+        n_launch = atomic_load(&shared->n_launch);
+
+        if (state->step) {
+            ggml_compute_step_run(state->step, state->trace, state->params.ith);
+        } else if (state->params.ith < state->params.nth) {
+            if (state->trace) {
+                const int64_t t_start_us = ggml_time_us();
+
+                ggml_compute_forward(&state->params, state->node);
+
+                ggml_trace_add(state->trace, state->params.ith, GGML_OP_LABEL[state->node->op],
+                        GGML_TASK_LABEL[state->params.type], t_start_us, ggml_time_us());
+            } else {
+                ggml_compute_forward(&state->params, state->node);
+            }
+        }
+
+        // the last worker to finish wakes up the main thread if it is sleeping
+        if (atomic_fetch_add(&shared->n_ready, 1) == n_workers - 1 && atomic_load(&shared->main_waiting)) {
+            ggml_mutex_lock(&shared->mutex);
+            ggml_cond_broadcast(&shared->cond_ready);
+            ggml_mutex_unlock(&shared->mutex);
+        }
+    }
+
+    return 0;
+}
+
+static struct ggml_threadpool * ggml_threadpool_new_impl(int n_threads, int n_numa, const int * cpus, int n_cpus) {
+    GGML_ASSERT(n_threads > 0);
+    GGML_ASSERT(n_numa > 0 && n_numa <= n_threads);
+    GGML_ASSERT(n_cpus == 0 || n_numa == 1);
+
+    struct ggml_threadpool * threadpool = malloc(sizeof(struct ggml_threadpool));
+
+    threadpool->n_threads = n_threads;
+    threadpool->affinity.saved   = false;
+    threadpool->shared.spin      = GGML_LOCK_INITIALIZER;
+    threadpool->shared.n_threads = n_threads;
+    threadpool->shared.n_numa    = n_numa;
+    threadpool->shared.cpus      = n_cpus > 0 ? malloc(n_cpus*sizeof(int)) : NULL;
+    threadpool->shared.n_cpus    = n_cpus;
+
+    if (n_cpus > 0) {
+        memcpy(threadpool->shared.cpus, cpus, n_cpus*sizeof(int));
+    }
+
+    atomic_store(&threadpool->shared.n_launch,     0);
+    atomic_store(&threadpool->shared.n_ready,      0);
+    atomic_store(&threadpool->shared.active,       false);
+    atomic_store(&threadpool->shared.stop,         false);
+    atomic_store(&threadpool->shared.n_spin,       GGML_N_SPIN);
+    atomic_store(&threadpool->shared.n_sleeping,   0);
+    atomic_store(&threadpool->shared.main_waiting, false);
+
+    threadpool->workers = n_threads > 1 ? malloc(sizeof(struct ggml_compute_state)*(n_threads - 1)) : NULL;
+
+    ggml_lock_init (&threadpool->shared.spin);
+    ggml_mutex_init(&threadpool->shared.mutex);
+    ggml_cond_init (&threadpool->shared.cond_launch);
+    ggml_cond_init (&threadpool->shared.cond_ready);
+
+    for (int j = 0; j < n_threads - 1; j++) {
+        threadpool->workers[j] = (struct ggml_compute_state) {
+            .thrd   = 0,
+            .params = {
+                .type  = GGML_TASK_COMPUTE,
+                .ith   = j + 1,
+                .nth   = n_threads,
+                .wsize  = 0,
+                .wdata  = NULL,
+                .n_numa = 1,
+                .chunk  = NULL,
+            },
+            .node   = NULL,
+            .trace  = NULL,
+            .step   = NULL,
+            .shared = &threadpool->shared,
+        };
+
+        int rc = ggml_thread_create(&threadpool->workers[j].thrd, NULL, ggml_graph_compute_thread, &threadpool->workers[j]);
+        assert(rc == 0);
+        UNUSED(rc);
+    }
+
+    return threadpool;
+}
+
+struct ggml_threadpool * ggml_threadpool_new(int n_threads) {
+    return ggml_threadpool_new_impl(n_threads, 1, NULL, 0);
+}
+
+struct ggml_threadpool * ggml_threadpool_new_numa(int n_threads) {
+    GGML_ASSERT(n_threads > 0);
+
+    return ggml_threadpool_new_impl(n_threads, MIN(g_numa.n_nodes, n_threads), NULL, 0);
+}
+
+struct ggml_threadpool * ggml_threadpool_new_cpus(int n_threads, const int * cpus, int n_cpus) {
+    GGML_ASSERT(n_cpus > 0);
+
+    return ggml_threadpool_new_impl(n_threads, 1, cpus, n_cpus);
+}
+
+void ggml_threadpool_free(struct ggml_threadpool * threadpool) {
+    if (threadpool == NULL) {
+        return;
+    }
+
+    ggml_mutex_lock(&threadpool->shared.mutex);
+    atomic_store(&threadpool->shared.stop, true);
+    ggml_cond_broadcast(&threadpool->shared.cond_launch);
+    ggml_mutex_unlock(&threadpool->shared.mutex);
+
+    for (int j = 0; j < threadpool->n_threads - 1; j++) {
+        int rc = ggml_thread_join(threadpool->workers[j].thrd, NULL);
+        assert(rc == 0);
+        UNUSED(rc);
+    }
+
+    ggml_cond_destroy (&threadpool->shared.cond_ready);
+    ggml_cond_destroy (&threadpool->shared.cond_launch);
+    ggml_mutex_destroy(&threadpool->shared.mutex);
+    ggml_lock_destroy (&threadpool->shared.spin);
+
+    free(threadpool->shared.cpus);
+    free(threadpool->workers);
+    free(threadpool);
+}
+
+int ggml_threadpool_n_threads(const struct ggml_threadpool * threadpool) {
+    return threadpool->n_threads;
+}
+
+void ggml_threadpool_set_n_spin(struct ggml_threadpool * threadpool, int n_spin) {
+    atomic_store(&threadpool->shared.n_spin, MAX(0, n_spin));
+}
+
+// the workers start spinning while waiting for tasks
+static void ggml_threadpool_begin(struct ggml_threadpool * threadpool) {
+    const struct ggml_compute_state_shared * shared = &threadpool->shared;
+
+    // the calling thread computes the tasks with ith = 0 - it is pinned until ggml_threadpool_end()
+    if (shared->n_cpus > 0 || shared->n_numa > 1) {
+        ggml_thread_affinity_save(&threadpool->affinity);
+
+        if (shared->n_cpus > 0) {
+            ggml_thread_set_affinity(shared->cpus, 1);
+        } else {
+            ggml_numa_set_affinity(0);
+        }
+    }
+
+    atomic_store(&threadpool->shared.active, true);
+}
+
+// the workers go to sleep once they are done with the current task
+static void ggml_threadpool_end(struct ggml_threadpool * threadpool) {
+    atomic_store(&threadpool->shared.active, false);
+
+    ggml_thread_affinity_restore(&threadpool->affinity);
+    threadpool->affinity.saved = false;
+}
+
+// run the given task of the node on all workers
+static void ggml_threadpool_launch(
+        struct ggml_threadpool * threadpool,
+        const struct ggml_compute_params * params,
+        struct ggml_tensor * node,
+        struct ggml_trace  * trace) {
+    struct ggml_compute_state_shared * shared = &threadpool->shared;
+
+    for (int j = 0; j < threadpool->n_threads - 1; j++) {
+        struct ggml_compute_state * worker = &threadpool->workers[j];
+
+        worker->params     = *params;
+        worker->params.ith = j + 1;
+        worker->node       = node;
+        worker->trace      = trace;
+        worker->step       = NULL;
+    }
+
+    atomic_fetch_add(&shared->n_launch, 1);
+
+    if (atomic_load(&shared->n_sleeping) > 0) {
+        ggml_mutex_lock(&shared->mutex);
+        ggml_cond_broadcast(&shared->cond_launch);
+        ggml_mutex_unlock(&shared->mutex);
+    }
+}
+
+// run the given step on all workers
+static void ggml_threadpool_launch_step(
+        struct ggml_threadpool * threadpool,
+        struct ggml_compute_step * step,
+        struct ggml_trace * trace) {
+    struct ggml_compute_state_shared * shared = &threadpool->shared;
+
+    for (int j = 0; j < threadpool->n_threads - 1; j++) {
+        struct ggml_compute_state * worker = &threadpool->workers[j];
+
+        worker->params.ith = j + 1;
+        worker->node       = NULL;
+        worker->trace      = trace;
+        worker->step       = step;
+    }
+
+    atomic_fetch_add(&shared->n_launch, 1);
+
+    if (atomic_load(&shared->n_sleeping) > 0) {
+        ggml_mutex_lock(&shared->mutex);
+        ggml_cond_broadcast(&shared->cond_launch);
+        ggml_mutex_unlock(&shared->mutex);
+    }
+}
+
+// wait for all workers to finish the launched task
+static void ggml_threadpool_wait(struct ggml_threadpool * threadpool) {
+    struct ggml_compute_state_shared * shared = &threadpool->shared;
+
+    const int n_workers = threadpool->n_threads - 1;
+    const int n_spin    = atomic_load(&shared->n_spin);
+
+    for (int i = 0; atomic_load(&shared->n_ready) < n_workers; ++i) {
+        if (i < n_spin) {
+            ggml_lock_lock  (&shared->spin);
+            ggml_lock_unlock(&shared->spin);
+            continue;
+        }
+
+        ggml_mutex_lock(&shared->mutex);
+        atomic_store(&shared->main_waiting, true);
+        while (atomic_load(&shared->n_ready) < n_workers) {
+            ggml_cond_wait(&shared->cond_ready, &shared->mutex);
+        }
+        atomic_store(&shared->main_waiting, false);
+        ggml_mutex_unlock(&shared->mutex);
+    }
+
+    atomic_store(&shared->n_ready, 0);
+}
+
+// the memory-bound ops (copies, element-wise ops, reductions) are split across the threads only when each task gets
+// at least this many elements - for the small tensors (e.g. the decoder with a single token) waking up the other
+// threads costs more than the work itself
+#ifndef GGML_MIN_ELEMENTS_PER_TASK
+#define GGML_MIN_ELEMENTS_PER_TASK (16*1024)
+#endif
+
+static int ggml_graph_n_tasks_elementwise(const struct ggml_tensor * node, int n_threads) {
+    int n = ggml_nelements(node);
+    if (node->src0) {
+        n = MAX(n, ggml_nelements(node->src0));
+    }
+
+    return MAX(1, MIN(n_threads, n/GGML_MIN_ELEMENTS_PER_TASK));
+}
+
+//
+// weight cache
+//
+
+enum ggml_wcache_state {
+    GGML_WCACHE_EMPTY,   // not used with BLAS yet
+    GGML_WCACHE_FILLING, // being converted by the node that claimed it
+    GGML_WCACHE_READY,
+    GGML_WCACHE_SKIP,    // over the budget
+};
+
+struct ggml_wcache_entry {
+    const struct ggml_tensor * tensor;
+
+    enum ggml_wcache_state state;
+    float * data;
+};
+
+struct ggml_wcache {
+    ggml_mutex_t mutex;
+
+    size_t budget;
+    size_t size;
+
+    int n_entries;
+    int n_alloc;
+
+    struct ggml_wcache_entry * entries;
+};
+
+struct ggml_wcache * ggml_wcache_new(size_t budget) {
+    struct ggml_wcache * cache = malloc(sizeof(struct ggml_wcache));
+
+    ggml_mutex_init(&cache->mutex);
+
+    cache->budget    = budget;
+    cache->size      = 0;
+    cache->n_entries = 0;
+    cache->n_alloc   = 0;
+    cache->entries   = NULL;
+
+    return cache;
+}
+
+void ggml_wcache_free(struct ggml_wcache * cache) {
+    if (cache == NULL) {
+        return;
+    }
+
+    for (int i = 0; i < cache->n_entries; i++) {
+        free(cache->entries[i].data);
+    }
+
+    ggml_mutex_destroy(&cache->mutex);
+
+    free(cache->entries);
+    free(cache);
+}
+
+void ggml_wcache_add(struct ggml_wcache * cache, const struct ggml_tensor * tensor) {
+    if (tensor->type != GGML_TYPE_F16 && !ggml_is_quantized(tensor->type)) {
+        return;
+    }
+
+    ggml_mutex_lock(&cache->mutex);
+
+    if (cache->n_entries == cache->n_alloc) {
+        cache->n_alloc = MAX(64, 2*cache->n_alloc);
+        cache->entries = realloc(cache->entries, cache->n_alloc*sizeof(struct ggml_wcache_entry));
+        GGML_ASSERT(cache->entries);
+    }
+
+    cache->entries[cache->n_entries++] = (struct ggml_wcache_entry) { tensor, GGML_WCACHE_EMPTY, NULL };
+
+    ggml_mutex_unlock(&cache->mutex);
+}
+
+size_t ggml_wcache_size(struct ggml_wcache * cache) {
+    ggml_mutex_lock(&cache->mutex);
+    const size_t size = cache->size;
+    ggml_mutex_unlock(&cache->mutex);
+
+    return size;
+}
+
+#if defined(GGML_USE_ACCELERATE) || defined(GGML_USE_OPENBLAS)
+// the F32 copy of the tensor, or NULL if the tensor is not cached (yet)
+// *fill is set if the data still has to be converted - the caller converts it, then calls ggml_wcache_release()
+static float * ggml_wcache_acquire(struct ggml_wcache * cache, const struct ggml_tensor * tensor, bool * fill) {
+    *fill = true;
+
+    if (cache == NULL) {
+        return NULL;
+    }
+
+    float * data = NULL;
+
+    ggml_mutex_lock(&cache->mutex);
+
+    for (int i = 0; i < cache->n_entries; i++) {
+        struct ggml_wcache_entry * e = &cache->entries[i];
+
+        if (e->tensor != tensor) {
+            continue;
+        }
+
+        if (e->state == GGML_WCACHE_READY) {
+            data  = e->data;
+            *fill = false;
+        } else if (e->state == GGML_WCACHE_EMPTY) {
+            const size_t size = sizeof(float)*ggml_nelements(tensor);
+
+            e->data  = cache->size + size <= cache->budget ? malloc(size) : NULL;
+            e->state = e->data ? GGML_WCACHE_FILLING : GGML_WCACHE_SKIP;
+
+            if (e->data) {
+                cache->size += size;
+                data = e->data;
+            }
+        }
+
+        // an entry being filled by another node is not waited for
+        break;
+    }
+
+    ggml_mutex_unlock(&cache->mutex);
+
+    return data;
+}
+
+static void ggml_wcache_release(struct ggml_wcache * cache, const struct ggml_tensor * tensor) {
+    ggml_mutex_lock(&cache->mutex);
+
+    for (int i = 0; i < cache->n_entries; i++) {
+        if (cache->entries[i].tensor == tensor) {
+            cache->entries[i].state = GGML_WCACHE_READY;
+            break;
+        }
+    }
+
+    ggml_mutex_unlock(&cache->mutex);
+}
+#endif
+
+//
+// kernel tuning
+//
+
+struct ggml_tune {
+    int n_entries;
+    int n_alloc;
+
+    struct ggml_tune_entry * entries;
+};
+
+static bool ggml_tune_kernel_available(enum ggml_tune_kernel kernel) {
+#if defined(GGML_USE_ACCELERATE) || defined(GGML_USE_OPENBLAS)
+    return kernel < GGML_TUNE_KERNEL_COUNT;
+#else
+    return kernel < GGML_TUNE_KERNEL_BLAS;
+#endif
+}
+
+// the mul_mat nodes that ggml_tune_graph() measures - the product of a 2D weight and a matrix
+static bool ggml_tune_is_tunable(const struct ggml_tensor * node) {
+    return node->op == GGML_OP_MUL_MAT &&
+        node->src0->op == GGML_OP_NONE && node->src0->data != NULL &&
+        node->src0->ne[2] == 1 && node->src0->ne[3] == 1 &&
+        node->src1->type == GGML_TYPE_F32 && ggml_is_contiguous(node->src1) &&
+        node->src1->ne[2] == 1 && node->src1->ne[3] == 1;
+}
+
+// the entry of the shape of the mul_mat node and n_threads with the closest number of columns of src1 - NULL if none
+static const struct ggml_tune_entry * ggml_tune_find(const struct ggml_tune * tune, const struct ggml_tensor * node, int n_threads) {
+    if (!ggml_tune_is_tunable(node)) {
+        return NULL;
+    }
+
+    const int n = node->src1->ne[1];
+
+    const struct ggml_tune_entry * best = NULL;
+    double best_ratio = 0.0;
+
+    for (int i = 0; i < tune->n_entries; i++) {
+        const struct ggml_tune_entry * e = &tune->entries[i];
+
+        if (e->type != node->src0->type || e->k != node->src0->ne[0] || e->m != node->src0->ne[1] ||
+            e->n_threads != n_threads || !ggml_tune_kernel_available(e->kernel)) {
+            continue;
+        }
+
+        // the GEMM needs at least NR columns of src1 (see ggml_gemm_f16_f32)
+        if (e->kernel == GGML_TUNE_KERNEL_GEMM && n < GGML_GEMM_NR) {
+            continue;
+        }
+
+        const double ratio = e->n > n ? (double) e->n/n : (double) n/e->n;
+
+        if (best == NULL || ratio < best_ratio) {
+            best = e;
+            best_ratio = ratio;
+        }
+    }
+
+    return best;
+}
+
+// set the number of tasks of the nodes and return the size of the work buffer needed by the graph
+static size_t ggml_graph_init_tasks(struct ggml_cgraph * cgraph) {
+    const int n_threads = cgraph->n_threads;
+
+    size_t work_size = 0;
+
+    // thread scheduling for the different operations
+    for (int i = 0; i < cgraph->n_nodes; i++) {
+        struct ggml_tensor * node = cgraph->nodes[i];
+
+        switch (node->op) {
+            case GGML_OP_ADD:
+            case GGML_OP_DUP:
+            case GGML_OP_SUB:
+            case GGML_OP_MUL:
+            case GGML_OP_DIV:
+            case GGML_OP_SQR:
+            case GGML_OP_SQRT:
+            case GGML_OP_MEAN:
+            case GGML_OP_REPEAT:
+            case GGML_OP_ABS:
+            case GGML_OP_SGN:
+            case GGML_OP_NEG:
+            case GGML_OP_STEP:
+            case GGML_OP_RELU:
+                {
+                    node->n_tasks = ggml_graph_n_tasks_elementwise(node, n_threads);
+                } break;
+            case GGML_OP_SUM:
+                {
+                    node->n_tasks = ggml_graph_n_tasks_elementwise(node, n_threads);
+
+                    // one partial sum per task
+                    work_size = MAX(work_size, sizeof(float)*CACHE_LINE_SIZE_F32*node->n_tasks);
+                } break;
+            case GGML_OP_GELU:
+            case GGML_OP_NORM:
+            case GGML_OP_NORM_AFFINE:
+                {
+                    node->n_tasks = ggml_graph_n_tasks_elementwise(node, n_threads);
+                } break;
+            case GGML_OP_MUL_MAT:
+                {
+                    node->n_tasks  = n_threads;
+                    node->n_chunks = 0;
+                    node->kernel   = GGML_TUNE_KERNEL_AUTO;
+
+                    const struct ggml_tune_entry * tuned = cgraph->tune ? ggml_tune_find(cgraph->tune, node, n_threads) : NULL;
+                    if (tuned) {
+                        node->n_tasks  = MIN(n_threads, MAX(1, tuned->n_tasks));
+                        node->n_chunks = tuned->n_chunks;
+                        node->kernel   = tuned->kernel;
+                    }
+
+                    size_t cur = 0;
+
+                    // TODO: better way to determine if the matrix is transposed
+                    if (node->src0->nb[1] < node->src0->nb[0]) {
+                        cur = ggml_nbytes(node)*node->n_tasks; // TODO: this can become (n_tasks-1)
+                    } else {
+                        if (node->src0->type == GGML_TYPE_F16 &&
+                            node->src1->type == GGML_TYPE_F32) {
+#if defined(GGML_USE_ACCELERATE) || defined(GGML_USE_OPENBLAS)
+                            if (ggml_compute_forward_mul_mat_use_blas(node->src0, node->src1, node)) {
+                                node->n_tasks = 1; // TODO: this actually is doing nothing
+                                                   //       the threads are still spinning
+                                cur = sizeof(float)*(node->src0->ne[0]*node->src0->ne[1]);
+                            } else if (ggml_compute_forward_mul_mat_use_gemm(node->src0, node->src1, node)) {
+                                cur = ggml_gemm_f16_f32_wsize(node->n_tasks);
+                            } else {
+                                cur = sizeof(ggml_fp16_t)*ggml_nelements(node->src1);
+                            }
+#else
+                            if (ggml_compute_forward_mul_mat_use_gemm(node->src0, node->src1, node)) {
+                                cur = ggml_gemm_f16_f32_wsize(node->n_tasks);
+                            } else {
+                                cur = sizeof(ggml_fp16_t)*ggml_nelements(node->src1);
+                            }
+#endif
+                        } else if (node->src0->type == GGML_TYPE_F32 &&
+                                   node->src1->type == GGML_TYPE_F32) {
+                            cur = 0;
+                        } else if (ggml_is_quantized(node->src0->type) &&
+                                   node->src1->type == GGML_TYPE_F32) {
+#if defined(GGML_USE_ACCELERATE) || defined(GGML_USE_OPENBLAS)
+                            if (ggml_compute_forward_mul_mat_use_blas(node->src0, node->src1, node)) {
+                                node->n_tasks = 1;
+                                cur = sizeof(float)*(node->src0->ne[0]*node->src0->ne[1]);
+                            } else {
+                                cur = (GGML_TYPE_SIZE[GGML_TYPE_Q8_0]*ggml_nelements(node->src1))/GGML_BLCK_SIZE[GGML_TYPE_Q8_0];
+                            }
+#else
+                            cur = (GGML_TYPE_SIZE[GGML_TYPE_Q8_0]*ggml_nelements(node->src1))/GGML_BLCK_SIZE[GGML_TYPE_Q8_0];
+#endif
+                        } else {
+                            GGML_ASSERT(false);
+                        }
+                    }
+
+                    work_size = MAX(work_size, cur);
+                } break;
+            case GGML_OP_SCALE:
+            case GGML_OP_CPY:
+                {
+                    node->n_tasks = ggml_graph_n_tasks_elementwise(node, n_threads);
+                } break;
+            case GGML_OP_RESHAPE:
+            case GGML_OP_VIEW:
+            case GGML_OP_PERMUTE:
+            case GGML_OP_TRANSPOSE:
+            case GGML_OP_GET_ROWS:
+            case GGML_OP_DIAG_MASK_INF:
+                {
+                    node->n_tasks = 1;
+                } break;
+            case GGML_OP_SOFT_MAX:
+                {
+                    node->n_tasks = ggml_graph_n_tasks_elementwise(node, n_threads);
+                } break;
+            case GGML_OP_ROPE:
+                {
+                    node->n_tasks = 1;
+                } break;
+            case GGML_OP_CONV_1D_1S:
+            case GGML_OP_CONV_1D_2S:
+                {
+                    node->n_tasks = n_threads;
+
+                    GGML_ASSERT(node->src0->ne[3] == 1);
+                    GGML_ASSERT(node->src1->ne[2] == 1);
+                    GGML_ASSERT(node->src1->ne[3] == 1);
+
+                    const size_t cur = ggml_conv_1d_wsize(node->src0, node->n_tasks);
+
+                    work_size = MAX(work_size, cur);
+                } break;
+            case GGML_OP_FLASH_ATTN:
+                {
+                    node->n_tasks = n_threads;
+
+                    const size_t cur = sizeof(float)*ggml_flash_attn_wsize(node->src0->ne[0])*node->n_tasks;
+
+                    work_size = MAX(work_size, cur);
+                } break;
+            case GGML_OP_FLASH_FF:
+                {
+                    node->n_tasks = n_threads;
+
+                    size_t cur = 0;
+
+                    if (node->src1->type == GGML_TYPE_F32) {
+                        cur  = sizeof(float)*node->src1->ne[1]*node->n_tasks; // TODO: this can become (n_tasks-1)
+                        cur += sizeof(float)*node->src1->ne[1]*node->n_tasks; // this is overestimated by x2
+                    }
+
+                    if (node->src1->type == GGML_TYPE_F16) {
+                        cur  = sizeof(float)*node->src1->ne[1]*node->n_tasks; // TODO: this can become (n_tasks-1)
+                        cur += sizeof(float)*node->src1->ne[1]*node->n_tasks; // this is overestimated by x2
+                    }
+
+                    work_size = MAX(work_size, cur);
+                } break;
+            case GGML_OP_NONE:
+                {
+                    node->n_tasks = 1;
+                } break;
+            case GGML_OP_COUNT:
+                {
+                    assert(false);
+                } break;
+        }
+    }
+
+    return work_size;
+}
+
+static void ggml_graph_init_work(struct ggml_context * ctx, struct ggml_cgraph * cgraph) {
+    const int n_threads = cgraph->n_threads;
+
+    const size_t work_size = ggml_graph_init_tasks(cgraph);
+
+    // TODO: better handling
+    GGML_ASSERT(cgraph->work == NULL || work_size <= cgraph->work_size);
+
+    if (work_size > 0 && cgraph->work == NULL) {
+        cgraph->work_size = work_size + CACHE_LINE_SIZE*(n_threads - 1);
+
+        GGML_PRINT_DEBUG("%s: allocating work buffer for graph (%zu bytes)\n", __func__, cgraph->work_size);
+        ggml_scratch_save(ctx);
+        cgraph->work = ggml_new_tensor_1d(ctx, GGML_TYPE_I8, cgraph->work_size);
+        ggml_scratch_load(ctx);
+    }
+}
+
+void ggml_graph_alloc_work(struct ggml_context * ctx, struct ggml_cgraph * cgraph) {
+    GGML_ASSERT(cgraph->n_threads > 0);
+
+    ggml_graph_init_work(ctx, cgraph);
+}
+
+// compute the node with node->n_tasks threads of the pool
+static void ggml_graph_compute_node(
+        struct ggml_cgraph * cgraph,
+        struct ggml_threadpool * threadpool,
+        struct ggml_tensor * node,
+        struct ggml_task_chunk * chunk,
+        struct ggml_trace * trace,
+        const bool perf) {
+    const int64_t perf_node_start_cycles  = perf ? ggml_cycles()  : 0;
+    const int64_t perf_node_start_time_us = perf ? ggml_time_us() : 0;
+
+    const char * label = GGML_OP_LABEL[node->op];
+
+    int64_t t_trace_us = trace ? ggml_time_us() : 0;
+
+    // INIT
+    struct ggml_compute_params params = {
+        /*.type  =*/ GGML_TASK_INIT,
+        /*.ith   =*/ 0,
+        /*.nth   =*/ node->n_tasks,
+        /*.wsize =*/ cgraph->work ? ggml_nbytes(cgraph->work) : 0,
+        /*.wdata =*/ cgraph->work ? cgraph->work->data : NULL,
+        // the NUMA groups of the threads are those of the whole pool
+        /*.n_numa =*/ threadpool && node->n_tasks == threadpool->n_threads ? threadpool->shared.n_numa : 1,
+        /*.chunk =*/ chunk,
+        /*.wcache =*/ cgraph->wcache,
+    };
+
+    ggml_compute_forward(&params, node);
+    ggml_trace_end(trace, label, "INIT", &t_trace_us);
+
+    // COMPUTE
+    params.type = GGML_TASK_COMPUTE;
+
+    ggml_task_chunk_reset(chunk, params.n_numa);
+
+    if (node->n_tasks > 1) {
+        ggml_threadpool_launch(threadpool, &params, node, trace);
+    }
+
+    ggml_compute_forward(&params, node);
+    ggml_trace_end(trace, label, "COMPUTE", &t_trace_us);
+
+    // wait for thread pool
+    if (node->n_tasks > 1) {
+        ggml_threadpool_wait(threadpool);
+        ggml_trace_end(trace, label, "WAIT", &t_trace_us);
+    }
+
+    // FINALIZE
+    params.type = GGML_TASK_FINALIZE;
+
+    ggml_task_chunk_reset(chunk, params.n_numa);
+
+    if (node->n_tasks > 1) {
+        ggml_threadpool_launch(threadpool, &params, node, trace);
+    }
+
+    ggml_compute_forward(&params, node);
+    ggml_trace_end(trace, label, "FINALIZE", &t_trace_us);
+
+    // wait for thread pool
+    if (node->n_tasks > 1) {
+        ggml_threadpool_wait(threadpool);
+        ggml_trace_end(trace, label, "WAIT", &t_trace_us);
+    }
+
+    // performance stats (node)
+    {
+        int64_t perf_cycles_cur  = perf ? ggml_cycles()  - perf_node_start_cycles  : 0;
+        int64_t perf_time_us_cur = perf ? ggml_time_us() - perf_node_start_time_us : 0;
+
+        node->perf_runs++;
+        node->perf_cycles  += perf_cycles_cur;
+        node->perf_time_us += perf_time_us_cur;
+    }
+}
+
+//
+// graph scheduling
+//
+// with a thread pool the nodes are computed level by level. the level of a node is one more than the highest level of
+// the earlier nodes it conflicts with: the nodes that write memory it reads or writes, or that read memory it writes.
+// the conflicts are found from the bytes spanned by the tensors at compute time, so they cover the edges of the graph
+// as well as the memory reused by ggml_graph_plan(), the in-place ops and the writes to views (e.g. the KV cache)
+//
+// the nodes of a level are independent. its small nodes - fewer tasks than threads and all the work in the COMPUTE
+// phase - are computed in a single step (see ggml_compute_step), with one launch of the thread pool instead of two
+// per node. the other nodes are computed one at a time with all the threads, as without a thread pool
+//
+// to keep the cost linear a node is only checked against the GGML_SCHED_WINDOW nodes before it, and it is placed
+// after all the earlier ones
+//
+
+#define GGML_SCHED_N_RANGES (3 + GGML_MAX_OPT) // dst, src0, src1, opt
+
+// the bytes spanned by the data of a tensor - empty if the data is not set
+struct ggml_range {
+    const char * beg;
+    const char * end;
+};
+
+static struct ggml_range ggml_tensor_range(const struct ggml_tensor * tensor) {
+    if (tensor == NULL || tensor->data == NULL) {
+        return (struct ggml_range) { NULL, NULL };
+    }
+
+    size_t size = GGML_TYPE_SIZE[tensor->type] + (tensor->ne[0]/GGML_BLCK_SIZE[tensor->type] - 1)*tensor->nb[0];
+    for (int i = 1; i < GGML_MAX_DIMS; i++) {
+        size += (tensor->ne[i] - 1)*tensor->nb[i];
+    }
+
+    return (struct ggml_range) { (const char *) tensor->data, (const char *) tensor->data + size };
+}
+
+static inline bool ggml_range_overlap(const struct ggml_range a, const struct ggml_range b) {
+    return a.beg < b.end && b.beg < a.end;
+}
+
+// ops that do not compute anything - the result is a view of the source
+static bool ggml_op_is_view(enum ggml_op op) {
+    return op == GGML_OP_NONE || op == GGML_OP_RESHAPE || op == GGML_OP_VIEW || op == GGML_OP_PERMUTE || op == GGML_OP_TRANSPOSE;
+}
+
+// ops that can be computed in a step - no work buffer and nothing to do in the INIT and FINALIZE phases
+static bool ggml_op_is_concurrent(enum ggml_op op) {
+    switch (op) {
+        case GGML_OP_SUM:
+        case GGML_OP_MUL_MAT:
+        case GGML_OP_CONV_1D_1S:
         case GGML_OP_CONV_1D_2S:
-            {
-                GGML_ASSERT(false); // TODO: not implemented
-            } break;
         case GGML_OP_FLASH_ATTN:
-            {
-                GGML_ASSERT(false); // not supported
-            } break;
         case GGML_OP_FLASH_FF:
-            {
-                GGML_ASSERT(false); // not supported
-            } break;
-        case GGML_OP_NONE:
-            {
-                // nop
-            } break;
-        case GGML_OP_COUNT:
-            {
-                GGML_ASSERT(false);
-            } break;
+            return false;
+        default:
+            return true;
     }
 }
 
-static void ggml_visit_parents(struct ggml_cgraph * cgraph, struct ggml_tensor * node) {
-    if (node->grad == NULL) {
-        // this usually happens when we generate intermediate nodes from constants in the backward pass
-        // it can also happen during forward pass, if the user performs computations with constants
-        if (node->op != GGML_OP_NONE) {
-            //GGML_PRINT_DEBUG("%s: warning: node %p has no grad, but op %d\n", __func__, (void *) node, node->op);
+// a - the ranges of an earlier node, b - the ranges of a later node
+static bool ggml_sched_conflict(const struct ggml_range * a, const struct ggml_range * b) {
+    for (int k = 0; k < GGML_SCHED_N_RANGES; k++) {
+        if (ggml_range_overlap(a[0], b[k]) || (k > 0 && ggml_range_overlap(b[0], a[k]))) {
+            return true;
         }
     }
 
-    // check if already visited
-    for (int i = 0; i < cgraph->n_nodes; i++) {
-        if (cgraph->nodes[i] == node) {
-            return;
+    return false;
+}
+
+// sort the nodes by level - the nodes of level l are order[level_beg[l] ... level_beg[l + 1] - 1], in graph order
+// returns the number of levels
+static int ggml_graph_schedule(const struct ggml_cgraph * cgraph, int * order, int * level_beg) {
+    const int n = cgraph->n_nodes;
+
+    struct ggml_range * ranges = malloc(n*GGML_SCHED_N_RANGES*sizeof(struct ggml_range));
+    int * level = malloc(n*sizeof(int));
+
+    int n_levels = 0;
+
+    // the lowest level of the current node - above the levels of the nodes before the window
+    int level_min = 0;
+
+    for (int j = 0; j < n; j++) {
+        const struct ggml_tensor * node = cgraph->nodes[j];
+
+        struct ggml_range * r = ranges + j*GGML_SCHED_N_RANGES;
+
+        for (int k = 0; k < GGML_SCHED_N_RANGES; k++) {
+            r[k] = (struct ggml_range) { NULL, NULL };
         }
-    }
 
-    for (int i = 0; i < cgraph->n_leafs; i++) {
-        if (cgraph->leafs[i] == node) {
-            return;
+        if (!ggml_op_is_view(node->op)) {
+            r[0] = ggml_tensor_range(node);
+            r[1] = ggml_tensor_range(node->src0);
+            r[2] = ggml_tensor_range(node->src1);
+            for (int k = 0; k < GGML_MAX_OPT; k++) {
+                r[3 + k] = ggml_tensor_range(node->opt[k]);
+            }
+        }
+
+        if (j >= GGML_SCHED_WINDOW) {
+            level_min = MAX(level_min, level[j - GGML_SCHED_WINDOW] + 1);
         }
+
+        int l = level_min;
+        for (int i = MAX(0, j - GGML_SCHED_WINDOW); i < j; i++) {
+            if (level[i] >= l && ggml_sched_conflict(ranges + i*GGML_SCHED_N_RANGES, r)) {
+                l = level[i] + 1;
+            }
+        }
+
+        level[j] = l;
+        n_levels = MAX(n_levels, l + 1);
     }
 
-    if (node->src0) {
-        ggml_visit_parents(cgraph, node->src0);
+    // counting sort
+    for (int l = 0; l <= n_levels; l++) {
+        level_beg[l] = 0;
+    }
+    for (int j = 0; j < n; j++) {
+        level_beg[level[j] + 1]++;
+    }
+    for (int l = 0; l < n_levels; l++) {
+        level_beg[l + 1] += level_beg[l];
     }
+    for (int j = 0; j < n; j++) {
+        order[level_beg[level[j]]++] = j;
+    }
+    for (int l = n_levels; l > 0; l--) {
+        level_beg[l] = level_beg[l - 1];
+    }
+    level_beg[0] = 0;
 
-    if (node->src1) {
-        ggml_visit_parents(cgraph, node->src1);
+    free(level);
+    free(ranges);
+
+    return n_levels;
+}
+
+// compute the nodes of the step at the same time
+// the wall time of the step is split evenly between its nodes in the performance stats
+static void ggml_graph_compute_step(
+        struct ggml_cgraph * cgraph,
+        struct ggml_threadpool * threadpool,
+        struct ggml_compute_step * step,
+        struct ggml_task_chunk * chunk,
+        struct ggml_trace * trace,
+        const bool perf) {
+    int n_compute = 0;
+    for (int k = 0; k < step->n_nodes; k++) {
+        n_compute += !ggml_op_is_view(step->nodes[k]->op);
     }
 
-    for (int i = 0; i < GGML_MAX_OPT; ++i) {
-        if (node->opt[i]) {
-            ggml_visit_parents(cgraph, node->opt[i]);
+    // nothing to compute in parallel
+    if (n_compute <= 1) {
+        for (int k = 0; k < step->n_nodes; k++) {
+            ggml_graph_compute_node(cgraph, threadpool, step->nodes[k], chunk, trace, perf);
         }
+        return;
     }
 
-    if (node->op == GGML_OP_NONE && node->grad == NULL) {
-        // reached a leaf node, not part of the gradient graph (e.g. a constant)
-        assert(cgraph->n_leafs < GGML_MAX_NODES);
+    const int64_t perf_step_start_cycles  = perf ? ggml_cycles()  : 0;
+    const int64_t perf_step_start_time_us = perf ? ggml_time_us() : 0;
 
-        cgraph->leafs[cgraph->n_leafs] = node;
-        cgraph->n_leafs++;
-    } else {
-        assert(cgraph->n_nodes < GGML_MAX_NODES);
+    step->task0[0] = 0;
+    for (int k = 0; k < step->n_nodes; k++) {
+        step->task0[k + 1] = step->task0[k] + step->nodes[k]->n_tasks;
 
-        cgraph->nodes[cgraph->n_nodes] = node;
-        cgraph->grads[cgraph->n_nodes] = node->grad;
-        cgraph->n_nodes++;
+        ggml_task_chunk_reset(&step->chunk[k], 1);
     }
-}
 
-static void ggml_build_forward_impl(struct ggml_cgraph * cgraph, struct ggml_tensor * tensor, bool expand) {
-    if (!expand) {
-        cgraph->n_nodes = 0;
-        cgraph->n_leafs = 0;
-    }
+    step->n_tasks = step->task0[step->n_nodes];
+    atomic_store(&step->next, 0);
 
-    const int n0 = cgraph->n_nodes;
-    UNUSED(n0);
+    ggml_threadpool_launch_step(threadpool, step, trace);
+    ggml_compute_step_run(step, trace, 0);
 
-    ggml_visit_parents(cgraph, tensor);
+    int64_t t_trace_us = trace ? ggml_time_us() : 0;
 
-    const int n_new = cgraph->n_nodes - n0;
-    GGML_PRINT_DEBUG("%s: visited %d new nodes\n", __func__, n_new);
+    ggml_threadpool_wait(threadpool);
+    ggml_trace_end(trace, "STEP", "WAIT", &t_trace_us);
 
-    if (n_new > 0) {
-        // the last added node should always be starting point
-        assert(cgraph->nodes[cgraph->n_nodes - 1] == tensor);
+    // performance stats (nodes)
+    {
+        int64_t perf_cycles_cur  = perf ? ggml_cycles()  - perf_step_start_cycles  : 0;
+        int64_t perf_time_us_cur = perf ? ggml_time_us() - perf_step_start_time_us : 0;
+
+        for (int k = 0; k < step->n_nodes; k++) {
+            struct ggml_tensor * node = step->nodes[k];
+
+            node->perf_runs++;
+
+            if (!ggml_op_is_view(node->op)) {
+                node->perf_cycles  += perf_cycles_cur/n_compute;
+                node->perf_time_us += perf_time_us_cur/n_compute;
+            }
+        }
     }
 }
 
-void ggml_build_forward_expand(struct ggml_cgraph * cgraph, struct ggml_tensor * tensor) {
-    ggml_build_forward_impl(cgraph, tensor, true);
-}
+//
+// graph memory planner
+//
 
-struct ggml_cgraph ggml_build_forward(struct ggml_tensor * tensor) {
-    struct ggml_cgraph result = {
-        /*.n_nodes      =*/ 0,
-        /*.n_leafs      =*/ 0,
-        /*.n_threads    =*/ 0,
-        /*.work_size    =*/ 0,
-        /*.work         =*/ NULL,
-        /*.nodes        =*/ { NULL },
-        /*.grads        =*/ { NULL },
-        /*.leafs        =*/ { NULL },
-        /*.perf_runs    =*/ 0,
-        /*.perf_cycles  =*/ 0,
-        /*.perf_time_us =*/ 0,
-    };
+#define GGML_PLAN_HASH_SIZE       (4*GGML_MAX_NODES) // power of 2, larger than the number of tensors in a graph
+#define GGML_PLAN_MAX_FREE_BLOCKS 256
 
-    ggml_build_forward_impl(&result, tensor, false);
+struct ggml_plan_entry {
+    const struct ggml_tensor * tensor;
 
-    return result;
+    int n_children; // number of nodes that read the tensor
+
+    // steps - see ggml_graph_plan()
+    int step;       // step of the node
+    int n_read;     // 1 + the last step that reads the memory of the tensor (0 if none)
+    int n_write;    // 1 + the last step that writes it
+
+    // tensors placed by the planner
+    int    last;    // step of the last node that reads the tensor
+    size_t offs;    // offset of the data in the buffer
+    bool   placed;
+    bool   freed;
+};
+
+struct ggml_plan_block {
+    size_t offs;
+    size_t size;
+};
+
+struct ggml_plan {
+    struct ggml_plan_entry * hash;
+
+    // free blocks below the end of the used memory, sorted by offset
+    int n_free;
+    struct ggml_plan_block free[GGML_PLAN_MAX_FREE_BLOCKS];
+
+    size_t end;      // end of the used memory
+    size_t max_size; // largest end seen so far
+};
+
+static struct ggml_plan_entry * ggml_plan_get(struct ggml_plan * plan, const struct ggml_tensor * tensor) {
+    size_t i = ((uintptr_t) tensor / sizeof(struct ggml_tensor)) & (GGML_PLAN_HASH_SIZE - 1);
+
+    while (plan->hash[i].tensor != NULL && plan->hash[i].tensor != tensor) {
+        i = (i + 1) & (GGML_PLAN_HASH_SIZE - 1);
+    }
+
+    plan->hash[i].tensor = tensor;
+
+    return &plan->hash[i];
 }
 
-struct ggml_cgraph ggml_build_backward(struct ggml_context * ctx, struct ggml_cgraph * gf, bool keep) {
-    struct ggml_cgraph result = *gf;
+// the tensor that owns the data of the given one - NULL if the data is not placed by the planner
+static struct ggml_tensor * ggml_plan_owner(struct ggml_tensor * tensor) {
+    struct ggml_tensor * owner = tensor->view_src ? tensor->view_src : tensor;
 
-    assert(gf->n_nodes > 0);
+    return owner->data == NULL ? owner : NULL;
+}
 
-    // if we are keeping the gradient graph, we have to detach the gradient nodes from the original graph
-    if (keep) {
-        for (int i = 0; i < gf->n_nodes; i++) {
-            struct ggml_tensor * node = gf->nodes[i];
+static size_t ggml_plan_alloc(struct ggml_plan * plan, size_t size) {
+    size = ((size + GGML_MEM_ALIGN - 1)/GGML_MEM_ALIGN)*GGML_MEM_ALIGN;
 
-            if (node->grad) {
-                node->grad = ggml_dup_tensor(ctx, node);
-                gf->grads[i] = node->grad;
-            }
+    // best fit among the free blocks
+    int best = -1;
+    for (int i = 0; i < plan->n_free; i++) {
+        if (plan->free[i].size >= size && (best == -1 || plan->free[i].size < plan->free[best].size)) {
+            best = i;
         }
     }
 
-    for (int i = gf->n_nodes - 1; i >= 0; i--) {
-        struct ggml_tensor * node = gf->nodes[i];
+    size_t offs;
 
-        // because we detached the grad nodes from the original graph, we can afford inplace operations
-        if (node->grad) {
-            ggml_compute_backward(ctx, node, keep);
+    if (best != -1) {
+        offs = plan->free[best].offs;
+
+        plan->free[best].offs += size;
+        plan->free[best].size -= size;
+
+        if (plan->free[best].size == 0) {
+            plan->n_free--;
+            memmove(&plan->free[best], &plan->free[best + 1], (plan->n_free - best)*sizeof(struct ggml_plan_block));
+        }
+    } else {
+        // grow the used memory, starting from the last free block if it is at the end
+        const int last = plan->n_free - 1;
+        if (last >= 0 && plan->free[last].offs + plan->free[last].size == plan->end) {
+            plan->end = plan->free[last].offs;
+            plan->n_free--;
         }
+
+        offs = plan->end;
+        plan->end += size;
+        plan->max_size = MAX(plan->max_size, plan->end);
     }
 
-    for (int i = gf->n_nodes - 1; i >= 0; i--) {
-        struct ggml_tensor * node = gf->nodes[i];
+    return offs;
+}
 
-        if (node->is_param) {
-            GGML_PRINT_DEBUG("%s: found root node %p\n", __func__, (void *) node);
-            ggml_build_forward_impl(&result, node->grad, true);
+static void ggml_plan_free(struct ggml_plan * plan, size_t offs, size_t size) {
+    size = ((size + GGML_MEM_ALIGN - 1)/GGML_MEM_ALIGN)*GGML_MEM_ALIGN;
+
+    if (offs + size == plan->end) {
+        plan->end = offs;
+
+        // merge with the last free block
+        const int last = plan->n_free - 1;
+        if (last >= 0 && plan->free[last].offs + plan->free[last].size == plan->end) {
+            plan->end = plan->free[last].offs;
+            plan->n_free--;
         }
+
+        return;
     }
 
-    return result;
+    int i = 0;
+    while (i < plan->n_free && plan->free[i].offs < offs) {
+        i++;
+    }
+
+    const bool merge_prev = i > 0             && plan->free[i - 1].offs + plan->free[i - 1].size == offs;
+    const bool merge_next = i < plan->n_free  && offs + size == plan->free[i].offs;
+
+    if (merge_prev && merge_next) {
+        plan->free[i - 1].size += size + plan->free[i].size;
+        plan->n_free--;
+        memmove(&plan->free[i], &plan->free[i + 1], (plan->n_free - i)*sizeof(struct ggml_plan_block));
+    } else if (merge_prev) {
+        plan->free[i - 1].size += size;
+    } else if (merge_next) {
+        plan->free[i].offs  = offs;
+        plan->free[i].size += size;
+    } else {
+        GGML_ASSERT(plan->n_free < GGML_PLAN_MAX_FREE_BLOCKS);
+
+        memmove(&plan->free[i + 1], &plan->free[i], (plan->n_free - i)*sizeof(struct ggml_plan_block));
+        plan->free[i] = (struct ggml_plan_block) { offs, size };
+        plan->n_free++;
+    }
 }
 
-//
-// thread data
-//
-// synchronization is done via busy loops
-// I tried using spin locks, but not sure how to use them correctly - the things I tried were slower than busy loops
-//
+size_t ggml_graph_plan(struct ggml_context * ctx, struct ggml_cgraph * cgraph, void * buffer, size_t size) {
+    GGML_ASSERT(cgraph->n_threads > 0);
 
-#ifdef __APPLE__
+    struct ggml_plan * plan = malloc(sizeof(struct ggml_plan));
+    *plan = (struct ggml_plan) {
+        .hash     = calloc(GGML_PLAN_HASH_SIZE, sizeof(struct ggml_plan_entry)),
+        .n_free   = 0,
+        .end      = 0,
+        .max_size = 0,
+    };
 
-//#include <os/lock.h>
-//
-//typedef os_unfair_lock ggml_lock_t;
-//
-//#define ggml_lock_init(x)    UNUSED(x)
-//#define ggml_lock_destroy(x) UNUSED(x)
-//#define ggml_lock_lock       os_unfair_lock_lock
-//#define ggml_lock_unlock     os_unfair_lock_unlock
-//
-//#define GGML_LOCK_INITIALIZER OS_UNFAIR_LOCK_INIT
+    // the sources of each node
+    #define GGML_PLAN_N_SRC (2 + GGML_MAX_OPT)
+    #define GGML_PLAN_SRC(node, j) ((j) == 0 ? (node)->src0 : (j) == 1 ? (node)->src1 : (node)->opt[(j) - 2])
 
-typedef int ggml_lock_t;
+    const int n_nodes = cgraph->n_nodes;
 
-#define ggml_lock_init(x)    UNUSED(x)
-#define ggml_lock_destroy(x) UNUSED(x)
-#define ggml_lock_lock(x)    UNUSED(x)
-#define ggml_lock_unlock(x)  UNUSED(x)
+    // the nodes are placed in steps - the memory freed by the nodes of a step is reused from the next step on
+    // without a thread pool each node is a step. with one, the steps are the levels of the graph: a node is one step
+    // after the last nodes that write the memory it reads, or that read or write the memory it writes. the nodes
+    // are then sorted by step, so that ggml_graph_compute() finds the independent nodes of a level next to each other
+    // and they do not share memory (see ggml_graph_schedule)
+    const bool by_level = cgraph->n_threads > 1 && GGML_MAX_CONCURRENT > 1;
 
-#define GGML_LOCK_INITIALIZER 0
+    int * order    = malloc(n_nodes*sizeof(int));
+    int * step_beg = malloc((n_nodes + 1)*sizeof(int));
 
-typedef pthread_t ggml_thread_t;
+    int n_steps = 0;
 
-#define ggml_thread_create pthread_create
-#define ggml_thread_join   pthread_join
+    // compute the step of each node and the last use of the tensors placed by the planner
+    for (int i = 0; i < n_nodes; i++) {
+        struct ggml_tensor * node = cgraph->nodes[i];
+
+        int step = i;
+
+        if (by_level) {
+            struct ggml_plan_entry * ew = ggml_op_is_view(node->op) ? NULL : ggml_plan_get(plan, node->view_src ? node->view_src : node);
+
+            step = ew ? MAX(ew->n_read, ew->n_write) : 0;
+
+            for (int j = 0; j < GGML_PLAN_N_SRC; j++) {
+                struct ggml_tensor * src = GGML_PLAN_SRC(node, j);
+                if (src) {
+                    step = MAX(step, ggml_plan_get(plan, src->view_src ? src->view_src : src)->n_write);
+                }
+            }
+
+            for (int j = 0; j < GGML_PLAN_N_SRC; j++) {
+                struct ggml_tensor * src = GGML_PLAN_SRC(node, j);
+                if (src) {
+                    struct ggml_plan_entry * e = ggml_plan_get(plan, src->view_src ? src->view_src : src);
+                    e->n_read = MAX(e->n_read, step + 1);
+                }
+            }
 
-#else
+            if (ew) {
+                ew->n_write = MAX(ew->n_write, step + 1);
+            }
+        }
 
-//typedef pthread_spinlock_t ggml_lock_t;
+        for (int j = 0; j < GGML_PLAN_N_SRC; j++) {
+            struct ggml_tensor * src = GGML_PLAN_SRC(node, j);
+            if (src == NULL) {
+                continue;
+            }
 
-//#define ggml_lock_init(x) pthread_spin_init(x, PTHREAD_PROCESS_PRIVATE)
-//#define ggml_lock_destroy pthread_spin_destroy
-//#define ggml_lock_lock    pthread_spin_lock
-//#define ggml_lock_unlock  pthread_spin_unlock
+            ggml_plan_get(plan, src)->n_children++;
 
-typedef int ggml_lock_t;
+            struct ggml_tensor * owner = ggml_plan_owner(src);
+            if (owner) {
+                struct ggml_plan_entry * e = ggml_plan_get(plan, owner);
+                e->last = MAX(e->last, step);
+            }
+        }
 
-#define ggml_lock_init(x)    UNUSED(x)
-#define ggml_lock_destroy(x) UNUSED(x)
-#define ggml_lock_lock(x)    UNUSED(x)
-#define ggml_lock_unlock(x)  UNUSED(x)
+        ggml_plan_get(plan, node)->step = step;
 
-#define GGML_LOCK_INITIALIZER 0
+        n_steps = MAX(n_steps, step + 1);
+    }
 
-typedef pthread_t ggml_thread_t;
+    // sort the nodes by step
+    for (int l = 0; l <= n_steps; l++) {
+        step_beg[l] = 0;
+    }
+    for (int i = 0; i < n_nodes; i++) {
+        step_beg[ggml_plan_get(plan, cgraph->nodes[i])->step + 1]++;
+    }
+    for (int l = 0; l < n_steps; l++) {
+        step_beg[l + 1] += step_beg[l];
+    }
+    for (int i = 0; i < n_nodes; i++) {
+        order[step_beg[ggml_plan_get(plan, cgraph->nodes[i])->step]++] = i;
+    }
+    for (int l = n_steps; l > 0; l--) {
+        step_beg[l] = step_beg[l - 1];
+    }
+    step_beg[0] = 0;
 
-#define ggml_thread_create pthread_create
-#define ggml_thread_join   pthread_join
+    // the nodes are computed in the order of the steps
+    if (by_level) {
+        struct ggml_tensor ** tmp = malloc(2*n_nodes*sizeof(struct ggml_tensor *));
 
-#endif
+        for (int k = 0; k < n_nodes; k++) {
+            tmp[k]           = cgraph->nodes[order[k]];
+            tmp[n_nodes + k] = cgraph->grads[order[k]];
+        }
 
-struct ggml_compute_state_shared {
-    ggml_lock_t spin;
+        for (int k = 0; k < n_nodes; k++) {
+            cgraph->nodes[k] = tmp[k];
+            cgraph->grads[k] = tmp[n_nodes + k];
+            order[k] = k;
+        }
 
-    int n_threads;
+        free(tmp);
+    }
 
-    // synchronization primitives
-    atomic_int  n_ready;
-    atomic_bool has_work;
-    atomic_bool stop; // stop all threads
-};
+    // the outputs of the graph are kept until the end
+    for (int i = 0; i < cgraph->n_nodes; i++) {
+        struct ggml_tensor * node  = cgraph->nodes[i];
+        struct ggml_tensor * owner = ggml_plan_owner(node);
 
-struct ggml_compute_state {
-    ggml_thread_t thrd;
+        if (owner && ggml_plan_get(plan, node)->n_children == 0) {
+            ggml_plan_get(plan, owner)->last = n_steps;
+        }
+    }
 
-    struct ggml_compute_params params;
-    struct ggml_tensor * node;
+    // the work buffer is used by all the nodes
+    size_t work_size = 0;
+    size_t work_offs = 0;
 
-    struct ggml_compute_state_shared * shared;
-};
+    if (cgraph->work == NULL) {
+        work_size = ggml_graph_init_tasks(cgraph);
+        if (work_size > 0) {
+            work_size += CACHE_LINE_SIZE*(cgraph->n_threads - 1);
+            work_offs  = ggml_plan_alloc(plan, work_size);
+        }
+    }
 
-static thread_ret_t ggml_graph_compute_thread(void * data) {
-    struct ggml_compute_state * state = (struct ggml_compute_state *) data;
+    for (int l = 0; l < n_steps; l++) {
+        for (int k = step_beg[l]; k < step_beg[l + 1]; k++) {
+            struct ggml_tensor * node = cgraph->nodes[order[k]];
 
-    const int n_threads = state->shared->n_threads;
+            // the leafs are placed before their first use
+            for (int j = 0; j < GGML_PLAN_N_SRC; j++) {
+                struct ggml_tensor * src = GGML_PLAN_SRC(node, j);
+                struct ggml_tensor * owner = src ? ggml_plan_owner(src) : NULL;
+                if (owner) {
+                    struct ggml_plan_entry * e = ggml_plan_get(plan, owner);
+                    if (!e->placed) {
+                        e->offs   = ggml_plan_alloc(plan, ggml_nbytes(owner));
+                        e->placed = true;
+                    }
+                }
+            }
 
-    while (true) {
-        if (atomic_fetch_add(&state->shared->n_ready, 1) == n_threads - 1) {
-            atomic_store(&state->shared->has_work, false);
-        } else {
-            while (atomic_load(&state->shared->has_work)) {
-                if (atomic_load(&state->shared->stop)) {
-                    return 0;
+            {
+                struct ggml_tensor * owner = ggml_plan_owner(node);
+                if (owner) {
+                    struct ggml_plan_entry * e = ggml_plan_get(plan, owner);
+                    if (!e->placed) {
+                        e->offs   = ggml_plan_alloc(plan, ggml_nbytes(owner));
+                        e->placed = true;
+                    }
                 }
-                ggml_lock_lock  (&state->shared->spin);
-                ggml_lock_unlock(&state->shared->spin);
             }
         }
 
-        atomic_fetch_sub(&state->shared->n_ready, 1);
+        // the memory of the sources that are not needed anymore can be used by the next steps
+        for (int k = step_beg[l]; k < step_beg[l + 1]; k++) {
+            struct ggml_tensor * node = cgraph->nodes[order[k]];
 
-        // wait for work
-        while (!atomic_load(&state->shared->has_work)) {
-            if (atomic_load(&state->shared->stop)) {
-                return 0;
+            for (int j = 0; j < GGML_PLAN_N_SRC; j++) {
+                struct ggml_tensor * src = GGML_PLAN_SRC(node, j);
+                struct ggml_tensor * owner = src ? ggml_plan_owner(src) : NULL;
+                if (owner) {
+                    struct ggml_plan_entry * e = ggml_plan_get(plan, owner);
+                    if (e->last == l && !e->freed) {
+                        ggml_plan_free(plan, e->offs, ggml_nbytes(owner));
+                        e->freed = true;
+                    }
+                }
             }
-            ggml_lock_lock  (&state->shared->spin);
-            ggml_lock_unlock(&state->shared->spin);
         }
+    }
 
-        // check if we should stop
-        if (atomic_load(&state->shared->stop)) {
-            break;
+    free(step_beg);
+    free(order);
+
+    const size_t size_needed = plan->max_size;
+
+    if (buffer != NULL && size_needed <= size) {
+        ggml_assert_aligned(buffer);
+
+        if (work_size > 0) {
+            const bool no_alloc = ctx->no_alloc;
+            ctx->no_alloc = true;
+            cgraph->work = ggml_new_tensor_1d(ctx, GGML_TYPE_I8, work_size);
+            ctx->no_alloc = no_alloc;
+
+            cgraph->work->data = (char *) buffer + work_offs;
+            cgraph->work_size  = work_size;
         }
 
-        if (state->node) {
-            if (state->params.ith < state->params.nth) {
-                ggml_compute_forward(&state->params, state->node);
-            }
+        // place the tensors first and then their views
+        for (int pass = 0; pass < 2; pass++) {
+            for (int k = 0; k < cgraph->n_nodes + cgraph->n_leafs; k++) {
+                struct ggml_tensor * t = k < cgraph->n_nodes ? cgraph->nodes[k] : cgraph->leafs[k - cgraph->n_nodes];
+                if (t->data != NULL) {
+                    continue;
+                }
 
-            state->node = NULL;
-        } else {
-            break;
+                if (pass == 0 && t->view_src == NULL) {
+                    t->data = (char *) buffer + ggml_plan_get(plan, t)->offs;
+                }
+
+                if (pass == 1 && t->view_src != NULL) {
+                    t->data = (char *) t->view_src->data + t->view_offs;
+                }
+            }
         }
     }
 
-    return 0;
+    #undef GGML_PLAN_SRC
+    #undef GGML_PLAN_N_SRC
+
+    free(plan->hash);
+    free(plan);
+
+    return size_needed;
 }
 
 void ggml_graph_compute(struct ggml_context * ctx, struct ggml_cgraph * cgraph) {
     if (cgraph->n_threads <= 0) {
-        cgraph->n_threads = 8;
+        cgraph->n_threads = cgraph->threadpool ? cgraph->threadpool->n_threads : 8;
     }
 
     const int n_threads = cgraph->n_threads;
 
-    struct ggml_compute_state_shared state_shared = {
-        /*.spin      =*/ GGML_LOCK_INITIALIZER,
-        /*.n_threads =*/ n_threads,
-        /*.n_ready   =*/ 0,
-        /*.has_work  =*/ false,
-        /*.stop      =*/ false,
-    };
-    struct ggml_compute_state * workers = n_threads > 1 ? alloca(sizeof(struct ggml_compute_state)*(n_threads - 1)) : NULL;
-
-    // create thread pool
-    if (n_threads > 1) {
-        ggml_lock_init(&state_shared.spin);
-
-        atomic_store(&state_shared.has_work, true);
-
-        for (int j = 0; j < n_threads - 1; j++) {
-            workers[j] = (struct ggml_compute_state) {
-                .thrd   = 0,
-                .params = {
-                    .type  = GGML_TASK_COMPUTE,
-                    .ith   = j + 1,
-                    .nth   = n_threads,
-                    .wsize = cgraph->work ? ggml_nbytes(cgraph->work) : 0,
-                    .wdata = cgraph->work ? cgraph->work->data : NULL,
-                },
-                .node   = NULL,
-                .shared = &state_shared,
-            };
+    // use a temporary thread pool if the graph does not have one
+    struct ggml_threadpool * threadpool = cgraph->threadpool;
+    if (threadpool == NULL && n_threads > 1) {
+        threadpool = ggml_threadpool_new(n_threads);
+    }
 
-            int rc = ggml_thread_create(&workers[j].thrd, NULL, ggml_graph_compute_thread, &workers[j]);
-            assert(rc == 0);
-            UNUSED(rc);
-        }
+    GGML_ASSERT(threadpool == NULL || threadpool->n_threads >= n_threads);
+
+    if (threadpool) {
+        ggml_threadpool_begin(threadpool);
     }
 
     // initialize tasks + work buffer
-    {
-        size_t work_size = 0;
+    ggml_graph_init_work(ctx, cgraph);
 
-        // thread scheduling for the different operations
-        for (int i = 0; i < cgraph->n_nodes; i++) {
-            struct ggml_tensor * node = cgraph->nodes[i];
-
-            switch (node->op) {
-                case GGML_OP_DUP:
-                    {
-                        node->n_tasks = 1;
-                    } break;
-                case GGML_OP_ADD:
-                    {
-                        node->n_tasks = n_threads;
-                    } break;
-                case GGML_OP_SUB:
-                case GGML_OP_MUL:
-                case GGML_OP_DIV:
-                case GGML_OP_SQR:
-                case GGML_OP_SQRT:
-                case GGML_OP_SUM:
-                case GGML_OP_MEAN:
-                case GGML_OP_REPEAT:
-                case GGML_OP_ABS:
-                case GGML_OP_SGN:
-                case GGML_OP_NEG:
-                case GGML_OP_STEP:
-                case GGML_OP_RELU:
-                    {
-                        node->n_tasks = 1;
-                    } break;
-                case GGML_OP_GELU:
-                    {
-                        node->n_tasks = n_threads;
-                    } break;
-                case GGML_OP_NORM:
-                    {
-                        node->n_tasks = n_threads;
-                    } break;
-                case GGML_OP_MUL_MAT:
-                    {
-                        node->n_tasks = n_threads;
-
-                        // TODO: use different scheduling for different matrix sizes
-                        //const int nr0 = ggml_nrows(node->src0);
-                        //const int nr1 = ggml_nrows(node->src1);
-
-                        //node->n_tasks = MIN(n_threads, MAX(1, nr0/128));
-                        //printf("nr0 = %8d, nr1 = %8d, nr0*nr1 = %8d, n_tasks = %d\n", nr0, nr1, nr0*nr1, node->n_tasks);
-
-                        size_t cur = 0;
-
-                        // TODO: better way to determine if the matrix is transposed
-                        if (node->src0->nb[1] < node->src0->nb[0]) {
-                            cur = ggml_nbytes(node)*node->n_tasks; // TODO: this can become (n_tasks-1)
-                        } else {
-                            if (node->src0->type == GGML_TYPE_F16 &&
-                                node->src1->type == GGML_TYPE_F32) {
-#if defined(GGML_USE_ACCELERATE) || defined(GGML_USE_OPENBLAS)
-                                if (ggml_compute_forward_mul_mat_use_blas(node->src0, node->src1, node)) {
-                                    node->n_tasks = 1; // TODO: this actually is doing nothing
-                                                       //       the threads are still spinning
-                                    cur = sizeof(float)*(node->src0->ne[0]*node->src0->ne[1]);
-                                } else {
-                                    cur = sizeof(ggml_fp16_t)*ggml_nelements(node->src1);
-                                }
+#ifdef GGML_PERF
+    const bool perf = true;
 #else
-                                cur = sizeof(ggml_fp16_t)*ggml_nelements(node->src1);
+    const bool perf = cgraph->perf;
 #endif
-                            } else if (node->src0->type == GGML_TYPE_F32 &&
-                                       node->src1->type == GGML_TYPE_F32) {
-                                cur = 0;
-                            } else {
-                                GGML_ASSERT(false);
-                            }
-                        }
 
-                        work_size = MAX(work_size, cur);
-                    } break;
-                case GGML_OP_SCALE:
-                    {
-                        node->n_tasks = n_threads;
-                    } break;
-                case GGML_OP_CPY:
-                case GGML_OP_RESHAPE:
-                case GGML_OP_VIEW:
-                case GGML_OP_PERMUTE:
-                case GGML_OP_TRANSPOSE:
-                case GGML_OP_GET_ROWS:
-                case GGML_OP_DIAG_MASK_INF:
-                    {
-                        node->n_tasks = 1;
-                    } break;
-                case GGML_OP_SOFT_MAX:
-                    {
-                        node->n_tasks = n_threads;
-                    } break;
-                case GGML_OP_ROPE:
-                    {
-                        node->n_tasks = 1;
-                    } break;
-                case GGML_OP_CONV_1D_1S:
-                case GGML_OP_CONV_1D_2S:
-                    {
-                        node->n_tasks = n_threads;
-
-                        GGML_ASSERT(node->src0->ne[3] == 1);
-                        GGML_ASSERT(node->src1->ne[2] == 1);
-                        GGML_ASSERT(node->src1->ne[3] == 1);
-
-                        size_t cur = 0;
-                        const int nk = node->src0->ne[0];
+    const int64_t perf_start_cycles  = perf ? ggml_cycles()  : 0;
+    const int64_t perf_start_time_us = perf ? ggml_time_us() : 0;
 
-                        if (node->src0->type == GGML_TYPE_F16 &&
-                            node->src1->type == GGML_TYPE_F32) {
-                            cur = sizeof(ggml_fp16_t)*(
-                                    nk*ggml_up32(node->src0->ne[1])*node->src0->ne[2] +
-                                    ( 2*(nk/2) + node->src1->ne[0])*node->src1->ne[1]
-                                    );
-                        } else if (node->src0->type == GGML_TYPE_F32 &&
-                                   node->src1->type == GGML_TYPE_F32) {
-                            cur = sizeof(float)*(
-                                    nk*ggml_up32(node->src0->ne[1])*node->src0->ne[2] +
-                                    ( 2*(nk/2) + node->src1->ne[0])*node->src1->ne[1]
-                                    );
-                        } else {
-                            GGML_ASSERT(false);
-                        }
+    struct ggml_trace * trace = cgraph->trace;
 
-                        work_size = MAX(work_size, cur);
-                    } break;
-                case GGML_OP_FLASH_ATTN:
-                    {
-                        node->n_tasks = n_threads;
+    // see ggml_task_chunk_next()
+    struct ggml_task_chunk chunk[GGML_NUMA_MAX_NODES];
 
-                        size_t cur = 0;
+    if (threadpool == NULL || GGML_MAX_CONCURRENT <= 1) {
+        for (int i = 0; i < cgraph->n_nodes; i++) {
+            GGML_PRINT_DEBUG_5("%s: %d/%d\n", __func__, i, cgraph->n_nodes);
 
-                        const int ne11 = ggml_up(node->src1->ne[1], GGML_SOFT_MAX_UNROLL);
+            // TODO: this could be used to avoid unnecessary computations, but it needs to be improved
+            //if (node->grad == NULL && node->perf_runs > 0) {
+            //    continue;
+            //}
 
-                        if (node->src1->type == GGML_TYPE_F32) {
-                            cur  = sizeof(float)*ne11*node->n_tasks; // TODO: this can become (n_tasks-1)
-                            cur += sizeof(float)*ne11*node->n_tasks; // this is overestimated by x2
-                        }
+            ggml_graph_compute_node(cgraph, threadpool, cgraph->nodes[i], chunk, trace, perf);
+        }
+    } else {
+        int * order     = malloc(cgraph->n_nodes*sizeof(int));
+        int * level_beg = malloc((cgraph->n_nodes + 1)*sizeof(int));
 
-                        if (node->src1->type == GGML_TYPE_F16) {
-                            cur  = sizeof(float)*ne11*node->n_tasks; // TODO: this can become (n_tasks-1)
-                            cur += sizeof(float)*ne11*node->n_tasks; // this is overestimated by x2
-                        }
+        const int n_levels = ggml_graph_schedule(cgraph, order, level_beg);
 
-                        work_size = MAX(work_size, cur);
-                    } break;
-                case GGML_OP_FLASH_FF:
-                    {
-                        node->n_tasks = n_threads;
+        struct ggml_compute_step step;
 
-                        size_t cur = 0;
+        for (int l = 0; l < n_levels; l++) {
+            step.n_nodes = 0;
 
-                        if (node->src1->type == GGML_TYPE_F32) {
-                            cur  = sizeof(float)*node->src1->ne[1]*node->n_tasks; // TODO: this can become (n_tasks-1)
-                            cur += sizeof(float)*node->src1->ne[1]*node->n_tasks; // this is overestimated by x2
-                        }
+            for (int k = level_beg[l]; k < level_beg[l + 1]; k++) {
+                struct ggml_tensor * node = cgraph->nodes[order[k]];
 
-                        if (node->src1->type == GGML_TYPE_F16) {
-                            cur  = sizeof(float)*node->src1->ne[1]*node->n_tasks; // TODO: this can become (n_tasks-1)
-                            cur += sizeof(float)*node->src1->ne[1]*node->n_tasks; // this is overestimated by x2
-                        }
+                if (node->n_tasks < n_threads && ggml_op_is_concurrent(node->op)) {
+                    step.nodes[step.n_nodes++] = node;
+
+                    if (step.n_nodes == GGML_MAX_CONCURRENT) {
+                        ggml_graph_compute_step(cgraph, threadpool, &step, chunk, trace, perf);
+                        step.n_nodes = 0;
+                    }
+                } else {
+                    ggml_graph_compute_node(cgraph, threadpool, node, chunk, trace, perf);
+                }
+            }
 
-                        work_size = MAX(work_size, cur);
-                    } break;
-                case GGML_OP_NONE:
-                    {
-                        node->n_tasks = 1;
-                    } break;
-                case GGML_OP_COUNT:
-                    {
-                        assert(false);
-                    } break;
+            if (step.n_nodes > 0) {
+                ggml_graph_compute_step(cgraph, threadpool, &step, chunk, trace, perf);
             }
         }
 
-        if (cgraph->work != NULL && work_size > cgraph->work_size) {
-            assert(false); // TODO: better handling
-        }
+        free(level_beg);
+        free(order);
+    }
 
-        if (work_size > 0 && cgraph->work == NULL) {
-            cgraph->work_size = work_size + CACHE_LINE_SIZE*(n_threads - 1);
+    if (threadpool) {
+        ggml_threadpool_end(threadpool);
 
-            GGML_PRINT_DEBUG("%s: allocating work buffer for graph (%zu bytes)\n", __func__, cgraph->work_size);
-            cgraph->work = ggml_new_tensor_1d(ctx, GGML_TYPE_I8, cgraph->work_size);
+        if (threadpool != cgraph->threadpool) {
+            ggml_threadpool_free(threadpool);
         }
     }
 
-    const int64_t perf_start_cycles  = ggml_perf_cycles();
-    const int64_t perf_start_time_us = ggml_perf_time_us();
+    // performance stats (graph)
+    {
+        int64_t perf_cycles_cur  = perf ? ggml_cycles()  - perf_start_cycles  : 0;
+        int64_t perf_time_us_cur = perf ? ggml_time_us() - perf_start_time_us : 0;
 
-    for (int i = 0; i < cgraph->n_nodes; i++) {
-        GGML_PRINT_DEBUG_5("%s: %d/%d\n", __func__, i, cgraph->n_nodes);
+        cgraph->perf_runs++;
+        cgraph->perf_cycles  += perf_cycles_cur;
+        cgraph->perf_time_us += perf_time_us_cur;
 
-        struct ggml_tensor * node = cgraph->nodes[i];
+        GGML_PRINT_DEBUG("%s: perf (%d) - cpu = %.3f / %.3f ms, wall = %.3f / %.3f ms\n",
+                __func__, cgraph->perf_runs,
+                (double) perf_cycles_cur      / (double) ggml_cycles_per_ms(),
+                (double) cgraph->perf_cycles  / (double) ggml_cycles_per_ms() / (double) cgraph->perf_runs,
+                (double) perf_time_us_cur     / 1000.0,
+                (double) cgraph->perf_time_us / 1000.0 / cgraph->perf_runs);
+    }
+}
 
-        // TODO: this could be used to avoid unnecessary computations, but it needs to be improved
-        //if (node->grad == NULL && node->perf_runs > 0) {
-        //    continue;
-        //}
+static const char * GGML_TUNE_KERNEL_NAME[GGML_TUNE_KERNEL_COUNT] = {
+    "auto",
+    "dot",
+    "gemm",
+    "blas",
+};
 
-        const int64_t perf_node_start_cycles  = ggml_perf_cycles();
-        const int64_t perf_node_start_time_us = ggml_perf_time_us();
+struct ggml_tune * ggml_tune_new(void) {
+    struct ggml_tune * tune = malloc(sizeof(struct ggml_tune));
 
-        // INIT
-        struct ggml_compute_params params = {
-            /*.type  =*/ GGML_TASK_INIT,
-            /*.ith   =*/ 0,
-            /*.nth   =*/ node->n_tasks,
-            /*.wsize =*/ cgraph->work ? ggml_nbytes(cgraph->work) : 0,
-            /*.wdata =*/ cgraph->work ? cgraph->work->data : NULL,
-        };
+    tune->n_entries = 0;
+    tune->n_alloc   = 0;
+    tune->entries   = NULL;
 
-        ggml_compute_forward(&params, node);
+    return tune;
+}
 
-        // COMPUTE
-        if (node->n_tasks > 1) {
-            if (atomic_fetch_add(&state_shared.n_ready, 1) == n_threads - 1) {
-                atomic_store(&state_shared.has_work, false);
-            }
+void ggml_tune_free(struct ggml_tune * tune) {
+    if (tune == NULL) {
+        return;
+    }
 
-            while (atomic_load(&state_shared.has_work)) {
-                ggml_lock_lock  (&state_shared.spin);
-                ggml_lock_unlock(&state_shared.spin);
-            }
+    free(tune->entries);
+    free(tune);
+}
 
-            // launch thread pool
-            for (int j = 0; j < n_threads - 1; j++) {
-                workers[j].params = (struct ggml_compute_params) {
-                    .type  = GGML_TASK_COMPUTE,
-                    .ith   = j + 1,
-                    .nth   = node->n_tasks,
-                    .wsize = cgraph->work ? ggml_nbytes(cgraph->work) : 0,
-                    .wdata = cgraph->work ? cgraph->work->data : NULL,
-                };
-                workers[j].node = node;
-            }
+int ggml_tune_n_entries(const struct ggml_tune * tune) {
+    return tune->n_entries;
+}
 
-            atomic_fetch_sub(&state_shared.n_ready, 1);
+const struct ggml_tune_entry * ggml_tune_get(const struct ggml_tune * tune, int i) {
+    GGML_ASSERT(i >= 0 && i < tune->n_entries);
 
-            while (atomic_load(&state_shared.n_ready) > 0) {
-                ggml_lock_lock  (&state_shared.spin);
-                ggml_lock_unlock(&state_shared.spin);
-            }
+    return &tune->entries[i];
+}
 
-            atomic_store(&state_shared.has_work, true);
+// index of the entry with the same key as e, or -1
+static int ggml_tune_index(const struct ggml_tune * tune, const struct ggml_tune_entry * e) {
+    for (int i = 0; i < tune->n_entries; i++) {
+        const struct ggml_tune_entry * cur = &tune->entries[i];
+
+        if (cur->type == e->type && cur->k == e->k && cur->m == e->m && cur->n == e->n && cur->n_threads == e->n_threads) {
+            return i;
         }
+    }
 
-        params.type = GGML_TASK_COMPUTE;
-        ggml_compute_forward(&params, node);
+    return -1;
+}
 
-        // wait for thread pool
-        if (node->n_tasks > 1) {
-            if (atomic_fetch_add(&state_shared.n_ready, 1) == n_threads - 1) {
-                atomic_store(&state_shared.has_work, false);
-            }
+void ggml_tune_add(struct ggml_tune * tune, const struct ggml_tune_entry * entry) {
+    const int i = ggml_tune_index(tune, entry);
+    if (i >= 0) {
+        tune->entries[i] = *entry;
+        return;
+    }
 
-            while (atomic_load(&state_shared.has_work)) {
-                ggml_lock_lock  (&state_shared.spin);
-                ggml_lock_unlock(&state_shared.spin);
-            }
+    if (tune->n_entries == tune->n_alloc) {
+        tune->n_alloc = MAX(16, 2*tune->n_alloc);
+        tune->entries = realloc(tune->entries, tune->n_alloc*sizeof(struct ggml_tune_entry));
+        GGML_ASSERT(tune->entries);
+    }
 
-            atomic_fetch_sub(&state_shared.n_ready, 1);
+    tune->entries[tune->n_entries++] = *entry;
+}
 
-            while (atomic_load(&state_shared.n_ready) != 0) {
-                ggml_lock_lock  (&state_shared.spin);
-                ggml_lock_unlock(&state_shared.spin);
-            }
+bool ggml_tune_load(struct ggml_tune * tune, const char * fname) {
+    FILE * f = fopen(fname, "r");
+    if (f == NULL) {
+        return false;
+    }
+
+    char line[256];
+
+    for (int il = 1; fgets(line, sizeof(line), f); il++) {
+        if (line[0] == '#' || line[strspn(line, " \t\r\n")] == '\0') {
+            continue;
         }
 
-        // FINALIZE
-        if (node->n_tasks > 1) {
-            if (atomic_fetch_add(&state_shared.n_ready, 1) == n_threads - 1) {
-                atomic_store(&state_shared.has_work, false);
-            }
+        char op[16], type[16], kernel[16];
+        long long t_us;
 
-            while (atomic_load(&state_shared.has_work)) {
-                ggml_lock_lock  (&state_shared.spin);
-                ggml_lock_unlock(&state_shared.spin);
+        struct ggml_tune_entry e = { 0 };
+
+        bool ok = sscanf(line, "%15s %15s %d %d %d %d %15s %d %d %lld", op, type,
+                &e.k, &e.m, &e.n, &e.n_threads, kernel, &e.n_tasks, &e.n_chunks, &t_us) == 10 && strcmp(op, "mul_mat") == 0;
+
+        e.type   = GGML_TYPE_COUNT;
+        e.kernel = GGML_TUNE_KERNEL_COUNT;
+        e.t_us   = ok ? t_us : 0;
+
+        for (int i = 0; ok && i < GGML_TYPE_COUNT; i++) {
+            if (strcmp(type, GGML_TYPE_NAME[i]) == 0) {
+                e.type = i;
             }
+        }
 
-            // launch thread pool
-            for (int j = 0; j < n_threads - 1; j++) {
-                workers[j].params = (struct ggml_compute_params) {
-                    .type  = GGML_TASK_FINALIZE,
-                    .ith   = j + 1,
-                    .nth   = node->n_tasks,
-                    .wsize = cgraph->work ? ggml_nbytes(cgraph->work) : 0,
-                    .wdata = cgraph->work ? cgraph->work->data : NULL,
-                };
-                workers[j].node = node;
+        for (int i = 0; ok && i < GGML_TUNE_KERNEL_COUNT; i++) {
+            if (strcmp(kernel, GGML_TUNE_KERNEL_NAME[i]) == 0) {
+                e.kernel = i;
             }
+        }
 
-            atomic_fetch_sub(&state_shared.n_ready, 1);
+        if (!ok || e.type == GGML_TYPE_COUNT || e.kernel == GGML_TUNE_KERNEL_COUNT || e.k <= 0 || e.m <= 0 || e.n <= 0 || e.n_threads <= 0) {
+            fprintf(stderr, "%s: %s:%d: invalid entry\n", __func__, fname, il);
+            fclose(f);
+            return false;
+        }
 
-            while (atomic_load(&state_shared.n_ready) > 0) {
-                ggml_lock_lock  (&state_shared.spin);
-                ggml_lock_unlock(&state_shared.spin);
-            }
+        ggml_tune_add(tune, &e);
+    }
+
+    fclose(f);
+
+    return true;
+}
+
+bool ggml_tune_save(const struct ggml_tune * tune, const char * fname) {
+    FILE * f = fopen(fname, "w");
+    if (f == NULL) {
+        return false;
+    }
+
+    fprintf(f, "# mul_mat <type> <k> <m> <n> <n_threads> <kernel> <n_tasks> <n_chunks> <t_us>\n");
+
+    for (int i = 0; i < tune->n_entries; i++) {
+        const struct ggml_tune_entry * e = &tune->entries[i];
 
-            atomic_store(&state_shared.has_work, true);
+        fprintf(f, "mul_mat %s %d %d %d %d %s %d %d %lld\n", GGML_TYPE_NAME[e->type], e->k, e->m, e->n, e->n_threads,
+                GGML_TUNE_KERNEL_NAME[e->kernel], e->n_tasks, e->n_chunks, (long long) e->t_us);
+    }
+
+    fclose(f);
+
+    return true;
+}
+
+// the best time of n_iter computations of the graph with the configuration e, after a warm-up run
+static int64_t ggml_tune_time(struct ggml_context * ctx, struct ggml_cgraph * gf, const struct ggml_tune_entry * e, int n_iter) {
+    struct ggml_tune_entry entry = *e;
+    struct ggml_tune tune = { 1, 1, &entry };
+
+    gf->tune = &tune;
+
+    int64_t t_best = INT64_MAX;
+
+    for (int it = -1; it < n_iter; it++) {
+        const int64_t t_start_us = ggml_time_us();
+
+        ggml_graph_compute(ctx, gf);
+
+        if (it >= 0) {
+            t_best = MIN(t_best, ggml_time_us() - t_start_us);
         }
+    }
 
-        params.type = GGML_TASK_FINALIZE;
-        ggml_compute_forward(&params, node);
+    gf->tune = NULL;
 
-        // wait for thread pool
-        if (node->n_tasks > 1) {
-            if (atomic_fetch_add(&state_shared.n_ready, 1) == n_threads - 1) {
-                atomic_store(&state_shared.has_work, false);
-            }
+    return t_best;
+}
 
-            while (atomic_load(&state_shared.has_work)) {
-                ggml_lock_lock  (&state_shared.spin);
-                ggml_lock_unlock(&state_shared.spin);
-            }
+// measure the configurations of mul_mat(a, b) with b of e->k x e->n and store the fastest in e
+static void ggml_tune_mul_mat(struct ggml_tensor * a, struct ggml_tune_entry * e, struct ggml_threadpool * threadpool, int n_iter) {
+    const int k = e->k;
+    const int m = e->m;
+    const int n = e->n;
+
+    const int n_threads = e->n_threads;
 
-            atomic_fetch_sub(&state_shared.n_ready, 1);
+    // the largest work buffer of the kernels (see ggml_graph_init_tasks)
+    size_t work_size = MAX(sizeof(float)*k*n, ggml_gemm_f16_f32_wsize(n_threads));
+#if defined(GGML_USE_ACCELERATE) || defined(GGML_USE_OPENBLAS)
+    work_size = MAX(work_size, sizeof(float)*k*m);
+#endif
+    work_size += CACHE_LINE_SIZE*n_threads;
+
+    struct ggml_init_params params = {
+        /*.mem_size   =*/ 3*ggml_tensor_overhead() + sizeof(float)*((size_t) k*n + (size_t) m*n) + work_size + 3*GGML_MEM_ALIGN,
+        /*.mem_buffer =*/ NULL,
+    };
+
+    struct ggml_context * ctx = ggml_init(params);
+    GGML_ASSERT(ctx);
+
+    struct ggml_tensor * b    = ggml_new_tensor_2d(ctx, GGML_TYPE_F32, k, n);
+    struct ggml_tensor * work = ggml_new_tensor_1d(ctx, GGML_TYPE_I8, work_size);
+
+    // random values in [-1, 1]
+    {
+        uint32_t x = 0x9e3779b9;
+        float * data = (float *) b->data;
+
+        for (int i = 0; i < k*n; i++) {
+            x = 1664525*x + 1013904223;
+            data[i] = (float) (x >> 8)/(1 << 23) - 1.0f;
+        }
+    }
+
+    struct ggml_cgraph gf = ggml_build_forward(ggml_mul_mat(ctx, a, b));
+
+    gf.n_threads  = n_threads;
+    gf.threadpool = threadpool;
+    gf.work       = work;
+    gf.work_size  = work_size;
+
+    // the candidate kernels
+    enum ggml_tune_kernel kernels[GGML_TUNE_KERNEL_COUNT];
+    int n_kernels = 0;
+
+    kernels[n_kernels++] = GGML_TUNE_KERNEL_DOT;
+    if (a->type == GGML_TYPE_F16 && a->nb[0] == sizeof(ggml_fp16_t) && a->nb[1] >= a->nb[0] && n >= GGML_GEMM_NR) {
+        kernels[n_kernels++] = GGML_TUNE_KERNEL_GEMM;
+    }
+#if defined(GGML_USE_ACCELERATE) || defined(GGML_USE_OPENBLAS)
+    if (ggml_is_contiguous(a)) {
+        kernels[n_kernels++] = GGML_TUNE_KERNEL_BLAS;
+    }
+#endif
+
+    // the kernel and the number of tasks with the default chunks ...
+    struct ggml_tune_entry best = *e;
+    best.t_us = INT64_MAX;
 
-            while (atomic_load(&state_shared.n_ready) != 0) {
-                ggml_lock_lock  (&state_shared.spin);
-                ggml_lock_unlock(&state_shared.spin);
+    for (int ik = 0; ik < n_kernels; ik++) {
+        // BLAS uses a single task
+        for (int nt = kernels[ik] == GGML_TUNE_KERNEL_BLAS ? 1 : n_threads; nt >= 1; nt = nt > 1 ? (nt + 1)/2 : 0) {
+            struct ggml_tune_entry cur = *e;
+
+            cur.kernel   = kernels[ik];
+            cur.n_tasks  = nt;
+            cur.n_chunks = 0;
+            cur.t_us     = ggml_tune_time(ctx, &gf, &cur, n_iter);
+
+            if (cur.t_us < best.t_us) {
+                best = cur;
             }
         }
+    }
 
-        // performance stats (node)
-        {
-            int64_t perf_cycles_cur  = ggml_perf_cycles()  - perf_node_start_cycles;
-            int64_t perf_time_us_cur = ggml_perf_time_us() - perf_node_start_time_us;
+    // ... then the chunks per task
+    if (best.kernel != GGML_TUNE_KERNEL_BLAS && best.n_tasks > 1) {
+        const struct ggml_tune_entry base = best;
 
-            node->perf_runs++;
-            node->perf_cycles  += perf_cycles_cur;
-            node->perf_time_us += perf_time_us_cur;
+        for (int nc = 1; nc <= 16; nc *= 2) {
+            struct ggml_tune_entry cur = base;
+
+            cur.n_chunks = nc;
+            cur.t_us     = ggml_tune_time(ctx, &gf, &cur, n_iter);
+
+            if (cur.t_us < best.t_us) {
+                best = cur;
+            }
         }
     }
 
-    // join thread pool
-    if (n_threads > 1) {
-        atomic_store(&state_shared.stop, true);
-        atomic_store(&state_shared.has_work, true);
+    GGML_PRINT_DEBUG("%s: %s %d x %d x %d, %d threads: %s, %d tasks, %d chunks - %lld us\n", __func__,
+            GGML_TYPE_NAME[e->type], m, k, n, n_threads, GGML_TUNE_KERNEL_NAME[best.kernel], best.n_tasks, best.n_chunks, (long long) best.t_us);
+
+    *e = best;
+
+    ggml_free(ctx);
+}
+
+int ggml_tune_graph(struct ggml_tune * tune, const struct ggml_cgraph * cgraph, int n_iter) {
+    int n_new = 0;
 
-        for (int j = 0; j < n_threads - 1; j++) {
-            int rc = ggml_thread_join(workers[j].thrd, NULL);
-            assert(rc == 0);
-            UNUSED(rc);
+    for (int i = 0; i < cgraph->n_nodes; i++) {
+        struct ggml_tensor * node = cgraph->nodes[i];
+
+        if (!ggml_tune_is_tunable(node)) {
+            continue;
         }
 
-        ggml_lock_destroy(&state_shared.spin);
-    }
+        struct ggml_tune_entry e = {
+            /*.type      =*/ node->src0->type,
+            /*.k         =*/ node->src0->ne[0],
+            /*.m         =*/ node->src0->ne[1],
+            /*.n         =*/ node->src1->ne[1],
+            /*.n_threads =*/ cgraph->n_threads,
+            /*.kernel    =*/ GGML_TUNE_KERNEL_AUTO,
+            /*.n_tasks   =*/ cgraph->n_threads,
+            /*.n_chunks  =*/ 0,
+            /*.t_us      =*/ 0,
+        };
 
-    // performance stats (graph)
-    {
-        int64_t perf_cycles_cur  = ggml_perf_cycles()  - perf_start_cycles;
-        int64_t perf_time_us_cur = ggml_perf_time_us() - perf_start_time_us;
+        // the same weight shape is usually repeated in every layer
+        if (ggml_tune_index(tune, &e) >= 0) {
+            continue;
+        }
 
-        cgraph->perf_runs++;
-        cgraph->perf_cycles  += perf_cycles_cur;
-        cgraph->perf_time_us += perf_time_us_cur;
+        ggml_tune_mul_mat(node->src0, &e, cgraph->threadpool, MAX(1, n_iter));
+        ggml_tune_add(tune, &e);
 
-        GGML_PRINT_DEBUG("%s: perf (%d) - cpu = %.3f / %.3f ms, wall = %.3f / %.3f ms\n",
-                __func__, cgraph->perf_runs,
-                (double) perf_cycles_cur      / (double) ggml_cycles_per_ms(),
-                (double) cgraph->perf_cycles  / (double) ggml_cycles_per_ms() / (double) cgraph->perf_runs,
-                (double) perf_time_us_cur     / 1000.0,
-                (double) cgraph->perf_time_us / 1000.0 / cgraph->perf_runs);
+        n_new++;
     }
+
+    return n_new;
 }
 
 void ggml_graph_reset(struct ggml_cgraph * cgraph) {
@@ -8457,9 +13075,22 @@ enum ggml_opt_result ggml_opt(
 
 ////////////////////////////////////////////////////////////////////////////////
 
+size_t ggml_quantize(enum ggml_type type, const float * src, void * dst, int n) {
+    GGML_ASSERT(ggml_is_quantized(type));
+    GGML_ASSERT(n % GGML_BLCK_SIZE[type] == 0);
+
+    quantize_fns[type].quantize_row_q(src, dst, n);
+
+    return (n/GGML_BLCK_SIZE[type])*GGML_TYPE_SIZE[type];
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
 int ggml_cpu_has_avx(void) {
 #if defined(__AVX__)
     return 1;
+#elif defined(GGML_CPU_DISPATCH)
+    return ggml_vec_fns.isa >= GGML_VEC_ISA_AVX2;
 #else
     return 0;
 #endif
@@ -8468,6 +13099,8 @@ int ggml_cpu_has_avx(void) {
 int ggml_cpu_has_avx2(void) {
 #if defined(__AVX2__)
     return 1;
+#elif defined(GGML_CPU_DISPATCH)
+    return ggml_vec_fns.isa >= GGML_VEC_ISA_AVX2;
 #else
     return 0;
 #endif
@@ -8476,6 +13109,18 @@ int ggml_cpu_has_avx2(void) {
 int ggml_cpu_has_avx512(void) {
 #if defined(__AVX512F__)
     return 1;
+#elif defined(GGML_CPU_DISPATCH)
+    return ggml_vec_fns.isa >= GGML_VEC_ISA_AVX512;
+#else
+    return 0;
+#endif
+}
+
+int ggml_cpu_has_avx512_vnni(void) {
+#if defined(__AVX512VNNI__)
+    return 1;
+#elif defined(GGML_CPU_DISPATCH)
+    return ggml_vec_fns.vnni;
 #else
     return 0;
 #endif
@@ -8484,6 +13129,8 @@ int ggml_cpu_has_avx512(void) {
 int ggml_cpu_has_fma(void) {
 #if defined(__FMA__)
     return 1;
+#elif defined(GGML_CPU_DISPATCH)
+    return ggml_vec_fns.isa >= GGML_VEC_ISA_AVX2;
 #else
     return 0;
 #endif
@@ -8508,6 +13155,8 @@ int ggml_cpu_has_arm_fma(void) {
 int ggml_cpu_has_f16c(void) {
 #if defined(__F16C__)
     return 1;
+#elif defined(GGML_CPU_DISPATCH)
+    return ggml_vec_fns.isa >= GGML_VEC_ISA_AVX2;
 #else
     return 0;
 #endif
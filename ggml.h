@@ -203,6 +203,8 @@ enum ggml_type {
     GGML_TYPE_I32,
     GGML_TYPE_F16,
     GGML_TYPE_F32,
+    GGML_TYPE_Q4_0, // blocks of 32 x 4-bit values + scale
+    GGML_TYPE_Q8_0, // blocks of 32 x 8-bit values + scale
     GGML_TYPE_COUNT,
 };
 
@@ -227,6 +229,7 @@ enum ggml_op {
     GGML_OP_RELU,
     GGML_OP_GELU,
     GGML_OP_NORM, // normalize
+    GGML_OP_NORM_AFFINE,
 
     GGML_OP_MUL_MAT,
 
@@ -272,22 +275,35 @@ struct ggml_tensor {
 
     // thread scheduling
     int n_tasks;
+    int n_chunks; // chunks per task, 0 for the default of the op - see ggml_set_chunks_per_thread()
+    int kernel;   // enum ggml_tune_kernel - the kernel of mul_mat, see ggml_tune_new()
 
     // performance
     int     perf_runs;
     int64_t perf_cycles;
     int64_t perf_time_us;
 
+    // views point to the data of view_src at offset view_offs
+    // if the data of view_src is placed by ggml_graph_plan(), the view is placed with it
+    struct ggml_tensor * view_src;
+    size_t view_offs;
+
     void * data;
-    char padding[8];
 };
 
 // computation graph
+struct ggml_threadpool;
+struct ggml_trace;
+struct ggml_tune;
+struct ggml_wcache;
+
 struct ggml_cgraph {
     int n_nodes;
     int n_leafs;
     int n_threads;
 
+    struct ggml_threadpool * threadpool; // optional, see ggml_threadpool_new()
+
     size_t work_size;
     struct ggml_tensor * work;
 
@@ -295,12 +311,26 @@ struct ggml_cgraph {
     struct ggml_tensor * grads[GGML_MAX_NODES];
     struct ggml_tensor * leafs[GGML_MAX_NODES];
 
+    struct ggml_trace * trace; // optional, see ggml_trace_new()
+
+    const struct ggml_tune * tune; // optional, see ggml_tune_new()
+
+    struct ggml_wcache * wcache; // optional, see ggml_wcache_new()
+
     // performance
+    bool    perf; // measure the nodes at runtime - always on when built with GGML_PERF
     int     perf_runs;
     int64_t perf_cycles;
     int64_t perf_time_us;
 };
 
+// scratch buffer for the data of intermediate tensors
+struct ggml_scratch {
+    size_t offs;
+    size_t size;
+    void * data;
+};
+
 struct ggml_init_params {
     // memory pool
     size_t mem_size;   // bytes
@@ -319,14 +349,33 @@ void ggml_print_objects(const struct ggml_context * ctx);
 int    ggml_nelements(const struct ggml_tensor * tensor);
 size_t ggml_nbytes   (const struct ggml_tensor * tensor);
 
-size_t ggml_type_size   (enum ggml_type type);
+int    ggml_blck_size   (enum ggml_type type); // number of elements per block (1 for non-quantized types)
+size_t ggml_type_size   (enum ggml_type type); // size in bytes of a block
+float  ggml_type_sizef  (enum ggml_type type); // ggml_type_size()/ggml_blck_size()
 size_t ggml_element_size(const struct ggml_tensor * tensor);
 
+bool ggml_is_quantized(enum ggml_type type);
+
+const char * ggml_type_name(enum ggml_type type);
+const char * ggml_op_name(enum ggml_op op);
+
 struct ggml_context * ggml_init(struct ggml_init_params params);
 void ggml_free(struct ggml_context * ctx);
 
 size_t ggml_used_mem(const struct ggml_context * ctx);
 
+// place the data of the tensors created after this call in the given scratch buffer instead of the context's
+// memory pool - pass { 0, 0, NULL } to go back to the memory pool
+// returns the number of bytes used so far in the previous scratch buffer
+size_t ggml_set_scratch(struct ggml_context * ctx, struct ggml_scratch scratch);
+
+// do not allocate the data of the tensors created after this call - it is placed later by ggml_graph_plan()
+// the tensors whose data is written while building the graph (constants, op parameters) are still allocated
+void ggml_set_no_alloc(struct ggml_context * ctx, bool no_alloc);
+
+// memory used in the context's memory pool by a tensor without data
+size_t ggml_tensor_overhead(void);
+
 struct ggml_tensor * ggml_new_tensor(
         struct ggml_context * ctx,
         enum   ggml_type type,
@@ -363,7 +412,7 @@ struct ggml_tensor * ggml_new_i32(struct ggml_context * ctx, int32_t value);
 struct ggml_tensor * ggml_new_f32(struct ggml_context * ctx, float value);
 
 struct ggml_tensor * ggml_dup_tensor (struct ggml_context * ctx, const struct ggml_tensor * src);
-struct ggml_tensor * ggml_view_tensor(struct ggml_context * ctx, const struct ggml_tensor * src);
+struct ggml_tensor * ggml_view_tensor(struct ggml_context * ctx, struct ggml_tensor * src);
 
 struct ggml_tensor * ggml_set_zero(struct ggml_tensor * tensor);
 struct ggml_tensor * ggml_set_i32 (struct ggml_tensor * tensor, int32_t value);
@@ -463,6 +512,14 @@ struct ggml_tensor * ggml_norm(
         struct ggml_context * ctx,
         struct ggml_tensor  * a);
 
+// w*norm(a) + b, with w and b broadcast along the rows of a
+// same as ggml_add(ggml_mul(ggml_repeat(w, x), x), ggml_repeat(b, x)) with x = ggml_norm(a), but in a single op
+struct ggml_tensor * ggml_norm_affine(
+        struct ggml_context * ctx,
+        struct ggml_tensor  * a,
+        struct ggml_tensor  * w,
+        struct ggml_tensor  * b);
+
 // A: m rows, n columns
 // B: p rows, n columns (i.e. we transpose it internally)
 // result is m columns, p rows
@@ -471,6 +528,16 @@ struct ggml_tensor * ggml_mul_mat(
         struct ggml_tensor  * a,
         struct ggml_tensor  * b);
 
+// gelu(ggml_mul_mat(a, b) + c), with c broadcast along the rows of the result
+// the bias c (a vector of a->ne[1] values) can be NULL
+// the bias and the GELU are applied when the result is written, instead of as separate ops
+struct ggml_tensor * ggml_mul_mat_bias(
+        struct ggml_context * ctx,
+        struct ggml_tensor  * a,
+        struct ggml_tensor  * b,
+        struct ggml_tensor  * c,
+        bool                  gelu);
+
 //
 // operations on tensors without backpropagation
 //
@@ -556,6 +623,15 @@ struct ggml_tensor * ggml_soft_max(
         struct ggml_context * ctx,
         struct ggml_tensor  * a);
 
+// soft_max(scale*a) with the elements above the diagonal masked as in ggml_diag_mask_inf - scale can have any sign
+// no mask if n_past < 0
+// in-place, returns view(a)
+struct ggml_tensor * ggml_soft_max_ext(
+        struct ggml_context * ctx,
+        struct ggml_tensor  * a,
+        float                 scale,
+        int                   n_past);
+
 // rotary position embedding
 // in-place, returns view(a)
 // if mode == 1, skip n_past elements
@@ -581,6 +657,23 @@ struct ggml_tensor * ggml_conv_1d_2s(
         struct ggml_tensor  * a,
         struct ggml_tensor  * b);
 
+// gelu(ggml_conv_1d_1s(a, b) + c) and gelu(ggml_conv_1d_2s(a, b) + c), with c broadcast along the rows of the result
+// the bias c (a->ne[2] values, one per output channel) can be NULL
+// the bias and the GELU are applied when the result is written, instead of as separate ops
+struct ggml_tensor * ggml_conv_1d_1s_bias(
+        struct ggml_context * ctx,
+        struct ggml_tensor  * a,
+        struct ggml_tensor  * b,
+        struct ggml_tensor  * c,
+        bool                  gelu);
+
+struct ggml_tensor * ggml_conv_1d_2s_bias(
+        struct ggml_context * ctx,
+        struct ggml_tensor  * a,
+        struct ggml_tensor  * b,
+        struct ggml_tensor  * c,
+        bool                  gelu);
+
 struct ggml_tensor * ggml_flash_attn(
         struct ggml_context * ctx,
         struct ggml_tensor  * q,
@@ -609,15 +702,200 @@ void ggml_build_forward_expand(struct ggml_cgraph * cgraph, struct ggml_tensor *
 struct ggml_cgraph ggml_build_forward (struct ggml_tensor * tensor);
 struct ggml_cgraph ggml_build_backward(struct ggml_context * ctx, struct ggml_cgraph * gf, bool keep);
 
+// with a thread pool, the small independent nodes (e.g. the branches of the attention) are computed at the same time,
+// each with its own threads - see ggml_graph_schedule() in ggml.c
 void ggml_graph_compute(struct ggml_context * ctx, struct ggml_cgraph * cgraph);
+
+// allocate the work buffer of the graph for the current shapes of its nodes
+// ggml_graph_compute() does this on the first call - call it beforehand, with the nodes set to their largest
+// shapes, for a graph that is computed multiple times while some of its nodes change shape (e.g. attention over a
+// growing KV cache)
+void ggml_graph_alloc_work(struct ggml_context * ctx, struct ggml_cgraph * cgraph);
+
+// place the data of the tensors of the graph created with ggml_set_no_alloc() in the given buffer
+//
+// the nodes are computed in order, so the memory of a tensor can be reused as soon as the last node that reads
+// it has been computed. with cgraph->n_threads > 1 the nodes are first sorted by level (a topological order, see
+// ggml_graph_schedule() in ggml.c) and the memory is reused only from the next level on, so that the independent
+// nodes of a level can be computed at the same time. the tensors that are not read by any node (the outputs) are
+// kept until the end of the graph. the leafs (e.g. the destination of ggml_cpy()) are placed right before their first use, so the inputs of
+// the graph must be created with the allocation enabled. the work buffer of the graph is placed in the buffer as
+// well, like ggml_graph_alloc_work() does
+//
+// returns the size of the buffer needed by the graph - pass a NULL buffer to only measure it
+// nothing is placed if the buffer is too small
+size_t ggml_graph_plan(struct ggml_context * ctx, struct ggml_cgraph * cgraph, void * buffer, size_t size);
+
 void ggml_graph_reset  (struct ggml_cgraph * cgraph);
 
+// thread pool
+//
+// the worker threads of a pool are created once and are reused by all ggml_graph_compute() calls
+// that have cgraph->threadpool set to it. between graphs, the workers sleep instead of spinning
+// if cgraph->threadpool is NULL, a temporary pool is created and destroyed for each graph
+//
+// a pool can be used by a single ggml_graph_compute() call at a time
+//
+// while waiting for each other, the threads busy-wait for up to n_spin iterations and then go to sleep
+// larger values reduce the synchronization latency, smaller values reduce the CPU usage of idle threads
+//
+struct ggml_threadpool * ggml_threadpool_new (int n_threads);
+void                     ggml_threadpool_free(struct ggml_threadpool * threadpool);
+
+int  ggml_threadpool_n_threads (const struct ggml_threadpool * threadpool);
+void ggml_threadpool_set_n_spin(      struct ggml_threadpool * threadpool, int n_spin);
+
+// NUMA
+//
+// on a machine with several NUMA nodes (e.g. a dual-socket host), a pool created with ggml_threadpool_new_numa() splits
+// its threads into one contiguous group per node and pins each group to the CPUs of its node. the thread that calls
+// ggml_graph_compute() (ith = 0) is pinned only during the computation, its affinity is restored afterwards. the threads
+// of a node first compute the rows of mul_mat in the block of rows that ggml_numa_distribute() places on their node
+//
+// the nodes are detected by the first ggml_init() call. on other systems, or with a single node, ggml_numa_n_nodes()
+// is 1 and these are the same as the non-NUMA functions
+//
+struct ggml_threadpool * ggml_threadpool_new_numa(int n_threads);
+
+int ggml_numa_n_nodes(void);
+
+// move the memory pages to the nodes - the pages are assigned to the range they mostly belong to
+// return false if the system rejects the placement, the memory is still usable
+bool ggml_numa_interleave(void * data, size_t size);          // spread the pages over all the nodes
+bool ggml_numa_distribute(const struct ggml_tensor * tensor); // the rows [g*nr/n, (g + 1)*nr/n) on node g
+
+// CPU affinity
+//
+// the threads of a pool created with ggml_threadpool_new_cpus() are pinned to one CPU each: thread ith to
+// cpus[ith % n_cpus]. the thread that calls ggml_graph_compute() (ith = 0) is pinned only during the computation, its
+// affinity is restored afterwards. e.g. to split a machine between several processes or contexts. this takes the place
+// of the NUMA groups of ggml_threadpool_new_numa()
+//
+struct ggml_threadpool * ggml_threadpool_new_cpus(int n_threads, const int * cpus, int n_cpus);
+
+// pin the calling thread to the given CPUs (Linux and Windows)
+// returns false if a CPU is out of range or the system rejects the set
+bool ggml_thread_set_affinity(const int * cpus, int n_cpus);
+
+// returns true if the calling thread may be pinned to the given CPUs, without changing its affinity
+bool ggml_thread_check_affinity(const int * cpus, int n_cpus);
+
+// tracing
+//
+// records the timeline of the graphs that have cgraph->trace set to it: the begin and end time of the tasks (INIT,
+// COMPUTE, FINALIZE) of each node on each thread and the time the main thread waits for the workers (WAIT)
+//
+// each thread stores up to n_max_events events, the rest are dropped. the events of the threads with ith >= n_threads
+// are dropped as well. the names must outlive the trace
+//
+struct ggml_trace * ggml_trace_new  (int n_threads, int n_max_events);
+void                ggml_trace_free (struct ggml_trace * trace);
+void                ggml_trace_reset(struct ggml_trace * trace);
+
+// add a span of the application (e.g. a whole graph) to the timeline of thread ith
+// must be called from the thread that computes the tasks of ith, or when no graph is being computed
+void ggml_trace_add(struct ggml_trace * trace, int ith, const char * name, const char * cat, int64_t t_start_us, int64_t t_end_us);
+
+// write the timeline in the Chrome trace-event format (chrome://tracing, https://ui.perfetto.dev)
+bool ggml_trace_dump_json(const struct ggml_trace * trace, const char * filename);
+
+// dynamic work distribution
+//
+// the heavy ops (GGML_OP_MUL_MAT, GGML_OP_CONV_1D_*) split their rows into n_tasks*n_chunks chunks that the threads
+// claim one at a time, so that a slow thread does not hold back the others. more chunks balance the load better
+// under contention (SMT siblings, throttled cores, other processes), fewer chunks have less overhead and better
+// cache reuse. n_chunks = 1 gives the static partition, n_chunks = 0 restores the default (GGML_CHUNKS_PER_THREAD)
+//
+void ggml_set_chunks_per_thread(enum ggml_op op, int n_chunks);
+int  ggml_get_chunks_per_thread(enum ggml_op op);
+
+// kernel tuning
+//
+// the mul_mat nodes of a graph with cgraph->tune set take their kernel, number of tasks and chunks per task from the
+// entry of the table with the same type and shape of src0 and number of threads, and the closest number of columns of
+// src1. the nodes without an entry use the built-in heuristics
+//
+// the entries are measured on the target machine with ggml_tune_graph() and stored in a text file, one per line:
+//
+//   mul_mat <type> <k> <m> <n> <n_threads> <kernel> <n_tasks> <n_chunks> <t_us>
+//
+enum ggml_tune_kernel {
+    GGML_TUNE_KERNEL_AUTO = 0, // the built-in heuristic
+    GGML_TUNE_KERNEL_DOT,      // dot products of the rows of src0 and src1 (any type)
+    GGML_TUNE_KERNEL_GEMM,     // blocked GEMM (F16)
+    GGML_TUNE_KERNEL_BLAS,     // BLAS sgemm (builds with BLAS)
+    GGML_TUNE_KERNEL_COUNT,
+};
+
+struct ggml_tune_entry {
+    enum ggml_type type; // of src0
+
+    int k; // src0->ne[0] == src1->ne[0]
+    int m; // src0->ne[1]
+    int n; // src1->ne[1]
+
+    int n_threads; // cgraph->n_threads
+
+    enum ggml_tune_kernel kernel;
+    int n_tasks;
+    int n_chunks;
+
+    int64_t t_us; // measured time, informative
+};
+
+struct ggml_tune * ggml_tune_new (void);
+void               ggml_tune_free(struct ggml_tune * tune);
+
+int                            ggml_tune_n_entries(const struct ggml_tune * tune);
+const struct ggml_tune_entry * ggml_tune_get      (const struct ggml_tune * tune, int i);
+
+// add the entry, or replace the entry with the same key (type, k, m, n, n_threads)
+void ggml_tune_add(struct ggml_tune * tune, const struct ggml_tune_entry * entry);
+
+// load adds the entries of the file to the table - returns false if the file cannot be read or is malformed
+bool ggml_tune_load(      struct ggml_tune * tune, const char * fname);
+bool ggml_tune_save(const struct ggml_tune * tune, const char * fname);
+
+// measure the candidate configurations of the mul_mat nodes of the graph that multiply a weight (src0 is a 2D tensor
+// that is not the result of an op) and have no entry with the exact shape yet, and add the fastest of each to the
+// table. the nodes are timed alone, on random src1 data, with the thread pool and the number of threads of the graph,
+// taking the best of n_iter runs. returns the number of new entries
+int ggml_tune_graph(struct ggml_tune * tune, const struct ggml_cgraph * cgraph, int n_iter);
+
+// weight cache
+//
+// the BLAS path of mul_mat converts src0 to F32 before each sgemm. with cgraph->wcache set, the F32 copies of the
+// tensors added to the cache are kept between the computations, up to budget bytes in total. a tensor is converted the
+// first time a node multiplies it with BLAS, and the tensors that do not fit are converted on each call as before.
+// no effect in builds without BLAS
+//
+// the data of the added tensors must not change (e.g. the weights of a model), and all of them must be added before
+// the graphs are computed. the graphs that use the cache can be computed concurrently
+//
+struct ggml_wcache * ggml_wcache_new (size_t budget);
+void                 ggml_wcache_free(struct ggml_wcache * cache);
+
+// F16 and quantized tensors, the other types are ignored
+void ggml_wcache_add(struct ggml_wcache * cache, const struct ggml_tensor * tensor);
+
+// bytes used by the F32 copies
+size_t ggml_wcache_size(struct ggml_wcache * cache);
+
 // print info and performance information for the graph
 void ggml_graph_print(const struct ggml_cgraph * cgraph);
 
 // dump the graph into a file using the dot format
 void ggml_graph_dump_dot(const struct ggml_cgraph * gb, const struct ggml_cgraph * gf, const char * filename);
 
+//
+// quantization
+//
+
+// quantize n floats from src into dst using the given block-quantized type
+// n must be a multiple of ggml_blck_size(type)
+// returns the number of bytes written to dst
+size_t ggml_quantize(enum ggml_type type, const float * src, void * dst, int n);
+
 //
 // optimization
 //
@@ -720,10 +998,13 @@ enum ggml_opt_result ggml_opt(
 //
 // system info
 //
+// on x86 the AVX / AVX2 / AVX512 / FMA / F16C flags also report the kernels that were selected at runtime by ggml_init
+//
 
 int ggml_cpu_has_avx(void);
 int ggml_cpu_has_avx2(void);
 int ggml_cpu_has_avx512(void);
+int ggml_cpu_has_avx512_vnni(void);
 int ggml_cpu_has_fma(void);
 int ggml_cpu_has_neon(void);
 int ggml_cpu_has_arm_fma(void);
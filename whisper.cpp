@@ -179,38 +179,6 @@ static const std::map<e_model, size_t> MEM_REQ_KV_CROSS = {
     { MODEL_LARGE,   235ull*MB },
 };
 
-static const std::map<e_model, size_t> MEM_REQ_ENCODE = {
-    { MODEL_TINY,     80ull*MB },
-    { MODEL_BASE,    128ull*MB },
-    { MODEL_SMALL,   300ull*MB },
-    { MODEL_MEDIUM,  680ull*MB },
-    { MODEL_LARGE,  1100ull*MB },
-};
-
-static const std::map<e_model, size_t> MEM_REQ_ENCODE_LAYER = {
-    { MODEL_TINY,    104ull*MB },
-    { MODEL_BASE,    138ull*MB },
-    { MODEL_SMALL,   208ull*MB },
-    { MODEL_MEDIUM,  280ull*MB },
-    { MODEL_LARGE,   354ull*MB },
-};
-
-static const std::map<e_model, size_t> MEM_REQ_DECODE = {
-    { MODEL_TINY,    200ull*MB },
-    { MODEL_BASE,    202ull*MB },
-    { MODEL_SMALL,   204ull*MB },
-    { MODEL_MEDIUM,  206ull*MB },
-    { MODEL_LARGE,   208ull*MB },
-};
-
-static const std::map<e_model, size_t> MEM_REQ_DECODE_LAYER = {
-    { MODEL_TINY,     32ull*MB },
-    { MODEL_BASE,     44ull*MB },
-    { MODEL_SMALL,    64ull*MB },
-    { MODEL_MEDIUM,   84ull*MB },
-    { MODEL_LARGE,   110ull*MB },
-};
-
 struct whisper_mel {
     int n_len;
     int n_mel;
@@ -285,7 +253,7 @@ struct whisper_hparams {
     int32_t n_text_head   = 6;
     int32_t n_text_layer  = 4;
     int32_t n_mels        = 80;
-    int32_t f16           = 1;
+    int32_t ftype         = 1;
 };
 
 // audio encoding layer
@@ -466,6 +434,51 @@ struct whisper_decoder {
     std::vector<whisper_token> tokens_tmp; // used for whisper_decode calls
 };
 
+// the topology of the decoder graph depends only on the number of tokens and on the audio context, so the graph
+// is built once and computed again for the following whisper_decode() calls with the same shape
+// only the inputs and the self-attention tensors that depend on n_past are updated in between
+struct whisper_graph_decoder {
+    int n_tokens    = 0;
+    int n_audio_ctx = 0;
+    int n_threads   = 0;
+
+    struct ggml_context * ctx = nullptr;
+
+    struct ggml_cgraph gf = {};
+
+    // inputs
+    struct ggml_tensor * embd     = nullptr;
+    struct ggml_tensor * position = nullptr;
+
+    // output
+    struct ggml_tensor * logits = nullptr;
+
+    // self-attention tensors that depend on n_past
+    struct layer {
+        struct ggml_tensor * k = nullptr; // stores the new keys in the KV cache
+        struct ggml_tensor * v = nullptr; // stores the new values in the KV cache
+
+        struct ggml_tensor * K       = nullptr;
+        struct ggml_tensor * V_trans = nullptr;
+
+        struct ggml_tensor * KQ          = nullptr;
+        struct ggml_tensor * KQ_soft_max = nullptr; // the causal mask is applied by ggml_soft_max_ext
+    };
+
+    std::vector<layer> layers;
+
+    // section (embeddings, layers, output) of each node - used for profiling
+    std::map<struct ggml_tensor *, int> sections;
+};
+
+// time of the nodes of the graphs aggregated per op or per layer (see whisper_set_profile())
+struct whisper_profile_stats {
+    std::string name;
+
+    int     n_calls;
+    int64_t t_us;
+};
+
 struct whisper_context {
     int64_t t_load_us   = 0;
     int64_t t_mel_us    = 0;
@@ -474,7 +487,8 @@ struct whisper_context {
     int64_t t_decode_us = 0;
     int64_t t_start_us  = 0;
 
-    ggml_type wtype; // weight type (FP32 or FP16)
+    ggml_type wtype; // weight type (FP32, FP16 or quantized)
+    ggml_type itype; // intermediate type (FP32 or FP16) - used for the KV caches and the conv weights
 
     whisper_mel mel;
 
@@ -487,9 +501,46 @@ struct whisper_context {
 
     whisper_decoder decoders[WHISPER_MAX_DECODERS] = {};
 
-    // memory buffers used by encode / decode contexts
+    // memory pool of the encode / decode contexts - holds the tensor objects, the constants and the inputs
     std::vector<uint8_t> buf_compute;
-    std::vector<uint8_t> buf_compute_layer;
+
+    // data of the intermediate tensors of the encode / decode graphs, placed by ggml_graph_plan()
+    // sized with a dry run of the graphs in whisper_init() and grown if a graph needs more memory
+    std::vector<uint8_t> buf_alloc;
+
+    // cached decoder graph - uses buf_compute and buf_alloc, so it is invalidated by whisper_encode()
+    whisper_graph_decoder graph_decoder;
+
+    // worker threads used by the encode / decode graphs
+    // kept alive between the graphs to avoid creating new threads for each of them
+    struct ggml_threadpool * threadpool = nullptr;
+
+    // see whisper_set_numa()
+    whisper_numa_strategy numa = WHISPER_NUMA_DISABLED;
+
+    // see whisper_set_cpus()
+    std::vector<int> cpus;
+    std::vector<int> threadpool_cpus; // the CPUs the thread pool was created with
+
+    // kernel configuration of the mul_mat nodes, see whisper_set_tune()
+    struct ggml_tune * tune = nullptr;
+
+    int tune_n_iter = 0; // > 0 while whisper_tune() measures the nodes of the graphs
+
+    // F32 copies of the weights for BLAS, see whisper_set_weight_cache()
+    struct ggml_wcache * wcache = nullptr;
+
+    // profiling
+    bool profile = false;
+
+    std::vector<whisper_profile_stats> profile_ops;    // indexed by ggml_op
+    std::vector<whisper_profile_stats> profile_layers; // sections of the encoder graph, then of the decoder graph
+
+    std::vector<whisper_profile_entry> profile_entries; // returned by whisper_get_profile()
+    std::string                        profile_str;     // returned by whisper_print_profile()
+
+    // timeline of the computation (see whisper_set_trace())
+    struct ggml_trace * trace = nullptr;
 
     // decode output (2-dimensional array: [n_tokens][n_vocab])
     std::vector<float> logits;
@@ -557,7 +608,7 @@ static bool kv_cache_reinit(struct whisper_kv_cache & cache) {
     const ggml_type wtype = cache.k->type;
     WHISPER_ASSERT(wtype == cache.v->type);
 
-    WHISPER_ASSERT(cache.buf.size() >= 2*n_elements*ggml_type_size(wtype));
+    WHISPER_ASSERT(cache.buf.size() >= 2*n_elements*ggml_type_sizef(wtype));
 
     struct ggml_init_params params;
     params.mem_size   = cache.buf.size();
@@ -576,6 +627,60 @@ static bool kv_cache_reinit(struct whisper_kv_cache & cache) {
     return true;
 }
 
+// returns the thread pool of the context, (re)creating it if the number of threads or the CPU set has changed
+static struct ggml_threadpool * whisper_threadpool(whisper_context & wctx, int n_threads) {
+    if (wctx.threadpool && (ggml_threadpool_n_threads(wctx.threadpool) != n_threads || wctx.threadpool_cpus != wctx.cpus)) {
+        ggml_threadpool_free(wctx.threadpool);
+        wctx.threadpool = nullptr;
+    }
+
+    // with a CPU set, a single thread also needs a pool to be pinned during the computation
+    if (wctx.threadpool == nullptr && (n_threads > 1 || !wctx.cpus.empty())) {
+        if (!wctx.cpus.empty()) {
+            wctx.threadpool = ggml_threadpool_new_cpus(n_threads, wctx.cpus.data(), wctx.cpus.size());
+        } else if (wctx.numa != WHISPER_NUMA_DISABLED) {
+            wctx.threadpool = ggml_threadpool_new_numa(n_threads);
+        } else {
+            wctx.threadpool = ggml_threadpool_new(n_threads);
+        }
+
+        wctx.threadpool_cpus = wctx.cpus;
+    }
+
+    return wctx.threadpool;
+}
+
+// add the span [t_start_us, now] to the timeline of the calling thread (see whisper_set_trace())
+static void whisper_trace_add(whisper_context & wctx, const char * name, int64_t t_start_us) {
+    if (wctx.trace) {
+        ggml_trace_add(wctx.trace, 0, name, "whisper", t_start_us, ggml_time_us());
+    }
+}
+
+static void whisper_graph_decoder_free(whisper_graph_decoder & graph) {
+    if (graph.ctx) {
+        ggml_free(graph.ctx);
+    }
+
+    graph.ctx = nullptr;
+    graph.n_tokens = 0;
+}
+
+// copy of the keys and values of the cache - see whisper_tune()
+static std::vector<uint8_t> kv_cache_save(const struct whisper_kv_cache & cache) {
+    std::vector<uint8_t> data(ggml_nbytes(cache.k) + ggml_nbytes(cache.v));
+
+    memcpy(data.data(),                       cache.k->data, ggml_nbytes(cache.k));
+    memcpy(data.data() + ggml_nbytes(cache.k), cache.v->data, ggml_nbytes(cache.v));
+
+    return data;
+}
+
+static void kv_cache_restore(struct whisper_kv_cache & cache, const std::vector<uint8_t> & data) {
+    memcpy(cache.k->data, data.data(),                        ggml_nbytes(cache.k));
+    memcpy(cache.v->data, data.data() + ggml_nbytes(cache.k), ggml_nbytes(cache.v));
+}
+
 static void kv_cache_free(struct whisper_kv_cache & cache) {
     if (cache.ctx) {
         ggml_free(cache.ctx);
@@ -583,6 +688,25 @@ static void kv_cache_free(struct whisper_kv_cache & cache) {
     }
 }
 
+// the type of the weights in the model file:
+//
+//   0 - F32
+//   1 - F16
+//   2 - Q4_0
+//   3 - Q8_0
+//
+// returns GGML_TYPE_COUNT for unknown values
+static ggml_type whisper_ftype_to_ggml_type(int32_t ftype) {
+    switch (ftype) {
+        case 0: return GGML_TYPE_F32;
+        case 1: return GGML_TYPE_F16;
+        case 2: return GGML_TYPE_Q4_0;
+        case 3: return GGML_TYPE_Q8_0;
+    }
+
+    return GGML_TYPE_COUNT;
+}
+
 // load the model from a ggml file
 //
 // file format:
@@ -628,7 +752,7 @@ static bool whisper_model_load(struct whisper_model_loader * loader, whisper_con
         read_safe(loader, hparams.n_text_head);
         read_safe(loader, hparams.n_text_layer);
         read_safe(loader, hparams.n_mels);
-        read_safe(loader, hparams.f16);
+        read_safe(loader, hparams.ftype);
 
         assert(hparams.n_text_state == hparams.n_audio_state);
 
@@ -652,11 +776,17 @@ static bool whisper_model_load(struct whisper_model_loader * loader, whisper_con
             model.type = e_model::MODEL_LARGE;
         }
 
-        // for the big tensors, we have the option to store the data in 16-bit floats
+        // for the big tensors, we have the option to store the data in 16-bit floats or quantized
         // in order to save memory and also to speed up the computation
-        wctx.wtype = model.hparams.f16 ? GGML_TYPE_F16 : GGML_TYPE_F32;
+        wctx.wtype = whisper_ftype_to_ggml_type(model.hparams.ftype);
+        if (wctx.wtype == GGML_TYPE_COUNT) {
+            fprintf(stderr, "%s: invalid model (bad ftype value %d)\n", __func__, model.hparams.ftype);
+            return false;
+        }
+
+        wctx.itype = wctx.wtype == GGML_TYPE_F32 ? GGML_TYPE_F32 : GGML_TYPE_F16;
 
-        const size_t scale = model.hparams.f16 ? 1 : 2;
+        const size_t scale = wctx.itype == GGML_TYPE_F32 ? 2 : 1;
 
         fprintf(stderr, "%s: n_vocab       = %d\n", __func__, hparams.n_vocab);
         fprintf(stderr, "%s: n_audio_ctx   = %d\n", __func__, hparams.n_audio_ctx);
@@ -668,17 +798,16 @@ static bool whisper_model_load(struct whisper_model_loader * loader, whisper_con
         fprintf(stderr, "%s: n_text_head   = %d\n", __func__, hparams.n_text_head);
         fprintf(stderr, "%s: n_text_layer  = %d\n", __func__, hparams.n_text_layer);
         fprintf(stderr, "%s: n_mels        = %d\n", __func__, hparams.n_mels);
-        fprintf(stderr, "%s: f16           = %d\n", __func__, hparams.f16);
+        fprintf(stderr, "%s: ftype         = %d\n", __func__, hparams.ftype);
         fprintf(stderr, "%s: type          = %d\n", __func__, model.type);
 
         // print memory requirements
         {
-            // this is the total memory required to run the inference
+            // this is the memory required by the model and the cross-attention cache
+            // the compute buffers are measured after the model has been loaded
             const size_t mem_required =
                 scale*MEM_REQ_MODEL.at       (model.type) +
-                scale*MEM_REQ_KV_CROSS.at    (model.type) +
-                scale*std::max(MEM_REQ_ENCODE.at(model.type),       MEM_REQ_DECODE.at(model.type)) +
-                scale*std::max(MEM_REQ_ENCODE_LAYER.at(model.type), MEM_REQ_DECODE_LAYER.at(model.type));
+                scale*MEM_REQ_KV_CROSS.at    (model.type);
 
             // this is the memory required by one decoder
             const size_t mem_required_decoder =
@@ -694,7 +823,7 @@ static bool whisper_model_load(struct whisper_model_loader * loader, whisper_con
         wctx.model.buf = new std::vector<uint8_t>();
         wctx.model.buf->resize(scale*MEM_REQ_MODEL.at(model.type));
 
-        if (!kv_cache_init(model.hparams, scale*MEM_REQ_KV_SELF.at(model.type), wctx.decoders[0].kv_self, wctx.wtype, model.hparams.n_text_ctx)) {
+        if (!kv_cache_init(model.hparams, scale*MEM_REQ_KV_SELF.at(model.type), wctx.decoders[0].kv_self, wctx.itype, model.hparams.n_text_ctx)) {
             fprintf(stderr, "%s: kv_cache_init() failed for self-attention cache\n", __func__);
             return false;
         }
@@ -704,7 +833,7 @@ static bool whisper_model_load(struct whisper_model_loader * loader, whisper_con
             fprintf(stderr, "%s: kv self size  = %7.2f MB\n", __func__, memory_size/1024.0/1024.0);
         }
 
-        if (!kv_cache_init(model.hparams, scale*MEM_REQ_KV_CROSS.at(model.type), wctx.kv_cross, wctx.wtype, model.hparams.n_audio_ctx)) {
+        if (!kv_cache_init(model.hparams, scale*MEM_REQ_KV_CROSS.at(model.type), wctx.kv_cross, wctx.itype, model.hparams.n_audio_ctx)) {
             fprintf(stderr, "%s: kv_cache_init() failed for cross-attention cache\n", __func__);
             return false;
         }
@@ -714,8 +843,12 @@ static bool whisper_model_load(struct whisper_model_loader * loader, whisper_con
             fprintf(stderr, "%s: kv cross size = %7.2f MB\n", __func__, memory_size/1024.0/1024.0);
         }
 
-        wctx.buf_compute.resize      (scale*std::max(MEM_REQ_ENCODE.at(model.type),       MEM_REQ_DECODE.at(model.type)));
-        wctx.buf_compute_layer.resize(scale*std::max(MEM_REQ_ENCODE_LAYER.at(model.type), MEM_REQ_DECODE_LAYER.at(model.type)));
+        // every tensor of a graph is either a node or a leaf - the scalar constants have a few bytes of data
+        // the largest inputs are the mel spectrogram of the encoder and the tokens + positions of the decoder
+        wctx.buf_compute.resize(
+                2*GGML_MAX_NODES*(ggml_tensor_overhead() + 32) +
+                2*hparams.n_audio_ctx*hparams.n_mels*sizeof(float) +
+                2*hparams.n_text_ctx*sizeof(int32_t));
     }
 
     // load mel filters
@@ -813,6 +946,7 @@ static bool whisper_model_load(struct whisper_model_loader * loader, whisper_con
     size_t ctx_size = 0;
 
     const ggml_type wtype = wctx.wtype;
+    const ggml_type itype = wctx.itype;
 
     {
         const auto & hparams = model.hparams;
@@ -833,10 +967,10 @@ static bool whisper_model_load(struct whisper_model_loader * loader, whisper_con
         {
             ctx_size += n_audio_ctx*n_audio_state*ggml_type_size(GGML_TYPE_F32); // e_pe;
 
-            ctx_size += 3*n_mels*n_audio_state*ggml_type_size(wtype);         // e_conv_1_w
+            ctx_size += 3*n_mels*n_audio_state*ggml_type_sizef(itype);        // e_conv_1_w
             ctx_size +=          n_audio_state*ggml_type_size(GGML_TYPE_F32); // e_conv_1_b
 
-            ctx_size += 3*n_audio_state*n_audio_state*ggml_type_size(wtype);         // e_conv_2_w
+            ctx_size += 3*n_audio_state*n_audio_state*ggml_type_sizef(itype);        // e_conv_2_w
             ctx_size +=                 n_audio_state*ggml_type_size(GGML_TYPE_F32); // e_conv_2_b
 
             ctx_size += n_audio_state*ggml_type_size(GGML_TYPE_F32); // e_ln_w;
@@ -847,7 +981,7 @@ static bool whisper_model_load(struct whisper_model_loader * loader, whisper_con
         {
             ctx_size += n_text_ctx*n_text_state*ggml_type_size(GGML_TYPE_F32); // d_pe;
 
-            ctx_size += n_vocab*n_text_state*ggml_type_size(wtype); // d_te;
+            ctx_size += n_vocab*n_text_state*ggml_type_sizef(wtype); // d_te;
 
             ctx_size += n_text_state*ggml_type_size(GGML_TYPE_F32); // d_ln_w;
             ctx_size += n_text_state*ggml_type_size(GGML_TYPE_F32); // d_ln_b;
@@ -858,24 +992,24 @@ static bool whisper_model_load(struct whisper_model_loader * loader, whisper_con
             ctx_size += n_audio_layer*(n_audio_state*ggml_type_size(GGML_TYPE_F32)); // mlp_ln_w
             ctx_size += n_audio_layer*(n_audio_state*ggml_type_size(GGML_TYPE_F32)); // mlp_ln_b
 
-            ctx_size += n_audio_layer*(4*n_audio_state*n_audio_state*ggml_type_size(wtype));         // mlp_0_w
+            ctx_size += n_audio_layer*(4*n_audio_state*n_audio_state*ggml_type_sizef(wtype));         // mlp_0_w
             ctx_size += n_audio_layer*(              4*n_audio_state*ggml_type_size(GGML_TYPE_F32)); // mlp_0_b
 
-            ctx_size += n_audio_layer*(4*n_audio_state*n_audio_state*ggml_type_size(wtype));         // mlp_1_w
+            ctx_size += n_audio_layer*(4*n_audio_state*n_audio_state*ggml_type_sizef(wtype));         // mlp_1_w
             ctx_size += n_audio_layer*(                n_audio_state*ggml_type_size(GGML_TYPE_F32)); // mlp_1_b
 
             ctx_size += n_audio_layer*(n_audio_state*ggml_type_size(GGML_TYPE_F32)); // attn_ln_0_w
             ctx_size += n_audio_layer*(n_audio_state*ggml_type_size(GGML_TYPE_F32)); // attn_ln_0_b
 
-            ctx_size += n_audio_layer*(n_audio_state*n_audio_state*ggml_type_size(wtype));         // attn_q_w
+            ctx_size += n_audio_layer*(n_audio_state*n_audio_state*ggml_type_sizef(wtype));         // attn_q_w
             ctx_size += n_audio_layer*(              n_audio_state*ggml_type_size(GGML_TYPE_F32)); // attn_q_b
 
-            ctx_size += n_audio_layer*(n_audio_state*n_audio_state*ggml_type_size(wtype)); // attn_k_w
+            ctx_size += n_audio_layer*(n_audio_state*n_audio_state*ggml_type_sizef(wtype)); // attn_k_w
 
-            ctx_size += n_audio_layer*(n_audio_state*n_audio_state*ggml_type_size(wtype));         // attn_v_w
+            ctx_size += n_audio_layer*(n_audio_state*n_audio_state*ggml_type_sizef(wtype));         // attn_v_w
             ctx_size += n_audio_layer*(              n_audio_state*ggml_type_size(GGML_TYPE_F32)); // attn_v_b
 
-            ctx_size += n_audio_layer*(n_audio_state*n_audio_state*ggml_type_size(wtype));         // attn_ln_1_w
+            ctx_size += n_audio_layer*(n_audio_state*n_audio_state*ggml_type_sizef(wtype));         // attn_ln_1_w
             ctx_size += n_audio_layer*(              n_audio_state*ggml_type_size(GGML_TYPE_F32)); // attn_ln_1_b
         }
 
@@ -884,38 +1018,38 @@ static bool whisper_model_load(struct whisper_model_loader * loader, whisper_con
             ctx_size += n_text_layer*(n_text_state*ggml_type_size(GGML_TYPE_F32)); // mlp_ln_w
             ctx_size += n_text_layer*(n_text_state*ggml_type_size(GGML_TYPE_F32)); // mlp_ln_b
 
-            ctx_size += n_text_layer*(4*n_text_state*n_text_state*ggml_type_size(wtype));         // mlp_0_w
+            ctx_size += n_text_layer*(4*n_text_state*n_text_state*ggml_type_sizef(wtype));         // mlp_0_w
             ctx_size += n_text_layer*(             4*n_text_state*ggml_type_size(GGML_TYPE_F32)); // mlp_0_b
 
-            ctx_size += n_text_layer*(4*n_text_state*n_text_state*ggml_type_size(wtype));         // mlp_1_w
+            ctx_size += n_text_layer*(4*n_text_state*n_text_state*ggml_type_sizef(wtype));         // mlp_1_w
             ctx_size += n_text_layer*(               n_text_state*ggml_type_size(GGML_TYPE_F32)); // mlp_1_b
 
             ctx_size += n_text_layer*(n_text_state*ggml_type_size(GGML_TYPE_F32)); // attn_ln_0_w
             ctx_size += n_text_layer*(n_text_state*ggml_type_size(GGML_TYPE_F32)); // attn_ln_0_b
 
-            ctx_size += n_text_layer*(n_text_state*n_text_state*ggml_type_size(wtype));         // attn_q_w
+            ctx_size += n_text_layer*(n_text_state*n_text_state*ggml_type_sizef(wtype));         // attn_q_w
             ctx_size += n_text_layer*(             n_text_state*ggml_type_size(GGML_TYPE_F32)); // attn_q_b
 
-            ctx_size += n_text_layer*(n_text_state*n_text_state*ggml_type_size(wtype)); // attn_k_w
+            ctx_size += n_text_layer*(n_text_state*n_text_state*ggml_type_sizef(wtype)); // attn_k_w
 
-            ctx_size += n_text_layer*(n_text_state*n_text_state*ggml_type_size(wtype));         // attn_v_w
+            ctx_size += n_text_layer*(n_text_state*n_text_state*ggml_type_sizef(wtype));         // attn_v_w
             ctx_size += n_text_layer*(             n_text_state*ggml_type_size(GGML_TYPE_F32)); // attn_v_b
 
-            ctx_size += n_text_layer*(n_text_state*n_text_state*ggml_type_size(wtype));         // attn_ln_1_w
+            ctx_size += n_text_layer*(n_text_state*n_text_state*ggml_type_sizef(wtype));         // attn_ln_1_w
             ctx_size += n_text_layer*(             n_text_state*ggml_type_size(GGML_TYPE_F32)); // attn_ln_1_b
                                                                                                 //
             ctx_size += n_text_layer*(n_text_state*ggml_type_size(GGML_TYPE_F32)); // cross_attn_ln_0_w
             ctx_size += n_text_layer*(n_text_state*ggml_type_size(GGML_TYPE_F32)); // cross_attn_ln_0_b
 
-            ctx_size += n_text_layer*(n_text_state*n_text_state*ggml_type_size(wtype));         // cross_attn_q_w
+            ctx_size += n_text_layer*(n_text_state*n_text_state*ggml_type_sizef(wtype));         // cross_attn_q_w
             ctx_size += n_text_layer*(             n_text_state*ggml_type_size(GGML_TYPE_F32)); // cross_attn_q_b
 
-            ctx_size += n_text_layer*(n_text_state*n_text_state*ggml_type_size(wtype)); // cross_attn_k_w
+            ctx_size += n_text_layer*(n_text_state*n_text_state*ggml_type_sizef(wtype)); // cross_attn_k_w
 
-            ctx_size += n_text_layer*(n_text_state*n_text_state*ggml_type_size(wtype));         // cross_attn_v_w
+            ctx_size += n_text_layer*(n_text_state*n_text_state*ggml_type_sizef(wtype));         // cross_attn_v_w
             ctx_size += n_text_layer*(             n_text_state*ggml_type_size(GGML_TYPE_F32)); // cross_attn_v_b
 
-            ctx_size += n_text_layer*(n_text_state*n_text_state*ggml_type_size(wtype));         // cross_attn_ln_1_w
+            ctx_size += n_text_layer*(n_text_state*n_text_state*ggml_type_sizef(wtype));         // cross_attn_ln_1_w
             ctx_size += n_text_layer*(             n_text_state*ggml_type_size(GGML_TYPE_F32)); // cross_attn_ln_1_b
         }
 
@@ -962,10 +1096,10 @@ static bool whisper_model_load(struct whisper_model_loader * loader, whisper_con
         {
             model.e_pe = ggml_new_tensor_2d(ctx, GGML_TYPE_F32, n_audio_state, n_audio_ctx);
 
-            model.e_conv_1_w = ggml_new_tensor_3d(ctx, wtype,         3, n_mels, n_audio_state);
+            model.e_conv_1_w = ggml_new_tensor_3d(ctx, itype,         3, n_mels, n_audio_state);
             model.e_conv_1_b = ggml_new_tensor_2d(ctx, GGML_TYPE_F32, 1, n_audio_state);
 
-            model.e_conv_2_w = ggml_new_tensor_3d(ctx, wtype,         3, n_audio_state, n_audio_state);
+            model.e_conv_2_w = ggml_new_tensor_3d(ctx, itype,         3, n_audio_state, n_audio_state);
             model.e_conv_2_b = ggml_new_tensor_2d(ctx, GGML_TYPE_F32, 1, n_audio_state);
 
             model.e_ln_w = ggml_new_tensor_1d(ctx, GGML_TYPE_F32, n_audio_state);
@@ -1181,11 +1315,19 @@ static bool whisper_model_load(struct whisper_model_loader * loader, whisper_con
                 return false;
             }
 
-            const size_t bpe = (ftype == 0) ? sizeof(float) : sizeof(ggml_fp16_t);
+            const ggml_type type = whisper_ftype_to_ggml_type(ftype);
+
+            if (type != tensor->type) {
+                fprintf(stderr, "%s: tensor '%s' has wrong type in model file: got %s, expected %s\n",
+                        __func__, name.data(), ggml_type_name(type), ggml_type_name(tensor->type));
+                return false;
+            }
+
+            const size_t nbytes = (nelements/ggml_blck_size(type))*ggml_type_size(type);
 
-            if (nelements*bpe != ggml_nbytes(tensor)) {
+            if (nbytes != ggml_nbytes(tensor)) {
                 fprintf(stderr, "%s: tensor '%s' has wrong size in model file: got %zu, expected %zu\n",
-                        __func__, name.data(), ggml_nbytes(tensor), nelements*bpe);
+                        __func__, name.data(), ggml_nbytes(tensor), nbytes);
                 return false;
             }
 
@@ -1213,23 +1355,97 @@ static bool whisper_model_load(struct whisper_model_loader * loader, whisper_con
     return true;
 }
 
-// evaluate the encoder
+// select the tuned kernels of the mul_mat nodes - measure the missing ones first when called from whisper_tune()
+// must be called before whisper_graph_plan(), since the work buffer depends on the kernels
+static void whisper_graph_tune(whisper_context & wctx, struct ggml_cgraph & gf) {
+    if (wctx.tune && wctx.tune_n_iter > 0) {
+        ggml_tune_graph(wctx.tune, &gf, wctx.tune_n_iter);
+    }
+
+    gf.tune = wctx.tune;
+}
+
+// place the data of the intermediate tensors of the graph in buf_alloc
+// the buffer is grown if the graph needs more memory than the graphs measured by whisper_init()
+static bool whisper_graph_plan(whisper_context & wctx, struct ggml_context * ctx, struct ggml_cgraph & gf) {
+    const size_t size = ggml_graph_plan(ctx, &gf, nullptr, 0);
+
+    if (size > wctx.buf_alloc.size()) {
+        wctx.buf_alloc.resize(size);
+    }
+
+    return ggml_graph_plan(ctx, &gf, wctx.buf_alloc.data(), wctx.buf_alloc.size()) <= wctx.buf_alloc.size();
+}
+
+// map the nodes of a built graph to their sections
+// must be called before ggml_graph_plan(), which can reorder the nodes
 //
-// given audio recording (more specifically, its log mel spectrogram), runs forward pass of the encoder
-// part of the transformer model and returns the encoded features
+//   - n_nodes: number of nodes of the graph after each section (see whisper_graph_encoder_build())
 //
-//   - model:      the model
-//   - n_threads:  number of threads to use
-//   - mel_offset: offset in the mel spectrogram (i.e. audio offset)
+static std::map<struct ggml_tensor *, int> whisper_graph_sections(
+    const struct ggml_cgraph & gf,
+      const std::vector<int> & n_nodes) {
+    std::map<struct ggml_tensor *, int> sections;
+
+    int is = 0;
+
+    for (int i = 0; i < gf.n_nodes; ++i) {
+        while (is < (int) n_nodes.size() - 1 && i >= n_nodes[is]) {
+            is++;
+        }
+
+        sections[gf.nodes[i]] = is;
+    }
+
+    return sections;
+}
+
+// add the time of the nodes of a computed graph to the profile and reset their counters
 //
-static bool whisper_encode(
-        whisper_context & wctx,
-              const int   mel_offset,
-              const int   n_threads) {
-    const int64_t t_start_us = ggml_time_us();
+//   - sections: the section of each node of the graph (see whisper_graph_sections())
+//   - il0:      index of the first section of the graph in profile_layers
+//
+static void whisper_profile_add(
+                       whisper_context & wctx,
+                    struct ggml_cgraph & gf,
+    const std::map<ggml_tensor *, int> & sections,
+                             const int   il0) {
+    for (int i = 0; i < gf.n_nodes; ++i) {
+        struct ggml_tensor * node = gf.nodes[i];
+
+        auto & op = wctx.profile_ops[node->op];
+
+        op.n_calls++;
+        op.t_us += node->perf_time_us;
+
+        const auto it = sections.find(node);
+        if (it != sections.end()) {
+            auto & layer = wctx.profile_layers[il0 + it->second];
+
+            layer.n_calls++;
+            layer.t_us += node->perf_time_us;
+        }
 
+        node->perf_runs    = 0;
+        node->perf_cycles  = 0;
+        node->perf_time_us = 0;
+    }
+}
+
+// build the encoder graph
+//
+// the data of the intermediate tensors is not allocated in ctx0 - whisper_graph_plan() places it in buf_alloc,
+// reusing the memory of the tensors of the previous layers
+// returns the mel spectrogram input of the graph
+//
+//   - n_nodes: number of nodes of the graph after the convolutions, each layer and the output
+//
+static struct ggml_tensor * whisper_graph_encoder_build(
+        whisper_context & wctx,
+    struct ggml_context * ctx0,
+     struct ggml_cgraph & gf,
+       std::vector<int> & n_nodes) {
     const auto & model   = wctx.model;
-    const auto & mel_inp = wctx.mel;
     const auto & hparams = model.hparams;
 
     const int n_ctx   = wctx.exp_n_audio_ctx > 0 ? wctx.exp_n_audio_ctx : hparams.n_audio_ctx;
@@ -1238,51 +1454,18 @@ static bool whisper_encode(
     const int n_layer = hparams.n_audio_layer;
 
     const int n_mels = hparams.n_mels;
-    assert(mel_inp.n_mel == n_mels);
-
-    struct ggml_init_params params;
-    params.mem_size   = wctx.buf_compute.size();
-    params.mem_buffer = wctx.buf_compute.data();
-
-    struct ggml_context * ctx0 = ggml_init(params);
 
     struct ggml_tensor * mel = ggml_new_tensor_2d(ctx0, GGML_TYPE_F32, 2*n_ctx, n_mels);
     assert(mel->type == GGML_TYPE_F32);
-    {
-        float * dst = (float *) mel->data;
-        memset(dst, 0, ggml_nbytes(mel));
 
-        const int i0 = std::min(mel_offset, mel_inp.n_len);
-        const int i1 = std::min(mel_offset + 2*n_ctx, mel_inp.n_len);
-
-        for (int j = 0; j < mel_inp.n_mel; ++j) {
-            for (int i = i0; i < i1; ++i) {
-                dst[j*2*n_ctx + (i - i0)] = mel_inp.data[j*mel_inp.n_len + i];
-            }
-        }
-    }
+    ggml_set_no_alloc(ctx0, true);
 
     struct ggml_tensor * cur;
 
     // convolution + gelu
     {
-        cur = ggml_conv_1d_1s(ctx0, model.e_conv_1_w, mel);
-        cur = ggml_add(ctx0,
-                ggml_repeat(ctx0,
-                    model.e_conv_1_b,
-                    cur),
-                cur);
-
-        cur = ggml_gelu(ctx0, cur);
-
-        cur = ggml_conv_1d_2s(ctx0, model.e_conv_2_w, cur);
-        cur = ggml_add(ctx0,
-                ggml_repeat(ctx0,
-                    model.e_conv_2_b,
-                    cur),
-                cur);
-
-        cur = ggml_gelu(ctx0, cur);
+        cur = ggml_conv_1d_1s_bias(ctx0, model.e_conv_1_w, mel, model.e_conv_1_b, true);
+        cur = ggml_conv_1d_2s_bias(ctx0, model.e_conv_2_w, cur, model.e_conv_2_b, true);
     }
 
     // ===================================================================
@@ -1310,158 +1493,130 @@ static bool whisper_encode(
     // original:
     //cur = ggml_add(ctx0, model.e_pe, ggml_transpose(ctx0, cur));
 
+    ggml_build_forward_expand(&gf, cur);
+    n_nodes.push_back(gf.n_nodes);
+
     struct ggml_tensor * inpL = cur;
 
     for (int il = 0; il < n_layer; ++il) {
         const auto & layer = model.layers_encoder[il];
 
-        // create separate context for each layer to reduce memory usage
-
-        struct ggml_init_params paramsL;
-        paramsL.mem_size   = wctx.buf_compute_layer.size();
-        paramsL.mem_buffer = wctx.buf_compute_layer.data();
-
-        struct ggml_context * ctxL = ggml_init(paramsL);
-
         // norm
         {
-            cur = ggml_norm(ctxL, inpL);
-
-            // cur = ln_0_w*cur + ln_0_b
-            cur = ggml_add(ctxL,
-                    ggml_mul(ctxL,
-                        ggml_repeat(ctxL, layer.attn_ln_0_w, cur),
-                        cur),
-                    ggml_repeat(ctxL, layer.attn_ln_0_b, cur));
+            cur = ggml_norm_affine(ctx0, inpL, layer.attn_ln_0_w, layer.attn_ln_0_b);
         }
 
         // self-attention
         {
-            struct ggml_tensor * Qcur = ggml_mul_mat(ctxL,
+            struct ggml_tensor * Qcur = ggml_mul_mat_bias(ctx0,
                     layer.attn_q_w,
-                    cur);
-
-            Qcur = ggml_add(ctxL,
-                    ggml_repeat(ctxL,
-                        layer.attn_q_b,
-                        Qcur),
-                    Qcur);
+                    cur,
+                    layer.attn_q_b,
+                    false);
 
-            //Qcur = ggml_scale(ctxL, Qcur, ggml_new_f32(ctxL, pow(float(n_state)/n_head, -0.25)));
+            //Qcur = ggml_scale(ctx0, Qcur, ggml_new_f32(ctx0, pow(float(n_state)/n_head, -0.25)));
 
             // note: no bias for Key
-            struct ggml_tensor * Kcur = ggml_mul_mat(ctxL,
+            struct ggml_tensor * Kcur = ggml_mul_mat(ctx0,
                     layer.attn_k_w,
                     cur);
 
-            //Kcur = ggml_scale(ctxL, Kcur, ggml_new_f32(ctxL, pow(float(n_state)/n_head, -0.25)));
+            //Kcur = ggml_scale(ctx0, Kcur, ggml_new_f32(ctx0, pow(float(n_state)/n_head, -0.25)));
 
-            struct ggml_tensor * Vcur = ggml_mul_mat(ctxL,
+            struct ggml_tensor * Vcur = ggml_mul_mat_bias(ctx0,
                     layer.attn_v_w,
-                    cur);
-
-            Vcur = ggml_add(ctxL,
-                    ggml_repeat(ctxL,
-                        layer.attn_v_b,
-                        Vcur),
-                    Vcur);
+                    cur,
+                    layer.attn_v_b,
+                    false);
 
             // ------
 
 #ifdef WHISPER_USE_FLASH_ATTN
             struct ggml_tensor * Q =
-                ggml_permute(ctxL,
-                        ggml_cpy(ctxL,
+                ggml_permute(ctx0,
+                        ggml_cpy(ctx0,
                             Qcur,
-                            ggml_new_tensor_3d(ctxL, wctx.wtype, n_state/n_head, n_head, n_ctx)),
+                            ggml_new_tensor_3d(ctx0, wctx.itype, n_state/n_head, n_head, n_ctx)),
                         0, 2, 1, 3);
 
             struct ggml_tensor * K =
-                ggml_permute(ctxL,
-                        ggml_cpy(ctxL,
+                ggml_permute(ctx0,
+                        ggml_cpy(ctx0,
                             Kcur,
-                            ggml_new_tensor_3d(ctxL, wctx.wtype, n_state/n_head, n_head, n_ctx)),
+                            ggml_new_tensor_3d(ctx0, wctx.itype, n_state/n_head, n_head, n_ctx)),
                         0, 2, 1, 3);
 
             struct ggml_tensor * V =
-                ggml_cpy(ctxL,
-                        ggml_permute(ctxL,
-                            ggml_reshape_3d(ctxL,
+                ggml_cpy(ctx0,
+                        ggml_permute(ctx0,
+                            ggml_reshape_3d(ctx0,
                                 Vcur,
                                 n_state/n_head, n_head, n_ctx),
                             1, 2, 0, 3),
-                        ggml_new_tensor_3d(ctxL, wctx.wtype, n_ctx, n_state/n_head, n_head)
+                        ggml_new_tensor_3d(ctx0, wctx.itype, n_ctx, n_state/n_head, n_head)
                         );
 
-            struct ggml_tensor * KQV = ggml_flash_attn(ctxL, Q, K, V, false);
+            struct ggml_tensor * KQV = ggml_flash_attn(ctx0, Q, K, V, false);
 #else
             struct ggml_tensor * Q =
-                ggml_permute(ctxL,
-                        ggml_cpy(ctxL,
+                ggml_permute(ctx0,
+                        ggml_cpy(ctx0,
                             Qcur,
-                            ggml_new_tensor_3d(ctxL, GGML_TYPE_F32, n_state/n_head, n_head, n_ctx)),
+                            ggml_new_tensor_3d(ctx0, GGML_TYPE_F32, n_state/n_head, n_head, n_ctx)),
                         0, 2, 1, 3);
 
             struct ggml_tensor * K =
-                ggml_permute(ctxL,
-                        ggml_cpy(ctxL,
+                ggml_permute(ctx0,
+                        ggml_cpy(ctx0,
                             Kcur,
-                            ggml_new_tensor_3d(ctxL, wctx.wtype, n_state/n_head, n_head, n_ctx)),
+                            ggml_new_tensor_3d(ctx0, wctx.itype, n_state/n_head, n_head, n_ctx)),
                         0, 2, 1, 3);
 
             // K * Q
-            struct ggml_tensor * KQ = ggml_mul_mat(ctxL, K, Q);
-
-            struct ggml_tensor * KQ_scaled =
-                ggml_scale(ctxL,
-                        KQ,
-                        ggml_new_f32(ctxL, 1.0f/sqrt(float(n_state)/n_head))
-                        );
+            struct ggml_tensor * KQ = ggml_mul_mat(ctx0, K, Q);
 
-            struct ggml_tensor * KQ_soft_max = ggml_soft_max(ctxL, KQ_scaled);
+            struct ggml_tensor * KQ_soft_max = ggml_soft_max_ext(ctx0, KQ, 1.0f/sqrt(float(n_state)/n_head), -1);
 
             //struct ggml_tensor * V_trans =
-            //    ggml_permute(ctxL,
-            //            ggml_cpy(ctxL,
+            //    ggml_permute(ctx0,
+            //            ggml_cpy(ctx0,
             //                Vcur,
-            //                ggml_new_tensor_3d(ctxL, wctx.wtype, n_state/n_head, n_head, n_ctx)),
+            //                ggml_new_tensor_3d(ctx0, wctx.itype, n_state/n_head, n_head, n_ctx)),
             //            1, 2, 0, 3);
 
-            //struct ggml_tensor * KQV = ggml_mul_mat(ctxL, V_trans, KQ_soft_max);
+            //struct ggml_tensor * KQV = ggml_mul_mat(ctx0, V_trans, KQ_soft_max);
 
             struct ggml_tensor * V =
-                ggml_cpy(ctxL,
-                        ggml_permute(ctxL,
-                            ggml_reshape_3d(ctxL,
+                ggml_cpy(ctx0,
+                        ggml_permute(ctx0,
+                            ggml_reshape_3d(ctx0,
                                 Vcur,
                                 n_state/n_head, n_head, n_ctx),
                             0, 2, 1, 3),
-                        ggml_new_tensor_3d(ctxL, wctx.wtype, n_state/n_head, n_ctx, n_head)
+                        ggml_new_tensor_3d(ctx0, wctx.itype, n_state/n_head, n_ctx, n_head)
                         );
 
-            struct ggml_tensor * KQV = ggml_mul_mat(ctxL, ggml_transpose(ctxL, V), KQ_soft_max);
+            struct ggml_tensor * KQV = ggml_mul_mat(ctx0, ggml_transpose(ctx0, V), KQ_soft_max);
 #endif
 
-            struct ggml_tensor * KQV_merged = ggml_permute(ctxL, KQV, 0, 2, 1, 3);
+            struct ggml_tensor * KQV_merged = ggml_permute(ctx0, KQV, 0, 2, 1, 3);
 
-            cur = ggml_cpy(ctxL,
+            cur = ggml_cpy(ctx0,
                     KQV_merged,
-                    ggml_new_tensor_2d(ctxL, GGML_TYPE_F32, n_state, n_ctx));
+                    ggml_new_tensor_2d(ctx0, GGML_TYPE_F32, n_state, n_ctx));
         }
 
         // projection
         {
-            cur = ggml_mul_mat(ctxL,
+            cur = ggml_mul_mat_bias(ctx0,
                     layer.attn_ln_1_w,
-                    cur);
-
-            cur = ggml_add(ctxL,
-                    ggml_repeat(ctxL, layer.attn_ln_1_b, cur),
-                    cur);
+                    cur,
+                    layer.attn_ln_1_b,
+                    false);
         }
 
         // add the input
-        cur = ggml_add(ctxL, cur, inpL);
+        cur = ggml_add(ctx0, cur, inpL);
 
         struct ggml_tensor * inpFF = cur;
 
@@ -1469,151 +1624,165 @@ static bool whisper_encode(
         {
             // norm
             {
-                cur = ggml_norm(ctxL, inpFF);
-
-                // cur = mlp_ln_w*cur + mlp_ln_b
-                cur = ggml_add(ctxL,
-                        ggml_mul(ctxL,
-                            ggml_repeat(ctxL, layer.mlp_ln_w, cur),
-                            cur),
-                        ggml_repeat(ctxL, layer.mlp_ln_b, cur));
+                cur = ggml_norm_affine(ctx0, inpFF, layer.mlp_ln_w, layer.mlp_ln_b);
             }
 
 #ifdef WHISPER_USE_FLASH_FF
-            cur = ggml_flash_ff(ctxL,
-                    ggml_cpy(ctxL, cur, ggml_new_tensor_2d(ctxL, wctx.wtype, n_state, N)),
+            cur = ggml_flash_ff(ctx0,
+                    ggml_cpy(ctx0, cur, ggml_new_tensor_2d(ctx0, wctx.itype, n_state, N)),
                     layer.mlp_0_w, layer.mlp_0_b, layer.mlp_1_w, layer.mlp_1_b);
 #else
             // fully connected
-            cur = ggml_mul_mat(ctxL,
+            cur = ggml_mul_mat_bias(ctx0,
                     layer.mlp_0_w,
-                    cur);
-
-            cur = ggml_add(ctxL,
-                    ggml_repeat(ctxL, layer.mlp_0_b, cur),
-                    cur);
-
-            // GELU activation
-            cur = ggml_gelu(ctxL, cur);
+                    cur,
+                    layer.mlp_0_b,
+                    true); // GELU activation
 
             // projection
-            cur = ggml_mul_mat(ctxL,
+            cur = ggml_mul_mat_bias(ctx0,
                     layer.mlp_1_w,
-                    cur);
-
-            cur = ggml_add(ctxL,
-                    ggml_repeat(ctxL, layer.mlp_1_b, cur),
-                    cur);
+                    cur,
+                    layer.mlp_1_b,
+                    false);
 #endif
         }
 
         // output from this layer
-        struct ggml_tensor * inpO = ggml_add(ctxL, cur, inpFF);
+        // input for next layer
+        inpL = ggml_add(ctx0, cur, inpFF);
 
-        {
-            struct ggml_cgraph gf = {};
-            gf.n_threads = n_threads;
+        ggml_build_forward_expand(&gf, inpL);
+        n_nodes.push_back(gf.n_nodes);
+    }
 
-            ggml_build_forward_expand(&gf, inpO);
-            ggml_graph_compute       (ctxL, &gf);
+    cur = inpL;
 
-            //ggml_graph_print(&gf);
-        }
+    // norm
+    {
+        cur = ggml_norm_affine(ctx0, cur, model.e_ln_w, model.e_ln_b);
+    }
 
-        // TODO: this is a hack to have per-layer computation graphs - need to come up with something better
-        // input for next layer (inpO -> inpL)
-        memcpy(inpL->data, inpO->data, ggml_nbytes(inpL));
-        inpL->op = GGML_OP_NONE;
-        inpL->src0 = nullptr;
-        inpL->src1 = nullptr;
+    // pre-compute cross-attention memory
+    for (int il = 0; il < model.hparams.n_text_layer; ++il) {
+        auto & layer = model.layers_decoder[il];
 
-        //printf("%s: - used_mem(%d) = %f MB\n", __func__, il, ggml_used_mem(ctxL)/1024.0/1024.0);
+        struct ggml_tensor * Kcross = ggml_mul_mat(ctx0,
+                layer.cross_attn_k_w,
+                cur);
 
-        ggml_free(ctxL);
-    }
+#ifndef WHISPER_USE_FLASH_ATTN
+        // with flash attention the scale is applied by ggml_flash_attn
+        Kcross = ggml_scale(ctx0, Kcross, ggml_new_f32(ctx0, pow(float(n_state)/n_head, -0.25)));
+#endif
 
-    cur = inpL;
+        struct ggml_tensor * Vcross = ggml_mul_mat_bias(ctx0,
+                layer.cross_attn_v_w,
+                cur,
+                layer.cross_attn_v_b,
+                false);
 
-    // norm
-    {
-        cur = ggml_norm(ctx0, cur);
+#ifdef WHISPER_USE_FLASH_ATTN
+        // ggml_flash_attn takes V transposed: [n_ctx, n_state/n_head, n_head]
+        Vcross = ggml_permute(ctx0,
+                ggml_reshape_3d(ctx0, Vcross, n_state/n_head, n_head, n_ctx),
+                1, 2, 0, 3);
+#endif
+
+        //struct ggml_tensor * k = ggml_view_1d(ctx0, wctx.kv_cross.k, n_state*n_ctx, (ggml_element_size(wctx.kv_cross.k)*n_state)*(il*hparams.n_audio_ctx + iter*n_ctx));
+        //struct ggml_tensor * v = ggml_view_1d(ctx0, wctx.kv_cross.v, n_state*n_ctx, (ggml_element_size(wctx.kv_cross.v)*n_state)*(il*hparams.n_audio_ctx + iter*n_ctx));
+        struct ggml_tensor * k = ggml_view_1d(ctx0, wctx.kv_cross.k, n_state*n_ctx, (ggml_element_size(wctx.kv_cross.k)*n_state)*(il*n_ctx));
+        struct ggml_tensor * v = ggml_view_1d(ctx0, wctx.kv_cross.v, n_state*n_ctx, (ggml_element_size(wctx.kv_cross.v)*n_state)*(il*n_ctx));
 
-        // cur = ln_f_g*cur + ln_f_b
-        cur = ggml_add(ctx0,
-                ggml_mul(ctx0,
-                    ggml_repeat(ctx0, model.e_ln_w, cur),
-                    cur),
-                ggml_repeat(ctx0, model.e_ln_b, cur));
+        ggml_build_forward_expand(&gf, ggml_cpy(ctx0, Kcross, k));
+        ggml_build_forward_expand(&gf, ggml_cpy(ctx0, Vcross, v));
     }
 
-    // run the computation
-    {
-        struct ggml_cgraph gf = {};
-        gf.n_threads = n_threads;
+    n_nodes.push_back(gf.n_nodes);
 
-        ggml_build_forward_expand(&gf, cur);
-        ggml_graph_compute       (ctx0, &gf);
+    ggml_set_no_alloc(ctx0, false);
 
-        //ggml_graph_print(&gf);
-    }
+    return mel;
+}
 
-    // cur
-    //{
-    //    printf("ne0 = %d\n", cur->ne[0]);
-    //    printf("ne1 = %d\n", cur->ne[1]);
-    //    for (int i = 0; i < 10; ++i) {
-    //        printf("%8.4f ", ((float *)(cur->data))[i]);
-    //    }
-    //    printf("... ");
-    //    for (int i = cur->ne[0] - 10; i < cur->ne[0]; ++i) {
-    //        printf("%8.4f ", ((float *)(cur->data))[i]);
-    //    }
-    //    printf("\n");
-    //}
+// evaluate the encoder
+//
+// given audio recording (more specifically, its log mel spectrogram), runs forward pass of the encoder
+// part of the transformer model and returns the encoded features
+//
+//   - model:      the model
+//   - n_threads:  number of threads to use
+//   - mel_offset: offset in the mel spectrogram (i.e. audio offset)
+//
+static bool whisper_encode(
+        whisper_context & wctx,
+              const int   mel_offset,
+              const int   n_threads) {
+    const int64_t t_start_us = ggml_time_us();
 
-    // pre-compute cross-attention memory
-    {
-        struct ggml_cgraph gf = {};
-        gf.n_threads = n_threads;
+    struct ggml_threadpool * threadpool = whisper_threadpool(wctx, n_threads);
 
-        // TODO: hack to disconnect the encoded features from the previous graph
-        cur->op = GGML_OP_NONE;
-        cur->src0 = nullptr;
-        cur->src1 = nullptr;
+    // the encoder reuses the memory of the decoder graph
+    whisper_graph_decoder_free(wctx.graph_decoder);
 
-        for (int il = 0; il < model.hparams.n_text_layer; ++il) {
-            auto & layer = model.layers_decoder[il];
+    const auto & mel_inp = wctx.mel;
+    const auto & hparams = wctx.model.hparams;
 
-            struct ggml_tensor * Kcross = ggml_mul_mat(ctx0,
-                    layer.cross_attn_k_w,
-                    cur);
+    const int n_ctx = wctx.exp_n_audio_ctx > 0 ? wctx.exp_n_audio_ctx : hparams.n_audio_ctx;
 
-            Kcross = ggml_scale(ctx0, Kcross, ggml_new_f32(ctx0, pow(float(n_state)/n_head, -0.25)));
+    assert(mel_inp.n_mel == hparams.n_mels);
 
-            struct ggml_tensor * Vcross = ggml_mul_mat(ctx0,
-                    layer.cross_attn_v_w,
-                    cur);
+    struct ggml_init_params params;
+    params.mem_size   = wctx.buf_compute.size();
+    params.mem_buffer = wctx.buf_compute.data();
+
+    struct ggml_context * ctx0 = ggml_init(params);
+
+    struct ggml_cgraph gf = {};
+    gf.n_threads  = n_threads;
+    gf.threadpool = threadpool;
+    gf.trace      = wctx.trace;
+    gf.wcache     = wctx.wcache;
+    gf.perf       = wctx.profile;
+
+    std::vector<int> n_nodes;
+
+    struct ggml_tensor * mel = whisper_graph_encoder_build(wctx, ctx0, gf, n_nodes);
 
-            Vcross = ggml_add(ctx0,
-                    ggml_repeat(ctx0,
-                        layer.cross_attn_v_b,
-                        Vcross),
-                    Vcross);
+    const auto sections = whisper_graph_sections(gf, n_nodes);
 
-            //struct ggml_tensor * k = ggml_view_1d(ctx0, wctx.kv_cross.k, n_state*n_ctx, (ggml_element_size(wctx.kv_cross.k)*n_state)*(il*hparams.n_audio_ctx + iter*n_ctx));
-            //struct ggml_tensor * v = ggml_view_1d(ctx0, wctx.kv_cross.v, n_state*n_ctx, (ggml_element_size(wctx.kv_cross.v)*n_state)*(il*hparams.n_audio_ctx + iter*n_ctx));
-            struct ggml_tensor * k = ggml_view_1d(ctx0, wctx.kv_cross.k, n_state*n_ctx, (ggml_element_size(wctx.kv_cross.k)*n_state)*(il*n_ctx));
-            struct ggml_tensor * v = ggml_view_1d(ctx0, wctx.kv_cross.v, n_state*n_ctx, (ggml_element_size(wctx.kv_cross.v)*n_state)*(il*n_ctx));
+    whisper_graph_tune(wctx, gf);
 
-            ggml_build_forward_expand(&gf, ggml_cpy(ctx0, Kcross, k));
-            ggml_build_forward_expand(&gf, ggml_cpy(ctx0, Vcross, v));
+    if (!whisper_graph_plan(wctx, ctx0, gf)) {
+        fprintf(stderr, "%s: failed to allocate the compute buffer\n", __func__);
+        ggml_free(ctx0);
+        return false;
+    }
+
+    {
+        float * dst = (float *) mel->data;
+        memset(dst, 0, ggml_nbytes(mel));
+
+        const int i0 = std::min(mel_offset, mel_inp.n_len);
+        const int i1 = std::min(mel_offset + 2*n_ctx, mel_inp.n_len);
+
+        for (int j = 0; j < mel_inp.n_mel; ++j) {
+            for (int i = i0; i < i1; ++i) {
+                dst[j*2*n_ctx + (i - i0)] = mel_inp.data[j*mel_inp.n_len + i];
+            }
         }
+    }
 
+    // run the computation
+    {
         ggml_graph_compute(ctx0, &gf);
+
         //ggml_graph_print(&gf);
     }
 
-    ////////////////////////////////////////////////////////////////////////////
+    if (wctx.profile) {
+        whisper_profile_add(wctx, gf, sections, 0);
+    }
 
     //printf("%s: used_mem = %f MB\n", __func__, ggml_used_mem(ctx0)/1024.0/1024.0);
 
@@ -1621,38 +1790,37 @@ static bool whisper_encode(
 
     wctx.t_encode_us += ggml_time_us() - t_start_us;
 
+    whisper_trace_add(wctx, "encode", t_start_us);
+
     return true;
 }
 
-// evaluate the decoder
+// set the strides of a tensor with a contiguous layout
+static void whisper_tensor_set_contiguous(struct ggml_tensor * t) {
+    t->nb[0] = ggml_type_size(t->type);
+    t->nb[1] = t->nb[0]*(t->ne[0]/ggml_blck_size(t->type));
+    for (int i = 2; i < GGML_MAX_DIMS; i++) {
+        t->nb[i] = t->nb[i - 1]*t->ne[i - 1];
+    }
+}
+
+// build the decoder graph for n_tokens new tokens
 //
-// given text prompt + audio features -> predicts the probabilities for the next token
+// the graph is built for the largest n_past, so that all tensors that depend on n_past have their largest size
+// whisper_graph_decoder_set_kv() updates them for the actual n_past before each computation
 //
-//   - model:      the model
-//   - n_threads:  number of threads to use
-//   - tokens:     text prompt
-//   - n_tokens:   number of tokens in the prompt
-//   - n_past:     number of past tokens to prefix the prompt with
-//
-static bool whisper_decode(
+static bool whisper_graph_decoder_build(
         whisper_context & wctx,
-        whisper_decoder & decoder,
-    const whisper_token * tokens,
+        const whisper_kv_cache & kv_self,
               const int   n_tokens,
-              const int   n_past,
+              const int   n_audio_ctx,
               const int   n_threads) {
-    const int64_t t_start_us = ggml_time_us();
-
     const auto & model   = wctx.model;
     const auto & hparams = model.hparams;
 
-    auto & kv_self = decoder.kv_self;
+    auto & graph = wctx.graph_decoder;
 
-    WHISPER_ASSERT(!!kv_self.ctx);
-
-    auto & logits_out = wctx.logits;
-
-    const int n_vocab = hparams.n_vocab;
+    whisper_graph_decoder_free(graph);
 
     const int n_ctx   = hparams.n_text_ctx;
     const int n_state = hparams.n_text_state;
@@ -1660,9 +1828,14 @@ static bool whisper_decode(
     const int n_layer = hparams.n_text_layer;
 
     const int N = n_tokens;
-    const int M = wctx.exp_n_audio_ctx > 0 ? wctx.exp_n_audio_ctx : hparams.n_audio_ctx;
+    const int M = n_audio_ctx;
 
-    //WHISPER_PRINT_DEBUG("%s: n_past = %d, N = %d, M = %d, n_ctx = %d\n", __func__, n_past, N, M, n_ctx);
+    const int n_past = n_ctx - N;
+
+    if (n_past < 0) {
+        fprintf(stderr, "%s: too many tokens (%d), max = %d\n", __func__, N, n_ctx);
+        return false;
+    }
 
     struct ggml_init_params params;
     params.mem_size   = wctx.buf_compute.size();
@@ -1670,230 +1843,229 @@ static bool whisper_decode(
 
     struct ggml_context * ctx0 = ggml_init(params);
 
-    struct ggml_tensor * embd = ggml_new_tensor_1d(ctx0, GGML_TYPE_I32, N);
-    memcpy(embd->data, tokens, N*ggml_element_size(embd));
+    graph.ctx = ctx0;
+    graph.layers.resize(n_layer);
 
-    struct ggml_tensor * position = ggml_new_tensor_1d(ctx0, GGML_TYPE_I32, N);
-    for (int i = 0; i < N; ++i) {
-        ((int32_t *) position->data)[i] = n_past + i;
-    }
+    graph.embd     = ggml_new_tensor_1d(ctx0, GGML_TYPE_I32, N);
+    graph.position = ggml_new_tensor_1d(ctx0, GGML_TYPE_I32, N);
+
+    // the data of the intermediate tensors is placed by whisper_graph_plan()
+    ggml_set_no_alloc(ctx0, true);
 
     // token encoding + position encoding
     struct ggml_tensor * cur =
         ggml_add(ctx0,
-                ggml_get_rows(ctx0, model.d_te, embd),
-                ggml_get_rows(ctx0, model.d_pe, position));
+                ggml_get_rows(ctx0, model.d_te, graph.embd),
+                ggml_get_rows(ctx0, model.d_pe, graph.position));
 
     struct ggml_tensor * inpL = cur;
 
+    struct ggml_cgraph & gf = graph.gf;
+
+    gf = {};
+    gf.n_threads = n_threads;
+
+    std::vector<int> n_nodes;
+
+    ggml_build_forward_expand(&gf, cur);
+    n_nodes.push_back(gf.n_nodes);
+
     for (int il = 0; il < n_layer; ++il) {
         const auto & layer = model.layers_decoder[il];
 
-        struct ggml_init_params paramsL;
-        paramsL.mem_size   = wctx.buf_compute_layer.size();
-        paramsL.mem_buffer = wctx.buf_compute_layer.data();
-
-        struct ggml_context * ctxL = ggml_init(paramsL);
-        struct ggml_cgraph gf = {};
-        gf.n_threads = n_threads;
+        auto & layer_graph = graph.layers[il];
 
         // norm
         {
-            cur = ggml_norm(ctxL, inpL);
-
-            // cur = ln_0_w*cur + ln_0_b
-            cur = ggml_add(ctxL,
-                    ggml_mul(ctxL,
-                        ggml_repeat(ctxL, layer.attn_ln_0_w, cur),
-                        cur),
-                    ggml_repeat(ctxL, layer.attn_ln_0_b, cur));
+            cur = ggml_norm_affine(ctx0, inpL, layer.attn_ln_0_w, layer.attn_ln_0_b);
         }
 
         // self-attention
         {
-            struct ggml_tensor * Qcur = ggml_mul_mat(ctxL,
+            struct ggml_tensor * Qcur = ggml_mul_mat_bias(ctx0,
                     layer.attn_q_w,
-                    cur);
-
-            Qcur = ggml_add(ctxL,
-                    ggml_repeat(ctxL,
-                        layer.attn_q_b,
-                        Qcur),
-                    Qcur);
+                    cur,
+                    layer.attn_q_b,
+                    false);
 
-            Qcur = ggml_scale(ctxL, Qcur, ggml_new_f32(ctxL, pow(float(n_state)/n_head, -0.25)));
+            Qcur = ggml_scale(ctx0, Qcur, ggml_new_f32(ctx0, pow(float(n_state)/n_head, -0.25)));
 
             // note: no bias for Key
-            struct ggml_tensor * Kcur = ggml_mul_mat(ctxL,
+            struct ggml_tensor * Kcur = ggml_mul_mat(ctx0,
                     layer.attn_k_w,
                     cur);
 
-            Kcur = ggml_scale(ctxL, Kcur, ggml_new_f32(ctxL, pow(float(n_state)/n_head, -0.25)));
+            Kcur = ggml_scale(ctx0, Kcur, ggml_new_f32(ctx0, pow(float(n_state)/n_head, -0.25)));
 
-            struct ggml_tensor * Vcur = ggml_mul_mat(ctxL,
+            struct ggml_tensor * Vcur = ggml_mul_mat_bias(ctx0,
                     layer.attn_v_w,
-                    cur);
-
-            Vcur = ggml_add(ctxL,
-                    ggml_repeat(ctxL,
-                        layer.attn_v_b,
-                        Vcur),
-                    Vcur);
+                    cur,
+                    layer.attn_v_b,
+                    false);
 
             // store key and value to memory
             {
-                struct ggml_tensor * k = ggml_view_1d(ctxL, kv_self.k, N*n_state, (ggml_element_size(kv_self.k)*n_state)*(il*n_ctx + n_past));
-                struct ggml_tensor * v = ggml_view_1d(ctxL, kv_self.v, N*n_state, (ggml_element_size(kv_self.v)*n_state)*(il*n_ctx + n_past));
+                struct ggml_tensor * k = ggml_view_1d(ctx0, kv_self.k, N*n_state, (ggml_element_size(kv_self.k)*n_state)*(il*n_ctx + n_past));
+                struct ggml_tensor * v = ggml_view_1d(ctx0, kv_self.v, N*n_state, (ggml_element_size(kv_self.v)*n_state)*(il*n_ctx + n_past));
 
-                ggml_build_forward_expand(&gf, ggml_cpy(ctxL, Kcur, k));
-                ggml_build_forward_expand(&gf, ggml_cpy(ctxL, Vcur, v));
+                layer_graph.k = ggml_cpy(ctx0, Kcur, k);
+                layer_graph.v = ggml_cpy(ctx0, Vcur, v);
+
+                ggml_build_forward_expand(&gf, layer_graph.k);
+                ggml_build_forward_expand(&gf, layer_graph.v);
             }
 
             // ------
 
             struct ggml_tensor * Q =
-                ggml_permute(ctxL,
-                        ggml_cpy(ctxL,
+                ggml_permute(ctx0,
+                        ggml_cpy(ctx0,
                             Qcur,
-                            ggml_new_tensor_3d(ctxL, GGML_TYPE_F32, n_state/n_head, n_head, N)),
+                            ggml_new_tensor_3d(ctx0, GGML_TYPE_F32, n_state/n_head, n_head, N)),
                         0, 2, 1, 3);
 
             struct ggml_tensor * K =
-                ggml_permute(ctxL,
-                        ggml_reshape_3d(ctxL,
-                            ggml_view_1d(ctxL, kv_self.k, (n_past + N)*n_state, il*n_ctx*ggml_element_size(kv_self.k)*n_state),
+                ggml_permute(ctx0,
+                        ggml_reshape_3d(ctx0,
+                            ggml_view_1d(ctx0, kv_self.k, (n_past + N)*n_state, il*n_ctx*ggml_element_size(kv_self.k)*n_state),
                             n_state/n_head, n_head, n_past + N),
                         0, 2, 1, 3);
 
             // K * Q
-            struct ggml_tensor * KQ = ggml_mul_mat(ctxL, K, Q);
+            struct ggml_tensor * KQ = ggml_mul_mat(ctx0, K, Q);
 
             //struct ggml_tensor * KQ_scaled =
-            //    ggml_scale(ctxL,
+            //    ggml_scale(ctx0,
             //            KQ,
-            //            ggml_new_f32(ctxL, 1.0f/sqrt(float(n_state)/n_head))
+            //            ggml_new_f32(ctx0, 1.0f/sqrt(float(n_state)/n_head))
             //            );
 
-            struct ggml_tensor * KQ_masked = ggml_diag_mask_inf(ctxL, KQ, n_past);
+            struct ggml_tensor * KQ_soft_max = ggml_soft_max_ext(ctx0, KQ, 1.0f, n_past);
 
-            struct ggml_tensor * KQ_soft_max = ggml_soft_max(ctxL, KQ_masked);
+            layer_graph.K           = K;
+            layer_graph.KQ          = KQ;
+            layer_graph.KQ_soft_max = KQ_soft_max;
 
             struct ggml_tensor * V_trans =
-                ggml_permute(ctxL,
-                        ggml_reshape_3d(ctxL,
-                            ggml_view_1d(ctxL, kv_self.v, (n_past + N)*n_state, il*n_ctx*ggml_element_size(kv_self.v)*n_state),
+                ggml_permute(ctx0,
+                        ggml_reshape_3d(ctx0,
+                            ggml_view_1d(ctx0, kv_self.v, (n_past + N)*n_state, il*n_ctx*ggml_element_size(kv_self.v)*n_state),
                             n_state/n_head, n_head, n_past + N),
                         1, 2, 0, 3);
 
-            struct ggml_tensor * KQV = ggml_mul_mat(ctxL, V_trans, KQ_soft_max);
+            layer_graph.V_trans = V_trans;
+
+            struct ggml_tensor * KQV = ggml_mul_mat(ctx0, V_trans, KQ_soft_max);
 
-            struct ggml_tensor * KQV_merged = ggml_permute(ctxL, KQV, 0, 2, 1, 3);
+            struct ggml_tensor * KQV_merged = ggml_permute(ctx0, KQV, 0, 2, 1, 3);
 
-            cur = ggml_cpy(ctxL,
+            cur = ggml_cpy(ctx0,
                     KQV_merged,
-                    ggml_new_tensor_2d(ctxL, GGML_TYPE_F32, n_state, N));
+                    ggml_new_tensor_2d(ctx0, GGML_TYPE_F32, n_state, N));
         }
 
         {
-            cur = ggml_mul_mat(ctxL,
+            cur = ggml_mul_mat_bias(ctx0,
                     layer.attn_ln_1_w,
-                    cur);
-
-            cur = ggml_add(ctxL,
-                    ggml_repeat(ctxL, layer.attn_ln_1_b, cur),
-                    cur);
+                    cur,
+                    layer.attn_ln_1_b,
+                    false);
         }
 
         // add the input
-        struct ggml_tensor * inpCA = ggml_add(ctxL, cur, inpL);
+        struct ggml_tensor * inpCA = ggml_add(ctx0, cur, inpL);
 
         // norm
         {
-            cur = ggml_norm(ctxL, inpCA); // note: we use inpCA here
-
-            // cur = ln_0_w*cur + ln_0_b
-            cur = ggml_add(ctxL,
-                    ggml_mul(ctxL,
-                        ggml_repeat(ctxL, layer.cross_attn_ln_0_w, cur),
-                        cur),
-                    ggml_repeat(ctxL, layer.cross_attn_ln_0_b, cur));
+            cur = ggml_norm_affine(ctx0, inpCA, layer.cross_attn_ln_0_w, layer.cross_attn_ln_0_b); // note: we use inpCA here
         }
 
         // cross-attention
         {
-            struct ggml_tensor * Qcur = ggml_mul_mat(ctxL,
+            struct ggml_tensor * Qcur = ggml_mul_mat_bias(ctx0,
                     layer.cross_attn_q_w,
-                    cur);
+                    cur,
+                    layer.cross_attn_q_b,
+                    false);
 
-            Qcur = ggml_add(ctxL,
-                    ggml_repeat(ctxL,
-                        layer.cross_attn_q_b,
-                        Qcur),
-                    Qcur);
-
-            Qcur = ggml_scale(ctxL, Qcur, ggml_new_f32(ctxL, pow(float(n_state)/n_head, -0.25)));
-
-            // Kcross is already scaled
+            // Kcross is already scaled - with flash attention the scale is applied by ggml_flash_attn
             struct ggml_tensor * Kcross =
-                ggml_reshape_3d(ctxL,
-                        ggml_view_1d(ctxL, wctx.kv_cross.k, M*n_state, il*M*ggml_element_size(wctx.kv_cross.k)*n_state),
+                ggml_reshape_3d(ctx0,
+                        ggml_view_1d(ctx0, wctx.kv_cross.k, M*n_state, il*M*ggml_element_size(wctx.kv_cross.k)*n_state),
                         n_state/n_head, n_head, M);
 
+#ifdef WHISPER_USE_FLASH_ATTN
+            // the cross-attention V is stored transposed by the encoder
             struct ggml_tensor * Vcross =
-                ggml_reshape_3d(ctxL,
-                        ggml_view_1d(ctxL, wctx.kv_cross.v, M*n_state, il*M*ggml_element_size(wctx.kv_cross.v)*n_state),
+                ggml_reshape_3d(ctx0,
+                        ggml_view_1d(ctx0, wctx.kv_cross.v, M*n_state, il*M*ggml_element_size(wctx.kv_cross.v)*n_state),
+                        M, n_state/n_head, n_head);
+
+            struct ggml_tensor * Q =
+                ggml_permute(ctx0,
+                        ggml_reshape_3d(ctx0, Qcur, n_state/n_head, n_head, N),
+                        0, 2, 1, 3);
+
+            struct ggml_tensor * K = ggml_permute(ctx0, Kcross, 0, 2, 1, 3);
+
+            struct ggml_tensor * KQV = ggml_flash_attn(ctx0, Q, K, Vcross, false);
+#else
+            Qcur = ggml_scale(ctx0, Qcur, ggml_new_f32(ctx0, pow(float(n_state)/n_head, -0.25)));
+
+            struct ggml_tensor * Vcross =
+                ggml_reshape_3d(ctx0,
+                        ggml_view_1d(ctx0, wctx.kv_cross.v, M*n_state, il*M*ggml_element_size(wctx.kv_cross.v)*n_state),
                         n_state/n_head, n_head, M);
 
             // ------
 
             struct ggml_tensor * Q =
-                ggml_permute(ctxL,
-                        ggml_cpy(ctxL,
+                ggml_permute(ctx0,
+                        ggml_cpy(ctx0,
                             Qcur,
-                            ggml_new_tensor_3d(ctxL, GGML_TYPE_F32, n_state/n_head, n_head, N)),
+                            ggml_new_tensor_3d(ctx0, GGML_TYPE_F32, n_state/n_head, n_head, N)),
                         0, 2, 1, 3);
 
-            struct ggml_tensor * K = ggml_permute(ctxL, Kcross, 0, 2, 1, 3);
+            struct ggml_tensor * K = ggml_permute(ctx0, Kcross, 0, 2, 1, 3);
 
             // K * Q
-            struct ggml_tensor * KQ = ggml_mul_mat(ctxL, K, Q);
+            struct ggml_tensor * KQ = ggml_mul_mat(ctx0, K, Q);
 
             //struct ggml_tensor * KQ_scaled =
-            //    ggml_scale(ctxL,
+            //    ggml_scale(ctx0,
             //            KQ,
-            //            ggml_new_f32(ctxL, 1.0f/sqrt(float(n_state)/n_head))
+            //            ggml_new_f32(ctx0, 1.0f/sqrt(float(n_state)/n_head))
             //            );
 
             // no masking for cross-attention
-            //struct ggml_tensor * KQ_masked = ggml_diag_mask_inf(ctxL, KQ_scaled, n_past);
+            //struct ggml_tensor * KQ_masked = ggml_diag_mask_inf(ctx0, KQ_scaled, n_past);
 
-            struct ggml_tensor * KQ_soft_max = ggml_soft_max(ctxL, KQ);
+            struct ggml_tensor * KQ_soft_max = ggml_soft_max(ctx0, KQ);
 
-            struct ggml_tensor * V_trans = ggml_permute(ctxL, Vcross, 1, 2, 0, 3);
+            struct ggml_tensor * V_trans = ggml_permute(ctx0, Vcross, 1, 2, 0, 3);
 
-            struct ggml_tensor * KQV = ggml_mul_mat(ctxL, V_trans, KQ_soft_max);
+            struct ggml_tensor * KQV = ggml_mul_mat(ctx0, V_trans, KQ_soft_max);
+#endif
 
-            struct ggml_tensor * KQV_merged = ggml_permute(ctxL, KQV, 0, 2, 1, 3);
+            struct ggml_tensor * KQV_merged = ggml_permute(ctx0, KQV, 0, 2, 1, 3);
 
             // cur = KQV_merged.contiguous().view(n_state, N)
-            cur = ggml_cpy(ctxL,
+            cur = ggml_cpy(ctx0,
                     KQV_merged,
-                    ggml_new_tensor_2d(ctxL, GGML_TYPE_F32, n_state, N));
+                    ggml_new_tensor_2d(ctx0, GGML_TYPE_F32, n_state, N));
         }
 
         // projection
         {
-            cur = ggml_mul_mat(ctxL,
+            cur = ggml_mul_mat_bias(ctx0,
                     layer.cross_attn_ln_1_w,
-                    cur);
-
-            cur = ggml_add(ctxL,
-                    ggml_repeat(ctxL, layer.cross_attn_ln_1_b, cur),
-                    cur);
+                    cur,
+                    layer.cross_attn_ln_1_b,
+                    false);
         }
 
         // add the input
-        cur = ggml_add(ctxL, cur, inpCA);
+        cur = ggml_add(ctx0, cur, inpCA);
 
         struct ggml_tensor * inpFF = cur;
 
@@ -1901,99 +2073,201 @@ static bool whisper_decode(
         {
             // norm
             {
-                cur = ggml_norm(ctxL, inpFF);
-
-                // cur = mlp_ln_w*cur + mlp_ln_b
-                cur = ggml_add(ctxL,
-                        ggml_mul(ctxL,
-                            ggml_repeat(ctxL, layer.mlp_ln_w, cur),
-                            cur),
-                        ggml_repeat(ctxL, layer.mlp_ln_b, cur));
+                cur = ggml_norm_affine(ctx0, inpFF, layer.mlp_ln_w, layer.mlp_ln_b);
             }
 
             // fully connected
-            cur = ggml_mul_mat(ctxL,
+            cur = ggml_mul_mat_bias(ctx0,
                     layer.mlp_0_w,
-                    cur);
+                    cur,
+                    layer.mlp_0_b,
+                    true); // GELU activation
+
+            // projection
+            cur = ggml_mul_mat_bias(ctx0,
+                    layer.mlp_1_w,
+                    cur,
+                    layer.mlp_1_b,
+                    false);
+        }
+
+        // output from this layer
+        // input for next layer
+        inpL = ggml_add(ctx0, cur, inpFF);
+
+        ggml_build_forward_expand(&gf, inpL);
+        n_nodes.push_back(gf.n_nodes);
+    }
+
+    cur = inpL;
+
+    // norm
+    {
+        cur = ggml_norm_affine(ctx0, cur, model.d_ln_w, model.d_ln_b);
+    }
+
+    graph.logits = ggml_mul_mat(ctx0, model.d_te, cur);
+
+    ggml_set_no_alloc(ctx0, false);
+
+    ggml_build_forward_expand(&gf, graph.logits);
+    n_nodes.push_back(gf.n_nodes);
+
+    graph.sections = whisper_graph_sections(gf, n_nodes);
+
+    graph.n_tokens    = N;
+    graph.n_audio_ctx = M;
+    graph.n_threads   = n_threads;
+
+    return true;
+}
+
+// point the self-attention of the cached decoder graph to the given KV cache and update the tensors that
+// depend on n_past
+static void whisper_graph_decoder_set_kv(
+        whisper_context & wctx,
+        const whisper_kv_cache & kv_self,
+              const int   n_past) {
+    const auto & hparams = wctx.model.hparams;
+
+    auto & graph = wctx.graph_decoder;
+
+    const int n_ctx   = hparams.n_text_ctx;
+    const int n_state = hparams.n_text_state;
+
+    // number of tokens to attend to
+    const int L = n_past + graph.n_tokens;
+
+    for (int il = 0; il < (int) graph.layers.size(); ++il) {
+        auto & layer_graph = graph.layers[il];
+
+        // store the new keys and values at position n_past
+        // note: the result of ggml_cpy() is a view of its destination
+        {
+            const size_t offset_k = (ggml_element_size(kv_self.k)*n_state)*(il*n_ctx + n_past);
+            const size_t offset_v = (ggml_element_size(kv_self.v)*n_state)*(il*n_ctx + n_past);
+
+            layer_graph.k->data = layer_graph.k->src1->data = (char *) kv_self.k->data + offset_k;
+            layer_graph.v->data = layer_graph.v->src1->data = (char *) kv_self.v->data + offset_v;
+        }
+
+        // K       = permute(reshape_3d(view_1d(kv_self.k)), 0, 2, 1, 3) -> [n_state/n_head, L, n_head]
+        // V_trans = permute(reshape_3d(view_1d(kv_self.v)), 1, 2, 0, 3) -> [L, n_state/n_head, n_head]
+        for (auto & kv : { std::make_pair(layer_graph.K, kv_self.k), std::make_pair(layer_graph.V_trans, kv_self.v) }) {
+            struct ggml_tensor * cur    = kv.first;
+            struct ggml_tensor * cur_3d = cur->src0;
+            struct ggml_tensor * cur_1d = cur_3d->src0;
+
+            cur_1d->data = (char *) kv.second->data + (ggml_element_size(kv.second)*n_state)*il*n_ctx;
+            cur_1d->ne[0] = L*n_state;
+            whisper_tensor_set_contiguous(cur_1d);
+
+            cur_3d->data = cur_1d->data;
+            cur_3d->ne[2] = L;
+            whisper_tensor_set_contiguous(cur_3d);
+
+            cur->data  = cur_1d->data;
+            cur->nb[3] = cur_3d->nb[3];
+        }
+
+        layer_graph.K->ne[1]       = L;
+        layer_graph.V_trans->ne[0] = L;
+
+        // KQ and KQ_soft_max -> [L, N, n_head]
+        layer_graph.KQ->ne[0] = L;
+        whisper_tensor_set_contiguous(layer_graph.KQ);
+
+        layer_graph.KQ_soft_max->ne[0] = L;
+        whisper_tensor_set_contiguous(layer_graph.KQ_soft_max);
+        ((int32_t *) layer_graph.KQ_soft_max->opt[0]->data)[0] = n_past;
+    }
+}
+
+// evaluate the decoder
+//
+// given text prompt + audio features -> predicts the probabilities for the next token
+//
+//   - model:      the model
+//   - n_threads:  number of threads to use
+//   - tokens:     text prompt
+//   - n_tokens:   number of tokens in the prompt
+//   - n_past:     number of past tokens to prefix the prompt with
+//
+static bool whisper_decode(
+        whisper_context & wctx,
+        whisper_decoder & decoder,
+    const whisper_token * tokens,
+              const int   n_tokens,
+              const int   n_past,
+              const int   n_threads) {
+    const int64_t t_start_us = ggml_time_us();
+
+    struct ggml_threadpool * threadpool = whisper_threadpool(wctx, n_threads);
+
+    const auto & model   = wctx.model;
+    const auto & hparams = model.hparams;
+
+    auto & kv_self = decoder.kv_self;
 
-            cur = ggml_add(ctxL,
-                    ggml_repeat(ctxL, layer.mlp_0_b, cur),
-                    cur);
+    WHISPER_ASSERT(!!kv_self.ctx);
 
-            // GELU activation
-            cur = ggml_gelu(ctxL, cur);
+    auto & logits_out = wctx.logits;
 
-            // projection
-            cur = ggml_mul_mat(ctxL,
-                    layer.mlp_1_w,
-                    cur);
+    const int n_vocab = hparams.n_vocab;
 
-            cur = ggml_add(ctxL,
-                    ggml_repeat(ctxL, layer.mlp_1_b, cur),
-                    cur);
-        }
+    const int N = n_tokens;
+    const int M = wctx.exp_n_audio_ctx > 0 ? wctx.exp_n_audio_ctx : hparams.n_audio_ctx;
 
-        // output from this layer
-        struct ggml_tensor * inpO = ggml_add(ctxL, cur, inpFF);
+    //WHISPER_PRINT_DEBUG("%s: n_past = %d, N = %d, M = %d, n_ctx = %d\n", __func__, n_past, N, M, n_ctx);
 
-        {
-            ggml_build_forward_expand(&gf, inpO);
-            ggml_graph_compute       (ctxL, &gf);
+    auto & graph = wctx.graph_decoder;
 
-            //ggml_graph_print(&gf);
+    // the graph is rebuilt only when its shape changes
+    // it is planned for the largest n_past, so the memory of the tensors that depend on n_past fits all of them
+    if (graph.ctx == nullptr || graph.n_tokens != N || graph.n_audio_ctx != M || graph.n_threads != n_threads) {
+        if (!whisper_graph_decoder_build(wctx, kv_self, N, M, n_threads)) {
+            return false;
         }
 
-        // TODO: this is a hack to have per-layer computation graphs - need to come up with something better
-        // input for next layer (inpO -> inpL)
-        memcpy(inpL->data, inpO->data, ggml_nbytes(inpL));
-        inpL->op = GGML_OP_NONE;
-        inpL->src0 = nullptr;
-        inpL->src1 = nullptr;
+        whisper_graph_tune(wctx, graph.gf);
 
-        if (N > 1) {
-            //printf("%s: - used_mem(%d) = %f MB\n", __func__, il, ggml_used_mem(ctxL)/1024.0/1024.0);
+        if (!whisper_graph_plan(wctx, graph.ctx, graph.gf)) {
+            fprintf(stderr, "%s: failed to allocate the compute buffer\n", __func__);
+            whisper_graph_decoder_free(graph);
+            return false;
         }
-
-        ggml_free(ctxL);
     }
 
-    cur = inpL;
-
-    // norm
-    {
-        cur = ggml_norm(ctx0, cur);
+    // set the inputs
+    memcpy(graph.embd->data, tokens, N*ggml_element_size(graph.embd));
 
-        cur = ggml_add(ctx0,
-                ggml_mul(ctx0,
-                    ggml_repeat(ctx0, model.d_ln_w, cur),
-                    cur),
-                ggml_repeat(ctx0, model.d_ln_b, cur));
+    for (int i = 0; i < N; ++i) {
+        ((int32_t *) graph.position->data)[i] = n_past + i;
     }
 
-    struct ggml_tensor * logits = ggml_mul_mat(ctx0, model.d_te, cur);
+    whisper_graph_decoder_set_kv(wctx, kv_self, n_past);
 
     // run the computation
     {
-        struct ggml_cgraph gf = {};
-        gf.n_threads = n_threads;
+        graph.gf.threadpool = threadpool;
+        graph.gf.trace      = wctx.trace;
+        graph.gf.wcache     = wctx.wcache;
+        graph.gf.perf       = wctx.profile;
 
-        ggml_build_forward_expand(&gf, logits);
-        ggml_graph_compute       (ctx0, &gf);
+        ggml_graph_compute(graph.ctx, &graph.gf);
     }
 
-    logits_out.resize(N*n_vocab);
-    memcpy(logits_out.data(), ggml_get_data(logits), sizeof(float)*N*n_vocab);
-
-    if (N > 1) {
-        //const float mem_per_token = ggml_used_mem(ctx0)/1024.0/1024.0/N;
-        //printf("%s: used_mem = %f MB / %f per token\n", __func__, ggml_used_mem(ctx0)/1024.0/1024.0, mem_per_token);
-        //printf("%s: max mem = %f MB\n", __func__, mem_per_token*model.hparams.n_text_ctx);
+    if (wctx.profile) {
+        whisper_profile_add(wctx, graph.gf, graph.sections, wctx.model.hparams.n_audio_layer + 2);
     }
 
-    ggml_free(ctx0);
+    logits_out.resize(N*n_vocab);
+    memcpy(logits_out.data(), ggml_get_data(graph.logits), sizeof(float)*N*n_vocab);
 
     wctx.t_decode_us += ggml_time_us() - t_start_us;
 
+    whisper_trace_add(wctx, "decode", t_start_us);
+
     return true;
 }
 
@@ -2128,6 +2402,11 @@ static bool log_mel_spectrogram(
     std::vector<std::thread> workers(n_threads);
     for (int iw = 0; iw < n_threads; ++iw) {
         workers[iw] = std::thread([&](int ith) {
+            // same placement as the ggml threads (see whisper_set_cpus())
+            if (!wctx.cpus.empty()) {
+                ggml_thread_set_affinity(&wctx.cpus[ith % wctx.cpus.size()], 1);
+            }
+
             std::vector<float> fft_in;
             fft_in.resize(fft_size);
             for (int i = 0; i < fft_size; i++) {
@@ -2218,6 +2497,8 @@ static bool log_mel_spectrogram(
 
     wctx.t_mel_us += ggml_time_us() - t_start_us;
 
+    whisper_trace_add(wctx, "mel", t_start_us);
+
     return true;
 }
 
@@ -2286,6 +2567,58 @@ static std::vector<whisper_vocab::id> tokenize(const whisper_vocab & vocab, cons
     return tokens;
 }
 
+// allocate the buffer of the intermediate tensors with the size measured by a dry run of the encoder and decoder
+// graphs - whisper_graph_plan() grows it later if needed (e.g. more threads or longer prompts)
+static bool whisper_alloc_compute(whisper_context & wctx) {
+    const auto & hparams = wctx.model.hparams;
+
+    const int n_threads = std::min(4, (int32_t) std::thread::hardware_concurrency());
+
+    // the longest prompt of whisper_full(): the previous text token, up to n_text_ctx/2 tokens of the previous
+    // text and the sot, language and task tokens
+    const int n_tokens = std::min(hparams.n_text_ctx, hparams.n_text_ctx/2 + 4);
+
+    size_t size_alloc = 0;
+
+    {
+        struct ggml_init_params params;
+        params.mem_size   = wctx.buf_compute.size();
+        params.mem_buffer = wctx.buf_compute.data();
+
+        struct ggml_context * ctx0 = ggml_init(params);
+
+        struct ggml_cgraph gf = {};
+        gf.n_threads = n_threads;
+
+        std::vector<int> n_nodes;
+
+        whisper_graph_encoder_build(wctx, ctx0, gf, n_nodes);
+
+        size_alloc = std::max(size_alloc, ggml_graph_plan(ctx0, &gf, nullptr, 0));
+
+        ggml_free(ctx0);
+    }
+
+    {
+        auto & graph = wctx.graph_decoder;
+
+        if (!whisper_graph_decoder_build(wctx, wctx.decoders[0].kv_self, n_tokens, hparams.n_audio_ctx, n_threads)) {
+            return false;
+        }
+
+        size_alloc = std::max(size_alloc, ggml_graph_plan(graph.ctx, &graph.gf, nullptr, 0));
+
+        whisper_graph_decoder_free(graph);
+    }
+
+    wctx.buf_alloc.resize(size_alloc);
+
+    fprintf(stderr, "%s: compute buffer = %7.2f MB + %7.2f MB\n", __func__,
+            wctx.buf_compute.size()/1024.0/1024.0, wctx.buf_alloc.size()/1024.0/1024.0);
+
+    return true;
+}
+
 //
 // interface implementation
 //
@@ -2318,7 +2651,18 @@ struct whisper_context * whisper_init_from_file(const char * path_model) {
         fin->close();
     };
 
-    return whisper_init(&loader);
+    whisper_context * ctx = whisper_init(&loader);
+
+    // the kernels measured for the model by whisper_tune(), if any
+    if (ctx) {
+        const std::string fname_tune = std::string(path_model) + ".tune";
+
+        if (std::ifstream(fname_tune).good()) {
+            whisper_set_tune(ctx, fname_tune.c_str());
+        }
+    }
+
+    return ctx;
 }
 
 struct whisper_context * whisper_init_from_buffer(void * buffer, size_t buffer_size) {
@@ -2371,6 +2715,14 @@ struct whisper_context * whisper_init(struct whisper_model_loader * loader) {
 
     loader->close(loader->context);
 
+    if (!whisper_alloc_compute(*ctx)) {
+        fprintf(stderr, "%s: failed to allocate the compute buffers\n", __func__);
+        whisper_free(ctx);
+        return nullptr;
+    }
+
+    whisper_reset_profile(ctx);
+
     return ctx;
 }
 
@@ -2390,6 +2742,11 @@ void whisper_free(struct whisper_context * ctx) {
                 ggml_free(ctx->decoders[i].kv_self.ctx);
             }
         }
+        ggml_threadpool_free(ctx->threadpool);
+        ggml_trace_free(ctx->trace);
+        ggml_tune_free(ctx->tune);
+        ggml_wcache_free(ctx->wcache);
+        whisper_graph_decoder_free(ctx->graph_decoder);
         delete ctx;
     }
 }
@@ -2659,6 +3016,305 @@ void whisper_reset_timings(struct whisper_context * ctx) {
     ctx->t_decode_us = 0;
 }
 
+void whisper_set_trace(struct whisper_context * ctx, bool enable) {
+    if (enable && ctx->trace == nullptr) {
+        // the events are allocated on the first use of each thread, so a generous limit costs only address space
+        const int n_threads = std::max(64, (int32_t) std::thread::hardware_concurrency());
+
+        ctx->trace = ggml_trace_new(n_threads, 1 << 22);
+    }
+
+    if (!enable && ctx->trace) {
+        ggml_trace_free(ctx->trace);
+        ctx->trace = nullptr;
+    }
+}
+
+int whisper_save_trace(struct whisper_context * ctx, const char * fname) {
+    if (ctx->trace == nullptr) {
+        fprintf(stderr, "%s: tracing is not enabled\n", __func__);
+        return -1;
+    }
+
+    if (!ggml_trace_dump_json(ctx->trace, fname)) {
+        fprintf(stderr, "%s: failed to open '%s' for writing\n", __func__, fname);
+        return -2;
+    }
+
+    ggml_trace_reset(ctx->trace);
+
+    return 0;
+}
+
+int whisper_set_numa(struct whisper_context * ctx, enum whisper_numa_strategy numa) {
+    if (numa == ctx->numa) {
+        return 0;
+    }
+
+    // the threads are pinned when the pool is created
+    ggml_threadpool_free(ctx->threadpool);
+    ctx->threadpool = nullptr;
+
+    ctx->numa = numa;
+
+    if (numa == WHISPER_NUMA_DISABLED || ggml_numa_n_nodes() <= 1) {
+        return 0;
+    }
+
+    bool ok = ggml_numa_interleave(ctx->kv_cross.buf.data(), ctx->kv_cross.buf.size());
+
+    ok = ggml_numa_interleave(ctx->model.buf->data(), ctx->model.buf->size()) && ok;
+
+    // the vectors (biases, norms) stay interleaved
+    if (numa == WHISPER_NUMA_DISTRIBUTE) {
+        for (const auto & kv : ctx->model.tensors) {
+            if (kv.second->ne[1] > 1) {
+                ok = ggml_numa_distribute(kv.second) && ok;
+            }
+        }
+    }
+
+    if (!ok) {
+        fprintf(stderr, "%s: failed to move the memory to the NUMA nodes\n", __func__);
+        return -1;
+    }
+
+    fprintf(stderr, "%s: placed the model on %d NUMA nodes\n", __func__, ggml_numa_n_nodes());
+
+    return 0;
+}
+
+int whisper_set_cpus(struct whisper_context * ctx, const int * cpus, int n_cpus) {
+    for (int i = 0; i < n_cpus; ++i) {
+        if (cpus[i] < 0) {
+            fprintf(stderr, "%s: invalid CPU %d\n", __func__, cpus[i]);
+            return -1;
+        }
+    }
+
+    if (n_cpus > 0 && !ggml_thread_check_affinity(cpus, n_cpus)) {
+        fprintf(stderr, "%s: the system does not allow pinning threads to these CPUs\n", __func__);
+        return -2;
+    }
+
+    ctx->cpus.assign(cpus, cpus + std::max(0, n_cpus));
+
+    return 0;
+}
+
+int whisper_set_weight_cache(struct whisper_context * ctx, size_t budget) {
+    ggml_wcache_free(ctx->wcache);
+    ctx->wcache = nullptr;
+
+    if (budget == 0) {
+        return 0;
+    }
+
+    if (!ggml_cpu_has_blas()) {
+        fprintf(stderr, "%s: the weight cache is only used by builds with BLAS\n", __func__);
+        return 0;
+    }
+
+    ctx->wcache = ggml_wcache_new(budget);
+
+    for (const auto & kv : ctx->model.tensors) {
+        ggml_wcache_add(ctx->wcache, kv.second);
+    }
+
+    return 0;
+}
+
+int whisper_set_tune(struct whisper_context * ctx, const char * fname) {
+    struct ggml_tune * tune = nullptr;
+
+    if (fname) {
+        tune = ggml_tune_new();
+
+        if (!ggml_tune_load(tune, fname)) {
+            fprintf(stderr, "%s: failed to load the tuning file '%s'\n", __func__, fname);
+            ggml_tune_free(tune);
+            return -1;
+        }
+
+        fprintf(stderr, "%s: loaded %d kernel configurations from '%s'\n", __func__, ggml_tune_n_entries(tune), fname);
+    }
+
+    ggml_tune_free(ctx->tune);
+    ctx->tune = tune;
+
+    // the kernels of the cached graph are selected when it is planned
+    whisper_graph_decoder_free(ctx->graph_decoder);
+
+    return 0;
+}
+
+int whisper_tune(struct whisper_context * ctx, int n_threads, int n_iter, const char * fname) {
+    const auto & hparams = ctx->model.hparams;
+
+    if (ctx->tune == nullptr) {
+        ctx->tune = ggml_tune_new();
+    }
+
+    // continue an existing file
+    if (fname && std::ifstream(fname).good() && !ggml_tune_load(ctx->tune, fname)) {
+        fprintf(stderr, "%s: failed to load the tuning file '%s'\n", __func__, fname);
+        return -1;
+    }
+
+    const int n_entries = ggml_tune_n_entries(ctx->tune);
+
+    whisper_graph_decoder_free(ctx->graph_decoder);
+
+    // the graphs are evaluated on a silent mel - the state of the context is restored afterwards
+    whisper_mel mel = std::move(ctx->mel);
+
+    ctx->mel.n_len = 0;
+    ctx->mel.n_mel = WHISPER_N_MEL;
+    ctx->mel.data.clear();
+
+    const std::vector<uint8_t> kv_cross = kv_cache_save(ctx->kv_cross);
+    const std::vector<uint8_t> kv_self  = kv_cache_save(ctx->decoders[0].kv_self);
+    const std::vector<float>   logits   = ctx->logits;
+
+    ctx->tune_n_iter = std::max(1, n_iter);
+
+    bool ok = whisper_encode(*ctx, 0, n_threads);
+
+    // the prompts, then the single tokens of the sampling
+    const int n_tokens[] = { 1, 4, 16, 64, hparams.n_text_ctx/2 };
+
+    std::vector<whisper_token> tokens(hparams.n_text_ctx, whisper_token_sot(ctx));
+
+    for (int i = 0; ok && i < (int) (sizeof(n_tokens)/sizeof(n_tokens[0])); ++i) {
+        ok = whisper_decode(*ctx, ctx->decoders[0], tokens.data(), n_tokens[i], 0, n_threads);
+    }
+
+    ctx->tune_n_iter = 0;
+
+    ctx->mel    = std::move(mel);
+    ctx->logits = logits;
+
+    kv_cache_restore(ctx->kv_cross,            kv_cross);
+    kv_cache_restore(ctx->decoders[0].kv_self, kv_self);
+
+    if (!ok) {
+        fprintf(stderr, "%s: failed to evaluate the graphs\n", __func__);
+        return -2;
+    }
+
+    fprintf(stderr, "%s: measured %d kernel configurations with %d threads\n", __func__,
+            ggml_tune_n_entries(ctx->tune) - n_entries, n_threads);
+
+    if (fname && !ggml_tune_save(ctx->tune, fname)) {
+        fprintf(stderr, "%s: failed to open '%s' for writing\n", __func__, fname);
+        return -3;
+    }
+
+    return 0;
+}
+
+void whisper_set_profile(struct whisper_context * ctx, bool enable) {
+    ctx->profile = enable;
+}
+
+void whisper_reset_profile(struct whisper_context * ctx) {
+    const auto & hparams = ctx->model.hparams;
+
+    ctx->profile_ops.clear();
+    ctx->profile_ops.resize(GGML_OP_COUNT);
+
+    for (int i = 0; i < GGML_OP_COUNT; ++i) {
+        ctx->profile_ops[i] = { ggml_op_name((enum ggml_op) i), 0, 0 };
+    }
+
+    // the sections of the graphs - see whisper_encode() and whisper_decode()
+    ctx->profile_layers.clear();
+
+    ctx->profile_layers.push_back({ "encoder.conv", 0, 0 });
+    for (int il = 0; il < hparams.n_audio_layer; ++il) {
+        ctx->profile_layers.push_back({ "encoder." + std::to_string(il), 0, 0 });
+    }
+    ctx->profile_layers.push_back({ "encoder.out", 0, 0 });
+
+    ctx->profile_layers.push_back({ "decoder.embd", 0, 0 });
+    for (int il = 0; il < hparams.n_text_layer; ++il) {
+        ctx->profile_layers.push_back({ "decoder." + std::to_string(il), 0, 0 });
+    }
+    ctx->profile_layers.push_back({ "decoder.out", 0, 0 });
+}
+
+struct whisper_profile whisper_get_profile(struct whisper_context * ctx) {
+    auto & entries = ctx->profile_entries;
+
+    entries.clear();
+
+    // the ops that were not used are skipped
+    for (const auto & op : ctx->profile_ops) {
+        if (op.n_calls > 0) {
+            entries.push_back({ op.name.c_str(), op.n_calls, op.t_us });
+        }
+    }
+
+    const int n_ops = entries.size();
+
+    for (const auto & layer : ctx->profile_layers) {
+        if (layer.n_calls > 0) {
+            entries.push_back({ layer.name.c_str(), layer.n_calls, layer.t_us });
+        }
+    }
+
+    whisper_profile result;
+
+    result.n_ops    = n_ops;
+    result.ops      = entries.data();
+    result.n_layers = entries.size() - n_ops;
+    result.layers   = entries.data() + n_ops;
+
+    return result;
+}
+
+const char * whisper_print_profile(struct whisper_context * ctx, const char * format) {
+    const bool json = strcmp(format, "json") == 0;
+    const bool csv  = strcmp(format, "csv")  == 0;
+
+    if (!json && !csv) {
+        fprintf(stderr, "%s: unknown profile format '%s'\n", __func__, format);
+        return nullptr;
+    }
+
+    const whisper_profile profile = whisper_get_profile(ctx);
+
+    std::string & s = ctx->profile_str;
+
+    char buf[256];
+
+    auto print = [&](const char * type, const whisper_profile_entry * entries, int n) {
+        for (int i = 0; i < n; ++i) {
+            if (json) {
+                snprintf(buf, sizeof(buf), "%s\n    { \"name\": \"%s\", \"n_calls\": %d, \"t_us\": %lld }",
+                        i == 0 ? "" : ",", entries[i].name, entries[i].n_calls, (long long) entries[i].t_us);
+            } else {
+                snprintf(buf, sizeof(buf), "%s,%s,%d,%lld\n", type, entries[i].name, entries[i].n_calls, (long long) entries[i].t_us);
+            }
+            s += buf;
+        }
+    };
+
+    if (json) {
+        s = "{\n  \"ops\": [";
+        print("op", profile.ops, profile.n_ops);
+        s += "\n  ],\n  \"layers\": [";
+        print("layer", profile.layers, profile.n_layers);
+        s += "\n  ]\n}\n";
+    } else {
+        s = "type,name,n_calls,t_us\n";
+        print("op", profile.ops, profile.n_ops);
+        print("layer", profile.layers, profile.n_layers);
+    }
+
+    return s.c_str();
+}
+
 const char * whisper_print_system_info(void) {
     static std::string s;
 
@@ -2666,6 +3322,7 @@ const char * whisper_print_system_info(void) {
     s += "AVX = "       + std::to_string(ggml_cpu_has_avx())       + " | ";
     s += "AVX2 = "      + std::to_string(ggml_cpu_has_avx2())      + " | ";
     s += "AVX512 = "    + std::to_string(ggml_cpu_has_avx512())    + " | ";
+    s += "AVX512_VNNI = " + std::to_string(ggml_cpu_has_avx512_vnni()) + " | ";
     s += "FMA = "       + std::to_string(ggml_cpu_has_fma())       + " | ";
     s += "NEON = "      + std::to_string(ggml_cpu_has_neon())      + " | ";
     s += "ARM_FMA = "   + std::to_string(ggml_cpu_has_arm_fma())   + " | ";
@@ -2738,6 +3395,9 @@ struct whisper_full_params whisper_full_default_params(enum whisper_sampling_str
 
         /*.encoder_begin_callback           =*/ nullptr,
         /*.encoder_begin_callback_user_data =*/ nullptr,
+
+        /*.cpus   =*/ nullptr,
+        /*.n_cpus =*/ 0,
     };
 
     switch (strategy) {
@@ -3179,7 +3839,7 @@ static void whisper_sequence_score(
     }
 }
 
-int whisper_full(
+static int whisper_full_impl(
         struct whisper_context * ctx,
         struct whisper_full_params params,
         const float * samples,
@@ -3475,6 +4135,8 @@ int whisper_full(
                     }
 
                     ctx->t_sample_us += ggml_time_us() - t_start_sample_us;
+
+                    whisper_trace_add(*ctx, "sample", t_start_sample_us);
                 }
             }
 
@@ -3674,6 +4336,8 @@ int whisper_full(
 
                 ctx->t_sample_us += ggml_time_us() - t_start_sample_us;
 
+                whisper_trace_add(*ctx, "sample", t_start_sample_us);
+
                 // obtain logits for the next token
                 for (int j = 0; j < n_decoders_cur; ++j) {
                     auto & decoder = ctx->decoders[j];
@@ -3700,6 +4364,8 @@ int whisper_full(
                         ++decoder.kv_self.n;
 
                         ctx->t_sample_us += ggml_time_us() - t_start_sample_us;
+
+                        whisper_trace_add(*ctx, "sample", t_start_sample_us);
                     }
                 }
             }
@@ -3892,6 +4558,44 @@ int whisper_full(
     return 0;
 }
 
+int whisper_full(
+        struct whisper_context * ctx,
+        struct whisper_full_params params,
+        const float * samples,
+        int n_samples) {
+    if (params.n_cpus <= 0) {
+        return whisper_full_impl(ctx, params, samples, n_samples);
+    }
+
+    // the CPU set of the call is used only for this call - restore the one of the context on return
+    const std::vector<int> cpus = ctx->cpus;
+
+    if (whisper_set_cpus(ctx, params.cpus, params.n_cpus) != 0) {
+        fprintf(stderr, "%s: failed to set the CPU set\n", __func__);
+        ctx->result_all.clear();
+        return -9;
+    }
+
+    const int ret = whisper_full_impl(ctx, params, samples, n_samples);
+
+    whisper_set_cpus(ctx, cpus.data(), (int) cpus.size());
+
+    return ret;
+}
+
+// the CPUs of processor i when the CPU set of the call is split evenly between n_processors
+static void whisper_full_cpus_split(whisper_full_params & params, int i, int n_processors) {
+    if (params.n_cpus <= 0) {
+        return;
+    }
+
+    const int c0 = (i*params.n_cpus)/n_processors;
+    const int c1 = std::max(c0 + 1, ((i + 1)*params.n_cpus)/n_processors);
+
+    params.cpus   = params.cpus + c0;
+    params.n_cpus = c1 - c0;
+}
+
 int whisper_full_parallel(
         struct whisper_context * ctx,
         struct whisper_full_params params,
@@ -3912,6 +4616,15 @@ int whisper_full_parallel(
 
         ctx_p = *ctx;
 
+        // each processor needs its own worker threads
+        ctx_p.threadpool = nullptr;
+
+        // only the first processor is traced
+        ctx_p.trace = nullptr;
+
+        // the cached graph points to the memory buffers of ctx
+        ctx_p.graph_decoder = {};
+
         ctx_p.logits.reserve(ctx_p.vocab.n_vocab*ctx_p.model.hparams.n_text_ctx);
 
         ctx_p.logits_id.reserve(ctx_p.vocab.n_vocab);
@@ -3956,12 +4669,16 @@ int whisper_full_parallel(
         params_cur.new_segment_callback = nullptr;
         params_cur.new_segment_callback_user_data = nullptr;
 
+        whisper_full_cpus_split(params_cur, i + 1, n_processors);
+
         workers[i] = std::thread(whisper_full, &ctxs[i], std::move(params_cur), samples + start_samples, n_samples_cur);
     }
 
     {
         auto params_cur = params;
 
+        whisper_full_cpus_split(params_cur, 0, n_processors);
+
         ret = whisper_full(ctx, std::move(params_cur), samples, offset_samples + n_samples_per_processor);
     }
 
@@ -3998,6 +4715,9 @@ int whisper_full_parallel(
         ctx->t_encode_us += ctxs[i].t_encode_us;
         ctx->t_decode_us += ctxs[i].t_decode_us;
 
+        ggml_threadpool_free(ctxs[i].threadpool);
+        whisper_graph_decoder_free(ctxs[i].graph_decoder);
+
         kv_cache_free(ctx->kv_cross);
 
         for (int j = 0; j < WHISPER_MAX_DECODERS; ++j) {
@@ -4126,26 +4846,32 @@ WHISPER_API int whisper_bench_ggml_mul_mat(int n_threads) {
     // a: N*N*sizeof(float)
     // b: N*N*sizeof(float)
     // c: N*N*sizeof(float)
-    // when F16 is used, there is an extra work buffer of size N*N*sizeof(float)
+    // when F16 or a quantized type is used, there is an extra work buffer of size up to N*N*sizeof(float)
     std::vector<char> buf(4llu*N_max*N_max*sizeof(float) + 4*256);
 
     for (size_t i = 0; i < buf.size(); i++) buf[i] = i;
 
+    struct ggml_threadpool * threadpool = n_threads > 1 ? ggml_threadpool_new(n_threads) : nullptr;
+
+    const ggml_type wtypes[] = {
+        GGML_TYPE_Q4_0, GGML_TYPE_Q8_0, GGML_TYPE_F16, GGML_TYPE_F32,
+    };
+
+    const int n_wtypes = sizeof(wtypes)/sizeof(wtypes[0]);
+
     for (int j = 0; j < (int) sizes.size(); j++) {
-        int n_fp16 = 0;
-        int n_fp32 = 0;
+        int n_runs[n_wtypes] = { 0 };
 
         // GFLOPS/s
-        double s_fp16 = 0.0;
-        double s_fp32 = 0.0;
+        double s_gflops[n_wtypes] = { 0.0 };
 
         const size_t N = sizes[j];
 
-        for (int k = 0; k < 2; ++k) {
-            const ggml_type wtype = k == 0 ? GGML_TYPE_F16 : GGML_TYPE_F32;
+        for (int k = 0; k < n_wtypes; ++k) {
+            const ggml_type wtype = wtypes[k];
 
-            double & s = k == 0 ? s_fp16 : s_fp32;
-            int    & n = k == 0 ? n_fp16   : n_fp32;
+            double & s = s_gflops[k];
+            int    & n = n_runs[k];
 
             struct ggml_init_params gparams = {
                 /*.mem_size   =*/ buf.size(),
@@ -4161,7 +4887,8 @@ WHISPER_API int whisper_bench_ggml_mul_mat(int n_threads) {
 
             struct ggml_cgraph gf = ggml_build_forward(c);
 
-            gf.n_threads = n_threads;
+            gf.n_threads  = n_threads;
+            gf.threadpool = threadpool;
 
             double tsum = 0.0;
 
@@ -4188,10 +4915,12 @@ WHISPER_API int whisper_bench_ggml_mul_mat(int n_threads) {
             s = ((2.0*N*N*N*n)/tsum)*1e-9;
         }
 
-        fprintf(stderr, "ggml_mul_mat: %5zu x %5zu: F16 %8.1f GFLOPS (%3d runs) / F32 %8.1f GFLOPS (%3d runs)\n",
-            N, N, s_fp16, n_fp16, s_fp32, n_fp32);
+        fprintf(stderr, "ggml_mul_mat: %5zu x %5zu: Q4_0 %7.1f GFLOPS (%3d runs) / Q8_0 %7.1f GFLOPS (%3d runs) / F16 %7.1f GFLOPS (%3d runs) / F32 %7.1f GFLOPS (%3d runs)\n",
+            N, N, s_gflops[0], n_runs[0], s_gflops[1], n_runs[1], s_gflops[2], n_runs[2], s_gflops[3], n_runs[3]);
     }
 
+    ggml_threadpool_free(threadpool);
+
     return 0;
 }
 
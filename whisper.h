@@ -212,6 +212,84 @@ extern "C" {
     WHISPER_API void whisper_print_timings(struct whisper_context * ctx);
     WHISPER_API void whisper_reset_timings(struct whisper_context * ctx);
 
+    // Profiling of the encoder and decoder graphs
+    // When enabled, the time of each node of the graphs is measured and aggregated per op type (e.g. "MUL_MAT",
+    // "SOFT_MAX", "CPY") and per layer (e.g. "encoder.conv", "encoder.3", "decoder.out") over all calls, until
+    // whisper_reset_profile(). The time of a node includes waiting for the other threads to finish it.
+    struct whisper_profile_entry {
+        const char * name;
+        int          n_calls; // number of computed nodes
+        int64_t      t_us;    // total time in microseconds
+    };
+
+    struct whisper_profile {
+        int n_ops;
+        const struct whisper_profile_entry * ops;
+
+        int n_layers;
+        const struct whisper_profile_entry * layers;
+    };
+
+    WHISPER_API void whisper_set_profile  (struct whisper_context * ctx, bool enable);
+    WHISPER_API void whisper_reset_profile(struct whisper_context * ctx);
+
+    // The entries are valid until the next call to whisper_get_profile() or whisper_print_profile()
+    WHISPER_API struct whisper_profile whisper_get_profile(struct whisper_context * ctx);
+
+    // Profile in the given format: "json" or "csv". Returns NULL for unknown formats
+    // The string is valid until the next call to whisper_get_profile() or whisper_print_profile()
+    WHISPER_API const char * whisper_print_profile(struct whisper_context * ctx, const char * format);
+
+    // Timeline of the computation in the Chrome trace-event format (chrome://tracing, https://ui.perfetto.dev)
+    // When enabled, the mel, encode, decode and sample spans of the calling thread are recorded, together with the
+    // INIT / COMPUTE / FINALIZE tasks of each node of the graphs on each worker thread and the time the calling
+    // thread waits for the workers. With whisper_full_parallel(), only the first processor is traced
+    WHISPER_API void whisper_set_trace(struct whisper_context * ctx, bool enable);
+
+    // Write the recorded timeline to a JSON file and start a new one
+    // Returns 0 on success
+    WHISPER_API int whisper_save_trace(struct whisper_context * ctx, const char * fname);
+
+    // NUMA placement on machines with several NUMA nodes (e.g. dual-socket hosts)
+    // When enabled, the ggml threads of the context are spread over the nodes and pinned to their CPUs, including the
+    // calling thread of whisper_encode() / whisper_decode() while the graphs are computed, and the weights are moved to the nodes:
+    //   WHISPER_NUMA_INTERLEAVE  - the pages of the weights are interleaved over the nodes
+    //   WHISPER_NUMA_DISTRIBUTE  - the rows of each weight matrix are placed on the node whose threads multiply them
+    // The cross-attention KV cache is interleaved in both cases. Disabling it only stops pinning new threads
+    // Returns 0 on success, also on machines with a single NUMA node
+    enum whisper_numa_strategy {
+        WHISPER_NUMA_DISABLED,
+        WHISPER_NUMA_INTERLEAVE,
+        WHISPER_NUMA_DISTRIBUTE,
+    };
+
+    WHISPER_API int whisper_set_numa(struct whisper_context * ctx, enum whisper_numa_strategy numa);
+
+    // CPU set of the threads of the context, e.g. to split a machine between several contexts or processes
+    // Thread i of whisper_pcm_to_mel(), whisper_encode(), whisper_decode() and whisper_full() runs on CPU cpus[i % n_cpus]
+    // The calling thread is thread 0 and is pinned only while the graphs are computed. This replaces the thread placement of whisper_set_numa()
+    // Pass n_cpus = 0 to stop pinning new threads (the default)
+    // Returns 0 on success
+    WHISPER_API int whisper_set_cpus(struct whisper_context * ctx, const int * cpus, int n_cpus);
+
+    // F32 copies of the F16 / quantized weights for builds with BLAS
+    // The BLAS matrix multiplications convert their weight to F32 on each call. With the cache, each weight is converted
+    // once, the first time it is used, and kept while the copies fit in budget bytes (about 2x the size of an F16
+    // model to keep all of them). The context must not be computing. Pass budget = 0 to free the copies (the default)
+    // Returns 0 on success
+    WHISPER_API int whisper_set_weight_cache(struct whisper_context * ctx, size_t budget);
+
+    // Kernel autotuning of the matrix multiplications of the model
+    // whisper_tune() times the candidate kernels, numbers of threads and chunk sizes of each matrix multiplication of
+    // the encoder and decoder graphs with n_threads threads, and uses the fastest ones from now on. The configurations
+    // are saved to fname (if not NULL), which is continued if it exists. The graphs are evaluated on a silent mel, the
+    // mel, the encoder output, the KV cache of the first decoder and the logits of the context are kept
+    // whisper_init_from_file() loads "<model>.tune" if it exists. Pass fname = NULL to whisper_set_tune() to go back
+    // to the default kernels
+    // Returns 0 on success
+    WHISPER_API int whisper_tune    (struct whisper_context * ctx, int n_threads, int n_iter, const char * fname);
+    WHISPER_API int whisper_set_tune(struct whisper_context * ctx, const char * fname);
+
     // Print system information
     WHISPER_API const char * whisper_print_system_info(void);
 
@@ -303,6 +381,11 @@ extern "C" {
         // called each time before the encoder starts
         whisper_encoder_begin_callback encoder_begin_callback;
         void * encoder_begin_callback_user_data;
+
+        // CPU set of this call only, see whisper_set_cpus() - NULL to use the one of the context
+        // whisper_full_parallel() splits the CPUs evenly between the processors
+        const int * cpus;
+        int n_cpus;
     };
 
     WHISPER_API struct whisper_full_params whisper_full_default_params(enum whisper_sampling_strategy strategy);